@@ -13,6 +13,21 @@
 
 using namespace Orc::Config::Common;
 
+// SAMPLES node, with GetThis' deduplication and priority attributes
+HRESULT getthis_samples(ConfigItem& parent, DWORD dwIndex)
+{
+    HRESULT hr = E_FAIL;
+    if (FAILED(hr = samples(parent, dwIndex)))
+        return hr;
+    if (FAILED(hr = parent[dwIndex].AddAttribute(L"dedup", GETTHIS_SAMPLES_DEDUP, ConfigItem::OPTION)))
+        return hr;
+    if (FAILED(hr = parent[dwIndex].AddAttribute(L"priority", GETTHIS_SAMPLES_PRIORITY, ConfigItem::OPTION)))
+        return hr;
+    if (FAILED(hr = parent[dwIndex][CONFIG_SAMPLE].AddAttribute(L"dedup", GETTHIS_SAMPLE_DEDUP, ConfigItem::OPTION)))
+        return hr;
+    return S_OK;
+}
+
 HRESULT Orc::Config::GetThis::root(ConfigItem& item)
 {
     HRESULT hr = E_FAIL;
@@ -28,7 +43,7 @@ HRESULT Orc::Config::GetThis::root(ConfigItem& item)
         return hr;
     if (FAILED(hr = item.AddChild(knownlocations, GETTHIS_KNOWNLOCATIONS)))
         return hr;
-    if (FAILED(hr = item.AddChild(samples, GETTHIS_SAMPLES)))
+    if (FAILED(hr = item.AddChild(getthis_samples, GETTHIS_SAMPLES)))
         return hr;
     if (FAILED(hr = item.AddChild(logging, GETTHIS_LOGGING)))
         return hr;
@@ -44,5 +59,7 @@ HRESULT Orc::Config::GetThis::root(ConfigItem& item)
         return hr;
     if (FAILED(hr = item.AddChild(yara, GETTHIS_YARA)))
         return hr;
+    if (FAILED(hr = item.AddAttribute(L"streaming", GETTHIS_STREAMING, ConfigItem::OPTION)))
+        return hr;
     return S_OK;
 }
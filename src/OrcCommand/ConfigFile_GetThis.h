@@ -25,6 +25,12 @@ constexpr auto GETTHIS_REPORTALL = 7L;
 constexpr auto GETTHIS_HASH = 8L;
 constexpr auto GETTHIS_FUZZYHASH = 9L;
 constexpr auto GETTHIS_YARA = 10L;
+constexpr auto GETTHIS_STREAMING = 11L;
+
+// GetThis attributes following the common samples and sample ones
+constexpr auto GETTHIS_SAMPLES_DEDUP = CONFIG_SAMPLE + 1;
+constexpr auto GETTHIS_SAMPLES_PRIORITY = CONFIG_SAMPLE + 2;
+constexpr auto GETTHIS_SAMPLE_DEDUP = CONFIG_SAMPLE_NAME + 1;
 
 constexpr auto GETTHIS_GETTHIS = 0L;
 
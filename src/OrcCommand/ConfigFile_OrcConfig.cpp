@@ -46,5 +46,7 @@ HRESULT Orc::Config::Wolf::Local::root(ConfigItem& item)
         return hr;
     if (FAILED(hr = item.AddAttribute(L"altitude", ORC_ALTITUDE, ConfigItem::OPTION)))
         return hr;
+    if (FAILED(hr = item.AddAttribute(L"hash_cache", ORC_HASH_CACHE, ConfigItem::OPTION)))
+        return hr;
     return S_OK;
 }
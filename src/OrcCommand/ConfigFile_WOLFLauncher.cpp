@@ -147,6 +147,8 @@ HRESULT wolf_archive(ConfigItem& parent, DWORD dwIndex)
         return hr;
     if (FAILED(hr = parent[dwIndex].AddAttribute(L"childdebug", WOLFLAUNCHER_ARCHIVE_CHILDDEBUG, ConfigItem::OPTION)))
         return hr;
+    if (FAILED(hr = parent[dwIndex].AddAttribute(L"dedup", WOLFLAUNCHER_ARCHIVE_DEDUP, ConfigItem::OPTION)))
+        return hr;
     return S_OK;
 }
 
@@ -60,6 +60,7 @@ constexpr auto WOLFLAUNCHER_ARCHIVE_CMD_TIMEOUT = 7L;
 constexpr auto WOLFLAUNCHER_ARCHIVE_TIMEOUT = 8L;
 constexpr auto WOLFLAUNCHER_ARCHIVE_OPTIONAL = 9L;
 constexpr auto WOLFLAUNCHER_ARCHIVE_CHILDDEBUG = 10L;
+constexpr auto WOLFLAUNCHER_ARCHIVE_DEDUP = 11L;
 
 constexpr auto WOLFLAUNCHER_RECIPIENT_NAME = 0L;
 constexpr auto WOLFLAUNCHER_RECIPIENT_ARCHIVE = 1L;
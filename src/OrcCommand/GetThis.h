@@ -30,6 +30,10 @@
 #include <vector>
 #include <set>
 #include <string>
+#include <chrono>
+
+#include <agents.h>
+#include <ppl.h>
 
 #pragma managed(push, off)
 
@@ -37,6 +41,13 @@ constexpr auto GETTHIS_DEFAULT_MAXTOTALBYTES = (100 * 1024 * 1024);  // 50MB;
 constexpr auto GETTHIS_DEFAULT_MAXPERSAMPLEBYTES = (15 * 1024 * 1024);  // 15MB
 constexpr auto GETTHIS_DEFAULT_MAXSAMPLECOUNT = 500;
 
+// In streaming mode, queued samples are flushed to the archive every 64MB
+constexpr auto GETTHIS_STREAMING_FLUSH_BYTES = (64 * 1024 * 1024);
+
+// Samples copied to a directory from this size on are copied by a task, at most GETTHIS_PARALLEL_SAMPLES at a time
+constexpr auto GETTHIS_PARALLEL_SAMPLE_BYTES = (8 * 1024 * 1024);
+constexpr auto GETTHIS_PARALLEL_SAMPLES = 2;
+
 namespace Orc {
 
 class YaraScanner;
@@ -89,6 +100,16 @@ enum ContentType
     RAW
 };
 
+// Order in which matching samples are granted the collection limits
+enum class SamplePriority
+{
+    None,  // first found first served, while locations are parsed
+    Newest,  // last modification time, most recent first
+    Oldest,
+    Smallest,  // data size, smallest first
+    Largest
+};
+
 class ContentSpec
 {
 public:
@@ -109,6 +130,7 @@ public:
         std::swap(PerSampleLimits, other.PerSampleLimits);
         std::swap(Content, other.Content);
         std::swap(Terms, other.Terms);
+        bDedup = other.bDedup;
     }
 
     SampleSpec(const SampleSpec&) = default;
@@ -117,6 +139,9 @@ public:
     Limits PerSampleLimits;
     ContentSpec Content;
 
+    // Store identical contents (same SHA256) only once, indeterminate means "use <samples> setting"
+    boost::logic::tribool bDedup = boost::indeterminate;
+
     std::vector<std::shared_ptr<FileFind::SearchTerm>> Terms;
 };
 
@@ -137,8 +162,13 @@ public:
         }
         bool bFlushRegistry = false;
         bool bReportAll = false;
+        bool bDedup = false;
+        bool bStreaming = false;
+        bool bBenchmark = false;
         boost::logic::tribool bAddShadows;
 
+        SamplePriority Priority = SamplePriority::None;
+
         OutputSpec Output;
 
         ListOfSampleSpecs listofSpecs;
@@ -158,6 +188,7 @@ public:
         FuzzyHashStream::SupportedAlgorithm FuzzyHashAlgs = FuzzyHashStream::SupportedAlgorithm::Undefined;
 
         ContentSpec GetContentSpecFromString(const std::wstring& str);
+        static SamplePriority GetSamplePriorityFromString(const std::wstring& str);
 
     private:
         static std::wregex g_ContentRegEx;
@@ -182,6 +213,9 @@ private:
         FILETIME CollectionDate;
         bool OffLimits = false;
 
+        bool Dedup = false;  // content may be replaced by a reference to an identical sample
+        std::wstring DuplicateOf;  // when not empty, name of the collected sample holding the same content
+
         LONGLONG VolumeSerial;  //   |
         MFT_SEGMENT_REFERENCE FRN;  //   |--> Uniquely identifies a data stream to collect
         USHORT InstanceID;  //   |
@@ -192,6 +226,8 @@ private:
         std::shared_ptr<ByteStream> CopyStream;
         GUID SnapshotID;
 
+        bool Streamed = false;  // archived while the MFT walk is running
+
         std::vector<std::shared_ptr<FileFind::Match>> Matches;
 
         SampleRef()
@@ -210,6 +246,9 @@ private:
             std::swap(SampleSize, Other.SampleSize);
             CollectionDate = Other.CollectionDate;
             OffLimits = Other.OffLimits;
+            Dedup = Other.Dedup;
+            std::swap(DuplicateOf, Other.DuplicateOf);
+            Streamed = Other.Streamed;
             std::swap(Matches, Other.Matches);
             AttributeIndex = Other.AttributeIndex;
             InstanceID = Other.InstanceID;
@@ -257,6 +296,36 @@ private:
     std::set<SampleRef> Samples;
     std::set<std::wstring> SampleNames;
 
+    // Samples the archive replaced by a reference to an identical one, found while they were compressed (by the
+    // streaming task until CompleteStreamingCollection returns)
+    std::set<std::wstring> ReferencedSamples;
+
+    // Streaming collection: samples within limits are archived while the MFT walk is still running
+    class StreamingCollection
+    {
+    public:
+        // What the task needs of a sample, copied on the walk thread: the task never reads the Samples set, which
+        // the walk keeps updating. The stream chain is only used by the task until CompleteStreamingCollection returns
+        struct Sample
+        {
+            std::wstring SampleName;
+            std::wstring FullName;
+            std::shared_ptr<ByteStream> CopyStream;
+            ULONGLONG SampleSize = 0LL;
+            bool Dedup = false;
+        };
+
+        std::shared_ptr<ArchiveCreate> Compressor;
+        std::shared_ptr<TableOutput::IWriter> CSV;
+
+        Concurrency::unbounded_buffer<std::shared_ptr<const Sample>> Queue;
+        Concurrency::task_group Tasks;
+
+        // Result of the last queue flush, only read once Tasks is waited for
+        HRESULT hrFlush = S_OK;
+    };
+    std::unique_ptr<StreamingCollection> Streaming;
+
     static HRESULT CreateSampleFileName(
         const ContentSpec& content,
         const PFILE_NAME pFileName,
@@ -266,8 +335,22 @@ private:
 
     HRESULT ConfigureSampleStreams(SampleRef& sampleRef);
 
+    static std::vector<const SampleRef*> GetCollectionOrder(const std::set<SampleRef>& MatchingSamples);
+
+    // ullBytes are the bytes read during the phase, when bRead is false they are only reported as matched bytes
+    void ReportPhase(
+        LPCWSTR szPhase,
+        const std::chrono::steady_clock::time_point& start,
+        ULONGLONG ullBytes,
+        bool bRead = true);
+
     static LimitStatus SampleLimitStatus(const Limits& GlobalLimits, const Limits& LocalLimits, DWORDLONG DataSize);
 
+    ListOfSampleSpecs::iterator FindSampleSpec(const std::shared_ptr<FileFind::Match>& aMatch);
+    void UpdateLimits(LimitStatus status, SampleSpec& aSpec, const std::wstring& strName, DWORDLONG dwlDataSize);
+
+    HRESULT PlanSampleCollection();
+
     HRESULT
     AddSamplesForMatch(LimitStatus status, const SampleSpec& aSpec, const std::shared_ptr<FileFind::Match>& aMatch);
 
@@ -289,6 +372,13 @@ private:
 
     HRESULT HashOffLimitSamples(ITableOutput& output, std::set<SampleRef>& MatchingSamples);
 
+    std::shared_ptr<ArchiveCreate> CreateSampleArchive();
+    void OnSampleArchived(const Archive::ArchiveItem& item);
+    HRESULT ResolveArchivedDuplicates(std::set<SampleRef>& MatchingSamples);
+
+    HRESULT StartStreamingCollection();
+    HRESULT CompleteStreamingCollection();
+
     HRESULT CollectMatchingSamples(const OutputSpec& output, std::set<SampleRef>& MatchingSamples);
 
     HRESULT FindMatchingSamples();
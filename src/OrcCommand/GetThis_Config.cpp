@@ -37,6 +37,18 @@ constexpr auto REGEX_CONTENT_STRINGS_MAX = 6;
 constexpr auto CONTENT_STRINGS_DEFAULT_MIN = 3;
 constexpr auto CONTENT_STRINGS_DEFAULT_MAX = 1024;
 
+namespace {
+
+bool IsYes(const ConfigItem& item)
+{
+    using namespace std::string_view_literals;
+    constexpr auto YES = L"Yes"sv;
+
+    return equalCaseInsensitive((const std::wstring&)item, YES, YES.size());
+}
+
+}  // namespace
+
 HRESULT Main::GetSchemaFromConfig(const ConfigItem& schemaitem)
 {
     config.Output.Schema = TableOutput::GetColumnsFromConfig(
@@ -96,6 +108,19 @@ ContentSpec Main::Configuration::GetContentSpecFromString(const std::wstring& st
     return retval;
 }
 
+SamplePriority Main::Configuration::GetSamplePriorityFromString(const std::wstring& str)
+{
+    if (equalCaseInsensitive(str, L"newest"))
+        return SamplePriority::Newest;
+    if (equalCaseInsensitive(str, L"oldest"))
+        return SamplePriority::Oldest;
+    if (equalCaseInsensitive(str, L"smallest"))
+        return SamplePriority::Smallest;
+    if (equalCaseInsensitive(str, L"largest"))
+        return SamplePriority::Largest;
+    return SamplePriority::None;
+}
+
 HRESULT Main::GetConfigurationFromConfig(const ConfigItem& configitem)
 {
     HRESULT hr = E_FAIL;
@@ -156,6 +181,15 @@ HRESULT Main::GetConfigurationFromConfig(const ConfigItem& configitem)
     {
         config.content = config.GetContentSpecFromString(configitem[GETTHIS_SAMPLES][CONFIG_SAMPLE_CONTENT]);
     }
+    if (configitem[GETTHIS_SAMPLES][GETTHIS_SAMPLES_DEDUP])
+    {
+        config.bDedup = IsYes(configitem[GETTHIS_SAMPLES][GETTHIS_SAMPLES_DEDUP]);
+    }
+    if (configitem[GETTHIS_SAMPLES][GETTHIS_SAMPLES_PRIORITY])
+    {
+        config.Priority =
+            config.GetSamplePriorityFromString(configitem[GETTHIS_SAMPLES][GETTHIS_SAMPLES_PRIORITY].strData);
+    }
 
     std::for_each(
         begin(configitem[GETTHIS_SAMPLES][CONFIG_SAMPLE].NodeList),
@@ -214,6 +248,10 @@ HRESULT Main::GetConfigurationFromConfig(const ConfigItem& configitem)
             {
                 aSpec.Content = config.GetContentSpecFromString(item[CONFIG_SAMPLE_CONTENT]);
             }
+            if (item[GETTHIS_SAMPLE_DEDUP])
+            {
+                aSpec.bDedup = IsYes(item[GETTHIS_SAMPLE_DEDUP]);
+            }
             config.listofSpecs.push_back(std::move(aSpec));
         });
 
@@ -250,6 +288,10 @@ HRESULT Main::GetConfigurationFromConfig(const ConfigItem& configitem)
     {
         config.bReportAll = true;
     }
+    if (configitem[GETTHIS_STREAMING])
+    {
+        config.bStreaming = IsYes(configitem[GETTHIS_STREAMING]);
+    }
     if (configitem[GETTHIS_HASH])
     {
         config.CryptoHashAlgs =
@@ -270,6 +312,7 @@ HRESULT Main::GetConfigurationFromArgcArgv(int argc, LPCWSTR argv[])
 {
     HRESULT hr = S_OK;
     std::wstring strContent;
+    std::wstring strPriority;
 
     try
     {
@@ -307,6 +350,12 @@ HRESULT Main::GetConfigurationFromArgcArgv(int argc, LPCWSTR argv[])
                         ;
                     else if (BooleanOption(argv[i] + 1, L"ReportAll", config.bReportAll))
                         ;
+                    else if (BooleanOption(argv[i] + 1, L"Dedup", config.bDedup))
+                        ;
+                    else if (BooleanOption(argv[i] + 1, L"Streaming", config.bStreaming))
+                        ;
+                    else if (BooleanOption(argv[i] + 1, L"Benchmark", config.bBenchmark))
+                        ;
                     else if (BooleanOption(argv[i] + 1, L"NoLimits", config.limits.bIgnoreLimits))
                         ;
                     else if (BooleanOption(argv[i] + 1, L"Shadows", config.bAddShadows))
@@ -321,6 +370,10 @@ HRESULT Main::GetConfigurationFromArgcArgv(int argc, LPCWSTR argv[])
                     {
                         config.content = config.GetContentSpecFromString(strContent);
                     }
+                    else if (ParameterOption(argv[i] + 1, L"Priority", strPriority))
+                    {
+                        config.Priority = config.GetSamplePriorityFromString(strPriority);
+                    }
                     else if (!_wcsnicmp(argv[i] + 1, L"XOR", wcslen(L"XOR")))
                     {
                         DWORD dwXOR = 0L;
@@ -433,6 +486,10 @@ HRESULT Main::CheckConfiguration()
         {
             aSpec.Content = config.content;
         }
+        if (boost::logic::indeterminate(aSpec.bDedup))
+        {
+            aSpec.bDedup = config.bDedup;
+        }
 
         std::for_each(begin(aSpec.Terms), end(aSpec.Terms), [this](const shared_ptr<FileFind::SearchTerm>& filespec) {
             FileFinder.AddTerm(filespec);
@@ -457,6 +514,15 @@ HRESULT Main::CheckConfiguration()
 
     GlobalLimits = config.limits;
 
+    if (config.Priority != SamplePriority::None && config.bStreaming)
+    {
+        log::Warning(
+            _L_,
+            E_INVALIDARG,
+            L"Sample priority requires all locations to be parsed before collection, streaming is disabled\r\n");
+        config.bStreaming = false;
+    }
+
     if (FAILED(hr = FileFinder.InitializeYara(config.Yara)))
     {
         log::Error(_L_, hr, L"Failed to initialize yara scanner\r\n");
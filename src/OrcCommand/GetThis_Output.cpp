@@ -48,6 +48,14 @@ void Main::PrintUsage()
         L"\t/logfile=<FileName>         : All output is duplicated to logfile <FileName>\r\n"
         L"\t/nolimits                   : Ignore all limits, overrides default values\r\n"
         L"\t/reportall                  : Add information about rejected samples (due to limits) to CSV\r\n"
+        L"\t/dedup                      : Collect identical contents (same SHA256) only once, duplicates are listed "
+        L"in CSV\r\n"
+        L"\t/streaming                  : Archive samples while locations are still being parsed (archive "
+        L"output only)\r\n"
+        L"\t/benchmark                  : Report time and throughput (MB/sec) of each collection phase\r\n"
+        L"\t/priority=<Newest|Oldest|Smallest|Largest>:\r\n"
+        L"\t                              Samples granted the limits first, once all locations are parsed (off "
+        L"limit samples are reported without hashes)\r\n"
         L"\t/xor=0xBADF00D0             : Pattern used to XOR sample files (optional)\r\n"
         L"\t/hash=<MD5|SHA-1|SHA256>    : List hash values stored in GetThis.csv\r\n"
         L"\t/fuzzyhash=<SSDeep|TLSH>    : List fuzzy hash values stored in GetThis.csv\r\n"
@@ -76,6 +84,28 @@ void Main::PrintParameters()
     PrintOutputOption(config.Output);
 
     PrintBooleanOption(L"Report All", config.bReportAll);
+    PrintBooleanOption(L"Dedup", config.bDedup);
+    PrintBooleanOption(L"Streaming", config.bStreaming);
+    PrintBooleanOption(L"Benchmark", config.bBenchmark);
+
+    switch (config.Priority)
+    {
+        case SamplePriority::Newest:
+            log::Info(_L_, L"%-17.17s     : %s\r\n", L"Priority", L"Newest first");
+            break;
+        case SamplePriority::Oldest:
+            log::Info(_L_, L"%-17.17s     : %s\r\n", L"Priority", L"Oldest first");
+            break;
+        case SamplePriority::Smallest:
+            log::Info(_L_, L"%-17.17s     : %s\r\n", L"Priority", L"Smallest first");
+            break;
+        case SamplePriority::Largest:
+            log::Info(_L_, L"%-17.17s     : %s\r\n", L"Priority", L"Largest first");
+            break;
+        default:
+            break;
+    }
+
     PrintHashAlgorithmOption(L"Hash", config.CryptoHashAlgs);
     PrintHashAlgorithmOption(L"Fuzzy Hash", config.FuzzyHashAlgs);
 
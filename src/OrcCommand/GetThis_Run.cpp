@@ -23,6 +23,7 @@
 #include "StringsStream.h"
 #include "XORStream.h"
 #include "CryptoHashStream.h"
+#include "NTFSStream.h"
 #include "ParameterCheck.h"
 #include "ArchiveExtract.h"
 
@@ -34,6 +35,9 @@
 #include <memory>
 #include <filesystem>
 #include <sstream>
+#include <map>
+#include <tuple>
+#include <algorithm>
 
 using namespace std;
 namespace fs = std::experimental::filesystem;
@@ -382,6 +386,8 @@ HRESULT Main::ConfigureSampleStreams(SampleRef& sampleRef)
         sampleRef.HashStream = make_shared<CryptoHashStream>(_L_);
 
         SupportedAlgorithm algs = config.CryptoHashAlgs;
+        if (sampleRef.Dedup)
+            algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::SHA256);
 
         if (FAILED(hr = sampleRef.HashStream->OpenToRead(algs, stream)))
             return hr;
@@ -395,6 +401,8 @@ HRESULT Main::ConfigureSampleStreams(SampleRef& sampleRef)
         std::shared_ptr<ByteStream> upstream = stream;
 
         SupportedAlgorithm algs = config.CryptoHashAlgs;
+        if (sampleRef.Dedup)
+            algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::SHA256);
 
         if (algs != SupportedAlgorithm::Undefined)
         {
@@ -420,6 +428,78 @@ HRESULT Main::ConfigureSampleStreams(SampleRef& sampleRef)
     return S_OK;
 }
 
+std::vector<const Main::SampleRef*> Main::GetCollectionOrder(const std::set<SampleRef>& MatchingSamples)
+{
+    // Samples are read in the order their data is laid out on each volume: resident data (already in memory) first,
+    // then by offset of the first allocated cluster. Copying many small files then becomes mostly sequential reads.
+    // Adjacent files are not merged into larger reads: the volume reader serializes them, already in this order
+    std::vector<std::pair<ULONGLONG, const SampleRef*>> ordered;
+    ordered.reserve(MatchingSamples.size());
+
+    for (const auto& sample_ref : MatchingSamples)
+    {
+        ULONGLONG ullDiskOffset = 0LL;
+
+        const auto& attr = sample_ref.Matches.front()->MatchingAttributes[sample_ref.AttributeIndex];
+        if (auto pNTFSStream = std::dynamic_pointer_cast<NTFSStream>(attr.RawStream))
+        {
+            const auto segments = pNTFSStream->DataSegments();
+            auto first = std::find_if(begin(segments), end(segments), [](const MFTUtils::DataSegment& segment) {
+                return !segment.bUnallocated;
+            });
+            if (first != end(segments))
+                ullDiskOffset = first->ullDiskBasedOffset;
+        }
+        ordered.emplace_back(ullDiskOffset, &sample_ref);
+    }
+
+    std::stable_sort(begin(ordered), end(ordered), [](const auto& left, const auto& right) {
+        if (left.second->VolumeSerial != right.second->VolumeSerial)
+            return left.second->VolumeSerial < right.second->VolumeSerial;
+
+        auto cmpresult = memcmp(&left.second->SnapshotID, &right.second->SnapshotID, sizeof(GUID));
+        if (cmpresult != 0)
+            return cmpresult < 0;
+
+        return left.first < right.first;
+    });
+
+    std::vector<const SampleRef*> retval;
+    retval.reserve(ordered.size());
+    std::transform(
+        begin(ordered), end(ordered), std::back_inserter(retval), [](const auto& item) { return item.second; });
+    return retval;
+}
+
+void Main::ReportPhase(
+    LPCWSTR szPhase,
+    const std::chrono::steady_clock::time_point& start,
+    ULONGLONG ullBytes,
+    bool bRead)
+{
+    if (!config.bBenchmark)
+        return;
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (!bRead)
+    {
+        // Not a throughput: the samples' data is not read while they are matched
+        log::Info(_L_, L"Benchmark: %s: %I64d matched bytes in %.3f sec\r\n", szPhase, ullBytes, elapsed.count());
+        return;
+    }
+
+    const double dblMBPerSec = elapsed.count() > 0.0 ? ((double)ullBytes / (1024 * 1024)) / elapsed.count() : 0.0;
+
+    log::Info(
+        _L_,
+        L"Benchmark: %s: %I64d bytes in %.3f sec (%.2f MB/sec)\r\n",
+        szPhase,
+        ullBytes,
+        elapsed.count(),
+        dblMBPerSec);
+}
+
 LimitStatus Main::SampleLimitStatus(const Limits& GlobalLimits, const Limits& LocalLimits, DWORDLONG DataSize)
 {
     if (GlobalLimits.bIgnoreLimits)
@@ -455,6 +535,166 @@ LimitStatus Main::SampleLimitStatus(const Limits& GlobalLimits, const Limits& Lo
     return SampleWithinLimits;
 }
 
+ListOfSampleSpecs::iterator Main::FindSampleSpec(const std::shared_ptr<FileFind::Match>& aMatch)
+{
+    return std::find_if(begin(config.listofSpecs), end(config.listofSpecs), [aMatch](const SampleSpec& aSpec) -> bool {
+        auto filespecIt = std::find(begin(aSpec.Terms), end(aSpec.Terms), aMatch->Term);
+        return filespecIt != end(aSpec.Terms);
+    });
+}
+
+void Main::UpdateLimits(LimitStatus status, SampleSpec& aSpec, const std::wstring& strName, DWORDLONG dwlDataSize)
+{
+    switch (status)
+    {
+        case NoLimits:
+        case SampleWithinLimits:
+            log::Info(_L_, L"\t%s matched (%d bytes)\r\n", strName.c_str(), dwlDataSize);
+            aSpec.PerSampleLimits.dwlAccumulatedBytesTotal += dwlDataSize;
+            aSpec.PerSampleLimits.dwAccumulatedSampleCount++;
+
+            GlobalLimits.dwlAccumulatedBytesTotal += dwlDataSize;
+            GlobalLimits.dwAccumulatedSampleCount++;
+            break;
+        case GlobalSampleCountLimitReached:
+            log::Info(
+                _L_, L"\t%s : Global sample count reached (%d)\r\n", strName.c_str(), GlobalLimits.dwMaxSampleCount);
+            GlobalLimits.bMaxSampleCountReached = true;
+            break;
+        case GlobalMaxBytesPerSample:
+            log::Info(
+                _L_,
+                L"\t%s : Exceeds global per sample size limit (%I64d)\r\n",
+                strName.c_str(),
+                GlobalLimits.dwlMaxBytesPerSample);
+            GlobalLimits.bMaxBytesPerSampleReached = true;
+            break;
+        case GlobalMaxBytesTotal:
+            log::Info(
+                _L_,
+                L"\t%s : Global total sample size limit reached (%I64d)\r\n",
+                strName.c_str(),
+                GlobalLimits.dwlMaxBytesTotal);
+            GlobalLimits.bMaxBytesTotalReached = true;
+            break;
+        case LocalSampleCountLimitReached:
+            log::Info(
+                _L_,
+                L"\t%s : sample count reached (%d)\r\n",
+                strName.c_str(),
+                aSpec.PerSampleLimits.dwMaxSampleCount);
+            aSpec.PerSampleLimits.bMaxSampleCountReached = true;
+            break;
+        case LocalMaxBytesPerSample:
+            log::Info(
+                _L_,
+                L"\t%s : Exceeds per sample size limit (%I64d)\r\n",
+                strName.c_str(),
+                aSpec.PerSampleLimits.dwlMaxBytesPerSample);
+            aSpec.PerSampleLimits.bMaxBytesPerSampleReached = true;
+            break;
+        case LocalMaxBytesTotal:
+            log::Info(
+                _L_,
+                L"\t%s : total sample size limit reached (%I64d)\r\n",
+                strName.c_str(),
+                aSpec.PerSampleLimits.dwlMaxBytesTotal);
+            aSpec.PerSampleLimits.bMaxBytesTotalReached = true;
+            break;
+        case FailedToComputeLimits:
+            break;
+    }
+}
+
+HRESULT Main::PlanSampleCollection()
+{
+    // Sizes and time stamps all come from the MFT: the collection set is computed before any sample data is read
+    std::vector<SampleRef*> candidates;
+    candidates.reserve(Samples.size());
+
+    for (auto& sample_ref : Samples)
+        candidates.push_back(const_cast<SampleRef*>(&sample_ref));
+
+    auto dataSize = [](const SampleRef* pSample) -> DWORDLONG {
+        return pSample->Matches.front()->MatchingAttributes[pSample->AttributeIndex].DataStream->GetSize();
+    };
+    // a match without $STANDARD_INFORMATION sorts as the oldest sample
+    auto lastModification = [](const SampleRef* pSample) -> ULONGLONG {
+        const auto pStandardInformation = pSample->Matches.front()->StandardInformation.get();
+        if (pStandardInformation == nullptr)
+            return 0LL;
+        const auto& time = pStandardInformation->LastModificationTime;
+        return ((ULONGLONG)time.dwHighDateTime << 32) | time.dwLowDateTime;
+    };
+
+    switch (config.Priority)
+    {
+        case SamplePriority::Newest:
+            std::stable_sort(begin(candidates), end(candidates), [&](const SampleRef* left, const SampleRef* right) {
+                return lastModification(left) > lastModification(right);
+            });
+            break;
+        case SamplePriority::Oldest:
+            std::stable_sort(begin(candidates), end(candidates), [&](const SampleRef* left, const SampleRef* right) {
+                return lastModification(left) < lastModification(right);
+            });
+            break;
+        case SamplePriority::Smallest:
+            std::stable_sort(begin(candidates), end(candidates), [&](const SampleRef* left, const SampleRef* right) {
+                return dataSize(left) < dataSize(right);
+            });
+            break;
+        case SamplePriority::Largest:
+            std::stable_sort(begin(candidates), end(candidates), [&](const SampleRef* left, const SampleRef* right) {
+                return dataSize(left) > dataSize(right);
+            });
+            break;
+        default:
+            break;
+    }
+
+    log::Info(_L_, L"\r\nApplying limits to %I64d candidate samples\r\n", (ULONGLONG)candidates.size());
+
+    DWORD dwOffLimits = 0L;
+    for (auto pSample : candidates)
+    {
+        const auto& aMatch = pSample->Matches.front();
+
+        auto aSpecIt = FindSampleSpec(aMatch);
+        if (aSpecIt == end(config.listofSpecs))
+        {
+            log::Error(
+                _L_, E_FAIL, L"Could not find sample spec for match %s\r\n", aMatch->Term->GetDescription().c_str());
+            return E_FAIL;
+        }
+
+        wstring strName;
+        aMatch->GetMatchFullName(
+            aMatch->MatchingNames.front(), aMatch->MatchingAttributes[pSample->AttributeIndex], strName);
+
+        const DWORDLONG dwlDataSize = dataSize(pSample);
+        const LimitStatus status = SampleLimitStatus(GlobalLimits, aSpecIt->PerSampleLimits, dwlDataSize);
+
+        UpdateLimits(status, *aSpecIt, strName, dwlDataSize);
+
+        pSample->OffLimits = status != NoLimits && status != SampleWithinLimits;
+        if (pSample->OffLimits)
+        {
+            // Nothing of this sample will be read: release its stream chain right away
+            pSample->CopyStream->Close();
+            dwOffLimits++;
+        }
+    }
+
+    log::Info(
+        _L_,
+        L"%d samples (%I64d bytes) to collect, %d samples off limits\r\n",
+        GlobalLimits.dwAccumulatedSampleCount,
+        GlobalLimits.dwlAccumulatedBytesTotal,
+        dwOffLimits);
+    return S_OK;
+}
+
 HRESULT
 Main::AddSampleRefToCSV(ITableOutput& output, const std::wstring& strComputerName, const Main::SampleRef& sampleRef)
 {
@@ -499,7 +739,7 @@ Main::AddSampleRefToCSV(ITableOutput& output, const std::wstring& strComputerNam
 
             output.WriteString(name_it->FullPathName.c_str());
 
-            if (sampleRef.OffLimits)
+            if (sampleRef.OffLimits || !sampleRef.DuplicateOf.empty())
                 output.WriteNothing();
             else
                 output.WriteString(sampleRef.SampleName.c_str());
@@ -582,6 +822,11 @@ Main::AddSampleRefToCSV(ITableOutput& output, const std::wstring& strComputerNam
                 output.WriteNothing();
             }
 
+            if (!sampleRef.DuplicateOf.empty())
+                output.WriteString(sampleRef.DuplicateOf.c_str());
+            else
+                output.WriteNothing();
+
             output.WriteEndOfLine();
         }
     }
@@ -653,6 +898,7 @@ Main::AddSamplesForMatch(LimitStatus status, const SampleSpec& aSpec, const std:
 
                 sampleRef.Content = aSpec.Content;
                 sampleRef.CollectionDate = CollectionDate;
+                sampleRef.Dedup = (bool)aSpec.bDedup;
 
                 wstring CabSampleName;
                 DWORD dwIdx = 0L;
@@ -682,7 +928,26 @@ Main::AddSamplesForMatch(LimitStatus status, const SampleSpec& aSpec, const std:
             {
                 log::Error(_L_, hr, L"Failed to configure sample reference for %s\r\n", sampleRef.SampleName.c_str());
             }
-            Samples.insert(sampleRef);
+            else if (Streaming && !sampleRef.OffLimits)
+            {
+                // limits were checked before: the sample can be archived right away
+                sampleRef.Streamed = true;
+            }
+
+            auto [inserted, bInserted] = Samples.insert(sampleRef);
+            if (bInserted && inserted->Streamed)
+            {
+                auto pSample = std::make_shared<StreamingCollection::Sample>();
+                pSample->SampleName = inserted->SampleName;
+                aMatch->GetMatchFullName(
+                    aMatch->MatchingNames.front(),
+                    aMatch->MatchingAttributes[inserted->AttributeIndex],
+                    pSample->FullName);
+                pSample->CopyStream = inserted->CopyStream;
+                pSample->SampleSize = inserted->SampleSize;
+                pSample->Dedup = inserted->Dedup;
+                Concurrency::send(Streaming->Queue, std::shared_ptr<const StreamingCollection::Sample>(pSample));
+            }
         }
     }
 
@@ -698,24 +963,34 @@ HRESULT Main::CollectMatchingSamples(
 {
     HRESULT hr = E_FAIL;
 
-    std::for_each(begin(Samples), end(Samples), [this, compressor, &hr](const SampleRef& sampleRef) {
-        if (!sampleRef.OffLimits)
+    const auto start = std::chrono::steady_clock::now();
+    ULONGLONG ullCollectedBytes = 0LL;
+
+    // Archive items are read in the order they are added
+    for (auto pSample : GetCollectionOrder(Samples))
+    {
+        const SampleRef& sampleRef = *pSample;
+
+        if (!sampleRef.OffLimits && !sampleRef.Streamed && sampleRef.DuplicateOf.empty())
         {
             wstring strName;
             sampleRef.Matches.front()->GetMatchFullName(
                 sampleRef.Matches.front()->MatchingNames.front(),
                 sampleRef.Matches.front()->MatchingAttributes.front(),
                 strName);
-            if (FAILED(hr = compressor->AddStream(sampleRef.SampleName.c_str(), strName.c_str(), sampleRef.CopyStream)))
+            if (FAILED(
+                    hr = compressor->AddStream(
+                        sampleRef.SampleName.c_str(), strName.c_str(), sampleRef.CopyStream, sampleRef.Dedup)))
             {
                 log::Error(_L_, hr, L"Failed to add sample %s\r\n", sampleRef.SampleName.c_str());
             }
+            else
+                ullCollectedBytes += sampleRef.SampleSize;
         }
-    });
+    }
 
     log::Info(_L_, L"\r\nAdding matching samples to archive:\r\n");
-    compressor->SetCallback(
-        [this](const Archive::ArchiveItem& item) { log::Info(_L_, L"\t%s\r\n", item.Path.c_str()); });
+    compressor->SetCallback([this](const Archive::ArchiveItem& item) { OnSampleArchived(item); });
 
     if (FAILED(hr = compressor->FlushQueue()))
     {
@@ -723,24 +998,32 @@ HRESULT Main::CollectMatchingSamples(
         return hr;
     }
 
+    ReportPhase(L"Sample collection", start, ullCollectedBytes);
+
     wstring strComputerName;
     SystemDetails::GetOrcComputerName(strComputerName);
 
-    std::for_each(
-        begin(Samples), end(Samples), [this, strComputerName, compressor, &output, &hr](const SampleRef& sampleRef) {
-            if (sampleRef.HashStream)
-            {
-                sampleRef.HashStream->GetMD5(const_cast<CBinaryBuffer&>(sampleRef.MD5));
-                sampleRef.HashStream->GetSHA1(const_cast<CBinaryBuffer&>(sampleRef.SHA1));
-                sampleRef.HashStream->GetSHA256(const_cast<CBinaryBuffer&>(sampleRef.SHA256));
-            }
+    for (const auto& sampleRef : Samples)
+    {
+        if (sampleRef.HashStream)
+        {
+            sampleRef.HashStream->GetMD5(const_cast<CBinaryBuffer&>(sampleRef.MD5));
+            sampleRef.HashStream->GetSHA1(const_cast<CBinaryBuffer&>(sampleRef.SHA1));
+            sampleRef.HashStream->GetSHA256(const_cast<CBinaryBuffer&>(sampleRef.SHA256));
+        }
 
-            if (sampleRef.FuzzyHashStream)
-            {
-                sampleRef.FuzzyHashStream->GetSSDeep(const_cast<CBinaryBuffer&>(sampleRef.SSDeep));
-                sampleRef.FuzzyHashStream->GetTLSH(const_cast<CBinaryBuffer&>(sampleRef.TLSH));
-            }
+        if (sampleRef.FuzzyHashStream)
+        {
+            sampleRef.FuzzyHashStream->GetSSDeep(const_cast<CBinaryBuffer&>(sampleRef.SSDeep));
+            sampleRef.FuzzyHashStream->GetTLSH(const_cast<CBinaryBuffer&>(sampleRef.TLSH));
+        }
+    }
 
+    if (FAILED(hr = ResolveArchivedDuplicates(Samples)))
+        return hr;
+
+    std::for_each(
+        begin(Samples), end(Samples), [this, strComputerName, compressor, &output, &hr](const SampleRef& sampleRef) {
             if (FAILED(hr = AddSampleRefToCSV(output, strComputerName, sampleRef)))
             {
                 log::Error(
@@ -770,35 +1053,131 @@ Main::CollectMatchingSamples(const std::wstring& outputdir, ITableOutput& output
 
     log::Info(_L_, L"\r\nCopying matching samples to %s\r\n", outputdir.c_str());
 
-    for (const auto& sample_ref : MatchingSamples)
-    {
-        if (!sample_ref.OffLimits)
+    const auto start = std::chrono::steady_clock::now();
+    ULONGLONG ullCollectedBytes = 0LL;
+
+    // Content of the deduplicated samples copied so far, by SHA256
+    std::map<std::string, const SampleRef*> collected;
+    DWORD dwDuplicates = 0L;
+    ULONGLONG ullSavedBytes = 0LL;
+
+    // Guards the above and ullCollectedBytes against the tasks copying large samples
+    Concurrency::critical_section cs;
+
+    auto copySample = [&](const SampleRef& sample_ref) -> HRESULT {
+        HRESULT hr = E_FAIL;
+
+        fs::path sampleFile = output_dir / fs::path(sample_ref.SampleName);
+
+        FileStream outputStream(_L_);
+
+        if (FAILED(hr = outputStream.WriteTo(sampleFile.wstring().c_str())))
+        {
+            log::Error(_L_, hr, L"Failed to create sample file %s\r\n", sampleFile.wstring().c_str());
+            return hr;
+        }
+
+        ULONGLONG ullBytesWritten = 0LL;
+        if (FAILED(hr = sample_ref.CopyStream->CopyTo(outputStream, &ullBytesWritten)))
         {
-            fs::path sampleFile = output_dir / fs::path(sample_ref.SampleName);
+            log::Error(_L_, hr, L"Failed while writing to sample %s\r\n", sampleFile.string().c_str());
+            return hr;
+        }
 
-            FileStream outputStream(_L_);
+        outputStream.Close();
+        sample_ref.CopyStream->Close();
 
-            if (FAILED(hr = outputStream.WriteTo(sampleFile.wstring().c_str())))
-            {
-                log::Error(_L_, hr, L"Failed to create sample file %s\r\n", sampleFile.wstring().c_str());
-                break;
-            }
+        Concurrency::critical_section::scoped_lock lock(cs);
+        ullCollectedBytes += ullBytesWritten;
 
-            ULONGLONG ullBytesWritten = 0LL;
-            if (FAILED(hr = sample_ref.CopyStream->CopyTo(outputStream, &ullBytesWritten)))
+        // The content was hashed while copied: a duplicate copy is removed, the csv names the sample holding it
+        if (sample_ref.Dedup && sample_ref.HashStream
+            && SUCCEEDED(sample_ref.HashStream->GetSHA256(const_cast<CBinaryBuffer&>(sample_ref.SHA256)))
+            && !sample_ref.SHA256.empty())
+        {
+            std::string strSHA256((const CHAR*)sample_ref.SHA256.GetData(), sample_ref.SHA256.GetCount());
+
+            if (auto it = collected.find(strSHA256); it != std::end(collected))
             {
-                log::Error(_L_, hr, L"Failed while writing to sample %s\r\n", sampleFile.string().c_str());
-                break;
+                if (!DeleteFile(sampleFile.wstring().c_str()))
+                {
+                    log::Warning(
+                        _L_,
+                        HRESULT_FROM_WIN32(GetLastError()),
+                        L"Failed to remove duplicate sample %s\r\n",
+                        sampleFile.wstring().c_str());
+                }
+                else
+                {
+                    const_cast<SampleRef&>(sample_ref).DuplicateOf = it->second->SampleName;
+                    log::Info(
+                        _L_,
+                        L"\t%s is identical to %s, only a reference is kept\r\n",
+                        sample_ref.SampleName.c_str(),
+                        sample_ref.DuplicateOf.c_str());
+
+                    dwDuplicates++;
+                    ullSavedBytes += ullBytesWritten;
+                    return S_OK;
+                }
             }
+            else
+                collected.emplace(std::move(strSHA256), &sample_ref);
+        }
 
-            outputStream.Close();
-            sample_ref.CopyStream->Close();
+        log::Info(
+            _L_, L"\t%s copied (%I64d bytes)\r\n", sample_ref.SampleName.c_str(), sample_ref.CopyStream->GetSize());
+        return S_OK;
+    };
 
-            log::Info(
-                _L_, L"\t%s copied (%I64d bytes)\r\n", sample_ref.SampleName.c_str(), sample_ref.CopyStream->GetSize());
+    // Small samples are copied in disk order. A large sample is read in large chunks: copied by a task, its hashing
+    // and writing overlap the reads of the following samples, which the volume reader serializes
+    Concurrency::task_group largeCopies;
+    DWORD dwLargeCopies = 0L;
+    HRESULT hrLargeCopies = S_OK;
+
+    for (auto pSample : GetCollectionOrder(MatchingSamples))
+    {
+        if (pSample->OffLimits)
+            continue;
+
+        if (pSample->SampleSize < GETTHIS_PARALLEL_SAMPLE_BYTES)
+        {
+            if (FAILED(hr = copySample(*pSample)))
+                break;
+            continue;
         }
+
+        if (dwLargeCopies == GETTHIS_PARALLEL_SAMPLES)
+        {
+            largeCopies.wait();
+            dwLargeCopies = 0L;
+            if (FAILED(hrLargeCopies))
+                break;
+        }
+
+        dwLargeCopies++;
+        largeCopies.run([&copySample, &cs, &hrLargeCopies, pSample]() {
+            if (HRESULT hr = copySample(*pSample); FAILED(hr))
+            {
+                Concurrency::critical_section::scoped_lock lock(cs);
+                hrLargeCopies = hr;
+            }
+        });
+    }
+    largeCopies.wait();
+
+    if (dwDuplicates > 0)
+    {
+        log::Info(
+            _L_,
+            L"\r\nDeduplication: %d duplicate samples replaced by references (%I64d bytes saved)\r\n",
+            dwDuplicates,
+            ullSavedBytes);
     }
 
+    ReportPhase(L"Sample collection", start, ullCollectedBytes);
+
     for (const auto& sample_ref : MatchingSamples)
     {
         fs::path sampleFile = output_dir / fs::path(sample_ref.SampleName);
@@ -807,7 +1186,7 @@ Main::CollectMatchingSamples(const std::wstring& outputdir, ITableOutput& output
         {
             sample_ref.HashStream->GetMD5(const_cast<CBinaryBuffer&>(sample_ref.MD5));
             sample_ref.HashStream->GetSHA1(const_cast<CBinaryBuffer&>(sample_ref.SHA1));
-            sample_ref.HashStream->GetSHA256(const_cast<CBinaryBuffer&>(sample_ref.SHA1));
+            sample_ref.HashStream->GetSHA256(const_cast<CBinaryBuffer&>(sample_ref.SHA256));
         }
 
         if (sample_ref.FuzzyHashStream)
@@ -825,6 +1204,71 @@ Main::CollectMatchingSamples(const std::wstring& outputdir, ITableOutput& output
     return S_OK;
 }
 
+HRESULT Main::StartStreamingCollection()
+{
+    HRESULT hr = E_FAIL;
+
+    Streaming = std::make_unique<StreamingCollection>();
+
+    Streaming->Compressor = CreateSampleArchive();
+
+    std::tie(hr, Streaming->CSV) = CreateArchiveLogFileAndCSV(config.Output.Path, Streaming->Compressor);
+    if (FAILED(hr))
+    {
+        Streaming.reset();
+        return hr;
+    }
+
+    Streaming->Compressor->SetCallback([this](const Archive::ArchiveItem& item) { OnSampleArchived(item); });
+
+    // Only this task uses the compressor until CompleteStreamingCollection returns
+    Streaming->Tasks.run([this]() {
+        HRESULT hr = E_FAIL;
+        ULONGLONG ullQueuedBytes = 0LL;
+
+        while (auto pSample = Concurrency::receive(Streaming->Queue))
+        {
+            if (FAILED(
+                    hr = Streaming->Compressor->AddStream(
+                        pSample->SampleName.c_str(), pSample->FullName.c_str(), pSample->CopyStream, pSample->Dedup)))
+            {
+                log::Error(_L_, hr, L"Failed to add sample %s\r\n", pSample->SampleName.c_str());
+                continue;
+            }
+
+            ullQueuedBytes += pSample->SampleSize;
+            if (ullQueuedBytes >= GETTHIS_STREAMING_FLUSH_BYTES)
+            {
+                if (FAILED(hr = Streaming->Compressor->FlushQueue()))
+                    log::Error(_L_, hr, L"Failed to flush queue to %s\r\n", config.Output.Path.c_str());
+                Streaming->hrFlush = hr;
+                ullQueuedBytes = 0LL;
+            }
+        }
+
+        if (ullQueuedBytes > 0LL)
+        {
+            if (FAILED(hr = Streaming->Compressor->FlushQueue()))
+                log::Error(_L_, hr, L"Failed to flush queue to %s\r\n", config.Output.Path.c_str());
+            Streaming->hrFlush = hr;
+        }
+    });
+
+    log::Info(_L_, L"\r\nMatching samples are archived while locations are parsed\r\n");
+    return S_OK;
+}
+
+HRESULT Main::CompleteStreamingCollection()
+{
+    if (!Streaming)
+        return S_OK;
+
+    Concurrency::send(Streaming->Queue, std::shared_ptr<const StreamingCollection::Sample>());
+    Streaming->Tasks.wait();
+
+    return Streaming->hrFlush;
+}
+
 HRESULT Main::CollectMatchingSamples(const OutputSpec& output, std::set<SampleRef>& MatchingSamples)
 {
     HRESULT hr = E_FAIL;
@@ -833,14 +1277,26 @@ HRESULT Main::CollectMatchingSamples(const OutputSpec& output, std::set<SampleRe
     {
         case OutputSpec::Archive:
         {
-            auto compressor = ArchiveCreate::MakeCreate(config.Output.ArchiveFormat, _L_, true);
+            std::shared_ptr<ArchiveCreate> compressor;
+            std::shared_ptr<TableOutput::IWriter> CSV;
 
-            if(!config.Output.Compression.empty())
-                compressor->SetCompressionLevel(config.Output.Compression);
+            if (Streaming)
+            {
+                // samples archived during the walk are now flushed, the others are collected below
+                if (FAILED(hr = CompleteStreamingCollection()))
+                    return hr;
 
-            auto [hr, CSV] = CreateArchiveLogFileAndCSV(config.Output.Path, compressor);
-            if (FAILED(hr))
-                return hr;
+                compressor = Streaming->Compressor;
+                CSV = Streaming->CSV;
+            }
+            else
+            {
+                compressor = CreateSampleArchive();
+
+                std::tie(hr, CSV) = CreateArchiveLogFileAndCSV(config.Output.Path, compressor);
+                if (FAILED(hr))
+                    return hr;
+            }
 
             if (config.bReportAll)
                 if (FAILED(hr = HashOffLimitSamples(CSV->GetTableOutput(), MatchingSamples)))
@@ -921,9 +1377,18 @@ HRESULT Main::HashOffLimitSamples(ITableOutput& output, std::set<SampleRef>& Mat
 
     auto devnull = std::make_shared<DevNullStream>(_L_);
 
+    if (config.Priority != SamplePriority::None)
+    {
+        // off limit samples were planned before any read: they are only reported with their MFT metadata
+        return S_OK;
+    }
+
     log::Info(_L_, L"\r\nComputing hash of off limit samples\r\n");
 
-    for (std::set<SampleRef>::iterator it = begin(MatchingSamples); it != end(MatchingSamples); ++it)
+    const auto start = std::chrono::steady_clock::now();
+    ULONGLONG ullHashedBytes = 0LL;
+
+    for (auto it : GetCollectionOrder(MatchingSamples))
     {
         if (it->OffLimits)
         {
@@ -935,11 +1400,85 @@ HRESULT Main::HashOffLimitSamples(ITableOutput& output, std::set<SampleRef>& Mat
             }
 
             it->CopyStream->Close();
+            ullHashedBytes += ullBytesWritten;
 
             it->HashStream->GetMD5(const_cast<CBinaryBuffer&>(it->MD5));
             it->HashStream->GetSHA1(const_cast<CBinaryBuffer&>(it->SHA1));
         }
     }
+
+    ReportPhase(L"Off limit samples hashing", start, ullHashedBytes);
+    return S_OK;
+}
+
+std::shared_ptr<ArchiveCreate> Main::CreateSampleArchive()
+{
+    auto compressor = ArchiveCreate::MakeCreate(config.Output.ArchiveFormat, _L_, true);
+
+    if (!config.Output.Compression.empty())
+        compressor->SetCompressionLevel(config.Output.Compression);
+
+    // Duplicates are found from the hash computed while the samples are compressed, only among deduplicated samples
+    if (std::any_of(begin(config.listofSpecs), end(config.listofSpecs), [](const SampleSpec& spec) {
+            return (bool)spec.bDedup;
+        }))
+        compressor->SetDeduplication(true);
+
+    return compressor;
+}
+
+void Main::OnSampleArchived(const Archive::ArchiveItem& item)
+{
+    log::Info(_L_, L"\t%s\r\n", item.Path.c_str());
+
+    const std::wstring_view reference(ArchiveCreate::DeduplicationReference);
+    if (item.NameInArchive.size() > reference.size()
+        && std::equal(rbegin(reference), rend(reference), rbegin(item.NameInArchive)))
+        ReferencedSamples.insert(item.NameInArchive.substr(0, item.NameInArchive.size() - reference.size()));
+}
+
+HRESULT Main::ResolveArchivedDuplicates(std::set<SampleRef>& MatchingSamples)
+{
+    if (ReferencedSamples.empty())
+        return S_OK;
+
+    // Each content is held by the one deduplicated sample that was not replaced by a reference
+    std::map<std::string, const SampleRef*> collected;
+    for (const auto& sample_ref : MatchingSamples)
+    {
+        if (!sample_ref.Dedup || sample_ref.OffLimits || sample_ref.SHA256.empty()
+            || ReferencedSamples.count(sample_ref.SampleName))
+            continue;
+
+        collected.emplace(
+            std::string((const CHAR*)sample_ref.SHA256.GetData(), sample_ref.SHA256.GetCount()), &sample_ref);
+    }
+
+    DWORD dwDuplicates = 0L;
+    ULONGLONG ullSavedBytes = 0LL;
+
+    for (const auto& sample_ref : MatchingSamples)
+    {
+        if (!ReferencedSamples.count(sample_ref.SampleName) || sample_ref.SHA256.empty())
+            continue;
+
+        std::string strSHA256((const CHAR*)sample_ref.SHA256.GetData(), sample_ref.SHA256.GetCount());
+        if (auto it = collected.find(strSHA256); it != std::end(collected))
+        {
+            const_cast<SampleRef&>(sample_ref).DuplicateOf = it->second->SampleName;
+            dwDuplicates++;
+            ullSavedBytes += sample_ref.SampleSize;
+        }
+    }
+
+    if (dwDuplicates > 0)
+    {
+        log::Info(
+            _L_,
+            L"\r\nDeduplication: %d duplicate samples replaced by references (%I64d bytes saved)\r\n",
+            dwDuplicates,
+            ullSavedBytes);
+    }
     return S_OK;
 }
 
@@ -960,11 +1499,7 @@ HRESULT Main::FindMatchingSamples()
                         return;
 
                     // finding the corresponding Sample Spec (for limits)
-                    auto aSpecIt = std::find_if(
-                        begin(config.listofSpecs), end(config.listofSpecs), [aMatch](const SampleSpec& aSpec) -> bool {
-                            auto filespecIt = std::find(begin(aSpec.Terms), end(aSpec.Terms), aMatch->Term);
-                            return filespecIt != end(aSpec.Terms);
-                        });
+                    auto aSpecIt = FindSampleSpec(aMatch);
 
                     if (aSpecIt == end(config.listofSpecs))
                     {
@@ -976,8 +1511,6 @@ HRESULT Main::FindMatchingSamples()
                         return;
                     }
 
-                    const wstring& strFullFileName = aMatch->MatchingNames.front().FullPathName;
-
                     for (const auto& attr : aMatch->MatchingAttributes)
                     {
                         wstring strName;
@@ -985,83 +1518,26 @@ HRESULT Main::FindMatchingSamples()
                         aMatch->GetMatchFullName(aMatch->MatchingNames.front(), attr, strName);
 
                         DWORDLONG dwlDataSize = attr.DataStream->GetSize();
-                        LimitStatus status = SampleLimitStatus(GlobalLimits, aSpecIt->PerSampleLimits, dwlDataSize);
+
+                        // with a priority, limits are only applied once all the candidates are known
+                        LimitStatus status = config.Priority != SamplePriority::None
+                            ? NoLimits
+                            : SampleLimitStatus(GlobalLimits, aSpecIt->PerSampleLimits, dwlDataSize);
 
                         if (FAILED(hr = AddSamplesForMatch(status, *aSpecIt, aMatch)))
                         {
                             log::Error(_L_, hr, L"\tFailed to add %s\r\n", strName.c_str());
                         }
 
-                        switch (status)
+                        if (hr == S_FALSE)
+                        {
+                            if (status == NoLimits || status == SampleWithinLimits)
+                                log::Info(_L_, L"\t%s is already collected\r\n", strName.c_str());
+                        }
+                        else if (config.Priority == SamplePriority::None)
                         {
-                            case NoLimits:
-                            case SampleWithinLimits:
-                            {
-                                if (hr == S_FALSE)
-                                {
-                                    log::Info(_L_, L"\t%s is already collected\r\n", strName.c_str());
-                                }
-                                else
-                                {
-                                    log::Info(_L_, L"\t%s matched (%d bytes)\r\n", strName.c_str(), dwlDataSize);
-                                    aSpecIt->PerSampleLimits.dwlAccumulatedBytesTotal += dwlDataSize;
-                                    aSpecIt->PerSampleLimits.dwAccumulatedSampleCount++;
-
-                                    GlobalLimits.dwlAccumulatedBytesTotal += dwlDataSize;
-                                    GlobalLimits.dwAccumulatedSampleCount++;
-                                }
-                            }
-                            break;
-                            case GlobalSampleCountLimitReached:
-                                log::Info(
-                                    _L_,
-                                    L"\t%s : Global sample count reached (%d)\r\n",
-                                    strName.c_str(),
-                                    GlobalLimits.dwMaxSampleCount);
-                                GlobalLimits.bMaxSampleCountReached = true;
-                                break;
-                            case GlobalMaxBytesPerSample:
-                                log::Info(
-                                    _L_,
-                                    L"\t%s : Exceeds global per sample size limit (%I64d)\r\n",
-                                    strName.c_str(),
-                                    GlobalLimits.dwlMaxBytesPerSample);
-                                GlobalLimits.bMaxBytesPerSampleReached = true;
-                                break;
-                            case GlobalMaxBytesTotal:
-                                log::Info(
-                                    _L_,
-                                    L"\t%s : Global total sample size limit reached (%I64d)\r\n",
-                                    strName.c_str(),
-                                    GlobalLimits.dwlMaxBytesTotal);
-                                GlobalLimits.bMaxBytesTotalReached = true;
-                                break;
-                            case LocalSampleCountLimitReached:
-                                log::Info(
-                                    _L_,
-                                    L"\t%s : sample count reached (%d)\r\n",
-                                    strName.c_str(),
-                                    aSpecIt->PerSampleLimits.dwMaxSampleCount);
-                                aSpecIt->PerSampleLimits.bMaxSampleCountReached = true;
-                                break;
-                            case LocalMaxBytesPerSample:
-                                log::Info(
-                                    _L_,
-                                    L"\t%s : Exceeds per sample size limit (%I64d)\r\n",
-                                    strName.c_str(),
-                                    aSpecIt->PerSampleLimits.dwlMaxBytesPerSample);
-                                aSpecIt->PerSampleLimits.bMaxBytesPerSampleReached = true;
-                                break;
-                            case LocalMaxBytesTotal:
-                                log::Info(
-                                    _L_,
-                                    L"\t%s : total sample size limit reached (%I64d)\r\n",
-                                    strName.c_str(),
-                                    aSpecIt->PerSampleLimits.dwlMaxBytesTotal);
-                                aSpecIt->PerSampleLimits.bMaxBytesTotalReached = true;
-                                break;
-                            case FailedToComputeLimits:
-                                break;
+                            // with a priority, the match is logged when the collection is planned
+                            UpdateLimits(status, *aSpecIt, strName, dwlDataSize);
                         }
                     }
                     return;
@@ -1071,6 +1547,15 @@ HRESULT Main::FindMatchingSamples()
         log::Error(_L_, hr, L"Failed while parsing locations\r\n");
     }
 
+    if (config.Priority != SamplePriority::None)
+    {
+        if (FAILED(hr = PlanSampleCollection()))
+        {
+            log::Error(_L_, hr, L"Failed to plan sample collection\r\n");
+            return hr;
+        }
+    }
+
     return S_OK;
 }
 
@@ -1101,12 +1586,26 @@ HRESULT Main::Run()
 
         try
         {
+            if (config.bStreaming && config.Output.Type == OutputSpec::Kind::Archive)
+            {
+                if (FAILED(hr = StartStreamingCollection()))
+                {
+                    log::Error(_L_, hr, L"\r\nGetThis failed to start streaming collection\r\n");
+                    return hr;
+                }
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+
             if (FAILED(hr = FindMatchingSamples()))
             {
                 log::Error(_L_, hr, L"\r\nGetThis failed while matching samples\r\n");
+                CompleteStreamingCollection();
                 return hr;
             }
 
+            ReportPhase(L"Locations parsing", start, GlobalLimits.dwlAccumulatedBytesTotal, false);
+
             if (FAILED(hr = CollectMatchingSamples(config.Output, Samples)))
             {
                 log::Error(_L_, hr, L"\r\nGetThis failed while collecting samples\r\n");
@@ -1116,6 +1615,19 @@ HRESULT Main::Run()
         catch (...)
         {
             log::Error(_L_, E_ABORT, L"\r\nGetThis failed during sample collection, terminating cabinet\r\n");
+            if (Streaming)
+            {
+                Concurrency::send(Streaming->Queue, std::shared_ptr<const StreamingCollection::Sample>());
+                Streaming->Tasks.cancel();
+                try
+                {
+                    // the archiving task must be done with the compressor and the samples before they are released
+                    Streaming->Tasks.wait();
+                }
+                catch (...)
+                {
+                }
+            }
             wstring strLogFileName(_L_->FileName());
             _L_->CloseLogFile();
 
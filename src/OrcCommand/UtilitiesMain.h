@@ -24,6 +24,8 @@
 #include "ArchiveAgent.h"
 #include "CryptoHashStream.h"
 #include "FuzzyHashStream.h"
+#include "BufferPool.h"
+#include "HashCache.h"
 #include "LogFileWriter.h"
 
 #include "LocationSet.h"
@@ -775,6 +777,9 @@ public:
 
         Cmd.PrintParameters();
 
+        if (BufferPool::LargePagesRequested())
+            BufferPool::Instance().EnableLargePages(_L_);
+
         try
         {
             if (FAILED(hr = Cmd.Run()))
@@ -795,6 +800,10 @@ public:
             return E_ABORT;
         }
 
+        HashCache::FlushProcessCache(_L_);
+        BufferPool::Instance().LogStatistics(_L_);
+        BufferPool::Instance().Trim();
+
         Cmd.PrintFooter();
 
         DWORD dwErrorCount = _L_->GetErrorCount();
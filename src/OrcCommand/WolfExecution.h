@@ -87,14 +87,22 @@ private:
 
     std::wstring m_strKeyword;
     std::wstring m_strCompressionLevel;
+    bool m_bDeduplicate = false;
     DWORD m_dwConcurrency;
 
     std::chrono::milliseconds m_CmdTimeOut;
     std::chrono::milliseconds m_ArchiveTimeOut;
 
     bool m_bUseJournalWhenEncrypting = true;
+    bool m_bUseChunkedEnvelope = false;
     bool m_bTeeClearTextOutput = false;
 
+    // When set, the archive is written as volumes and a resumed run skips the commands recorded in its manifest
+    ULONGLONG m_ullCheckpointSize = 0LL;
+    std::chrono::seconds m_CheckpointInterval = std::chrono::seconds(0);
+    std::shared_ptr<ArchiveCheckpoint> m_Checkpoint;
+    std::unique_ptr<Concurrency::timer<ArchiveMessage::Message>> m_CheckpointTimer;
+
     bool m_bOptional = false;
 
     boost::tribool m_bChildDebug = boost::indeterminate;
@@ -124,6 +132,13 @@ private:
     std::shared_ptr<TableOutput::IWriter> m_JobStatisticsWriter;
     OutputSpec m_JobStatisticsOutput;
 
+    std::shared_ptr<TableOutput::IWriter> m_ArchiveStatisticsWriter;
+    OutputSpec m_ArchiveStatisticsOutput;
+
+    // The archive statistics are written once the archive is flushed, with the compression decisions of its entries
+    CompressionPolicy::Statistics m_ArchiveStatistics;
+    Concurrency::event m_ArchiveFlushed;
+
     std::vector<CommandMessage::Message> m_Commands;
 
     std::map<std::wstring, std::shared_ptr<WolfTask>> m_TasksByKeyword;
@@ -147,9 +162,21 @@ private:
 
     HRESULT AddProcessStatistics(ITableOutput& output, const CommandNotification::Notification& notification);
     HRESULT AddJobStatistics(ITableOutput& output, const CommandNotification::Notification& notification);
+    HRESULT AddArchiveStatistics(ITableOutput& output);
 
     HRESULT NotifyTask(const CommandNotification::Notification& item);
 
+    std::wstring GetOutputPath(const std::wstring& strArchivePath) const
+    {
+        return m_Recipients.empty() ? strArchivePath : strArchivePath + L".p7b";
+    }
+
+    HRESULT CreateOutputStream(
+        const std::wstring& strOutputFullPath,
+        const std::wstring& strArchiveFullPath,
+        ArchiveFormat fmt,
+        std::shared_ptr<ByteStream>& pStream);
+
     static std::wregex g_WinVerRegEx;
 
     std::shared_ptr<ByteStream> m_configStream;
@@ -171,7 +198,8 @@ public:
         const OutputSpec& output,
         const OutputSpec& temporary,
         const OutputSpec& jobstats,
-        const OutputSpec& processstats)
+        const OutputSpec& processstats,
+        const OutputSpec& archivestats)
     {
         if (output.Type != OutputSpec::Kind::Directory)
             return E_INVALIDARG;
@@ -190,6 +218,11 @@ public:
         {
             m_ProcessStatisticsOutput.Path = m_Temporary.Path + L"\\" + m_ProcessStatisticsOutput.Path;
         }
+        m_ArchiveStatisticsOutput = archivestats;
+        if (m_ArchiveStatisticsOutput.Type & OutputSpec::Kind::TableFile)
+        {
+            m_ArchiveStatisticsOutput.Path = m_Temporary.Path + L"\\" + m_ArchiveStatisticsOutput.Path;
+        }
         return S_OK;
     };
 
@@ -221,6 +254,16 @@ public:
         m_bUseJournalWhenEncrypting = bUseJournalWhenEncrypting;
     };
 
+    bool UseChunkedEnvelope() const { return m_bUseChunkedEnvelope; };
+    void SetUseChunkedEnvelope(bool bUseChunkedEnvelope) { m_bUseChunkedEnvelope = bUseChunkedEnvelope; };
+
+    bool IsCheckpointed() const { return m_ullCheckpointSize > 0LL || m_CheckpointInterval.count() > 0; };
+    void SetCheckpoint(ULONGLONG ullVolumeSize, std::chrono::seconds volumeInterval)
+    {
+        m_ullCheckpointSize = ullVolumeSize;
+        m_CheckpointInterval = volumeInterval;
+    };
+
     bool TeeClearTextOutput() const { return m_bTeeClearTextOutput; };
     void SetTeeClearTextOutput(bool bTeeClearTextOutput) { m_bTeeClearTextOutput = bTeeClearTextOutput; };
 
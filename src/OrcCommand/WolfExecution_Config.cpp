@@ -769,7 +769,7 @@ HRESULT WolfExecution::SetJobTimeOutFromConfig(
 
 HRESULT WolfExecution::SetJobConfigFromConfig(const ConfigItem& item)
 {
-    // <Archive name="Robustness.cab" keyword="Robustness" compression="fast" >
+    // <Archive name="Robustness.cab" keyword="Robustness" compression="fast" dedup="yes" >
 
     HRESULT hr = E_FAIL;
 
@@ -790,6 +790,11 @@ HRESULT WolfExecution::SetJobConfigFromConfig(const ConfigItem& item)
     if (item[WOLFLAUNCHER_ARCHIVE_COMPRESSION])
         m_strCompressionLevel = (const std::wstring&)item[WOLFLAUNCHER_ARCHIVE_COMPRESSION];
 
+    // Duplicates in zip and zstd archives are stored as ".ref" entries that readers of the archive must resolve
+    // themselves (see Deduplication.csv)
+    if (item[WOLFLAUNCHER_ARCHIVE_DEDUP])
+        m_bDeduplicate = !_wcsicmp(item[WOLFLAUNCHER_ARCHIVE_DEDUP].strData.c_str(), L"yes");
+
     if (!item[WOLFLAUNCHER_ARCHIVE_CONCURRENCY])
     {
         m_dwConcurrency = 5;
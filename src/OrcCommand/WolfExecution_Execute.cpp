@@ -9,6 +9,7 @@
 #include "stdafx.h"
 
 #include <string>
+#include <filesystem>
 
 #include <agents.h>
 
@@ -142,6 +143,112 @@ HRESULT WolfExecution::BuildFullArchiveName()
     return S_OK;
 }
 
+HRESULT WolfExecution::CreateOutputStream(
+    const std::wstring& strOutputFullPath,
+    const std::wstring& strArchiveFullPath,
+    ArchiveFormat fmt,
+    std::shared_ptr<ByteStream>& pStream)
+{
+    HRESULT hr = E_FAIL;
+
+    if (strOutputFullPath.empty())
+    {
+        log::Error(_L_, E_FAIL, L"Invalid empty output file name\r\n");
+        return E_FAIL;
+    }
+
+    auto pOutputStream = std::make_shared<FileStream>(_L_);
+
+    if (FAILED(hr = pOutputStream->WriteTo(strOutputFullPath.c_str())))
+    {
+        log::Error(_L_, hr, L"Failed open file %s to write\r\n", strOutputFullPath.c_str());
+        return hr;
+    }
+
+    if (m_Recipients.empty())
+    {
+        pStream = pOutputStream;
+        return S_OK;
+    }
+
+    auto pEncodingStream = std::make_shared<EncodeMessageStream>(_L_);
+
+    for (auto& recipient : m_Recipients)
+    {
+        if (FAILED(hr = pEncodingStream->AddRecipient(recipient->Certificate)))
+        {
+            log::Error(_L_, hr, L"Failed to add certificate for recipient %s\r\n", recipient->Name.c_str());
+            return hr;
+        }
+    }
+    const auto envelopeFormat = UseChunkedEnvelope() ? MessageStream::Format::Chunked : MessageStream::Format::CMS;
+    if (FAILED(hr = pEncodingStream->Initialize(pOutputStream, envelopeFormat)))
+    {
+        log::Error(_L_, hr, L"Failed initialize encoding stream for %s\r\n", strOutputFullPath.c_str());
+        return hr;
+    }
+
+    std::shared_ptr<ByteStream> pFinalStream;
+
+    if (fmt == ArchiveFormat::Zstd || fmt == ArchiveFormat::Zip)
+    {
+        // zstd archives and zips without a password (wolf archives have none) are written front to back: they are
+        // encrypted as they are produced. A zip only rewinds to drop a failed entry, which fails the archive instead.
+        pFinalStream = pEncodingStream;
+    }
+    else if (UseJournalWhenEncrypting())
+    {
+        auto pJournalingStream = std::make_shared<JournalingStream>(_L_);
+
+        if (FAILED(hr = pJournalingStream->Open(pEncodingStream)))
+        {
+            log::Error(_L_, hr, L"Failed open journaling stream to write\r\n");
+            return hr;
+        }
+        pFinalStream = pJournalingStream;
+    }
+    else
+    {
+        auto pAccumulatingStream = std::make_shared<AccumulatingStream>(_L_);
+
+        if (FAILED(hr = pAccumulatingStream->Open(pEncodingStream, m_Temporary.Path, 100 * 1024 * 1024)))
+        {
+            log::Error(_L_, hr, L"Failed open accumulating stream to write\r\n");
+            return hr;
+        }
+        pFinalStream = pAccumulatingStream;
+    }
+
+    if (TeeClearTextOutput())
+    {
+        auto pClearStream = std::make_shared<FileStream>(_L_);
+
+        if (FAILED(hr = pClearStream->WriteTo(strArchiveFullPath.c_str())))
+        {
+            log::Error(_L_, hr, L"Failed initialize file stream for %s\r\n", strArchiveFullPath.c_str());
+            return hr;
+        }
+
+        auto pTeeTream = std::make_shared<TeeStream>(_L_);
+
+        if (FAILED(hr = pTeeTream->Open({pClearStream, pFinalStream})))
+        {
+            log::Error(
+                _L_,
+                hr,
+                L"Failed initialize tee stream for %s & %s\r\n",
+                strOutputFullPath.c_str(),
+                strArchiveFullPath.c_str());
+            return hr;
+        }
+
+        pFinalStream = pTeeTream;
+    }
+
+    pStream = pFinalStream;
+    return S_OK;
+}
+
 HRESULT WolfExecution::CreateArchiveAgent()
 {
     HRESULT hr = E_FAIL;
@@ -156,9 +263,14 @@ HRESULT WolfExecution::CreateArchiveAgent()
                     log::Info(_L_, L"%*s: %s started\r\n", m_dwLongerTaskKeyword + 20, L"ARC", item->Keyword().c_str());
                     break;
                 case ArchiveNotification::FileAddition:
+                    m_ArchiveStatistics.Add(item->GetDecision(), item->GetSize(), item->GetCompressedSize());
                     log::Info(
                         _L_, L"%*s: File %s added\r\n", m_dwLongerTaskKeyword + 20, L"ARC", item->Keyword().c_str());
                     break;
+                case ArchiveNotification::FlushQueue:
+                    if (item->Keyword() == L"ArchiveStatistics")
+                        m_ArchiveFlushed.set();
+                    break;
                 case ArchiveNotification::DirectoryAddition:
                     log::Info(
                         _L_,
@@ -185,6 +297,8 @@ HRESULT WolfExecution::CreateArchiveAgent()
                 L"ArchiveOperation: Operation for %s failed \"%s\"\r\n",
                 item->Keyword().c_str(),
                 item->Description().c_str());
+            if (item->GetType() == ArchiveNotification::FlushQueue && item->Keyword() == L"ArchiveStatistics")
+                m_ArchiveFlushed.set();
         }
         return;
     });
@@ -197,111 +311,64 @@ HRESULT WolfExecution::CreateArchiveAgent()
         return E_FAIL;
     }
 
-    if (!m_Recipients.empty())
-    {
-        if (m_strOutputFullPath.empty())
-        {
-            log::Error(_L_, E_FAIL, L"Invalid empty output file name\r\n");
-            return E_FAIL;
-        }
+    ArchiveFormat fmt = Archive::GetArchiveFormat(m_strArchiveFileName);
 
-        auto pOutputStream = std::make_shared<FileStream>(_L_);
+    if (IsCheckpointed())
+    {
+        m_Checkpoint = std::make_shared<ArchiveCheckpoint>(
+            _L_,
+            m_strArchiveFileName,
+            m_strArchiveFullPath + ArchiveCheckpoint::ManifestExtension,
+            m_ullCheckpointSize,
+            m_CheckpointInterval);
 
-        if (FAILED(hr = pOutputStream->WriteTo(m_strOutputFullPath.c_str())))
-        {
-            log::Error(_L_, hr, L"Failed open file %s to write\r\n", m_strOutputFullPath.c_str());
+        if (FAILED(hr = m_Checkpoint->Load()))
             return hr;
-        }
-
-        auto pEncodingStream = std::make_shared<EncodeMessageStream>(_L_);
 
-        for (auto& recipient : m_Recipients)
-        {
-            if (FAILED(hr = pEncodingStream->AddRecipient(recipient->Certificate)))
-            {
-                log::Error(_L_, hr, L"Failed to add certificate for recipient %s\r\n", recipient->Name.c_str());
-                return hr;
-            }
-        }
-        if (FAILED(hr = pEncodingStream->Initialize(pOutputStream)))
-        {
-            log::Error(_L_, hr, L"Failed initialize encoding stream for %s\r\n", m_strOutputFullPath.c_str());
+        if (m_Checkpoint->IsComplete() && FAILED(hr = m_Checkpoint->Reset()))
             return hr;
-        }
-
-        std::shared_ptr<ByteStream> pFinalStream;
-
-        if (UseJournalWhenEncrypting())
-        {
-            auto pJournalingStream = std::make_shared<JournalingStream>(_L_);
-
-            if (FAILED(hr = pJournalingStream->Open(pEncodingStream)))
-            {
-                log::Error(_L_, hr, L"Failed open journaling stream to write\r\n");
-                return hr;
-            }
-            pFinalStream = pJournalingStream;
-        }
-        else
-        {
-            auto pAccumulatingStream = std::make_shared<AccumulatingStream>(_L_);
-
-            if (FAILED(hr = pAccumulatingStream->Open(pEncodingStream, m_Temporary.Path, 100 * 1024 * 1024)))
-            {
-                log::Error(_L_, hr, L"Failed open accumulating stream to write\r\n");
-                return hr;
-            }
-            pFinalStream = pAccumulatingStream;
-        }
 
-        if (TeeClearTextOutput())
+        if (m_Checkpoint->IsResumed())
         {
-            auto pClearStream = std::make_shared<FileStream>(_L_);
-
-            if (FAILED(hr = pClearStream->WriteTo(m_strArchiveFullPath.c_str())))
-            {
-                log::Error(_L_, hr, L"Failed initialize file stream for %s\r\n", m_strArchiveFullPath.c_str());
-                return hr;
-            }
-
-            auto pTeeTream = std::make_shared<TeeStream>(_L_);
-
-            if (FAILED(hr = pTeeTream->Open({pClearStream, pFinalStream})))
-            {
-                log::Error(
-                    _L_,
-                    hr,
-                    L"Failed initialize tee stream for %s & %s\r\n",
-                    m_strOutputFileName.c_str(),
-                    m_strArchiveFullPath.c_str());
-                return hr;
-            }
-
-            pFinalStream = pTeeTream;
+            log::Info(
+                _L_,
+                L"%*s: Resuming %s at volume %d\r\n",
+                m_dwLongerTaskKeyword + 20,
+                L"ARC",
+                m_strArchiveFileName.c_str(),
+                m_Checkpoint->GetNextVolume());
         }
 
-        ArchiveFormat fmt = Archive::GetArchiveFormat(m_strArchiveFileName);
+        auto makeVolumeStream = [this, fmt](const std::wstring& strVolumeName, std::shared_ptr<ByteStream>& stream) {
+            const auto strVolumeFullPath =
+                std::filesystem::path(m_strArchiveFullPath).replace_filename(strVolumeName).wstring();
+            return CreateOutputStream(GetOutputPath(strVolumeFullPath), strVolumeFullPath, fmt, stream);
+        };
 
         Concurrency::send(
             m_ArchiveMessageBuffer,
-            ArchiveMessage::MakeOpenRequest(m_strArchiveFileName, fmt, pFinalStream, m_strCompressionLevel));
-    }
-    else
-    {
-        auto pOutputStream = std::make_shared<FileStream>(_L_);
+            ArchiveMessage::MakeOpenRequest(m_Checkpoint, fmt, makeVolumeStream, m_strCompressionLevel, m_bDeduplicate));
 
-        if (FAILED(hr = pOutputStream->WriteTo(m_strOutputFullPath.c_str())))
+        if (m_CheckpointInterval > 0s)
         {
-            log::Error(_L_, hr, L"Failed open file %s to write\r\n", m_strOutputFullPath.c_str());
-            return hr;
+            // Lets the archive agent close a volume when no output comes in
+            m_CheckpointTimer = std::make_unique<timer<ArchiveMessage::Message>>(
+                (unsigned int)duration_cast<milliseconds>(m_CheckpointInterval).count(),
+                ArchiveMessage::MakeFlushQueueRequest(),
+                &m_ArchiveMessageBuffer,
+                true);
+            m_CheckpointTimer->start();
         }
+        return S_OK;
+    }
 
-        ArchiveFormat fmt = Archive::GetArchiveFormat(m_strArchiveFileName);
+    std::shared_ptr<ByteStream> pFinalStream;
+    if (FAILED(hr = CreateOutputStream(m_strOutputFullPath, m_strArchiveFullPath, fmt, pFinalStream)))
+        return hr;
 
-        Concurrency::send(
-            m_ArchiveMessageBuffer,
-            ArchiveMessage::MakeOpenRequest(m_strArchiveFileName, fmt, pOutputStream, m_strCompressionLevel));
-    }
+    Concurrency::send(
+        m_ArchiveMessageBuffer,
+        ArchiveMessage::MakeOpenRequest(m_strArchiveFileName, fmt, pFinalStream, m_strCompressionLevel, m_bDeduplicate));
     return S_OK;
 }
 
@@ -434,6 +501,27 @@ HRESULT WolfExecution::AddJobStatistics(ITableOutput& output, const CommandNotif
     return S_OK;
 }
 
+HRESULT WolfExecution::AddArchiveStatistics(ITableOutput& output)
+{
+    SystemDetails::WriteComputerName(output);
+    output.WriteString(m_strKeyword.c_str());
+
+    // Stored entries are not compressed, their compressed size is their size
+    using Decision = CompressionPolicy::Decision;
+    const auto& archive = m_ArchiveStatistics;
+    output.WriteInteger(archive.Entries[static_cast<size_t>(Decision::Store)]);
+    output.WriteInteger(archive.UncompressedSize[static_cast<size_t>(Decision::Store)]);
+    for (const auto decision : {Decision::Fast, Decision::Strong})
+    {
+        output.WriteInteger(archive.Entries[static_cast<size_t>(decision)]);
+        output.WriteInteger(archive.UncompressedSize[static_cast<size_t>(decision)]);
+        output.WriteInteger(archive.CompressedSize[static_cast<size_t>(decision)]);
+    }
+
+    output.WriteEndOfLine();
+    return S_OK;
+}
+
 HRESULT WolfExecution::NotifyTask(const CommandNotification::Notification& item)
 {
     HRESULT hr = E_FAIL;
@@ -500,6 +588,15 @@ HRESULT WolfExecution::CreateCommandAgent(
         }
     }
 
+    if (m_ArchiveStatisticsOutput.Type & OutputSpec::Kind::TableFile)
+    {
+        m_ArchiveStatisticsWriter = TableOutput::GetWriter(_L_, m_ArchiveStatisticsOutput);
+        if (m_ArchiveStatisticsWriter == nullptr)
+        {
+            log::Error(_L_, E_FAIL, L"Failed to initalize ArchiveStatistics writer\r\n");
+        }
+    }
+
     m_cmdNotification = std::make_unique<call<CommandNotification::Notification>>(
         [this](const CommandNotification::Notification& item) {
             HRESULT hr = E_FAIL;
@@ -640,6 +737,17 @@ HRESULT WolfExecution::EnqueueCommands()
         {
             m_TasksByKeyword[command->Keyword()] = make_shared<WolfTask>(_L_, command->Keyword());
         }
+
+        if (m_Checkpoint != nullptr && m_Checkpoint->IsUnitComplete(command->Keyword()))
+        {
+            log::Info(
+                _L_,
+                L"%*s: Skipped, completed by a previous run\r\n",
+                m_dwLongerTaskKeyword + 20,
+                command->Keyword().c_str());
+            continue;
+        }
+
         if (!command->IsOptional())
             Concurrency::send(m_cmdAgentBuffer, command);
     }
@@ -718,6 +826,26 @@ HRESULT WolfExecution::TerminateAllAndComplete()
 HRESULT WolfExecution::CompleteArchive(UploadMessage::ITarget* pUploadMessageQueue)
 {
     HRESULT hr = E_FAIL;
+
+    if (m_CheckpointTimer)
+        m_CheckpointTimer->stop();
+
+    if (m_ArchiveStatisticsWriter != nullptr)
+    {
+        // The archive statistics count the entries archived so far, all of the commands' output
+        if (m_archiveAgent != nullptr)
+        {
+            send(m_ArchiveMessageBuffer, ArchiveMessage::MakeFlushQueueRequest(L"ArchiveStatistics"));
+            if (m_ArchiveFlushed.wait((unsigned int)m_ArchiveTimeOut.count()) == COOPERATIVE_WAIT_TIMEOUT)
+                log::Warning(
+                    _L_,
+                    HRESULT_FROM_WIN32(ERROR_TIMEOUT),
+                    L"Archive flush timeout, archive statistics may not count all the archived entries\r\n");
+        }
+        AddArchiveStatistics(m_ArchiveStatisticsWriter->GetTableOutput());
+        m_ArchiveStatisticsWriter->Close();
+    }
+
     m_ProcessStatisticsWriter->Close();
     m_JobStatisticsWriter->Close();
 
@@ -736,6 +864,14 @@ HRESULT WolfExecution::CompleteArchive(UploadMessage::ITarget* pUploadMessageQue
             ArchiveMessage::MakeAddFileRequest(L"JobStatistics.csv", m_JobStatisticsOutput.Path, false, 0L, true));
     }
 
+    if (VerifyFileExists(m_ArchiveStatisticsOutput.Path.c_str()) == S_OK)
+    {
+        send(
+            m_ArchiveMessageBuffer,
+            ArchiveMessage::MakeAddFileRequest(
+                L"ArchiveStatistics.csv", m_ArchiveStatisticsOutput.Path, false, 0L, true));
+    }
+
     if (m_configStream != nullptr)
     {
         m_configStream->SetFilePointer(0LL, FILE_BEGIN, NULL);
@@ -775,21 +911,40 @@ HRESULT WolfExecution::CompleteArchive(UploadMessage::ITarget* pUploadMessageQue
 
     if (pUploadMessageQueue && m_Output.UploadOutput)
     {
-        if (m_Output.UploadOutput->IsFileUploaded(_L_, m_strOutputFileName))
+        // File name and full path of each output
+        std::vector<std::pair<std::wstring, std::wstring>> outputs;
+
+        if (m_Checkpoint != nullptr)
         {
+            for (const auto& volume : m_Checkpoint->GetVolumes())
+            {
+                const auto strVolumeFullPath =
+                    std::filesystem::path(m_strArchiveFullPath).replace_filename(volume.Name).wstring();
+                outputs.emplace_back(GetOutputPath(volume.Name), GetOutputPath(strVolumeFullPath));
+            }
+
+            const auto& strManifestPath = m_Checkpoint->GetManifestPath();
+            outputs.emplace_back(std::filesystem::path(strManifestPath).filename().wstring(), strManifestPath);
+        }
+        else
+            outputs.emplace_back(m_strOutputFileName, m_strOutputFullPath);
+
+        for (const auto& [strFileName, strFullPath] : outputs)
+        {
+            if (!m_Output.UploadOutput->IsFileUploaded(_L_, strFileName))
+                continue;
+
             switch (m_Output.UploadOutput->Operation)
             {
                 case OutputSpec::UploadOperation::NoOp:
                     break;
                 case OutputSpec::UploadOperation::Copy:
                     Concurrency::send(
-                        pUploadMessageQueue,
-                        UploadMessage::MakeUploadFileRequest(m_strOutputFileName, m_strOutputFullPath, false));
+                        pUploadMessageQueue, UploadMessage::MakeUploadFileRequest(strFileName, strFullPath, false));
                     break;
                 case OutputSpec::UploadOperation::Move:
                     Concurrency::send(
-                        pUploadMessageQueue,
-                        UploadMessage::MakeUploadFileRequest(m_strOutputFileName, m_strOutputFullPath, true));
+                        pUploadMessageQueue, UploadMessage::MakeUploadFileRequest(strFileName, strFullPath, true));
                     break;
             }
         }
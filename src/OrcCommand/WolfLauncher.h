@@ -79,6 +79,8 @@ public:
                 static_cast<OutputSpec::Kind>(OutputSpec::Kind::TableFile | OutputSpec::Kind::SQL);
             ProcessStatistics.supportedTypes =
                 static_cast<OutputSpec::Kind>(OutputSpec::Kind::TableFile | OutputSpec::Kind::SQL);
+            ArchiveStatistics.supportedTypes =
+                static_cast<OutputSpec::Kind>(OutputSpec::Kind::TableFile | OutputSpec::Kind::SQL);
             Log.supportedTypes = OutputSpec::Kind::File;
             TempWorkingDir.supportedTypes = OutputSpec::Kind::Directory;
         };
@@ -88,6 +90,7 @@ public:
         OutputSpec Output;
         OutputSpec JobStatistics;
         OutputSpec ProcessStatistics;
+        OutputSpec ArchiveStatistics;
 
         OutputSpec Log;
         std::wstring strLogFileName;
@@ -98,6 +101,7 @@ public:
         OutputSpec TempWorkingDir;
 
         std::optional<std::wstring> strOfflineLocation;
+        std::optional<std::wstring> strHashCache;
 
         std::chrono::milliseconds msRefreshTimer = 1s;
         std::chrono::milliseconds msArchiveTimeOut = 10min;
@@ -115,6 +119,9 @@ public:
         bool bAddConfigToArchive = true;
         bool bUseJournalWhenEncrypting = true;
         bool bNoJournaling = false;
+        bool bChunkedEnvelope = false;
+        DWORDLONG dwlCheckpointSize = 0LL;
+        std::chrono::seconds CheckpointInterval = 0s;
         bool bTeeClearTextOutput = false;
         bool bWERDontShowUI = false;
 
@@ -203,6 +210,13 @@ private:
         return S_OK;
     }
 
+    HRESULT SetHashCache()
+    {
+        if (!config.strHashCache.has_value())
+            return S_OK;
+        return HashCache::ConfigureProcessCache(_L_, config.strHashCache.value());
+    }
+
     HRESULT Run_Execute();
     HRESULT Run_Keywords();
 };
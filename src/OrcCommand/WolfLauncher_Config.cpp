@@ -46,6 +46,10 @@ HRESULT Main::GetSchemaFromConfig(const ConfigItem& schemaitem)
         _L_,
         config.ProcessStatistics.TableKey.empty() ? L"ProcessStatistics" : config.ProcessStatistics.TableKey.c_str(),
         schemaitem);
+    config.ArchiveStatistics.Schema = TableOutput::GetColumnsFromConfig(
+        _L_,
+        config.ArchiveStatistics.TableKey.empty() ? L"ArchiveStatistics" : config.ArchiveStatistics.TableKey.c_str(),
+        schemaitem);
     return S_OK;
 }
 
@@ -413,6 +417,17 @@ HRESULT Main::GetLocalConfigurationFromConfig(const ConfigItem& configitem)
         config.DefaultAltitude = LocationSet::GetAltitudeFromString(configitem[ORC_ALTITUDE].strData.c_str());
     }
 
+    if (configitem[ORC_HASH_CACHE])
+    {
+        std::wstring strHashCache;
+        if (FAILED(hr = GetOutputFile(configitem[ORC_HASH_CACHE].strData.c_str(), strHashCache, true)))
+        {
+            log::Error(_L_, hr, L"Invalid hash cache path %s\r\n", configitem[ORC_HASH_CACHE].strData.c_str());
+            return hr;
+        }
+        config.strHashCache = strHashCache;
+    }
+
     if (configitem[ORC_KEY])
     {
         for (const auto& item : configitem[ORC_KEY].NodeList)
@@ -459,6 +474,7 @@ HRESULT Main::GetConfigurationFromArgcArgv(int argc, LPCWSTR argv[])
         for (int i = 0; i < argc; i++)
         {
             std::wstring strPriority;
+            std::wstring strHashCache;
 
             switch (argv[i][0])
             {
@@ -524,6 +540,8 @@ HRESULT Main::GetConfigurationFromArgcArgv(int argc, LPCWSTR argv[])
                         ;
                     else if (ParameterOption(argv[i] + 1, L"Offline", config.strOfflineLocation))
                         ;
+                    else if (OutputFileOption(argv[i] + 1, L"HashCache", strHashCache))
+                        config.strHashCache = strHashCache;
                     else if (BooleanOption(argv[i] + 1, L"Beep", config.bBeepWhenDone))
                         ;
                     else if (ParameterOption(argv[i] + 1, L"Priority", strPriority))
@@ -543,6 +561,12 @@ HRESULT Main::GetConfigurationFromArgcArgv(int argc, LPCWSTR argv[])
                     {
                         config.bUseJournalWhenEncrypting = false;
                     }
+                    else if (BooleanOption(argv[i] + 1, L"chunked_envelope", config.bChunkedEnvelope))
+                        ;
+                    else if (FileSizeOption(argv[i] + 1, L"checkpoint_size", config.dwlCheckpointSize))
+                        ;
+                    else if (ParameterOption(argv[i] + 1, L"checkpoint_interval", config.CheckpointInterval))
+                        ;
                     else if (EncodingOption(argv[i] + 1, config.Output.OutputEncoding))
                     {
                         config.TempWorkingDir.OutputEncoding = config.Output.OutputEncoding;
@@ -710,6 +734,17 @@ HRESULT Main::CheckConfiguration()
         }
     }
 
+    if (config.ArchiveStatistics.Type == OutputSpec::Kind::None)
+    {
+        if (FAILED(
+                hr = config.ArchiveStatistics.Configure(
+                    _L_, static_cast<OutputSpec::Kind>(OutputSpec::Kind::TableFile), L"ArchiveStatistics.csv")))
+        {
+            log::Error(_L_, hr, L"Failed to set archive statistics output\r\n");
+            return hr;
+        }
+    }
+
     if (config.bRepeatCreateNew)
         config.RepeatBehavior = WolfExecution::CreateNew;
     if (config.bRepeatOnce)
@@ -722,7 +757,12 @@ HRESULT Main::CheckConfiguration()
 
         HRESULT hr = E_FAIL;
         wolfexec->SetRepeatBehaviour(config.RepeatBehavior);
-        wolfexec->SetOutput(config.Output, config.TempWorkingDir, config.JobStatistics, config.ProcessStatistics);
+        wolfexec->SetOutput(
+            config.Output,
+            config.TempWorkingDir,
+            config.JobStatistics,
+            config.ProcessStatistics,
+            config.ArchiveStatistics);
 
         wolfexec->SetRecipients(m_Recipients);
 
@@ -62,6 +62,8 @@ void Main::PrintUsage()
         L"\t/Offline=<ImagePath>        : Sets the DFIR-Orc to work on a disk image, will set %OfflineLocation% and "
         L"explicitely select archive DFIR-ORC_Offline"
         L"\r\n"
+        L"\t/HashCache=<File>           : Hashes computed by the commands are kept in <File> and reused for the files "
+        L"which did not change (also in later collections)\r\n"
         L"\t/verbose           : Turns on verbose logging\r\n"
         L"\t/debug             : Adds debug information (Source File Name, Line number) to output, outputs to debugger "
         L"(OutputDebugString)\r\n"
@@ -85,6 +87,11 @@ void Main::PrintParameters()
         log::Info(_L_, L"Offline location      : %s\r\n", config.strOfflineLocation.value().c_str());
     }
 
+    if (config.strHashCache.has_value())
+    {
+        log::Info(_L_, L"Hash cache            : %s\r\n", config.strHashCache.value().c_str());
+    }
+
     PrintOutputOption(L"Output", config.Output);
     PrintOutputOption(L"Temp", config.TempWorkingDir);
     log::Info(_L_, L"Log file              : %s\r\n", config.strLogFileName.c_str());
@@ -232,6 +232,11 @@ HRESULT Main::Run_Execute()
         log::Warning(_L_, hr, L"Failed to configure default altitude\r\n");
     }
 
+    if (FAILED(hr = SetHashCache()))
+    {
+        log::Warning(_L_, hr, L"Failed to configure hash cache\r\n");
+    }
+
     if (FAILED(hr = SetLauncherPriority(config.Priority)))
     {
         log::Warning(_L_, hr, L"Failed to configure launcher priority\r\n");
@@ -325,6 +330,8 @@ HRESULT Main::Run_Execute()
         }
 
         exec->SetUseJournalWhenEncrypting(config.bUseJournalWhenEncrypting);
+        exec->SetUseChunkedEnvelope(config.bChunkedEnvelope);
+        exec->SetCheckpoint(config.dwlCheckpointSize, config.CheckpointInterval);
 
         bool bDebug = exec->IsChildDebugActive(config.bChildDebug);
 
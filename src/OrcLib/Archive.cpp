@@ -39,12 +39,16 @@ Orc::ArchiveFormat Archive::GetArchiveFormat(const std::wstring_view& filepath)
         return ArchiveFormat::Zip;
     if (equalCaseInsensitive(ext, L".7z"))
         return ArchiveFormat::SevenZip;
+    if (equalCaseInsensitive(ext, L".zst"))
+        return ArchiveFormat::Zstd;
     if (equalCaseInsensitive(ext, L"cab"))
         return ArchiveFormat::Cabinet;
     if (equalCaseInsensitive(ext, L"zip"))
         return ArchiveFormat::Zip;
     if (equalCaseInsensitive(ext, L"7z"))
         return ArchiveFormat::SevenZip;
+    if (equalCaseInsensitive(ext, L"zst"))
+        return ArchiveFormat::Zstd;
 
     const auto pZipLib = ZipLibrary::CreateZipLibrary(nullptr);
     if (pZipLib == nullptr)
@@ -73,6 +77,8 @@ std::wstring_view Archive::GetArchiveFormatString(Orc::ArchiveFormat format)
             return L"zip"sv;
         case ArchiveFormat::SevenZip:
             return L"7z"sv;
+        case ArchiveFormat::Zstd:
+            return L"zst"sv;
         default:
             return L"Unknown";
     }
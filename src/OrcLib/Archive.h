@@ -12,6 +12,7 @@
 #include "ByteStream.h"
 
 #include "ArchiveFormat.h"
+#include "CompressionPolicy.h"
 
 #include <memory>
 #include <vector>
@@ -54,6 +55,8 @@ public:
         FILETIME modifiedTime = {0L, 0L};
         DWORD attrib = 0L;
         bool isDir = false;
+        CompressionPolicy::Decision Compression = CompressionPolicy::Decision::Default;
+        ULONGLONG CompressedSize = 0LL;  // when the format reports it
 
         ArchiveItem() = default;
 
@@ -65,6 +68,8 @@ public:
             isDir = other.isDir;
             bDeleteWhenAdded = other.bDeleteWhenAdded;
             attrib = other.attrib;
+            Compression = other.Compression;
+            CompressedSize = other.CompressedSize;
             std::swap(NameInArchive, other.NameInArchive);
             std::swap(Path, other.Path);
             std::swap(Stream, other.Stream);
@@ -177,6 +177,104 @@ HRESULT ArchiveAgent::CompleteOnFlush(bool bFinal)
     return S_OK;
 }
 
+HRESULT ArchiveAgent::OpenVolume(DWORD dwVolume, std::shared_ptr<ArchiveCreate>& compressor)
+{
+    HRESULT hr = E_FAIL;
+
+    const auto strVolumeName = m_checkpoint->GetVolumeName(dwVolume);
+
+    std::shared_ptr<ByteStream> stream;
+    if (FAILED(hr = m_makeVolumeStream(strVolumeName, stream)) || stream == nullptr)
+    {
+        log::Error(_L_, hr, L"Failed to open stream for archive volume %s\r\n", strVolumeName.c_str());
+        return FAILED(hr) ? hr : E_POINTER;
+    }
+
+    compressor = ArchiveCreate::MakeCreate(m_volumeFormat, _L_, m_bVolumeComputeHash);
+    if (compressor == nullptr)
+    {
+        log::Error(_L_, E_FAIL, L"Failed to create compressor for archive volume %s\r\n", strVolumeName.c_str());
+        return E_FAIL;
+    }
+
+    if (!m_volumeCompressionLevel.empty())
+        compressor->SetCompressionLevel(m_volumeCompressionLevel);
+    compressor->SetDeduplication(m_bVolumeDeduplicate);
+
+    if (FAILED(hr = compressor->InitArchive(stream)))
+    {
+        log::Error(_L_, hr, L"Failed to initialize archive volume %s\r\n", strVolumeName.c_str());
+        compressor.reset();
+        return hr;
+    }
+
+    compressor->SetCallback([this](const Archive::ArchiveItem& item) {
+        m_ullVolumeData += item.Size;
+
+        auto notification = ArchiveNotification::MakeAddItemSuccessNotification(
+            item.NameInArchive, item.Compression, item.Size, item.CompressedSize);
+        if (notification)
+            SendResult(notification);
+    });
+
+    log::Verbose(_L_, L"Archive volume %s opened\r\n", strVolumeName.c_str());
+    return S_OK;
+}
+
+HRESULT ArchiveAgent::CheckpointVolume(bool bFinal)
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_compressor == nullptr)
+        return E_POINTER;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (!bFinal
+        && !m_checkpoint->IsVolumeFull(
+            m_ullVolumeData, std::chrono::duration_cast<std::chrono::seconds>(now - m_VolumeStart)))
+        return S_FALSE;
+
+    // The next volume is opened first: should it fail, the current volume goes on
+    std::shared_ptr<ArchiveCreate> next;
+    if (!bFinal && FAILED(hr = OpenVolume(m_dwVolume + 1, next)))
+    {
+        m_VolumeStart = now;
+        return hr;
+    }
+
+    const auto strVolumeName = m_checkpoint->GetVolumeName(m_dwVolume);
+
+    if (FAILED(hr = m_compressor->Complete()))
+    {
+        // Not recorded, the units completed in this volume are run again when resuming
+        log::Error(_L_, hr, L"Failed to complete archive volume %s\r\n", strVolumeName.c_str());
+    }
+    else if (FAILED(hr = m_checkpoint->AddVolume(m_dwVolume, m_VolumeUnits, bFinal)))
+    {
+        log::Error(_L_, hr, L"Failed to record archive volume %s in manifest\r\n", strVolumeName.c_str());
+    }
+
+    if (!bFinal)
+    {
+        auto notification = FAILED(hr) ? ArchiveNotification::MakeFailureNotification(
+                                ArchiveNotification::ArchiveComplete, hr, strVolumeName, L"Volume checkpoint failed")
+                                       : ArchiveNotification::MakeSuccessNotification(
+                                           ArchiveNotification::ArchiveComplete, strVolumeName);
+        if (notification)
+            SendResult(notification);
+
+        CompleteOnFlush(false);
+
+        m_compressor = std::move(next);
+        m_dwVolume++;
+    }
+
+    m_VolumeUnits.clear();
+    m_ullVolumeData = 0LL;
+    m_VolumeStart = now;
+    return hr;
+}
+
 void ArchiveAgent::run()
 {
     HRESULT hr = E_FAIL;
@@ -196,6 +294,34 @@ void ArchiveAgent::run()
                     notification = ArchiveNotification::MakeFailureNotification(
                         ArchiveNotification::ArchiveStarted, E_FAIL, request->Name(), L"Already creating archive");
                 }
+                else if (request->GetCheckpoint() != nullptr)
+                {
+                    m_checkpoint = request->GetCheckpoint();
+                    m_makeVolumeStream = request->GetMakeVolumeStream();
+                    m_volumeFormat = request->GetArchiveFormat();
+                    m_volumeCompressionLevel = request->GetCompressionLevel();
+                    m_bVolumeComputeHash = request->GetComputeHash();
+                    m_bVolumeDeduplicate = request->GetDeduplicate();
+
+                    // A resumed archive goes on with the volume after the last recorded one
+                    m_dwVolume = m_checkpoint->GetNextVolume();
+                    m_ullVolumeData = 0LL;
+                    m_VolumeStart = std::chrono::steady_clock::now();
+
+                    if (FAILED(hr = OpenVolume(m_dwVolume, m_compressor)))
+                        notification = ArchiveNotification::MakeFailureNotification(
+                            ArchiveNotification::ArchiveStarted,
+                            hr,
+                            request->Name(),
+                            L"Failed to create archive volume");
+                    else
+                    {
+                        m_cabName = request->Name();
+
+                        notification = ArchiveNotification::MakeArchiveStartedSuccessNotification(
+                            request->Name(), m_checkpoint->GetVolumeName(m_dwVolume), request->GetCompressionLevel());
+                    }
+                }
                 else if (request->GetStream() == nullptr)
                 {
                     ArchiveFormat fmt = Archive::GetArchiveFormat(request->Name());
@@ -222,6 +348,7 @@ void ArchiveAgent::run()
                         {
                             if (!request->GetCompressionLevel().empty())
                                 m_compressor->SetCompressionLevel(request->GetCompressionLevel());
+                            m_compressor->SetDeduplication(request->GetDeduplicate());
 
                             if (FAILED(hr = m_compressor->InitArchive(request->Name().c_str())))
                                 notification = ArchiveNotification::MakeFailureNotification(
@@ -234,8 +361,8 @@ void ArchiveAgent::run()
                                 m_cabName = request->Name();
 
                                 m_compressor->SetCallback([this](const Archive::ArchiveItem& item) {
-                                    auto notification = ArchiveNotification::MakeSuccessNotification(
-                                        ArchiveNotification::FileAddition, item.NameInArchive);
+                                    auto notification = ArchiveNotification::MakeAddItemSuccessNotification(
+                                        item.NameInArchive, item.Compression, item.Size, item.CompressedSize);
                                     if (notification)
                                         SendResult(notification);
                                 });
@@ -261,6 +388,7 @@ void ArchiveAgent::run()
                     {
                         if (!request->GetCompressionLevel().empty())
                             m_compressor->SetCompressionLevel(request->GetCompressionLevel());
+                        m_compressor->SetDeduplication(request->GetDeduplicate());
 
                         if (FAILED(hr = m_compressor->InitArchive(request->GetStream())))
                             notification = ArchiveNotification::MakeFailureNotification(
@@ -273,8 +401,8 @@ void ArchiveAgent::run()
                             m_cabName = request->Name();
 
                             m_compressor->SetCallback([this](const Archive::ArchiveItem& item) {
-                                auto notification = ArchiveNotification::MakeSuccessNotification(
-                                    ArchiveNotification::FileAddition, item.NameInArchive);
+                                auto notification = ArchiveNotification::MakeAddItemSuccessNotification(
+                                    item.NameInArchive, item.Compression, item.Size, item.CompressedSize);
                                 if (notification)
                                     SendResult(notification);
                             });
@@ -412,13 +540,33 @@ void ArchiveAgent::run()
                         ArchiveNotification::FlushQueue, hr, request->Name(), L"FlushQueue completion actions failed");
                     SendResult(notification);
                 }
+
+                // A keyed flush is acknowledged once all the items queued before it were notified
+                if (!request->Keyword().empty())
+                {
+                    notification = ArchiveNotification::MakeSuccessNotification(
+                        ArchiveNotification::FlushQueue, request->Keyword());
+                    SendResult(notification);
+                }
+            }
+            break;
+            case ArchiveMessage::CompleteUnit:
+            {
+                // The unit is recorded as complete with the volume its last output went to
+                if (m_checkpoint != nullptr)
+                    m_VolumeUnits.push_back(request->Keyword());
             }
             break;
             case ArchiveMessage::Complete:
             {
                 ArchiveNotification::Notification notification;
 
-                if (FAILED(hr = m_compressor->Complete()))
+                if (m_checkpoint != nullptr)
+                    hr = CheckpointVolume(true);
+                else
+                    hr = m_compressor->Complete();
+
+                if (FAILED(hr))
                     notification = ArchiveNotification::MakeFailureNotification(
                         ArchiveNotification::ArchiveComplete, hr, m_cabName, L"Complete failed");
                 else
@@ -440,6 +588,9 @@ void ArchiveAgent::run()
 
         ArchiveMessage::Request type = request->GetRequest();
 
+        if (m_checkpoint != nullptr && type != ArchiveMessage::OpenArchive && type != ArchiveMessage::Complete)
+            CheckpointVolume(false);
+
         request = nullptr;
 
         if (type == ArchiveMessage::Complete)
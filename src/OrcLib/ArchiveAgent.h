@@ -12,9 +12,11 @@
 #include "ArchiveMessage.h"
 #include "ArchiveNotification.h"
 #include "ArchiveCreate.h"
+#include "ArchiveCheckpoint.h"
 
 #include "Robustness.h"
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <agents.h>
@@ -119,6 +121,22 @@ private:
 
     std::vector<OnComplete> m_PendingCompletions;
 
+    // When the archive is written as checkpointed volumes
+    std::shared_ptr<ArchiveCheckpoint> m_checkpoint;
+    ArchiveMessage::MakeVolumeStream m_makeVolumeStream;
+    ArchiveFormat m_volumeFormat = ArchiveFormat::Unknown;
+    std::wstring m_volumeCompressionLevel;
+    bool m_bVolumeComputeHash = false;
+    bool m_bVolumeDeduplicate = false;
+
+    DWORD m_dwVolume = 0L;
+    ULONGLONG m_ullVolumeData = 0LL;
+    std::chrono::steady_clock::time_point m_VolumeStart;
+    std::vector<std::wstring> m_VolumeUnits;
+
+    HRESULT OpenVolume(DWORD dwVolume, std::shared_ptr<ArchiveCreate>& compressor);
+    HRESULT CheckpointVolume(bool bFinal);
+
 protected:
     ArchiveNotification::ITarget& m_target;
     ArchiveMessage::ISource& m_source;
@@ -0,0 +1,192 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "ArchiveCheckpoint.h"
+
+#include "FileStream.h"
+#include "LogFileWriter.h"
+#include "ParameterCheck.h"
+#include "WideAnsi.h"
+
+#include <sstream>
+
+using namespace Orc;
+
+ArchiveCheckpoint::ArchiveCheckpoint(
+    logger pLog,
+    const std::wstring& strArchiveName,
+    const std::wstring& strManifestPath,
+    ULONGLONG ullVolumeSize,
+    std::chrono::seconds volumeInterval)
+    : _L_(std::move(pLog))
+    , m_strArchiveName(strArchiveName)
+    , m_strManifestPath(strManifestPath)
+    , m_ullVolumeSize(ullVolumeSize)
+    , m_VolumeInterval(volumeInterval)
+{
+}
+
+std::wstring ArchiveCheckpoint::GetVolumeName(const std::wstring& strArchiveName, DWORD dwIndex)
+{
+    WCHAR szSuffix[16];
+    swprintf_s(szSuffix, L"_%04lu", dwIndex);
+
+    const auto separator = strArchiveName.find_last_of(L"\\/");
+    const auto extension = strArchiveName.find_last_of(L'.');
+
+    if (extension == std::wstring::npos || (separator != std::wstring::npos && extension < separator))
+        return strArchiveName + szSuffix;
+
+    std::wstring strVolumeName(strArchiveName);
+    strVolumeName.insert(extension, szSuffix);
+    return strVolumeName;
+}
+
+HRESULT ArchiveCheckpoint::Load()
+{
+    HRESULT hr = E_FAIL;
+
+    m_Volumes.clear();
+    m_Units.clear();
+    m_bComplete = false;
+
+    if (VerifyFileExists(m_strManifestPath.c_str()) != S_OK)
+        return S_FALSE;
+
+    FileStream manifest(_L_);
+    if (FAILED(hr = manifest.ReadFrom(m_strManifestPath.c_str())))
+    {
+        log::Error(_L_, hr, L"Failed to open archive manifest %s\r\n", m_strManifestPath.c_str());
+        return hr;
+    }
+
+    std::string content(static_cast<size_t>(manifest.GetSize()), '\0');
+    ULONGLONG ullRead = 0LL;
+    if (!content.empty() && FAILED(hr = manifest.Read(content.data(), content.size(), &ullRead)))
+    {
+        log::Error(_L_, hr, L"Failed to read archive manifest %s\r\n", m_strManifestPath.c_str());
+        return hr;
+    }
+    manifest.Close();
+    content.resize(static_cast<size_t>(ullRead));
+
+    std::wstring strContent;
+    if (FAILED(hr = AnsiToWide(_L_, std::string_view(content), strContent)))
+        return hr;
+
+    // A line cut short by an interruption has no line feed: it is ignored
+    std::wistringstream lines(strContent);
+    std::wstring strLine;
+    while (std::getline(lines, strLine) && !lines.eof())
+    {
+        if (!strLine.empty() && strLine.back() == L'\r')
+            strLine.pop_back();
+
+        const auto first = strLine.find(L',');
+        const auto second = first == std::wstring::npos ? std::wstring::npos : strLine.find(L',', first + 1);
+        if (second == std::wstring::npos)
+        {
+            log::Warning(
+                _L_, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Invalid manifest line: %s\r\n", strLine.c_str());
+            continue;
+        }
+
+        const auto strType = strLine.substr(0, first);
+        const auto dwIndex = wcstoul(strLine.substr(first + 1, second - first - 1).c_str(), nullptr, 10);
+        auto strValue = strLine.substr(second + 1);
+
+        if (strType == L"Volume" || strType == L"Complete")
+        {
+            m_Volumes.push_back({dwIndex, std::move(strValue)});
+            m_bComplete = strType == L"Complete";
+        }
+        else if (strType == L"Unit")
+            m_Units.insert(std::move(strValue));
+    }
+
+    log::Verbose(
+        _L_,
+        L"Archive manifest %s lists %Iu volume(s) and %Iu unit(s)%s\r\n",
+        m_strManifestPath.c_str(),
+        m_Volumes.size(),
+        m_Units.size(),
+        m_bComplete ? L" (complete)" : L"");
+    return S_OK;
+}
+
+HRESULT ArchiveCheckpoint::Reset()
+{
+    m_Volumes.clear();
+    m_Units.clear();
+    m_bComplete = false;
+
+    if (VerifyFileExists(m_strManifestPath.c_str()) == S_OK && !DeleteFile(m_strManifestPath.c_str()))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        log::Error(_L_, hr, L"Failed to delete archive manifest %s\r\n", m_strManifestPath.c_str());
+        return hr;
+    }
+    return S_OK;
+}
+
+bool ArchiveCheckpoint::IsVolumeFull(ULONGLONG ullVolumeData, std::chrono::seconds elapsed) const
+{
+    if (m_ullVolumeSize > 0LL && ullVolumeData >= m_ullVolumeSize)
+        return true;
+    if (m_VolumeInterval.count() > 0 && elapsed >= m_VolumeInterval)
+        return true;
+    return false;
+}
+
+HRESULT ArchiveCheckpoint::AddVolume(DWORD dwIndex, const std::vector<std::wstring>& units, bool bFinal)
+{
+    HRESULT hr = E_FAIL;
+
+    Volume volume;
+    volume.Index = dwIndex;
+    volume.Name = GetVolumeName(dwIndex);
+
+    std::wstring strLines;
+    strLines.append(bFinal ? L"Complete," : L"Volume,").append(std::to_wstring(dwIndex)).append(L",");
+    strLines.append(volume.Name).append(L"\r\n");
+    for (const auto& unit : units)
+        strLines.append(L"Unit,").append(std::to_wstring(dwIndex)).append(L",").append(unit).append(L"\r\n");
+
+    std::string strAnsiLines;
+    if (FAILED(hr = WideToAnsi(_L_, strLines, strAnsiLines)))
+        return hr;
+
+    FileStream manifest(_L_);
+    if (FAILED(
+            hr = manifest.OpenFile(
+                m_strManifestPath.c_str(),
+                FILE_APPEND_DATA,
+                FILE_SHARE_READ,
+                NULL,
+                OPEN_ALWAYS,
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH,
+                NULL)))
+    {
+        log::Error(_L_, hr, L"Failed to open archive manifest %s\r\n", m_strManifestPath.c_str());
+        return hr;
+    }
+
+    ULONGLONG ullWritten = 0LL;
+    if (FAILED(hr = manifest.Write((PVOID)strAnsiLines.data(), strAnsiLines.size(), &ullWritten)))
+    {
+        log::Error(_L_, hr, L"Failed to write archive manifest %s\r\n", m_strManifestPath.c_str());
+        return hr;
+    }
+    manifest.Close();
+
+    m_Volumes.push_back(std::move(volume));
+    m_Units.insert(begin(units), end(units));
+    m_bComplete = bFinal;
+    return S_OK;
+}
@@ -0,0 +1,94 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include <chrono>
+#include <set>
+#include <string>
+#include <vector>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+class LogFileWriter;
+
+//
+// ArchiveCheckpoint splits an archive into volumes, each a complete archive of its own, and keeps a manifest of the
+// volumes written and of the units (e.g. commands) whose output they hold. The manifest is appended to, write
+// through, once a volume is closed: after an interruption, it lists what a new run can skip and the next volume.
+//
+// The manifest is a UTF-8 csv file:
+//  Volume,<index>,<volume name>
+//  Unit,<index>,<unit>
+//  Complete,<index>,<volume name>   (the last volume of a completed archive)
+//
+class ORCLIB_API ArchiveCheckpoint
+{
+public:
+    static constexpr auto ManifestExtension = L".manifest.csv";
+
+    class Volume
+    {
+    public:
+        DWORD Index = 0L;
+        std::wstring Name;
+    };
+
+    ArchiveCheckpoint(
+        logger pLog,
+        const std::wstring& strArchiveName,
+        const std::wstring& strManifestPath,
+        ULONGLONG ullVolumeSize,
+        std::chrono::seconds volumeInterval);
+
+    // archive.7z is written as archive_0001.7z, archive_0002.7z...
+    static std::wstring GetVolumeName(const std::wstring& strArchiveName, DWORD dwIndex);
+    std::wstring GetVolumeName(DWORD dwIndex) const { return GetVolumeName(m_strArchiveName, dwIndex); }
+
+    // Reads the manifest of a previous run, if any: S_FALSE when there is none
+    HRESULT Load();
+
+    // Removes the manifest of a completed run, to start over from the first volume
+    HRESULT Reset();
+
+    bool IsResumed() const { return !m_Volumes.empty() && !m_bComplete; }
+    bool IsComplete() const { return m_bComplete; }
+    bool IsUnitComplete(const std::wstring& strUnit) const { return m_Units.find(strUnit) != m_Units.end(); }
+
+    DWORD GetNextVolume() const { return m_Volumes.empty() ? 1L : m_Volumes.back().Index + 1; }
+    const std::vector<Volume>& GetVolumes() const { return m_Volumes; }
+
+    const std::wstring& GetArchiveName() const { return m_strArchiveName; }
+    const std::wstring& GetManifestPath() const { return m_strManifestPath; }
+
+    // A volume is closed when either limit is reached (0 means no limit)
+    bool IsVolumeFull(ULONGLONG ullVolumeData, std::chrono::seconds elapsed) const;
+
+    // Records a closed volume with the units completed in it
+    HRESULT AddVolume(DWORD dwIndex, const std::vector<std::wstring>& units, bool bFinal);
+
+private:
+    logger _L_;
+
+    std::wstring m_strArchiveName;
+    std::wstring m_strManifestPath;
+
+    ULONGLONG m_ullVolumeSize;
+    std::chrono::seconds m_VolumeInterval;
+
+    std::vector<Volume> m_Volumes;
+    std::set<std::wstring> m_Units;
+    bool m_bComplete = false;
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
@@ -16,10 +16,14 @@
 #include "MemoryStream.h"
 #include "NTFSStream.h"
 #include "CryptoHashStream.h"
+#include "WideAnsi.h"
 #include "XORStream.h"
 
+#include <boost/algorithm/string.hpp>
+
 #include "ZipCreate.h"
 #include "CabCreate.h"
+#include "ZstdCreate.h"
 
 using namespace std;
 
@@ -38,6 +42,9 @@ std::shared_ptr<ArchiveCreate> ArchiveCreate::MakeCreate(ArchiveFormat fmt, logg
         case ArchiveFormat::Cabinet:
             retval = std::make_shared<CabCreate>(std::move(pLog), bComputeHash);
             break;
+        case ArchiveFormat::Zstd:
+            retval = std::make_shared<ZstdCreate>(std::move(pLog), bComputeHash);
+            break;
         default:
             return nullptr;
     }
@@ -53,10 +60,169 @@ ArchiveCreate::ArchiveCreate(logger pLog, bool bComputeHash, DWORD XORPattern)
 
 ArchiveCreate::~ArchiveCreate(void) {}
 
+std::wstring ArchiveCreate::ParseCompressionLevel(const std::wstring& strLevel, const CompressionOption& onOption)
+{
+    std::vector<std::wstring> options;
+    boost::split(options, strLevel, boost::is_any_of(L","));
+
+    for (size_t i = 1; i < options.size(); i++)
+    {
+        std::vector<std::wstring> keyValue;
+        boost::split(keyValue, options[i], boost::is_any_of(L"="));
+
+        if (keyValue.size() == 2 && onOption(boost::trim_copy(keyValue[0]), boost::trim_copy(keyValue[1])))
+            continue;
+        log::Warning(_L_, E_INVALIDARG, L"Ignoring unrecognised compression option %s\r\n", options[i].c_str());
+    }
+
+    return boost::trim_copy(options.front());
+}
+
+namespace {
+
+std::string CsvField(const std::string& field)
+{
+    std::string retval = "\"";
+    for (const auto c : field)
+    {
+        if (c == '"')
+            retval.push_back('"');
+        retval.push_back(c);
+    }
+    retval.push_back('"');
+    return retval;
+}
+
+}  // namespace
+
+void ArchiveCreate::SetDeduplication(bool bDeduplicate)
+{
+    if (bDeduplicate && m_Format != ArchiveFormat::Zip && m_Format != ArchiveFormat::Zstd)
+    {
+        log::Warning(_L_, E_NOTIMPL, L"Only zip and zstd archives are deduplicated\r\n");
+        bDeduplicate = false;
+    }
+    m_bDeduplicate = bDeduplicate;
+}
+
+HRESULT ArchiveCreate::FindDuplicate(const ArchiveItem& item, ULONGLONG ullSize, Duplicate& duplicate)
+{
+    HRESULT hr = E_FAIL;
+
+    if (!m_bDeduplicate || ullSize < DeduplicationMinimumSize || item.Stream == nullptr)
+        return S_FALSE;
+
+    // The hash is only valid when the compressor read the entry once, from its beginning to its end
+    CBinaryBuffer sha256;
+    auto hashstream = std::dynamic_pointer_cast<CryptoHashStream>(ByteStream::GetHashStream(item.Stream));
+    if (hashstream == nullptr || FAILED(hr = hashstream->GetSHA256(sha256)) || sha256.GetCount() == 0)
+    {
+        log::Verbose(_L_, L"No content hash for %s, it is not deduplicated\r\n", item.NameInArchive.c_str());
+        return S_FALSE;
+    }
+
+    auto strSHA256 = sha256.ToHex();
+    auto it = m_Contents.find(strSHA256);
+    if (it == end(m_Contents))
+    {
+        m_Contents.emplace(std::move(strSHA256), item.NameInArchive);
+        return S_FALSE;
+    }
+
+    duplicate.NameInArchive = item.NameInArchive + DeduplicationReference;
+    duplicate.Reference = it->second;
+    duplicate.SHA256 = std::move(strSHA256);
+    duplicate.Size = ullSize;
+    return S_OK;
+}
+
+HRESULT ArchiveCreate::MakeReference(ArchiveItem& item, Duplicate duplicate)
+{
+    HRESULT hr = E_FAIL;
+
+    // The reference entry names the entry that holds the content
+    std::string strReference;
+    if (FAILED(hr = WideToAnsi(_L_, duplicate.Reference, strReference)))
+        return hr;
+
+    auto reference = make_shared<MemoryStream>(_L_);
+    ULONGLONG ullWritten = 0LL;
+    if (FAILED(hr = reference->OpenForReadWrite(64 * 1024))
+        || FAILED(hr = reference->Write(strReference.data(), strReference.size(), &ullWritten)))
+    {
+        log::Error(_L_, hr, L"Failed to create reference entry for %s\r\n", item.NameInArchive.c_str());
+        return hr;
+    }
+
+    std::wstring strPrefixedName;
+    auto pStream = GetStreamToAdd(reference, duplicate.NameInArchive, strPrefixedName);
+    if (pStream == nullptr)
+        return E_FAIL;
+
+    log::Verbose(
+        _L_,
+        L"%s has the same content as %s, adding a reference\r\n",
+        item.NameInArchive.c_str(),
+        duplicate.Reference.c_str());
+
+    item.NameInArchive = duplicate.NameInArchive;
+    item.Stream = std::move(pStream);
+    item.Size = reference->GetSize();
+    item.MD5.RemoveAll();
+    item.SHA1.RemoveAll();
+
+    m_Duplicates.push_back(std::move(duplicate));
+    return S_OK;
+}
+
+HRESULT ArchiveCreate::AddDeduplicationManifest()
+{
+    HRESULT hr = E_FAIL;
+
+    if (!m_bDeduplicate || m_Duplicates.empty())
+        return S_OK;
+
+    std::string strManifest = "Entry,Reference,SHA256,Size\r\n";
+    for (const auto& duplicate : m_Duplicates)
+    {
+        std::string strName, strReference, strSHA256;
+        if (FAILED(hr = WideToAnsi(_L_, duplicate.NameInArchive, strName))
+            || FAILED(hr = WideToAnsi(_L_, duplicate.Reference, strReference))
+            || FAILED(hr = WideToAnsi(_L_, duplicate.SHA256, strSHA256)))
+            return hr;
+
+        strManifest += CsvField(strName) + "," + CsvField(strReference) + "," + strSHA256 + ","
+            + std::to_string(duplicate.Size) + "\r\n";
+    }
+
+    auto manifest = make_shared<MemoryStream>(_L_);
+    ULONGLONG ullWritten = 0LL;
+    if (FAILED(hr = manifest->OpenForReadWrite())
+        || FAILED(hr = manifest->Write(strManifest.data(), strManifest.size(), &ullWritten)))
+    {
+        log::Error(_L_, hr, L"Failed to create deduplication manifest\r\n");
+        return hr;
+    }
+
+    ArchiveItem item;
+    item.NameInArchive = DeduplicationManifest;
+    item.Stream = GetStreamToAdd(manifest, item.NameInArchive, item.NameInArchive);
+    item.Size = manifest->GetSize();
+    if (item.Stream == nullptr)
+        return E_FAIL;
+
+    log::Info(_L_, L"%Iu entries were deduplicated, see %s\r\n", m_Duplicates.size(), item.NameInArchive.c_str());
+
+    m_Duplicates.clear();
+    m_Queue.push_back(std::move(item));
+    return S_OK;
+}
+
 std::shared_ptr<ByteStream> ArchiveCreate::GetStreamToAdd(
     const std::shared_ptr<ByteStream>& astream,
     const std::wstring& strCabbedName,
-    std::wstring& strPrefixedName)
+    std::wstring& strPrefixedName,
+    bool bDeduplicate)
 {
     HRESULT hr = E_FAIL;
 
@@ -66,6 +232,13 @@ std::shared_ptr<ByteStream> ArchiveCreate::GetStreamToAdd(
     // Move back to the begining of the stream
     astream->SetFilePointer(0LL, FILE_BEGIN, nullptr);
 
+    // Duplicates are found from the SHA256 computed while the compressor reads the entry
+    DWORD dwAlgorithms = 0L;
+    if (m_bComputeHash)
+        dwAlgorithms |= SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1;
+    if (m_bDeduplicate && bDeduplicate)
+        dwAlgorithms |= SupportedAlgorithm::SHA256;
+
     if (m_XORPattern != 0L)
     {
         WCHAR szPrefixedName[MAX_PATH];
@@ -84,13 +257,11 @@ std::shared_ptr<ByteStream> ArchiveCreate::GetStreamToAdd(
 
         strPrefixedName.assign(szPrefixedName);
 
-        if (m_bComputeHash)
+        if (dwAlgorithms != 0L)
         {
             shared_ptr<CryptoHashStream> pHashStream = make_shared<CryptoHashStream>(_L_);
 
-            if (FAILED(
-                    hr = pHashStream->OpenToRead(
-                        static_cast<SupportedAlgorithm>(SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1), astream)))
+            if (FAILED(hr = pHashStream->OpenToRead(static_cast<SupportedAlgorithm>(dwAlgorithms), astream)))
                 return nullptr;
             if (FAILED(hr = pXORStream->OpenForXOR(pHashStream)))
                 return nullptr;
@@ -108,13 +279,11 @@ std::shared_ptr<ByteStream> ArchiveCreate::GetStreamToAdd(
     {
         strPrefixedName = strCabbedName;
 
-        if (m_bComputeHash)
+        if (dwAlgorithms != 0L)
         {
             shared_ptr<CryptoHashStream> pHashStream = make_shared<CryptoHashStream>(_L_);
 
-            if (FAILED(
-                    hr = pHashStream->OpenToRead(
-                        static_cast<SupportedAlgorithm>(SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1), astream)))
+            if (FAILED(hr = pHashStream->OpenToRead(static_cast<SupportedAlgorithm>(dwAlgorithms), astream)))
                 return nullptr;
             return pHashStream;
         }
@@ -194,11 +363,20 @@ STDMETHODIMP ArchiveCreate::AddStream(
     __in_opt PCWSTR pwzNameInArchive,
     __in_opt PCWSTR pwzPath,
     __in_opt const std::shared_ptr<ByteStream>& pStream)
+{
+    return AddStream(pwzNameInArchive, pwzPath, pStream, true);
+}
+
+HRESULT ArchiveCreate::AddStream(
+    __in_opt PCWSTR pwzNameInArchive,
+    __in_opt PCWSTR pwzPath,
+    __in_opt const std::shared_ptr<ByteStream>& pStream,
+    bool bDeduplicate)
 {
     ArchiveItem item;
 
     item.NameInArchive = pwzNameInArchive;
-    item.Stream = GetStreamToAdd(pStream, item.NameInArchive, item.NameInArchive);
+    item.Stream = GetStreamToAdd(pStream, item.NameInArchive, item.NameInArchive, bDeduplicate);
     item.Size = pStream->GetSize();
     item.Path = pwzPath;
 
@@ -15,6 +15,7 @@
 #include "Archive.h"
 
 #include <memory>
+#include <unordered_map>
 
 #pragma managed(push, off)
 
@@ -31,13 +32,39 @@ protected:
 
     DWORD m_XORPattern;
 
-    ArchiveFormat m_Format;
+    ArchiveFormat m_Format = ArchiveFormat::Unknown;
     ArchiveItems m_Queue;
 
+    struct Duplicate
+    {
+        std::wstring NameInArchive;
+        std::wstring Reference;  // entry holding the content
+        std::wstring SHA256;
+        ULONGLONG Size = 0LL;
+    };
+
+    bool m_bDeduplicate = false;
+    std::unordered_map<std::wstring, std::wstring> m_Contents;  // SHA256 -> entry holding the content
+    std::vector<Duplicate> m_Duplicates;
+
+    // Once the compressor read the item, from the SHA256 of its hash stream: S_OK and the reference when an entry
+    // already holds the same content, S_FALSE when the content is new (it is then recorded as held by the item)
+    HRESULT FindDuplicate(const ArchiveItem& item, ULONGLONG ullSize, Duplicate& duplicate);
+    // Turns the item into the reference entry of its duplicate, listed in the deduplication manifest
+    HRESULT MakeReference(ArchiveItem& item, Duplicate duplicate);
+    HRESULT AddDeduplicationManifest();
+
+    // Without bDeduplicate, the entry is neither replaced by a reference nor referenced by a later entry
     std::shared_ptr<ByteStream> GetStreamToAdd(
         const std::shared_ptr<ByteStream>& astream,
         const std::wstring& strCabbedName,
-        std::wstring& strPrefixedName);
+        std::wstring& strPrefixedName,
+        bool bDeduplicate = true);
+
+    // Splits "<level>[,<option>=<value>]..." and returns the level. onOption returns false for an option it does not
+    // know, which is ignored with a warning
+    using CompressionOption = std::function<bool(const std::wstring& strOption, const std::wstring& strValue)>;
+    std::wstring ParseCompressionLevel(const std::wstring& strLevel, const CompressionOption& onOption);
 
     ArchiveCreate(logger pLog, bool bComputeHash, DWORD XORPattern);
 
@@ -50,10 +77,26 @@ public:
 
     STDMETHOD(SetCompressionLevel)(__in const std::wstring& strLevel) PURE;
 
+    // Entries whose content was already added become a reference to the first entry (see DeduplicationManifest).
+    // An entry is known to be a duplicate once it was compressed: only the zip and zstd writers, appending to an
+    // output they can seek back into, replace it by its reference. Nothing resolves the references on extraction or
+    // import: the ".ref" entry holds the name of the entry holding the content
+    void SetDeduplication(bool bDeduplicate);
+    static constexpr auto DeduplicationManifest = L"Deduplication.csv";
+    static constexpr auto DeduplicationReference = L".ref";
+    // Smaller entries are not worth a hash and a reference entry plus its manifest line
+    static constexpr ULONGLONG DeduplicationMinimumSize = 4096LL;
+
     STDMETHOD(AddFile)(__in PCWSTR pwzNameInArchive, __in PCWSTR pwzFileName, bool bDeleteWhenDone);
     STDMETHOD(AddBuffer)(__in_opt PCWSTR pwzNameInArchive, __in PVOID pData, __in DWORD cbData);
     STDMETHOD(AddStream)
     (__in_opt PCWSTR pwzNameInArchive, __in_opt PCWSTR pwzPath, __in_opt const std::shared_ptr<ByteStream>& pStream);
+    // Only the entries added with bDeduplicate are compared, when deduplication is enabled
+    HRESULT AddStream(
+        __in_opt PCWSTR pwzNameInArchive,
+        __in_opt PCWSTR pwzPath,
+        __in_opt const std::shared_ptr<ByteStream>& pStream,
+        bool bDeduplicate);
 
     STDMETHOD(FlushQueue)() PURE;
 
@@ -29,6 +29,7 @@
 
 #include "ZipExtract.h"
 #include "CabExtract.h"
+#include "ZstdExtract.h"
 
 #include "ParameterCheck.h"
 
@@ -49,6 +50,8 @@ std::shared_ptr<ArchiveExtract> ArchiveExtract::MakeExtractor(ArchiveFormat fmt,
             return std::make_shared<ZipExtract>(std::move(pLog), bComputeHash);
         case ArchiveFormat::Zip:
             return std::make_shared<ZipExtract>(std::move(pLog), bComputeHash);
+        case ArchiveFormat::Zstd:
+            return std::make_shared<ZstdExtract>(std::move(pLog), bComputeHash);
     }
     return nullptr;
 }
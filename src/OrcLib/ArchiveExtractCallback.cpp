@@ -107,43 +107,47 @@ STDMETHODIMP ArchiveExtractCallback::SetCompleted(const UInt64* completeValue)
     return S_OK;
 }
 
-std::shared_ptr<ByteStream> ArchiveExtractCallback::GetStreamToWrite()
+std::shared_ptr<ByteStream> ArchiveExtractCallback::MakeStreamToWrite(
+    const logger& pLog,
+    Archive::ArchiveItem& item,
+    const ArchiveExtract::MakeOutputStream& makeWriteAbleStream,
+    bool bComputeHash)
 {
     HRESULT hr = E_FAIL;
     std::shared_ptr<ByteStream> retval;
     shared_ptr<XORStream> pXORStream;
 
-    if (XORStream::IsNameXORPrefixed(m_currentItem.NameInArchive.c_str()) == S_OK)
+    if (XORStream::IsNameXORPrefixed(item.NameInArchive.c_str()) == S_OK)
     {
         WCHAR szUnprefix[MAX_PATH];
         DWORD dwPattern;
 
-        pXORStream = make_shared<XORStream>(_L_);
+        pXORStream = make_shared<XORStream>(pLog);
 
-        if (FAILED(hr = pXORStream->GetXORPatternFromName(m_currentItem.NameInArchive.c_str(), dwPattern)))
+        if (FAILED(hr = pXORStream->GetXORPatternFromName(item.NameInArchive.c_str(), dwPattern)))
             return nullptr;
 
-        if (FAILED(hr = pXORStream->XORUnPrefixFileName(m_currentItem.NameInArchive.c_str(), szUnprefix, MAX_PATH)))
+        if (FAILED(hr = pXORStream->XORUnPrefixFileName(item.NameInArchive.c_str(), szUnprefix, MAX_PATH)))
             return nullptr;
 
         pXORStream->SetXORPattern(dwPattern);
-        m_currentItem.NameInArchive = szUnprefix;
+        item.NameInArchive = szUnprefix;
     }
 
-    auto filestream = m_MakeWriteAbleStream(m_currentItem);
+    auto filestream = makeWriteAbleStream(item);
 
     if (!filestream)
     {
-        log::Error(_L_, E_FAIL, L"Failed to create writeable stream for %s\r\n", m_currentItem.NameInArchive.c_str());
+        log::Error(pLog, E_FAIL, L"Failed to create writeable stream for %s\r\n", item.NameInArchive.c_str());
         return nullptr;
     }
 
     if (pXORStream)
     {
 
-        if (m_bComputeHash)
+        if (bComputeHash)
         {
-            auto hashstream = make_shared<CryptoHashStream>(_L_);
+            auto hashstream = make_shared<CryptoHashStream>(pLog);
             if (FAILED(
                     hr = hashstream->OpenToRead(
                         static_cast<SupportedAlgorithm>(SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1),
@@ -161,9 +165,9 @@ std::shared_ptr<ByteStream> ArchiveExtractCallback::GetStreamToWrite()
     }
     else
     {
-        if (m_bComputeHash)
+        if (bComputeHash)
         {
-            auto hashstream = make_shared<CryptoHashStream>(_L_);
+            auto hashstream = make_shared<CryptoHashStream>(pLog);
             if (FAILED(
                     hr = hashstream->OpenToRead(
                         static_cast<SupportedAlgorithm>(SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1),
@@ -179,6 +183,11 @@ std::shared_ptr<ByteStream> ArchiveExtractCallback::GetStreamToWrite()
     return retval;
 }
 
+std::shared_ptr<ByteStream> ArchiveExtractCallback::GetStreamToWrite()
+{
+    return MakeStreamToWrite(_L_, m_currentItem, m_MakeWriteAbleStream, m_bComputeHash);
+}
+
 STDMETHODIMP ArchiveExtractCallback::GetStream(UInt32 index, ISequentialOutStream** outStream, Int32 askExtractMode)
 {
     HRESULT hr = E_FAIL;
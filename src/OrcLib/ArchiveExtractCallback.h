@@ -72,6 +72,13 @@ public:
     // ICryptoGetTextPassword
     STDMETHOD(CryptoGetTextPassword)(BSTR* password);
 
+    // Makes the output stream of item, removing the XOR prefix from its name and computing its hashes if needed
+    static std::shared_ptr<ByteStream> MakeStreamToWrite(
+        const logger& pLog,
+        Archive::ArchiveItem& item,
+        const ArchiveExtract::MakeOutputStream& makeWriteAbleStream,
+        bool bComputeHash);
+
 private:
     std::shared_ptr<ByteStream> GetStreamToWrite();
 
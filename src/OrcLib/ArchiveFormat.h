@@ -17,6 +17,7 @@ enum ArchiveFormat
     SevenZip,
     Zip,
     SevenZipSupported,
+    Zstd,
 };
 }
 #pragma managed(pop)
@@ -25,13 +25,15 @@ ArchiveMessage::Message ArchiveMessage::MakeOpenRequest(
     const std::wstring& strArchiveName,
     const ArchiveFormat aFormat,
     const std::shared_ptr<ByteStream>& aStream,
-    const std::wstring& strCompressionLevel)
+    const std::wstring& strCompressionLevel,
+    bool bDeduplicate)
 {
     auto retval = make_shared<ArchiveMessage>(ArchiveMessage::OpenArchive);
     retval->m_Name = strArchiveName;
     retval->m_Format = aFormat;
     retval->m_Stream = aStream;
     retval->m_CompressionLevel = strCompressionLevel;
+    retval->m_bDeduplicate = bDeduplicate;
     return retval;
 }
 
@@ -47,6 +49,26 @@ ArchiveMessage::Message ArchiveMessage::MakeOpenRequest(const OutputSpec& anOutp
     return retval;
 }
 
+ArchiveMessage::Message ArchiveMessage::MakeOpenRequest(
+    const std::shared_ptr<ArchiveCheckpoint>& aCheckpoint,
+    const ArchiveFormat aFormat,
+    const MakeVolumeStream& makeVolumeStream,
+    const std::wstring& strCompressionLevel,
+    bool bDeduplicate)
+{
+    if (aCheckpoint == nullptr || makeVolumeStream == nullptr)
+        return nullptr;
+
+    auto retval = make_shared<ArchiveMessage>(ArchiveMessage::OpenArchive);
+    retval->m_Name = aCheckpoint->GetArchiveName();
+    retval->m_Format = aFormat;
+    retval->m_Checkpoint = aCheckpoint;
+    retval->m_MakeVolumeStream = makeVolumeStream;
+    retval->m_CompressionLevel = strCompressionLevel;
+    retval->m_bDeduplicate = bDeduplicate;
+    return retval;
+}
+
 ArchiveMessage::Message ArchiveMessage::MakeAddFileRequest(
     const std::wstring& szNameInArchive,
     const std::wstring& szFileName,
@@ -99,9 +121,18 @@ ArchiveMessage::Message ArchiveMessage::MakeAddStreamRequest(
     return retval;
 }
 
-ArchiveMessage::Message ArchiveMessage::MakeFlushQueueRequest()
+ArchiveMessage::Message ArchiveMessage::MakeFlushQueueRequest(const std::wstring& strKeyword)
+{
+    auto retval = make_shared<ArchiveMessage>(ArchiveMessage::FlushQueue);
+    retval->m_Keyword = strKeyword;
+    return retval;
+}
+
+ArchiveMessage::Message ArchiveMessage::MakeCompleteUnitRequest(const std::wstring& strUnit)
 {
-    return make_shared<ArchiveMessage>(ArchiveMessage::FlushQueue);
+    auto retval = make_shared<ArchiveMessage>(ArchiveMessage::CompleteUnit);
+    retval->m_Keyword = strUnit;
+    return retval;
 }
 
 ArchiveMessage::Message ArchiveMessage::MakeCompleteRequest()
@@ -13,8 +13,10 @@
 #include "BoundedBuffer.h"
 #include "ByteStream.h"
 #include "Archive.h"
+#include "ArchiveCheckpoint.h"
 #include "OutputSpec.h"
 
+#include <functional>
 #include <memory>
 #include <agents.h>
 
@@ -35,6 +37,7 @@ public:
         AddDirectory,
         AddStream,
         FlushQueue,
+        CompleteUnit,
         Cancel,
         Complete
     };
@@ -55,6 +58,10 @@ public:
     using ITarget = Concurrency::ITarget<Message>;
     using ISource = Concurrency::ISource<Message>;
 
+    // Opens the output stream of a new archive volume
+    using MakeVolumeStream =
+        std::function<HRESULT(const std::wstring& strVolumeName, std::shared_ptr<ByteStream>& stream)>;
+
 private:
     Request m_Request;
     Status m_Status;
@@ -67,14 +74,19 @@ private:
     ArchiveFormat m_Format;
     std::shared_ptr<ByteStream> m_Stream;
 
+    std::shared_ptr<ArchiveCheckpoint> m_Checkpoint;
+    MakeVolumeStream m_MakeVolumeStream;
+
     bool m_bDeleteWhenDone;
     bool m_bHashData;
+    bool m_bDeduplicate;
     DWORD m_dwXORPattern;
 
     ArchiveMessage(Request request)
         : m_Request(request)
         , m_Status(Open)
         , m_bHashData(false)
+        , m_bDeduplicate(false)
         , m_dwXORPattern(0L)
         , m_bDeleteWhenDone(false)
         , m_Format(ArchiveFormat::Unknown) {};
@@ -85,9 +97,18 @@ public:
         const std::wstring& szArchiveName,
         const ArchiveFormat aFormat,
         const std::shared_ptr<ByteStream>& aStream,
-        const std::wstring& strCompressionLevel = L"");
+        const std::wstring& strCompressionLevel = L"",
+        bool bDeduplicate = false);
     static Message MakeOpenRequest(const OutputSpec& anOutput);
 
+    // The archive is written as volumes, checkpointed in aCheckpoint's manifest
+    static Message MakeOpenRequest(
+        const std::shared_ptr<ArchiveCheckpoint>& aCheckpoint,
+        const ArchiveFormat aFormat,
+        const MakeVolumeStream& makeVolumeStream,
+        const std::wstring& strCompressionLevel = L"",
+        bool bDeduplicate = false);
+
     static Message MakeAddFileRequest(
         const std::wstring& szCabbedName,
         const std::wstring& szFileName,
@@ -107,7 +128,11 @@ public:
         bool bHashData = false,
         DWORD dwXORPattern = 0);
 
-    static Message MakeFlushQueueRequest();
+    // With a keyword, the flush is acknowledged with a FlushQueue notification for it
+    static Message MakeFlushQueueRequest(const std::wstring& strKeyword = L"");
+
+    // All the output of strUnit was sent before this request
+    static Message MakeCompleteUnitRequest(const std::wstring& strUnit);
     static Message MakeCompleteRequest();
 
     static Message MakeCancellationRequest();
@@ -116,6 +141,7 @@ public:
     Status GetStatus() const { return m_Status; };
     DWORD GetXORPattern() const { return m_dwXORPattern; };
     bool GetComputeHash() const { return m_bHashData; };
+    bool GetDeduplicate() const { return m_bDeduplicate; };
     bool GetDeleteWhenDone() const { return m_bDeleteWhenDone; };
 
     const std::wstring& Name() const { return m_Name; };
@@ -124,6 +150,9 @@ public:
 
     const std::shared_ptr<ByteStream>& GetStream() const { return m_Stream; };
 
+    const std::shared_ptr<ArchiveCheckpoint>& GetCheckpoint() const { return m_Checkpoint; };
+    const MakeVolumeStream& GetMakeVolumeStream() const { return m_MakeVolumeStream; };
+
     ArchiveFormat GetArchiveFormat() const { return m_Format; };
     const std::wstring& GetCompressionLevel() const { return m_CompressionLevel; };
 
@@ -10,6 +10,7 @@
 #include "OrcLib.h"
 
 #include "BinaryBuffer.h"
+#include "CompressionPolicy.h"
 
 #include <string>
 #include <memory>
@@ -62,6 +63,10 @@ private:
     CBinaryBuffer m_md5;
     CBinaryBuffer m_sha1;
 
+    CompressionPolicy::Decision m_Decision = CompressionPolicy::Decision::Default;
+    ULONGLONG m_ullSize = 0LL;
+    ULONGLONG m_ullCompressedSize = 0LL;
+
 protected:
     ArchiveNotification(Type type, Status status, const std::wstring& keyword, const std::wstring& descr, HRESULT hr)
         : m_Type(type)
@@ -96,6 +101,19 @@ public:
         return retval;
     }
 
+    static Notification MakeAddItemSuccessNotification(
+        const std::wstring& keyword,
+        CompressionPolicy::Decision decision,
+        ULONGLONG ullSize,
+        ULONGLONG ullCompressedSize)
+    {
+        auto retval = std::make_shared<ArchiveNotification>(FileAddition, Success, keyword, L"", S_OK);
+        retval->m_Decision = decision;
+        retval->m_ullSize = ullSize;
+        retval->m_ullCompressedSize = ullCompressedSize;
+        return retval;
+    }
+
     static Notification
     MakeAddFileSucessNotification(const std::wstring& keyword, CBinaryBuffer& md5, CBinaryBuffer& sha1)
     {
@@ -125,6 +143,11 @@ public:
     const CBinaryBuffer& MD5() const { return m_md5; };
     const CBinaryBuffer& SHA1() const { return m_sha1; };
 
+    // Compression decision and sizes of an added item, when the archive format reports them
+    CompressionPolicy::Decision GetDecision() const { return m_Decision; }
+    ULONGLONG GetSize() const { return m_ullSize; }
+    ULONGLONG GetCompressedSize() const { return m_ullCompressedSize; }
+
     ~ArchiveNotification(void);
 };
 
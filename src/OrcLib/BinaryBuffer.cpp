@@ -51,7 +51,18 @@ CBinaryBuffer::CBinaryBuffer(const CBinaryBuffer& other)
 {
     if (other.m_size > 0)
     {
-        if (other.m_bOwnMemory)
+        if (other.m_bOwnMemory && BufferPool::GetSizeClass(other.m_size) != BufferPool::NotPooled)
+        {
+            if (FAILED(BufferPool::Instance().Allocate(other.m_size, m_PoolBlock)))
+                throw Exception(Fatal, E_OUTOFMEMORY, L"out of memory");
+
+            m_pData = m_PoolBlock.pData;
+            if (!other.m_bJunk)
+                CopyMemory(m_pData, other.m_pData, other.m_size);
+            m_bJunk = false;
+            m_size = other.m_size;
+        }
+        else if (other.m_bOwnMemory)
         {
             if (m_bVirtualAlloc)
             {
@@ -100,7 +111,42 @@ bool CBinaryBuffer::SetCount(size_t NewSize)
 
         if (NewSize > 0)
         {
-            if (m_bVirtualAlloc)
+            if (m_PoolBlock.Class != BufferPool::NotPooled
+                && NewSize <= BufferPool::SizeClasses[m_PoolBlock.Class])
+            {
+                // The block of the size class is large enough: the data stays in place
+                if (FAILED(BufferPool::Instance().Grow(m_PoolBlock, NewSize)))
+                    return false;
+                m_size = NewSize;
+                m_bJunk = false;
+            }
+            else if (BufferPool::GetSizeClass(NewSize) != BufferPool::NotPooled)
+            {
+                BufferPool::Block NewBlock;
+                if (FAILED(BufferPool::Instance().Allocate(NewSize, NewBlock)))
+                    return false;
+
+                if (m_pData != nullptr && !m_bJunk)
+                    CopyMemory(NewBlock.pData, m_pData, min(m_size, NewSize));
+                RemoveAll();
+
+                m_PoolBlock = NewBlock;
+                m_pData = NewBlock.pData;
+                m_size = NewSize;
+                m_bJunk = false;
+            }
+            else if (m_PoolBlock.Class != BufferPool::NotPooled)
+            {
+                // Too large for the pool: move the data out of the pooled block
+                CBinaryBuffer NewBuffer(m_bVirtualAlloc);
+                if (!NewBuffer.SetCount(NewSize))
+                    return false;
+
+                if (!m_bJunk)
+                    CopyMemory(NewBuffer.m_pData, m_pData, min(m_size, NewSize));
+                *this = std::move(NewBuffer);
+            }
+            else if (m_bVirtualAlloc)
             {
                 BYTE* NewData = (BYTE*)VirtualAlloc(NULL, NewSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
                 if (NewData == NULL)
@@ -894,7 +940,11 @@ void CBinaryBuffer::RemoveAll()
 {
     if (m_bOwnMemory)
     {
-        if (m_bVirtualAlloc)
+        if (m_PoolBlock.Class != BufferPool::NotPooled)
+        {
+            BufferPool::Instance().Free(m_PoolBlock);
+        }
+        else if (m_bVirtualAlloc)
         {
             VirtualFree(m_pData, 0L, MEM_RELEASE);
         }
@@ -9,6 +9,8 @@
 
 #include "OrcLib.h"
 
+#include "BufferPool.h"
+
 #include <memory>
 
 #include <WinCrypt.h>
@@ -31,6 +33,7 @@ private:
     bool m_bOwnMemory;
     bool m_bVirtualAlloc;
     bool m_bJunk;
+    BufferPool::Block m_PoolBlock;  // owned memory drawn from the buffer pool
 
     static HCRYPTPROV g_hProv;
 
@@ -44,9 +47,11 @@ public:
         m_bVirtualAlloc = newThis.m_bVirtualAlloc;
         m_bOwnMemory = newThis.m_bOwnMemory;
         m_bJunk = newThis.m_bJunk;
+        m_PoolBlock = newThis.m_PoolBlock;
 
         if (newThis.m_bOwnMemory)
         {
+            newThis.m_PoolBlock = BufferPool::Block();
             newThis.m_pData = nullptr;
             newThis.m_size = 0;
             newThis.m_bOwnMemory = true;
@@ -71,6 +76,7 @@ public:
         , m_bOwnMemory(other.m_bOwnMemory)
         , m_bVirtualAlloc(other.m_bVirtualAlloc)
         , m_bJunk(other.m_bJunk)
+        , m_PoolBlock(other.m_PoolBlock)
     {
         // Copy the data pointer and its length from the
         // source object.
@@ -78,6 +84,7 @@ public:
         {
             // Release the data pointer from the source object so that
             // the destructor does not free the memory multiple times.
+            other.m_PoolBlock = BufferPool::Block();
             other.m_pData = nullptr;
             other.m_size = 0;
             other.m_bOwnMemory = true;
@@ -109,11 +116,13 @@ public:
             m_size = other.m_size;
             m_bOwnMemory = other.m_bOwnMemory;
             m_bJunk = other.m_bJunk;
+            m_PoolBlock = other.m_PoolBlock;
 
             if (m_bOwnMemory)
             {
                 // Release the data pointer from the source object so that
                 // the destructor does not free the memory multiple times.
+                other.m_PoolBlock = BufferPool::Block();
                 other.m_pData = nullptr;
                 other.m_size = 0;
                 other.m_bOwnMemory = true;
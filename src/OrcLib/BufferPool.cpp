@@ -0,0 +1,359 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "BufferPool.h"
+
+#include "LogFileWriter.h"
+#include "Privilege.h"
+
+using namespace Orc;
+
+namespace {
+
+constexpr auto OrcLargePagesEnv = L"DFIR-ORC_LARGE_PAGES";
+
+enum class ThreadCacheState : BYTE
+{
+    None,
+    Alive,
+    Destroyed
+};
+
+// Plain thread local: remains readable while (and after) the thread cache is destroyed
+thread_local ThreadCacheState t_CacheState = ThreadCacheState::None;
+
+}  // namespace
+
+class BufferPool::ThreadCache
+{
+public:
+    std::array<std::vector<Block>, ClassCount> Blocks;
+
+    ThreadCache() { t_CacheState = ThreadCacheState::Alive; }
+    ~ThreadCache()
+    {
+        t_CacheState = ThreadCacheState::Destroyed;
+
+        auto& pool = BufferPool::Instance();
+        for (auto& blocks : Blocks)
+        {
+            for (auto& block : blocks)
+                pool.Release(block);
+            blocks.clear();
+        }
+    }
+};
+
+BufferPool::ThreadCache& BufferPool::GetThreadCache()
+{
+    thread_local ThreadCache t_Cache;
+    return t_Cache;
+}
+
+BufferPool& BufferPool::Instance()
+{
+    // Never destroyed: buffers held by static objects are freed after the static destructors ran
+    static BufferPool* g_pPool = new BufferPool();
+    return *g_pPool;
+}
+
+BufferPool::BufferPool()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    m_cbPage = si.dwPageSize;
+
+    ULONG ulHighestNode = 0L;
+    if (!GetNumaHighestNodeNumber(&ulHighestNode))
+        ulHighestNode = 0L;
+
+    const auto nbNodes = std::min<ULONG>(ulHighestNode + 1, NotPooled);
+    for (ULONG i = 0; i < nbNodes; i++)
+        m_Nodes.push_back(std::make_unique<NodeCache>());
+}
+
+BYTE BufferPool::GetSizeClass(size_t cbSize)
+{
+    if (cbSize < MinPooledSize)
+        return NotPooled;
+
+    for (BYTE i = 0; i < ClassCount; i++)
+    {
+        if (cbSize <= SizeClasses[i])
+            return i;
+    }
+    return NotPooled;
+}
+
+BYTE BufferPool::GetCurrentNode() const
+{
+    if (m_Nodes.size() == 1)
+        return 0;
+
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+
+    USHORT usNode = 0;
+    if (!GetNumaProcessorNodeEx(&processor, &usNode) || usNode >= m_Nodes.size())
+        return 0;
+    return static_cast<BYTE>(usNode);
+}
+
+void BufferPool::OnInUse(LONGLONG llDelta)
+{
+    const auto ullInUse = m_InUse += llDelta;
+
+    auto ullHighWater = m_HighWater.load();
+    while (ullInUse > ullHighWater && !m_HighWater.compare_exchange_weak(ullHighWater, ullInUse))
+        ;
+}
+
+HRESULT BufferPool::SystemAllocate(BYTE sizeClass, BYTE node, Block& block)
+{
+    const auto cbClass = SizeClasses[sizeClass];
+
+    block = Block();
+    block.Class = sizeClass;
+    block.Node = node;
+
+    if (m_bLargePages && cbClass % m_cbLargePage == 0)
+    {
+        block.pData = (BYTE*)VirtualAllocExNuma(
+            GetCurrentProcess(), NULL, cbClass, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+        if (block.pData != nullptr)
+        {
+            block.cbCommitted = cbClass;
+            block.bLargePages = true;
+            m_SystemAllocations++;
+            return S_OK;
+        }
+    }
+
+    // Only reserved: the pages are committed as the buffer grows
+    block.pData = (BYTE*)VirtualAllocExNuma(GetCurrentProcess(), NULL, cbClass, MEM_RESERVE, PAGE_READWRITE, node);
+    if (block.pData == nullptr)
+    {
+        block = Block();
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_SystemAllocations++;
+    return S_OK;
+}
+
+void BufferPool::SystemFree(Block& block)
+{
+    if (block.pData != nullptr)
+        VirtualFree(block.pData, 0L, MEM_RELEASE);
+    block = Block();
+}
+
+HRESULT BufferPool::Allocate(size_t cbSize, Block& block)
+{
+    HRESULT hr = E_FAIL;
+
+    block = Block();
+
+    const auto sizeClass = GetSizeClass(cbSize);
+    if (sizeClass == NotPooled)
+        return E_INVALIDARG;
+
+    m_Allocations++;
+
+    if (t_CacheState != ThreadCacheState::Destroyed && !GetThreadCache().Blocks[sizeClass].empty())
+    {
+        auto& blocks = GetThreadCache().Blocks[sizeClass];
+        block = blocks.back();
+        blocks.pop_back();
+        m_Cached -= block.cbCommitted;
+        m_ThreadCacheHits++;
+    }
+    else
+    {
+        const auto node = GetCurrentNode();
+        {
+            auto& nodeCache = *m_Nodes[node];
+            std::lock_guard<std::mutex> lock(nodeCache.Lock);
+
+            if (!nodeCache.Blocks[sizeClass].empty())
+            {
+                block = nodeCache.Blocks[sizeClass].back();
+                nodeCache.Blocks[sizeClass].pop_back();
+                m_NodeCacheHits++;
+            }
+        }
+
+        if (block.pData == nullptr)
+        {
+            if (FAILED(hr = SystemAllocate(sizeClass, node, block)))
+                return hr;
+        }
+        else
+            m_Cached -= block.cbCommitted;
+    }
+
+    OnInUse(block.cbCommitted);
+
+    if (FAILED(hr = Grow(block, cbSize)))
+    {
+        Free(block);
+        return hr;
+    }
+    return S_OK;
+}
+
+HRESULT BufferPool::Grow(Block& block, size_t cbSize)
+{
+    if (block.Class == NotPooled || block.pData == nullptr)
+        return E_INVALIDARG;
+    if (cbSize > SizeClasses[block.Class])
+        return E_INVALIDARG;
+
+    if (cbSize <= block.cbCommitted)
+        return S_OK;
+
+    const auto cbCommit = std::min(((cbSize + m_cbPage - 1) / m_cbPage) * m_cbPage, SizeClasses[block.Class]);
+    if (VirtualAlloc(block.pData, cbCommit, MEM_COMMIT, PAGE_READWRITE) == nullptr)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    OnInUse(cbCommit - block.cbCommitted);
+    block.cbCommitted = cbCommit;
+    return S_OK;
+}
+
+void BufferPool::Free(Block& block)
+{
+    if (block.Class == NotPooled || block.pData == nullptr)
+        return;
+
+    OnInUse(-static_cast<LONGLONG>(block.cbCommitted));
+    m_Cached += block.cbCommitted;
+
+    if (t_CacheState != ThreadCacheState::Destroyed)
+    {
+        auto& blocks = GetThreadCache().Blocks[block.Class];
+        if (blocks.size() < ThreadCacheDepth[block.Class])
+        {
+            blocks.push_back(block);
+            block = Block();
+            return;
+        }
+    }
+
+    Release(block);
+}
+
+void BufferPool::Release(Block& block)
+{
+    {
+        auto& nodeCache = *m_Nodes[block.Node];
+        std::lock_guard<std::mutex> lock(nodeCache.Lock);
+
+        auto& blocks = nodeCache.Blocks[block.Class];
+        if (blocks.size() < NodeCacheDepth[block.Class])
+        {
+            blocks.push_back(block);
+            block = Block();
+            return;
+        }
+    }
+
+    m_Cached -= block.cbCommitted;
+    SystemFree(block);
+}
+
+void BufferPool::Trim()
+{
+    if (t_CacheState == ThreadCacheState::Alive)
+    {
+        for (auto& blocks : GetThreadCache().Blocks)
+        {
+            for (auto& block : blocks)
+            {
+                m_Cached -= block.cbCommitted;
+                SystemFree(block);
+            }
+            blocks.clear();
+        }
+    }
+
+    for (auto& node : m_Nodes)
+    {
+        std::lock_guard<std::mutex> lock(node->Lock);
+
+        for (auto& blocks : node->Blocks)
+        {
+            for (auto& block : blocks)
+            {
+                m_Cached -= block.cbCommitted;
+                SystemFree(block);
+            }
+            blocks.clear();
+        }
+    }
+}
+
+bool BufferPool::LargePagesRequested()
+{
+    return GetEnvironmentVariableW(OrcLargePagesEnv, NULL, 0L) != 0;
+}
+
+HRESULT BufferPool::EnableLargePages(const logger& pLog)
+{
+    HRESULT hr = E_FAIL;
+
+    const auto cbLargePage = GetLargePageMinimum();
+    if (cbLargePage == 0)
+    {
+        log::Warning(pLog, hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), L"Large pages are not supported\r\n");
+        return hr;
+    }
+
+    if (FAILED(hr = SetPrivilege(pLog, SE_LOCK_MEMORY_NAME, TRUE)))
+    {
+        log::Warning(pLog, hr, L"Failed to enable the lock memory privilege, large pages are not used\r\n");
+        return hr;
+    }
+
+    m_cbLargePage = cbLargePage;
+    m_bLargePages = true;
+    log::Verbose(pLog, L"Buffer pool uses %Iu bytes large pages\r\n", cbLargePage);
+    return S_OK;
+}
+
+BufferPool::Statistics BufferPool::GetStatistics() const
+{
+    Statistics retval;
+    retval.InUse = m_InUse;
+    retval.HighWater = m_HighWater;
+    retval.Cached = m_Cached;
+    retval.Allocations = m_Allocations;
+    retval.ThreadCacheHits = m_ThreadCacheHits;
+    retval.NodeCacheHits = m_NodeCacheHits;
+    retval.SystemAllocations = m_SystemAllocations;
+    return retval;
+}
+
+void BufferPool::LogStatistics(const logger& pLog) const
+{
+    const auto stats = GetStatistics();
+
+    if (stats.Allocations == 0LL)
+        return;
+
+    log::Verbose(
+        pLog,
+        L"Buffer pool: %I64u allocations (%I64u thread cache hits, %I64u node cache hits, %I64u system allocations), "
+        L"high water mark %I64u bytes\r\n",
+        stats.Allocations,
+        stats.ThreadCacheHits,
+        stats.NodeCacheHits,
+        stats.SystemAllocations,
+        stats.HighWater);
+}
@@ -0,0 +1,132 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+class LogFileWriter;
+
+//
+// BufferPool recycles the large I/O buffers (CBinaryBuffer, stream copy buffers, ...) instead of returning them to
+// the system after each file.
+//
+// Blocks are reserved with the size of their size class on the NUMA node of the allocating thread and committed on
+// demand, so a 1.1MB buffer only commits 1.1MB of its 4MB block. A freed block goes to a small cache local to the
+// freeing thread, then to the cache of its node, then back to the system.
+//
+// Large pages are used for the size classes they fit once EnableLargePages succeeded (the process must hold
+// SeLockMemoryPrivilege). The commands enable them when %DFIR-ORC_LARGE_PAGES% is set.
+//
+class ORCLIB_API BufferPool
+{
+public:
+    static constexpr size_t ClassCount = 4;
+    static constexpr std::array<size_t, ClassCount> SizeClasses = {0x10000, 0x100000, 0x400000, 0x1000000};
+    static constexpr BYTE NotPooled = 0xFF;
+
+    // Smaller buffers are left to the heap
+    static constexpr size_t MinPooledSize = 0x4000;
+
+    class Block
+    {
+    public:
+        BYTE* pData = nullptr;
+        size_t cbCommitted = 0;
+        BYTE Class = NotPooled;
+        BYTE Node = 0;
+        bool bLargePages = false;
+    };
+
+    class Statistics
+    {
+    public:
+        ULONGLONG InUse = 0LL;  // committed bytes held by buffers
+        ULONGLONG HighWater = 0LL;  // maximum of InUse
+        ULONGLONG Cached = 0LL;  // committed bytes waiting in the caches
+        ULONGLONG Allocations = 0LL;
+        ULONGLONG ThreadCacheHits = 0LL;
+        ULONGLONG NodeCacheHits = 0LL;
+        ULONGLONG SystemAllocations = 0LL;
+    };
+
+    static BufferPool& Instance();
+
+    // Size class able to hold cbSize bytes, NotPooled when cbSize is out of the pooled range
+    static BYTE GetSizeClass(size_t cbSize);
+
+    // Commits at least cbSize bytes
+    HRESULT Allocate(size_t cbSize, Block& block);
+    // Commits at least cbSize bytes in the same block, cbSize must fit in the block's size class
+    HRESULT Grow(Block& block, size_t cbSize);
+    void Free(Block& block);
+
+    static bool LargePagesRequested();
+    HRESULT EnableLargePages(const logger& pLog);
+    // Returns the blocks cached by the calling thread and on the nodes to the system (the caches of the other
+    // threads are returned when they exit)
+    void Trim();
+
+    Statistics GetStatistics() const;
+    void LogStatistics(const logger& pLog) const;
+
+    BufferPool(const BufferPool&) = delete;
+
+private:
+    class ThreadCache;
+    friend class ThreadCache;
+
+    class NodeCache
+    {
+    public:
+        std::mutex Lock;
+        std::array<std::vector<Block>, ClassCount> Blocks;
+    };
+
+    static constexpr std::array<size_t, ClassCount> ThreadCacheDepth = {8, 4, 2, 1};
+    static constexpr std::array<size_t, ClassCount> NodeCacheDepth = {64, 32, 16, 4};
+
+    BufferPool();
+
+    static ThreadCache& GetThreadCache();
+
+    BYTE GetCurrentNode() const;
+    HRESULT SystemAllocate(BYTE sizeClass, BYTE node, Block& block);
+    void SystemFree(Block& block);
+    // Gives a block back to its node cache, or to the system when the cache is full
+    void Release(Block& block);
+
+    void OnInUse(LONGLONG llDelta);
+
+    std::vector<std::unique_ptr<NodeCache>> m_Nodes;
+
+    size_t m_cbPage = 0x1000;
+    size_t m_cbLargePage = 0;
+    bool m_bLargePages = false;
+
+    std::atomic<ULONGLONG> m_InUse = 0LL;
+    std::atomic<ULONGLONG> m_HighWater = 0LL;
+    std::atomic<ULONGLONG> m_Cached = 0LL;
+    std::atomic<ULONGLONG> m_Allocations = 0LL;
+    std::atomic<ULONGLONG> m_ThreadCacheHits = 0LL;
+    std::atomic<ULONGLONG> m_NodeCacheHits = 0LL;
+    std::atomic<ULONGLONG> m_SystemAllocations = 0LL;
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
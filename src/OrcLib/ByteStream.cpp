@@ -23,6 +23,11 @@
 #include "IStreamWrapper.h"
 #include "ISequentialStreamWrapper.h"
 
+#include <agents.h>
+#include <ppl.h>
+
+#include <atomic>
+
 using namespace std;
 
 using namespace Orc;
@@ -57,14 +62,19 @@ HRESULT ByteStream::CopyTo(
 }
 
 HRESULT ByteStream::CopyTo(__in ByteStream& outStream, const ULONGLONG ullChunk, __out_opt PULONGLONG pcbBytesWritten)
+{
+    return CopyTo(outStream, ullChunk, DEFAULT_COPY_DEPTH, pcbBytesWritten);
+}
+
+HRESULT ByteStream::CopyTo(
+    __in ByteStream& outStream,
+    const ULONGLONG ullChunk,
+    const DWORD dwDepth,
+    __out_opt PULONGLONG pcbBytesWritten)
 {
     HRESULT hr = E_FAIL;
     ULONG64 qwBytesCopied = 0;
-    ULONGLONG ullBytesRead = 0;
     ULONGLONG ullBytesWritten = 0;
-    CBinaryBuffer buffer(true);
-
-    buffer.SetCount(static_cast<size_t>(ullChunk));
 
     if (pcbBytesWritten)
         *pcbBytesWritten = 0LL;
@@ -74,27 +84,181 @@ HRESULT ByteStream::CopyTo(__in ByteStream& outStream, const ULONGLONG ullChunk,
     if (FAILED(hr = SetFilePointer(0, SEEK_SET, NULL)))
         return hr;
 
-    while (qwBytesCopied < GetSize())
-    {
-        if (FAILED(hr = Read(buffer.GetData(), buffer.GetCount(), &ullBytesRead)))
-            return hr;
+    if (GetSize() == 0LL)
+        return S_OK;
+
+    View view;
+    if (FAILED(hr = ReadView(ullChunk, view)))
+        return hr;
 
-        if (ullBytesRead == 0LL)
-            break;  // When read returns 0 bytes read, we have reached the end of the file
+    // Memory lent without an owner is only valid until the next read: there is no latency to hide there anyway
+    if (dwDepth > 1 && view.Owner != nullptr && view.cbData < GetSize())
+        return PipelinedCopyTo(outStream, ullChunk, dwDepth, std::move(view), pcbBytesWritten);
 
-        if (FAILED(hr = outStream.Write(buffer.GetData(), ullBytesRead, &ullBytesWritten)))
+    while (!view.empty())
+    {
+        if (FAILED(hr = outStream.CommitView(view, &ullBytesWritten)))
             return hr;
 
-        _ASSERT(ullBytesRead == ullBytesWritten);
-        qwBytesCopied += ullBytesRead;
+        _ASSERT(view.cbData == ullBytesWritten);
+        qwBytesCopied += view.cbData;
 
         if (pcbBytesWritten)
             *pcbBytesWritten = qwBytesCopied;
+
+        if (qwBytesCopied >= GetSize())
+            break;
+
+        // When read returns 0 bytes read, we have reached the end of the file
+        if (FAILED(hr = ReadView(ullChunk, view)))
+            return hr;
     }
 
     return S_OK;
 }
 
+HRESULT ByteStream::PipelinedCopyTo(
+    ByteStream& outStream,
+    ULONGLONG ullChunk,
+    DWORD dwDepth,
+    View&& firstView,
+    PULONGLONG pcbBytesWritten)
+{
+    // An empty view ends the copy
+    Concurrency::unbounded_buffer<View> filled;
+    // One message per chunk the reader may still read ahead
+    Concurrency::unbounded_buffer<bool> slots;
+
+    std::atomic<bool> bStop = false;
+    HRESULT hrRead = S_OK;
+
+    for (DWORD i = 1; i < dwDepth; i++)
+        Concurrency::send(slots, true);
+
+    ULONGLONG ullBytesRead = firstView.cbData;
+    Concurrency::send(filled, std::move(firstView));
+
+    Concurrency::task_group reader;
+    reader.run([&]() {
+        try
+        {
+            while (ullBytesRead < GetSize())
+            {
+                Concurrency::receive(slots);
+                if (bStop)
+                    break;
+
+                View view;
+                if (FAILED(hrRead = ReadView(ullChunk, view)) || view.empty())
+                    break;
+
+                ullBytesRead += view.cbData;
+                Concurrency::send(filled, std::move(view));
+            }
+        }
+        catch (const std::bad_alloc&)
+        {
+            log::Error(_L_, hrRead = E_OUTOFMEMORY, L"Failed to read ahead of the copy\r\n");
+        }
+        catch (...)
+        {
+            log::Error(_L_, hrRead = E_FAIL, L"Reading ahead of the copy threw an exception\r\n");
+        }
+        // The writer waits for this empty view whatever happened to the reader
+        Concurrency::send(filled, View());
+    });
+
+    HRESULT hr = S_OK;
+    ULONGLONG qwBytesCopied = 0LL;
+
+    // The writer keeps draining after a failure so that the reader is never left waiting for a slot
+    while (true)
+    {
+        View view = Concurrency::receive(filled);
+        if (view.empty())
+            break;
+
+        if (SUCCEEDED(hr))
+        {
+            ULONGLONG ullBytesWritten = 0LL;
+            if (FAILED(hr = outStream.CommitView(view, &ullBytesWritten)))
+            {
+                bStop = true;
+            }
+            else
+            {
+                _ASSERT(view.cbData == ullBytesWritten);
+                qwBytesCopied += view.cbData;
+
+                if (pcbBytesWritten)
+                    *pcbBytesWritten = qwBytesCopied;
+            }
+        }
+
+        // The chunk must be released before the reader is allowed to read another one
+        view = View();
+        Concurrency::send(slots, true);
+    }
+
+    reader.wait();
+
+    if (FAILED(hr))
+        return hr;
+    return hrRead;
+}
+
+/*
+    ByteStream::ReadView
+
+    Default implementation for the streams unaware of views: data is read into a buffer owned by the stream, which
+    is re-used as long as the previous view was released
+*/
+HRESULT ByteStream::ReadView(__in ULONGLONG cbBytes, __out View& view)
+{
+    HRESULT hr = E_FAIL;
+
+    view = View();
+
+    if (cbBytes > MAXDWORD)
+        return E_INVALIDARG;
+
+    if (m_pViewBuffer == nullptr || m_pViewBuffer.use_count() > 1)
+        m_pViewBuffer = std::make_shared<CBinaryBuffer>(true);
+
+    if (m_pViewBuffer->GetCount() < cbBytes)
+    {
+        if (!m_pViewBuffer->SetCount(static_cast<size_t>(cbBytes)))
+            return E_OUTOFMEMORY;
+    }
+
+    ULONGLONG ullBytesRead = 0LL;
+    if (FAILED(hr = Read(m_pViewBuffer->GetData(), cbBytes, &ullBytesRead)))
+        return hr;
+
+    view.Owner = m_pViewBuffer;
+    view.pData = m_pViewBuffer->GetData();
+    view.cbData = ullBytesRead;
+    return S_OK;
+}
+
+HRESULT ByteStream::CommitView(__in const View& view, __out_opt PULONGLONG pcbBytesWritten)
+{
+    ULONGLONG ullBytesWritten = 0LL;
+
+    if (pcbBytesWritten)
+        *pcbBytesWritten = 0LL;
+
+    if (view.empty())
+        return S_OK;
+
+    // Write does not modify the buffer it is given
+    auto hr = Write(const_cast<BYTE*>(view.pData), view.cbData, &ullBytesWritten);
+
+    if (pcbBytesWritten)
+        *pcbBytesWritten = ullBytesWritten;
+    return hr;
+}
+
 std::shared_ptr<ByteStream> ByteStream::_GetHashStream()
 {
     return nullptr;
@@ -42,7 +42,34 @@ protected:
     virtual std::shared_ptr<ByteStream> _GetHashStream();
     virtual std::shared_ptr<ByteStream> _GetXORStream();
 
+    // Buffer lent by the default ReadView, re-used as soon as no view holds it anymore
+    std::shared_ptr<CBinaryBuffer> m_pViewBuffer;
+
+    // Reads on a separate task while outStream writes, with up to dwDepth chunks in flight
+    HRESULT PipelinedCopyTo(
+        ByteStream& outStream,
+        ULONGLONG ullChunk,
+        DWORD dwDepth,
+        View&& firstView,
+        PULONGLONG pcbBytesWritten);
+
 public:
+    //
+    // View is a read only slice of data lent by a stream: pass-through stages (hash, tee, ...) observe it without
+    // copying it into a buffer of their own.
+    // The data is valid until the next call on the lending stream, unless Owner is kept alive: the streams lending
+    // their own pooled buffer only re-use it once no view references it anymore.
+    //
+    class View
+    {
+    public:
+        std::shared_ptr<void> Owner;
+        const BYTE* pData = nullptr;
+        ULONGLONG cbData = 0LL;
+
+        bool empty() const { return cbData == 0LL; }
+    };
+
     virtual ~ByteStream();
 
     STDMETHOD(IsOpen)() PURE;
@@ -61,6 +88,12 @@ public:
     STDMETHOD(SetFilePointer)
     (__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer) PURE;
 
+    // Borrows up to cbBytes of data, an empty view means the end of the stream.
+    // Streams unaware of views are read into a pooled buffer.
+    STDMETHOD(ReadView)(__in ULONGLONG cbBytes, __out View& view);
+    // Writes a borrowed view, streams unaware of views copy it with Write
+    STDMETHOD(CommitView)(__in const View& view, __out_opt PULONGLONG pcbBytesWritten);
+
     STDMETHOD(CopyTo)(__in const std::shared_ptr<ByteStream>& pOutStream, __out_opt PULONGLONG pcbBytesWritten);
 
     STDMETHOD(CopyTo)(__in ByteStream& pOutStream, __out_opt PULONGLONG pcbBytesWritten);
@@ -73,6 +106,13 @@ public:
     STDMETHOD(CopyTo)
     (__in ByteStream& pOutStream, __in const ULONGLONG ullChunk, __out_opt PULONGLONG pcbBytesWritten);
 
+    // Source reads overlap destination writes when more than one chunk is copied and dwDepth > 1
+    STDMETHOD(CopyTo)
+    (__in ByteStream& pOutStream,
+     __in const ULONGLONG ullChunk,
+     __in const DWORD dwDepth,
+     __out_opt PULONGLONG pcbBytesWritten);
+
     STDMETHOD_(ULONG64, GetSize)() PURE;
     STDMETHOD(SetSize)(ULONG64) PURE;
 
@@ -91,5 +131,7 @@ public:
 }  // namespace Orc
 
 constexpr auto DEFAULT_READ_SIZE = (0x0200000);
+// Number of chunks a pipelined CopyTo keeps in flight between its reader and its writer
+constexpr auto DEFAULT_COPY_DEPTH = (3);
 
 #pragma managed(pop)
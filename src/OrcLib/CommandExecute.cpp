@@ -684,6 +684,14 @@ HRESULT CommandExecute::CompleteExecution(ArchiveMessage::ITarget* pCab)
         action->CancelTerminationHandler();
     });
 
+    // Everything this command produced is now queued to the archive. A command that failed or was killed is not
+    // recorded as complete so that a resumed run executes it again
+    if (pCab != nullptr && m_dwExitCode == 0L)
+        Concurrency::send(pCab, ArchiveMessage::MakeCompleteUnitRequest(m_Keyword));
+    else if (pCab != nullptr)
+        log::Verbose(
+            _L_, L"Command %s exited with 0x%lX, it will run again on resume\r\n", m_Keyword.c_str(), m_dwExitCode);
+
     CloseHandle(m_pi.hProcess);
     m_pi.hProcess = INVALID_HANDLE_VALUE;
     CloseHandle(m_pi.hThread);
@@ -0,0 +1,137 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "CompressionPolicy.h"
+
+#include "LogFileWriter.h"
+
+#include <cmath>
+#include <string_view>
+
+using namespace Orc;
+
+namespace {
+
+class Magic
+{
+public:
+    size_t Offset;
+    std::string_view Bytes;
+};
+
+using namespace std::string_view_literals;
+
+// Formats whose payload is already compressed
+const Magic g_CompressedMagics[] = {
+    {0, "PK\x03\x04"sv},  // zip, docx, jar, ...
+    {0, "7z\xBC\xAF\x27\x1C"sv},
+    {0, "MSCF"sv},  // cabinet
+    {0, "\x1F\x8B"sv},  // gzip
+    {0, "BZh"sv},
+    {0, "\xFD" "7zXZ\x00"sv},
+    {0, "\x28\xB5\x2F\xFD"sv},  // zstandard
+    {0, "\x04\x22\x4D\x18"sv},  // lz4
+    {0, "Rar!\x1A\x07"sv},
+    {0, "\xFF\xD8\xFF"sv},  // jpeg
+    {0, "\x89PNG\r\n\x1A\n"sv},
+    {0, "GIF8"sv},
+    {0, "PAR1"sv},  // parquet
+    {4, "ftyp"sv},  // mp4, mov
+};
+
+}  // namespace
+
+bool CompressionPolicy::IsCompressedFormat(const BYTE* pSample, size_t cbSample)
+{
+    const std::string_view sample(reinterpret_cast<const char*>(pSample), cbSample);
+
+    for (const auto& magic : g_CompressedMagics)
+    {
+        if (sample.size() >= magic.Offset + magic.Bytes.size()
+            && sample.substr(magic.Offset, magic.Bytes.size()) == magic.Bytes)
+            return true;
+    }
+    return false;
+}
+
+double CompressionPolicy::Entropy(const BYTE* pSample, size_t cbSample)
+{
+    if (cbSample == 0)
+        return 0.0;
+
+    std::array<size_t, 256> counts = {};
+    for (size_t i = 0; i < cbSample; i++)
+        counts[pSample[i]]++;
+
+    double entropy = 0.0;
+    for (auto count : counts)
+    {
+        if (count == 0)
+            continue;
+        const double p = (double)count / cbSample;
+        entropy -= p * std::log2(p);
+    }
+    return entropy;
+}
+
+CompressionPolicy::Decision CompressionPolicy::Evaluate(const BYTE* pSample, size_t cbSample, bool bComplete)
+{
+    if (bComplete && cbSample < TinySize)
+        return Decision::Store;
+
+    if (IsCompressedFormat(pSample, cbSample))
+        return Decision::Store;
+
+    const auto entropy = Entropy(pSample, cbSample);
+    if (entropy >= StoreEntropy)
+        return Decision::Store;
+    if (entropy >= FastEntropy)
+        return Decision::Fast;
+    return Decision::Strong;
+}
+
+PCWSTR CompressionPolicy::ToString(Decision decision)
+{
+    switch (decision)
+    {
+        case Decision::Store:
+            return L"store";
+        case Decision::Fast:
+            return L"fast";
+        case Decision::Strong:
+            return L"strong";
+        default:
+            return L"default";
+    }
+}
+
+void CompressionPolicy::Statistics::Add(Decision decision, ULONGLONG ullUncompressed, ULONGLONG ullCompressed)
+{
+    const auto index = static_cast<size_t>(decision);
+    Entries[index]++;
+    UncompressedSize[index] += ullUncompressed;
+    CompressedSize[index] += ullCompressed;
+}
+
+void CompressionPolicy::Statistics::Log(const logger& pLog) const
+{
+    for (size_t i = 0; i < DecisionCount; i++)
+    {
+        if (Entries[i] == 0LL)
+            continue;
+
+        log::Verbose(
+            pLog,
+            L"Compression policy: %I64u entries %s (%I64u bytes compressed to %I64u bytes)\r\n",
+            Entries[i],
+            ToString(static_cast<Decision>(i)),
+            UncompressedSize[i],
+            CompressedSize[i]);
+    }
+}
@@ -0,0 +1,70 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include <array>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+class LogFileWriter;
+
+//
+// CompressionPolicy chooses how an archive entry is compressed from a sample of its first bytes: entries already
+// compressed (known magic or near random bytes) and tiny entries are stored, dense binaries get a fast level and the
+// rest gets the archive's level.
+//
+class ORCLIB_API CompressionPolicy
+{
+public:
+    enum class Decision : BYTE
+    {
+        Default,  // not evaluated: the archive's level
+        Store,
+        Fast,
+        Strong
+    };
+    static constexpr size_t DecisionCount = 4;
+
+    static constexpr size_t SampleSize = 0x10000;
+
+    // Smaller entries do not shrink enough to pay for their compression
+    static constexpr size_t TinySize = 256;
+
+    // Shannon entropy of the sample, in bits per byte
+    static constexpr double StoreEntropy = 7.5;
+    static constexpr double FastEntropy = 6.5;
+
+    static constexpr DWORD FastLevel = 1L;
+
+    class Statistics
+    {
+    public:
+        std::array<ULONGLONG, DecisionCount> Entries = {};
+        std::array<ULONGLONG, DecisionCount> UncompressedSize = {};
+        std::array<ULONGLONG, DecisionCount> CompressedSize = {};
+
+        void Add(Decision decision, ULONGLONG ullUncompressed, ULONGLONG ullCompressed);
+        void Log(const logger& pLog) const;
+    };
+
+    // bComplete is true when the sample holds the whole entry
+    static Decision Evaluate(const BYTE* pSample, size_t cbSample, bool bComplete);
+
+    static double Entropy(const BYTE* pSample, size_t cbSample);
+    static bool IsCompressedFormat(const BYTE* pSample, size_t cbSample);
+
+    static PCWSTR ToString(Decision decision);
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
@@ -176,6 +176,8 @@ HRESULT Orc::Config::Common::ntfs_criterias(ConfigItem& parent, DWORD dwIndex)
         return hr;
     if (FAILED(hr = parent[dwIndex].AddAttribute(L"yara_rule", CONFIG_FILEFIND_YARA_RULE, ConfigItem::OPTION)))
         return hr;
+    if (FAILED(hr = parent[dwIndex].AddAttribute(L"hashset", CONFIG_FILEFIND_HASHSET, ConfigItem::OPTION)))
+        return hr;
     return S_OK;
 }
 
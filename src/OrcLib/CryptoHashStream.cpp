@@ -12,8 +12,6 @@
 
 #include "LogFileWriter.h"
 
-#include "SystemDetails.h"
-
 #include "CryptoUtilities.h"
 #include "CaseInsensitive.h"
 
@@ -24,18 +22,9 @@ using namespace std;
 
 using namespace Orc;
 
-HCRYPTPROV CryptoHashStream::g_hProv = NULL;
-
 CryptoHashStream::~CryptoHashStream(void)
 {
     Close();
-    if (m_MD5 != NULL)
-        CryptDestroyHash(m_MD5);
-    if (m_Sha1 != NULL)
-        CryptDestroyHash(m_Sha1);
-    if (m_Sha256 != NULL)
-        CryptDestroyHash(m_Sha256);
-    m_MD5 = m_Sha1 = m_Sha256 = NULL;
     m_bHashIsValid = false;
 }
 
@@ -78,63 +67,15 @@ HRESULT CryptoHashStream::OpenToWrite(SupportedAlgorithm algs, const std::shared
 
 HRESULT CryptoHashStream::ResetHash(bool bContinue)
 {
-    HRESULT hr = S_OK;
-
-    if (m_MD5 != NULL)
-        CryptDestroyHash(m_MD5);
-    if (m_Sha1 != NULL)
-        CryptDestroyHash(m_Sha1);
-    if (m_Sha256 != NULL)
-        CryptDestroyHash(m_Sha256);
-
-    m_MD5 = m_Sha1 = m_Sha256 = NULL;
-    m_bHashIsValid = false;
-
-    if (bContinue)
-    {
-        if (g_hProv == NULL)
-        {
-            // Acquire the best available crypto provider
-            if (FAILED(hr = CryptoUtilities::AcquireContext(_L_, g_hProv)))
-            {
-                log::Error(_L_, hr, L"Failed to initalize providers\r\n");
-                return hr;
-            }
-        }
-        m_bHashIsValid = true;
-
-        if ((m_Algorithms & MD5) && !CryptCreateHash(g_hProv, CALG_MD5, 0, 0, &m_MD5))
-        {
-            log::Verbose(_L_, L"Failed to initialise MD5 hash (hr=0x%lx)\r\n", hr = HRESULT_FROM_WIN32(GetLastError()));
-        }
-        if ((m_Algorithms & SHA1) && !CryptCreateHash(g_hProv, CALG_SHA1, 0, 0, &m_Sha1))
-        {
-            log::Verbose(
-                _L_, L"Failed to initialise SHA1 hash (hr=0x%lx)\r\n", hr = HRESULT_FROM_WIN32(GetLastError()));
-        }
-        if ((m_Algorithms & SHA256) && !CryptCreateHash(g_hProv, CALG_SHA_256, 0, 0, &m_Sha256))
-        {
-            log::Verbose(
-                _L_, L"Failed to initialise SHA256 hash (hr=0x%lx)\r\n", hr = HRESULT_FROM_WIN32(GetLastError()));
-        }
-    }
+    m_Engine.Reset(bContinue ? m_Algorithms : SupportedAlgorithm::Undefined);
+    m_bHashIsValid = bContinue;
     return S_OK;
 }
 
 HRESULT CryptoHashStream::HashData(LPBYTE pBuffer, DWORD dwBytesToHash)
 {
     if (m_bHashIsValid)
-    {
-        if (m_MD5)
-            if (!CryptHashData(m_MD5, pBuffer, dwBytesToHash, 0))
-                return HRESULT_FROM_WIN32(GetLastError());
-        if (m_Sha1)
-            if (!CryptHashData(m_Sha1, pBuffer, dwBytesToHash, 0))
-                return HRESULT_FROM_WIN32(GetLastError());
-        if (m_Sha256)
-            if (!CryptHashData(m_Sha256, pBuffer, dwBytesToHash, 0))
-                return HRESULT_FROM_WIN32(GetLastError());
-    }
+        m_Engine.Update(pBuffer, dwBytesToHash);
     return S_OK;
 }
 
@@ -142,27 +83,23 @@ HRESULT CryptoHashStream::GetHash(SupportedAlgorithm alg, CBinaryBuffer& hash)
 {
     if (m_bHashIsValid)
     {
-        HCRYPTHASH hHash = NULL;
         DWORD cbHash = 0L;
         switch (alg)
         {
             case MD5:
                 cbHash = BYTES_IN_MD5_HASH;
-                hHash = m_MD5;
                 break;
             case SHA1:
                 cbHash = BYTES_IN_SHA1_HASH;
-                hHash = m_Sha1;
                 break;
             case SHA256:
                 cbHash = BYTES_IN_SHA256_HASH;
-                hHash = m_Sha256;
                 break;
             default:
                 return E_INVALIDARG;
         }
 
-        if (hHash == NULL)
+        if (!(m_Algorithms & alg))
         {
             hash.RemoveAll();
             return MK_E_UNAVAILABLE;
@@ -170,8 +107,7 @@ HRESULT CryptoHashStream::GetHash(SupportedAlgorithm alg, CBinaryBuffer& hash)
 
         hash.SetCount(cbHash);
         hash.ZeroMe();
-        if (!CryptGetHashParam(hHash, HP_HASHVAL, hash.GetData(), &cbHash, 0))
-            return HRESULT_FROM_WIN32(GetLastError());
+        return m_Engine.GetDigest(alg, hash.GetData(), cbHash);
     }
     else
         hash.SetCount(0);
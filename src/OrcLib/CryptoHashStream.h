@@ -9,6 +9,7 @@
 #pragma once
 
 #include "HashStream.h"
+#include "HashEngine.h"
 
 #include <memory>
 
@@ -20,14 +21,6 @@ namespace Orc {
 
 class LogFileWriter;
 
-enum SupportedAlgorithm : char
-{
-    Undefined = 0,
-    MD5 = 1 << 0,
-    SHA1 = 1 << 1,
-    SHA256 = 1 << 2
-};
-
 class ORCLIB_API CryptoHashStream : public HashStream
 {
 public:
@@ -57,11 +50,7 @@ public:
 
 protected:
     SupportedAlgorithm m_Algorithms;
-    HCRYPTHASH m_Sha1;
-    HCRYPTHASH m_Sha256;
-    HCRYPTHASH m_MD5;
-
-    static HCRYPTPROV g_hProv;
+    HashEngine m_Engine;
 
     STDMETHOD(ResetHash(bool bContinue = false));
     STDMETHOD(HashData(LPBYTE pBuffer, DWORD dwBytesToHash));
@@ -69,9 +58,7 @@ protected:
 public:
     CryptoHashStream(logger pLog)
         : HashStream(std::move(pLog))
-        , m_Sha256(NULL)
-        , m_Sha1(NULL)
-        , m_MD5(NULL) {};
+        , m_Algorithms(SupportedAlgorithm::Undefined) {};
 
     ~CryptoHashStream(void);
 
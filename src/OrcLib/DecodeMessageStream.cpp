@@ -8,12 +8,114 @@
 #include "stdafx.h"
 
 #include "DecodeMessageStream.h"
+#include "EnvelopeStructures.h"
+#include "GcmChunkCipher.h"
+#include "HashEngine.h"
 #include "LogFileWriter.h"
 
 #include "boost/scope_exit.hpp"
 
+#include <ncrypt.h>
+
+#include <array>
+#include <thread>
+
 using namespace Orc;
 
+class DecodeMessageStream::ChunkedEnvelope
+{
+public:
+    // Header and recipients, as read so far
+    std::vector<BYTE> HeaderBytes;
+    bool bHeaderComplete = false;
+
+    PCCERT_CONTEXT pDecryptor = nullptr;
+    GcmChunkCipher Gcm;
+
+    CBinaryBuffer Buffer;
+    DWORD dwBufferedData = 0L;
+    ULONGLONG ullChunksRead = 0LL;
+    bool bClosed = false;
+
+    const Envelope::Header& Header() const { return *reinterpret_cast<const Envelope::Header*>(HeaderBytes.data()); }
+
+    // Size of the header and recipients as far as the bytes read so far tell, 0 when they are invalid
+    size_t HeaderSize() const
+    {
+        if (HeaderBytes.size() < sizeof(Envelope::Header))
+            return sizeof(Envelope::Header);
+
+        const auto& header = Header();
+        if (memcmp(header.Magic, Envelope::Magic, sizeof(Envelope::Magic)) || header.Version != Envelope::Version
+            || header.ChunkSize == 0L || header.ChunkSize > GcmChunkCipher::MaxChunkSize || header.RecipientCount == 0L
+            || header.RecipientCount > Envelope::MaxRecipients)
+            return 0;
+
+        size_t cbHeader = sizeof(Envelope::Header);
+        for (DWORD i = 0; i < header.RecipientCount; i++)
+        {
+            if (HeaderBytes.size() < cbHeader + sizeof(Envelope::Recipient))
+                return cbHeader + sizeof(Envelope::Recipient);
+
+            const auto& recipient = *reinterpret_cast<const Envelope::Recipient*>(HeaderBytes.data() + cbHeader);
+            if (recipient.WrappedKeySize == 0L || recipient.WrappedKeySize > Envelope::MaxWrappedKeySize)
+                return 0;
+            cbHeader += sizeof(Envelope::Recipient) + recipient.WrappedKeySize;
+        }
+        return cbHeader;
+    }
+
+    // Opens nbChunks sealed chunks from Buffer, the last one possibly final, and drops them from the buffer
+    HRESULT ReadChunks(const logger& pLog, ByteStream& output, DWORD nbChunks, DWORD cbLastSealed, bool bFinal)
+    {
+        HRESULT hr = E_FAIL;
+        const DWORD cbSealedChunk = Gcm.ChunkSize() + GcmChunkCipher::TagLength;
+
+        ULONGLONG ullFailedChunk = 0LL;
+        if (FAILED(
+                hr = Gcm.OpenChunks(
+                    output, ullChunksRead, Buffer.GetData(), nbChunks, cbLastSealed, bFinal, ullFailedChunk)))
+        {
+            if (hr == GcmChunkCipher::AuthenticationFailure)
+                log::Error(pLog, hr, L"Envelope chunk %I64d failed authentication (altered data)\r\n", ullFailedChunk);
+            else
+                log::Error(pLog, hr, L"Failed to decrypt or write envelope chunk %I64d\r\n", ullFailedChunk);
+            return hr;
+        }
+        ullChunksRead += nbChunks;
+
+        const DWORD dwConsumed = (nbChunks - 1) * cbSealedChunk + cbLastSealed;
+        _ASSERT(dwConsumed <= dwBufferedData);
+
+        if (dwConsumed < dwBufferedData)
+            MoveMemory(Buffer.GetData(), Buffer.GetData() + dwConsumed, dwBufferedData - dwConsumed);
+        dwBufferedData -= dwConsumed;
+        return S_OK;
+    }
+
+    ~ChunkedEnvelope()
+    {
+        if (pDecryptor != nullptr)
+            CertFreeCertificateContext(pDecryptor);
+    }
+};
+
+DecodeMessageStream::DecodeMessageStream(logger pLog)
+    : MessageStream(std::move(pLog))
+{
+    ZeroMemory(&m_DecryptParam, sizeof(CMSG_CTRL_DECRYPT_PARA));
+    m_DecryptParam.cbSize = sizeof(CMSG_CTRL_DECRYPT_PARA);
+}
+
+PCCERT_CONTEXT DecodeMessageStream::GetDecryptor() const
+{
+    if (m_pChunked)
+        return m_pChunked->pDecryptor;
+    if (m_DecryptParam.hCryptProv != NULL)
+        return m_Recipients[m_DecryptParam.dwRecipientIndex];
+    return nullptr;
+}
+
 STDMETHODIMP DecodeMessageStream::Initialize(const std::shared_ptr<ByteStream>& pInnerStream)
 {
     HRESULT hr = E_FAIL;
@@ -279,10 +381,222 @@ HRESULT DecodeMessageStream::GetDecryptionMaterial()
     return S_OK;
 }
 
-HRESULT DecodeMessageStream::Write(
-    __in_bcount(cbBytes) const PVOID pBuffer,
-    __in ULONGLONG cbBytes,
-    __out PULONGLONG pcbBytesWritten)
+HRESULT DecodeMessageStream::UnwrapContentKey(const BYTE* pRecipient, BYTE* pKey, PCCERT_CONTEXT& pCertContext)
+{
+    HRESULT hr = E_FAIL;
+
+    const auto& recipient = *reinterpret_cast<const Envelope::Recipient*>(pRecipient);
+    const BYTE* pWrappedKey = pRecipient + sizeof(Envelope::Recipient);
+
+    CRYPT_HASH_BLOB thumbprint = {sizeof(recipient.Thumbprint), const_cast<BYTE*>(recipient.Thumbprint)};
+
+    PCCERT_CONTEXT pCandidate = CertFindCertificateInStore(
+        m_hSystemStore, X509_ASN_ENCODING | PKCS_7_ASN_ENCODING, 0L, CERT_FIND_SHA1_HASH, &thumbprint, NULL);
+    if (pCandidate == NULL)
+    {
+        log::Verbose(
+            _L_,
+            L"Unknown certificate (thumbprint=%s)\r\n",
+            CBinaryBuffer(thumbprint.pbData, thumbprint.cbData).ToHex().c_str());
+        return CRYPT_E_NOT_FOUND;
+    }
+    BOOST_SCOPE_EXIT((&pCandidate)) if (pCandidate != NULL) CertFreeCertificateContext(pCandidate);
+    BOOST_SCOPE_EXIT_END;
+
+    HCRYPTPROV_OR_NCRYPT_KEY_HANDLE hKeyHandle = NULL;
+    DWORD dwKeySpec = 0L;
+    BOOL fCallerFreeProvOrNCryptKey = FALSE;
+
+    if (!CryptAcquireCertificatePrivateKey(
+            pCandidate,
+            CRYPT_ACQUIRE_SILENT_FLAG | CRYPT_ACQUIRE_ONLY_NCRYPT_KEY_FLAG,
+            NULL,
+            &hKeyHandle,
+            &dwKeySpec,
+            &fCallerFreeProvOrNCryptKey))
+    {
+        log::Verbose(_L_, L"CryptAcquireCertificatePrivateKey failed (0x%lx)\r\n", HRESULT_FROM_WIN32(GetLastError()));
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    BOOST_SCOPE_EXIT((hKeyHandle)(fCallerFreeProvOrNCryptKey))
+    {
+        if (fCallerFreeProvOrNCryptKey)
+            NCryptFreeObject(hKeyHandle);
+    }
+    BOOST_SCOPE_EXIT_END;
+
+    BCRYPT_OAEP_PADDING_INFO padding = {BCRYPT_SHA256_ALGORITHM, NULL, 0L};
+
+    DWORD cbKey = 0L;
+    SECURITY_STATUS status = NCryptDecrypt(
+        hKeyHandle,
+        const_cast<BYTE*>(pWrappedKey),
+        recipient.WrappedKeySize,
+        &padding,
+        pKey,
+        GcmChunkCipher::KeyLength,
+        &cbKey,
+        NCRYPT_PAD_OAEP_FLAG);
+    if (status != ERROR_SUCCESS || cbKey != GcmChunkCipher::KeyLength)
+    {
+        log::Error(_L_, hr = (HRESULT)status, L"Failed to unwrap content key\r\n");
+        return FAILED(hr) ? hr : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    pCertContext = pCandidate;
+    pCandidate = NULL;
+    return S_OK;
+}
+
+HRESULT DecodeMessageStream::OpenEnvelope()
+{
+    HRESULT hr = E_FAIL;
+
+    auto& envelope = *m_pChunked;
+    const auto& header = envelope.Header();
+
+    std::array<BYTE, GcmChunkCipher::KeyLength> key;
+    BOOST_SCOPE_EXIT(&key) { SecureZeroMemory(key.data(), key.size()); }
+    BOOST_SCOPE_EXIT_END;
+
+    size_t offset = sizeof(Envelope::Header);
+    for (DWORD i = 0; i < header.RecipientCount && envelope.pDecryptor == nullptr; i++)
+    {
+        const BYTE* pRecipient = envelope.HeaderBytes.data() + offset;
+        const auto& recipient = *reinterpret_cast<const Envelope::Recipient*>(pRecipient);
+
+        UnwrapContentKey(pRecipient, key.data(), envelope.pDecryptor);
+        offset += sizeof(Envelope::Recipient) + recipient.WrappedKeySize;
+    }
+
+    if (envelope.pDecryptor == nullptr)
+    {
+        log::Error(
+            _L_, hr = CRYPT_E_NO_DECRYPT_CERT, L"No private key is available for the recipients of the envelope\r\n");
+        return hr;
+    }
+    log::Verbose(_L_, L"Decryption information is now available\r\n");
+
+    // Each chunk authenticates the header and the recipients
+    HashEngine::SHA256Digest digest;
+    HashEngine engine(SupportedAlgorithm::SHA256);
+    engine.Update(envelope.HeaderBytes.data(), envelope.HeaderBytes.size());
+    if (FAILED(hr = engine.GetDigest(SupportedAlgorithm::SHA256, digest.data(), (DWORD)digest.size())))
+        return hr;
+
+    const auto dwCores = std::max(1u, std::thread::hardware_concurrency());
+    if (FAILED(
+            hr = envelope.Gcm.Initialize(
+                key.data(),
+                header.NoncePrefix,
+                digest.data(),
+                (ULONG)digest.size(),
+                header.ChunkSize,
+                std::min<DWORD>(GcmChunkCipher::MaxParallelChunks, dwCores))))
+    {
+        log::Error(_L_, hr, L"Failed to initialize envelope cipher\r\n");
+        return hr;
+    }
+
+    envelope.bHeaderComplete = true;
+    return S_OK;
+}
+
+HRESULT DecodeMessageStream::ChunkedWrite(const BYTE* pBuffer, ULONGLONG cbBytes)
+{
+    HRESULT hr = E_FAIL;
+
+    auto& envelope = *m_pChunked;
+    ULONGLONG cbUsed = 0LL;
+
+    while (!envelope.bHeaderComplete)
+    {
+        const auto cbHeader = envelope.HeaderSize();
+        if (cbHeader == 0)
+        {
+            log::Error(_L_, hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Invalid envelope header\r\n");
+            return hr;
+        }
+        if (envelope.HeaderBytes.size() == cbHeader)
+        {
+            if (FAILED(hr = OpenEnvelope()))
+                return hr;
+            break;
+        }
+        if (cbUsed == cbBytes)
+            return S_OK;
+
+        const auto cbToCopy = std::min<ULONGLONG>(cbHeader - envelope.HeaderBytes.size(), cbBytes - cbUsed);
+        envelope.HeaderBytes.insert(end(envelope.HeaderBytes), pBuffer + cbUsed, pBuffer + cbUsed + cbToCopy);
+        cbUsed += cbToCopy;
+    }
+
+    const DWORD cbSealedChunk = envelope.Gcm.ChunkSize() + GcmChunkCipher::TagLength;
+    const DWORD nbSlots = envelope.Gcm.Slots();
+
+    // The last chunk is kept until Close or more data comes: it may turn out to be the final one
+    const size_t cbBatch = (size_t)nbSlots * cbSealedChunk;
+    if (!envelope.Buffer.CheckCount(cbBatch + cbSealedChunk))
+        return E_OUTOFMEMORY;
+
+    while (cbUsed < cbBytes)
+    {
+        const auto cbToCopy =
+            std::min<ULONGLONG>(cbBytes - cbUsed, cbBatch + cbSealedChunk - envelope.dwBufferedData);
+
+        CopyMemory(envelope.Buffer.GetData() + envelope.dwBufferedData, pBuffer + cbUsed, (size_t)cbToCopy);
+        envelope.dwBufferedData += (DWORD)cbToCopy;
+        cbUsed += cbToCopy;
+
+        if (envelope.dwBufferedData > cbBatch)
+        {
+            if (FAILED(hr = envelope.ReadChunks(_L_, *m_pChainedStream, nbSlots, cbSealedChunk, false)))
+                return hr;
+        }
+    }
+    return S_OK;
+}
+
+HRESULT DecodeMessageStream::ChunkedClose()
+{
+    HRESULT hr = E_FAIL;
+
+    auto& envelope = *m_pChunked;
+    if (envelope.bClosed)
+        return S_OK;
+
+    // On success the chained stream stays open: the caller may still read back what was decrypted
+    BOOST_SCOPE_EXIT((&hr)(this_))
+    {
+        if (FAILED(hr))
+            this_->m_pChainedStream->Close();
+    }
+    BOOST_SCOPE_EXIT_END;
+
+    if (!envelope.bHeaderComplete || envelope.dwBufferedData < GcmChunkCipher::TagLength)
+    {
+        log::Error(_L_, hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), L"Truncated envelope\r\n");
+        return hr;
+    }
+
+    const DWORD cbSealedChunk = envelope.Gcm.ChunkSize() + GcmChunkCipher::TagLength;
+    const DWORD nbChunks = (envelope.dwBufferedData + cbSealedChunk - 1) / cbSealedChunk;
+    const DWORD cbLastSealed = envelope.dwBufferedData - (nbChunks - 1) * cbSealedChunk;
+
+    if (cbLastSealed < GcmChunkCipher::TagLength)
+    {
+        log::Error(_L_, hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), L"Truncated envelope\r\n");
+        return hr;
+    }
+
+    if (FAILED(hr = envelope.ReadChunks(_L_, *m_pChainedStream, nbChunks, cbLastSealed, true)))
+        return hr;
+
+    envelope.bClosed = true;
+    return S_OK;
+}
+
+HRESULT DecodeMessageStream::UpdateMessage(const BYTE* pBuffer, ULONGLONG cbBytes)
 {
     HRESULT hr = E_FAIL;
 
@@ -295,7 +609,7 @@ HRESULT DecodeMessageStream::Write(
         return E_INVALIDARG;
     }
 
-    if (!CryptMsgUpdate(m_hMsg, (const BYTE*)pBuffer, static_cast<DWORD>(cbBytes), FALSE))
+    if (!CryptMsgUpdate(m_hMsg, pBuffer, static_cast<DWORD>(cbBytes), FALSE))
     {
         log::Error(_L_, hr = HRESULT_FROM_WIN32(GetLastError()), L"CryptMsgUpdate failed\r\n");
         return hr;
@@ -307,11 +621,55 @@ HRESULT DecodeMessageStream::Write(
             return hr;
     }
 
-    *pcbBytesWritten = cbBytes;
     log::Verbose(_L_, L"CryptMsgUpdate %d bytes succeeded (hMsg=0x%lx)\r\n", cbBytes, m_hMsg);
     return S_OK;
 }
 
+HRESULT DecodeMessageStream::Write(
+    __in_bcount(cbBytes) const PVOID pBuffer,
+    __in ULONGLONG cbBytes,
+    __out PULONGLONG pcbBytesWritten)
+{
+    HRESULT hr = E_FAIL;
+
+    if (!m_bFormatKnown)
+    {
+        // A chunked envelope is told from a CMS message by its magic
+        m_Prefix.insert(end(m_Prefix), (const BYTE*)pBuffer, (const BYTE*)pBuffer + cbBytes);
+        if (m_Prefix.size() < sizeof(Envelope::Magic))
+        {
+            *pcbBytesWritten = cbBytes;
+            return S_OK;
+        }
+
+        std::vector<BYTE> prefix;
+        std::swap(prefix, m_Prefix);
+        m_bFormatKnown = true;
+
+        if (!memcmp(prefix.data(), Envelope::Magic, sizeof(Envelope::Magic)))
+        {
+            m_Format = Format::Chunked;
+            m_pChunked = std::make_unique<ChunkedEnvelope>();
+            hr = ChunkedWrite(prefix.data(), prefix.size());
+        }
+        else
+            hr = UpdateMessage(prefix.data(), prefix.size());
+
+        if (FAILED(hr))
+            return hr;
+    }
+    else if (m_pChunked)
+    {
+        if (FAILED(hr = ChunkedWrite((const BYTE*)pBuffer, cbBytes)))
+            return hr;
+    }
+    else if (FAILED(hr = UpdateMessage((const BYTE*)pBuffer, cbBytes)))
+        return hr;
+
+    *pcbBytesWritten = cbBytes;
+    return S_OK;
+}
+
 HRESULT DecodeMessageStream::SetFilePointer(
     __in LONGLONG lDistanceToMove,
     __in DWORD dwMoveMethod,
@@ -339,6 +697,25 @@ HRESULT DecodeMessageStream::SetSize(ULONG64 ullNewSize)
 
 HRESULT DecodeMessageStream::Close()
 {
+    if (!m_bFormatKnown && !m_Prefix.empty())
+    {
+        std::vector<BYTE> prefix;
+        std::swap(prefix, m_Prefix);
+        m_bFormatKnown = true;
+        UpdateMessage(prefix.data(), prefix.size());
+    }
+
+    if (m_pChunked)
+    {
+        if (m_hMsg != NULL)
+        {
+            // The CMS message opened by Initialize was not used
+            CryptMsgClose(m_hMsg);
+            m_hMsg = NULL;
+        }
+        return ChunkedClose();
+    }
+
     if (m_hMsg != NULL)
     {
         HRESULT hr = E_FAIL;
@@ -8,10 +8,17 @@
 #pragma once
 #include "MessageStream.h"
 
+#include <memory>
+
 #pragma managed(push, off)
 
 namespace Orc {
 
+//
+// DecodeMessageStream unwraps what is written to it into the chained stream: a CMS (PKCS#7) enveloped message or a
+// chunked envelope, told apart by the envelope's magic.
+// A chunked envelope's last chunk is only known at Close, which fails when the envelope is truncated.
+//
 class ORCLIB_API DecodeMessageStream : public MessageStream
 {
 private:
@@ -27,23 +34,30 @@ private:
 
     HRESULT GetDecryptionMaterial();
 
+    bool m_bFormatKnown = false;
+    Format m_Format = Format::CMS;
+    std::vector<BYTE> m_Prefix;
+
+    class ChunkedEnvelope;
+    std::unique_ptr<ChunkedEnvelope> m_pChunked;
+
+    HRESULT UpdateMessage(const BYTE* pBuffer, ULONGLONG cbBytes);
+
+    HRESULT UnwrapContentKey(const BYTE* pRecipient, BYTE* pKey, PCCERT_CONTEXT& pCertContext);
+    HRESULT OpenEnvelope();
+    HRESULT ChunkedWrite(const BYTE* pBuffer, ULONGLONG cbBytes);
+    HRESULT ChunkedClose();
+
 public:
-    DecodeMessageStream(logger pLog)
-        : MessageStream(std::move(pLog))
-    {
-        ZeroMemory(&m_DecryptParam, sizeof(CMSG_CTRL_DECRYPT_PARA));
-        m_DecryptParam.cbSize = sizeof(CMSG_CTRL_DECRYPT_PARA);
-    };
+    DecodeMessageStream(logger pLog);
 
     STDMETHOD(Initialize)(const std::shared_ptr<ByteStream>& pInnerStream);
 
     HRESULT GetRecipients();
-    PCCERT_CONTEXT GetDecryptor() const
-    {
-        if (m_DecryptParam.hCryptProv != NULL)
-            return m_Recipients[m_DecryptParam.dwRecipientIndex];
-        return nullptr;
-    };
+    PCCERT_CONTEXT GetDecryptor() const;
+
+    // Known once the first bytes are written
+    Format GetFormat() const { return m_Format; }
 
     STDMETHOD(Read)
     (__out_bcount_part(cbBytesToRead, *pcbBytesRead) PVOID pBuffer,
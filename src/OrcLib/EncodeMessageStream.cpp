@@ -10,10 +10,93 @@
 #include "EncodeMessageStream.h"
 #include "SystemDetails.h"
 #include "CryptoUtilities.h"
+#include "GcmChunkCipher.h"
+#include "HashEngine.h"
 #include "LogFileWriter.h"
 
+#include <boost/scope_exit.hpp>
+
+#include <bcrypt.h>
+
+#include <array>
+#include <thread>
+
 using namespace Orc;
 
+namespace {
+
+// Wraps the content key with the recipient's (RSA) public key
+HRESULT WrapContentKey(PCCERT_CONTEXT pCertContext, const BYTE* pKey, ULONG cbKey, std::vector<BYTE>& wrapped)
+{
+    BCRYPT_KEY_HANDLE hPublicKey = NULL;
+    if (!CryptImportPublicKeyInfoEx2(
+            X509_ASN_ENCODING, &pCertContext->pCertInfo->SubjectPublicKeyInfo, 0L, NULL, &hPublicKey))
+        return HRESULT_FROM_WIN32(GetLastError());
+    BOOST_SCOPE_EXIT(hPublicKey) { BCryptDestroyKey(hPublicKey); }
+    BOOST_SCOPE_EXIT_END;
+
+    BCRYPT_OAEP_PADDING_INFO padding = {BCRYPT_SHA256_ALGORITHM, NULL, 0L};
+
+    ULONG cbWrapped = 0L;
+    NTSTATUS status =
+        BCryptEncrypt(hPublicKey, (PUCHAR)pKey, cbKey, &padding, NULL, 0L, NULL, 0L, &cbWrapped, BCRYPT_PAD_OAEP);
+    if (!BCRYPT_SUCCESS(status))
+        return HRESULT_FROM_NT(status);
+
+    wrapped.resize(cbWrapped);
+    status = BCryptEncrypt(
+        hPublicKey, (PUCHAR)pKey, cbKey, &padding, NULL, 0L, wrapped.data(), cbWrapped, &cbWrapped, BCRYPT_PAD_OAEP);
+    if (!BCRYPT_SUCCESS(status))
+        return HRESULT_FROM_NT(status);
+
+    wrapped.resize(cbWrapped);
+    return S_OK;
+}
+
+}  // namespace
+
+class EncodeMessageStream::ChunkedEnvelope
+{
+public:
+    GcmChunkCipher Gcm;
+
+    CBinaryBuffer Buffer;
+    DWORD dwBufferedData = 0L;
+    ULONGLONG ullChunksWritten = 0LL;
+    bool bClosed = false;
+
+    // Seals nbChunks chunks from Buffer, the last one possibly final, and drops them from the buffer
+    HRESULT WriteChunks(const logger& pLog, ByteStream& output, DWORD nbChunks, DWORD cbLastChunk, bool bFinal)
+    {
+        HRESULT hr = E_FAIL;
+        const DWORD dwChunkSize = Gcm.ChunkSize();
+
+        ULONGLONG ullFailedChunk = 0LL;
+        if (FAILED(
+                hr = Gcm.SealChunks(
+                    output, ullChunksWritten, Buffer.GetData(), nbChunks, cbLastChunk, bFinal, ullFailedChunk)))
+        {
+            log::Error(pLog, hr, L"Failed to encrypt or write envelope chunk %I64d\r\n", ullFailedChunk);
+            return hr;
+        }
+        ullChunksWritten += nbChunks;
+
+        const DWORD dwConsumed = (nbChunks - 1) * dwChunkSize + cbLastChunk;
+        _ASSERT(dwConsumed <= dwBufferedData);
+
+        if (dwConsumed < dwBufferedData)
+            MoveMemory(Buffer.GetData(), Buffer.GetData() + dwConsumed, dwBufferedData - dwConsumed);
+        dwBufferedData -= dwConsumed;
+        return S_OK;
+    }
+};
+
+EncodeMessageStream::EncodeMessageStream(logger pLog)
+    : MessageStream(std::move(pLog))
+{
+    ZeroMemory(&EncodeInfo, sizeof(CMSG_ENVELOPED_ENCODE_INFO));
+}
+
 STDMETHODIMP EncodeMessageStream::AddRecipient(const CBinaryBuffer& buffer)
 {
     HRESULT hr = E_FAIL;
@@ -150,6 +233,181 @@ STDMETHODIMP EncodeMessageStream::Initialize(const std::shared_ptr<ByteStream>&
     return S_OK;
 }
 
+STDMETHODIMP
+EncodeMessageStream::Initialize(const std::shared_ptr<ByteStream>& pInnerStream, Format format, DWORD dwChunkSize)
+{
+    if (format == Format::CMS)
+        return Initialize(pInnerStream);
+
+    if (pInnerStream == nullptr)
+        return E_POINTER;
+
+    m_pChainedStream = pInnerStream;
+    return InitializeChunked(dwChunkSize);
+}
+
+HRESULT EncodeMessageStream::InitializeChunked(DWORD dwChunkSize)
+{
+    HRESULT hr = E_FAIL;
+    NTSTATUS status = 0;
+
+    if (dwChunkSize == 0L || dwChunkSize > GcmChunkCipher::MaxChunkSize)
+    {
+        log::Error(_L_, hr = E_INVALIDARG, L"Invalid envelope chunk size (%d bytes)\r\n", dwChunkSize);
+        return hr;
+    }
+    if (m_recipients.empty() || m_recipients.size() > Envelope::MaxRecipients)
+    {
+        log::Error(_L_, hr = E_INVALIDARG, L"Invalid number of recipients (%Iu)\r\n", m_recipients.size());
+        return hr;
+    }
+
+    Envelope::Header header;
+    CopyMemory(header.Magic, Envelope::Magic, sizeof(header.Magic));
+    header.Version = Envelope::Version;
+    header.ChunkSize = dwChunkSize;
+    header.RecipientCount = static_cast<DWORD>(m_recipients.size());
+
+    std::array<BYTE, GcmChunkCipher::KeyLength> key;
+    BOOST_SCOPE_EXIT(&key) { SecureZeroMemory(key.data(), key.size()); }
+    BOOST_SCOPE_EXIT_END;
+
+    status = BCryptGenRandom(NULL, key.data(), (ULONG)key.size(), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+    if (BCRYPT_SUCCESS(status))
+        status = BCryptGenRandom(NULL, header.NoncePrefix, sizeof(header.NoncePrefix), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+    if (!BCRYPT_SUCCESS(status))
+    {
+        log::Error(_L_, hr = HRESULT_FROM_NT(status), L"Failed to generate content key\r\n");
+        return hr;
+    }
+
+    std::vector<BYTE> headerBytes((const BYTE*)&header, (const BYTE*)&header + sizeof(header));
+
+    for (auto pCertContext : m_recipients)
+    {
+        std::wstring strSubject;
+        CertNameToString(&pCertContext->pCertInfo->Subject, CERT_SIMPLE_NAME_STR, strSubject);
+
+        Envelope::Recipient recipient;
+        DWORD cbThumbprint = sizeof(recipient.Thumbprint);
+        if (!CertGetCertificateContextProperty(
+                pCertContext, CERT_SHA1_HASH_PROP_ID, recipient.Thumbprint, &cbThumbprint))
+        {
+            log::Error(
+                _L_,
+                hr = HRESULT_FROM_WIN32(GetLastError()),
+                L"Failed to get thumbprint of \"%s\"'s certificate\r\n",
+                strSubject.c_str());
+            return hr;
+        }
+
+        std::vector<BYTE> wrapped;
+        if (FAILED(hr = WrapContentKey(pCertContext, key.data(), (ULONG)key.size(), wrapped)))
+        {
+            log::Error(
+                _L_, hr, L"Failed to wrap content key for \"%s\" (RSA keys only)\r\n", strSubject.c_str());
+            return hr;
+        }
+        if (wrapped.size() > Envelope::MaxWrappedKeySize)
+        {
+            log::Error(_L_, hr = E_INVALIDARG, L"Public key of \"%s\" is too large\r\n", strSubject.c_str());
+            return hr;
+        }
+        recipient.WrappedKeySize = static_cast<DWORD>(wrapped.size());
+
+        headerBytes.insert(end(headerBytes), (const BYTE*)&recipient, (const BYTE*)&recipient + sizeof(recipient));
+        headerBytes.insert(end(headerBytes), begin(wrapped), end(wrapped));
+    }
+
+    // Each chunk authenticates the header and the recipients
+    HashEngine::SHA256Digest digest;
+    HashEngine engine(SupportedAlgorithm::SHA256);
+    engine.Update(headerBytes.data(), headerBytes.size());
+    if (FAILED(hr = engine.GetDigest(SupportedAlgorithm::SHA256, digest.data(), (DWORD)digest.size())))
+        return hr;
+
+    m_pChunked = std::make_unique<ChunkedEnvelope>();
+
+    const auto dwCores = std::max(1u, std::thread::hardware_concurrency());
+    if (FAILED(
+            hr = m_pChunked->Gcm.Initialize(
+                key.data(),
+                header.NoncePrefix,
+                digest.data(),
+                (ULONG)digest.size(),
+                dwChunkSize,
+                std::min<DWORD>(GcmChunkCipher::MaxParallelChunks, dwCores))))
+    {
+        log::Error(_L_, hr, L"Failed to initialize envelope cipher\r\n");
+        return hr;
+    }
+
+    ULONGLONG ullWritten = 0LL;
+    if (FAILED(hr = m_pChainedStream->Write(headerBytes.data(), headerBytes.size(), &ullWritten)))
+    {
+        log::Error(_L_, hr, L"Failed to write envelope header\r\n");
+        return hr;
+    }
+    return S_OK;
+}
+
+HRESULT EncodeMessageStream::ChunkedWrite(const BYTE* pBuffer, ULONGLONG cbBytes)
+{
+    HRESULT hr = E_FAIL;
+
+    auto& envelope = *m_pChunked;
+    const DWORD dwChunkSize = envelope.Gcm.ChunkSize();
+    const DWORD nbSlots = envelope.Gcm.Slots();
+
+    // The last chunk is kept until Close or more data comes: it may turn out to be the final one
+    const size_t cbBatch = (size_t)nbSlots * dwChunkSize;
+    if (!envelope.Buffer.CheckCount(cbBatch + dwChunkSize))
+        return E_OUTOFMEMORY;
+
+    ULONGLONG cbWritten = 0LL;
+    while (cbWritten < cbBytes)
+    {
+        const auto cbToCopy =
+            std::min<ULONGLONG>(cbBytes - cbWritten, cbBatch + dwChunkSize - envelope.dwBufferedData);
+
+        CopyMemory(envelope.Buffer.GetData() + envelope.dwBufferedData, pBuffer + cbWritten, (size_t)cbToCopy);
+        envelope.dwBufferedData += (DWORD)cbToCopy;
+        cbWritten += cbToCopy;
+
+        if (envelope.dwBufferedData > cbBatch)
+        {
+            if (FAILED(hr = envelope.WriteChunks(_L_, *m_pChainedStream, nbSlots, dwChunkSize, false)))
+                return hr;
+        }
+    }
+    return S_OK;
+}
+
+HRESULT EncodeMessageStream::ChunkedClose()
+{
+    HRESULT hr = E_FAIL;
+
+    auto& envelope = *m_pChunked;
+    if (envelope.bClosed)
+        return S_OK;
+    envelope.bClosed = true;
+
+    const DWORD dwChunkSize = envelope.Gcm.ChunkSize();
+
+    // An empty content still gets its (empty) final chunk
+    const DWORD nbChunks =
+        envelope.dwBufferedData == 0L ? 1L : (envelope.dwBufferedData + dwChunkSize - 1) / dwChunkSize;
+    const DWORD cbLastChunk = envelope.dwBufferedData - (nbChunks - 1) * dwChunkSize;
+
+    if (!envelope.Buffer.CheckCount(std::max<size_t>(envelope.dwBufferedData, 1)))
+        return E_OUTOFMEMORY;
+
+    if (FAILED(hr = envelope.WriteChunks(_L_, *m_pChainedStream, nbChunks, cbLastChunk, true)))
+        return hr;
+
+    return m_pChainedStream->Close();
+}
+
 __data_entrypoint(File) HRESULT EncodeMessageStream::Read(
     __out_bcount_part(cbBytesToRead, *pcbBytesRead) PVOID pBuffer,
     __in ULONGLONG cbBytesToRead,
@@ -173,6 +431,14 @@ HRESULT EncodeMessageStream::Write(
 {
     HRESULT hr = E_FAIL;
 
+    if (m_pChunked)
+    {
+        if (FAILED(hr = ChunkedWrite((const BYTE*)pBuffer, cbBytes)))
+            return hr;
+        *pcbBytesWritten = cbBytes;
+        return S_OK;
+    }
+
     if (m_hMsg == NULL)
         return E_POINTER;
 
@@ -224,6 +490,9 @@ HRESULT EncodeMessageStream::SetSize(ULONG64 ullNewSize)
 
 HRESULT EncodeMessageStream::Close()
 {
+    if (m_pChunked)
+        return ChunkedClose();
+
     if (m_hMsg != NULL)
     {
         HRESULT hr = E_FAIL;
@@ -9,29 +9,40 @@
 
 #include "MessageStream.h"
 
+#include "EnvelopeStructures.h"
+
 #include <boost/logic/tribool.hpp>
 
+#include <memory>
+
 #pragma managed(push, off)
 
 namespace Orc {
 
 class LogFileWriter;
 
+//
+// EncodeMessageStream envelopes what is written to it for its recipients, as a CMS (PKCS#7) enveloped message through
+// CryptoAPI's message streaming, or as a chunked envelope whose chunks are sealed in parallel (Format::Chunked).
+//
 class ORCLIB_API EncodeMessageStream : public MessageStream
 {
 protected:
     HCRYPTPROV m_hProv = NULL;
 
+    class ChunkedEnvelope;
+    std::unique_ptr<ChunkedEnvelope> m_pChunked;
+
+    HRESULT InitializeChunked(DWORD dwChunkSize);
+    HRESULT ChunkedWrite(const BYTE* pBuffer, ULONGLONG cbBytes);
+    HRESULT ChunkedClose();
+
     std::vector<PCCERT_CONTEXT> m_recipients;
 
     CMSG_ENVELOPED_ENCODE_INFO EncodeInfo;
 
 public:
-    EncodeMessageStream(logger pLog)
-        : MessageStream(std::move(pLog))
-    {
-        ZeroMemory(&EncodeInfo, sizeof(CMSG_ENVELOPED_ENCODE_INFO));
-    }
+    EncodeMessageStream(logger pLog);
 
     STDMETHOD(AddRecipient)(const CBinaryBuffer& buffer);
     STDMETHOD(AddRecipient)(LPCSTR szEncodedCert, DWORD cchLen, DWORD dwFlags = CRYPT_STRING_ANY);
@@ -40,6 +51,8 @@ public:
     STDMETHOD(AddRecipient)(const std::wstring& strEncodedCert, DWORD dwFlags = CRYPT_STRING_ANY);
 
     STDMETHOD(Initialize)(const std::shared_ptr<ByteStream>& pInnerStream);
+    STDMETHOD(Initialize)
+    (const std::shared_ptr<ByteStream>& pInnerStream, Format format, DWORD dwChunkSize = Envelope::DefaultChunkSize);
 
     STDMETHOD(Read)
     (__out_bcount_part(cbBytesToRead, *pcbBytesRead) PVOID pBuffer,
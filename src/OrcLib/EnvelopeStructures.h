@@ -0,0 +1,55 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "GcmChunkCipher.h"
+
+#pragma managed(push, off)
+
+//
+// A chunked envelope seals its content with a random AES-256 content key, wrapped (RSA-OAEP with SHA256) with the
+// public key of each recipient. The content is sealed in chunks by GcmChunkCipher, each chunk authenticating the
+// SHA256 of the header and recipients:
+//
+//  Header
+//  Recipient + wrapped content key, for each recipient
+//  sealed chunks, ChunkSize + tag bytes long except for the last (final) one
+//
+namespace Orc::Envelope {
+
+constexpr BYTE Magic[8] = {'O', 'R', 'C', 'E', 'N', 'V', '0', '1'};
+constexpr DWORD Version = 1L;
+
+constexpr DWORD DefaultChunkSize = 0x100000;
+
+constexpr DWORD MaxRecipients = 256L;
+constexpr DWORD MaxWrappedKeySize = 2048L;  // a 16384 bits RSA key
+
+#pragma pack(push, 1)
+struct Header
+{
+    BYTE Magic[8];
+    DWORD Version;
+    DWORD ChunkSize;
+    BYTE NoncePrefix[GcmChunkCipher::NoncePrefixLength];
+    DWORD RecipientCount;
+};
+
+struct Recipient
+{
+    BYTE Thumbprint[20];  // SHA1 of the recipient's certificate
+    DWORD WrappedKeySize;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(Header) == 24, "The envelope header is 24 bytes long");
+static_assert(sizeof(Recipient) == 24, "An envelope recipient is 24 bytes long");
+
+}  // namespace Orc::Envelope
+
+#pragma managed(pop)
@@ -810,6 +810,19 @@ std::shared_ptr<FileFind::SearchTerm> FileFind::GetSearchTermFromConfig(const Co
 
         fs->Required |= FileFind::SearchTerm::YARA;
     }
+    if (item[CONFIG_FILEFIND_HASHSET])
+    {
+        fs->HashSetSpec = item[CONFIG_FILEFIND_HASHSET];
+        fs->HashSet = HashIOCSet::GetCachedSet(pLog, fs->HashSetSpec);
+
+        if (fs->HashSet != nullptr)
+            fs->Required |= FileFind::SearchTerm::DATA_HASHSET;
+        else
+        {
+            log::Warning(
+                pLog, E_INVALIDARG, L"Failed to load hash set (%s), ignored\r\n", fs->HashSetSpec.c_str());
+        }
+    }
     return fs;
 }
 
@@ -1078,6 +1091,15 @@ wstring FileFind::SearchTerm::GetDescription() const
             stream << fmt::format(L"{02X}", SHA256[i]);
         bFirst = false;
     }
+    if (Required & SearchTerm::Criteria::DATA_HASHSET)
+    {
+        if (!bFirst)
+            stream << L", ";
+        stream << L"Hash in set " << HashSetSpec;
+        if (HashSet)
+            stream << L" (" << HashSet->Count() << L" hashes)";
+        bFirst = false;
+    }
 
     if (Required & SearchTerm::Criteria::CONTAINS)
     {
@@ -1259,6 +1281,11 @@ HRESULT FileFind::SearchTerm::AddTermToConfig(ConfigItem& item)
         ntfs_find.SubItems[CONFIG_FILEFIND_SHA256].strData = SHA256.ToHex();
         ntfs_find.SubItems[CONFIG_FILEFIND_SHA256].Status = ConfigItem::PRESENT;
     }
+    if (Required & DATA_HASHSET)
+    {
+        ntfs_find.SubItems[CONFIG_FILEFIND_HASHSET].strData = HashSetSpec;
+        ntfs_find.SubItems[CONFIG_FILEFIND_HASHSET].Status = ConfigItem::PRESENT;
+    }
     if (Required & HEADER || Required & HEADER_HEX)
     {
         ntfs_find.SubItems[CONFIG_FILEFIND_HEADER_HEX].strData = Header.ToHex();
@@ -2783,6 +2810,47 @@ FileFind::SearchTerm::Criteria FileFind::MatchHash(
     return matchedSpec;
 }
 
+FileFind::SearchTerm::Criteria FileFind::MatchHashSet(
+    const std::shared_ptr<FileFind::SearchTerm>& aTerm,
+    const std::shared_ptr<DataAttribute>& pDataAttr) const
+{
+    HRESULT hr = E_FAIL;
+
+    if (!(aTerm->Required & SearchTerm::Criteria::DATA_HASHSET) || aTerm->HashSet == nullptr)
+        return SearchTerm::Criteria::NONE;
+
+    if (pDataAttr == nullptr)
+        return SearchTerm::Criteria::NONE;
+
+    if (aTerm->HashSet->HasSizeFilter())
+    {
+        // MFT provided size is enough to rule out most files without reading a single byte
+        ULONGLONG ullDataSize = 0LL;
+        if (SUCCEEDED(pDataAttr->DataSize(m_pVolReader, ullDataSize)) && !aTerm->HashSet->IsCandidateSize(ullDataSize))
+            return SearchTerm::Criteria::NONE;
+    }
+
+    if (FAILED(hr = pDataAttr->GetHashInformation(_L_, m_pVolReader, m_NeededHash)))
+    {
+        log::Error(_L_, hr, L"Failed to compute hash for data attribute\r\n");
+        return SearchTerm::Criteria::NONE;
+    }
+
+    const auto algs = aTerm->HashSet->GetAlgorithms();
+
+    if (algs & SupportedAlgorithm::MD5
+        && aTerm->HashSet->Contains(SupportedAlgorithm::MD5, pDataAttr->GetDetails()->MD5()))
+        return SearchTerm::Criteria::DATA_HASHSET;
+    if (algs & SupportedAlgorithm::SHA1
+        && aTerm->HashSet->Contains(SupportedAlgorithm::SHA1, pDataAttr->GetDetails()->SHA1()))
+        return SearchTerm::Criteria::DATA_HASHSET;
+    if (algs & SupportedAlgorithm::SHA256
+        && aTerm->HashSet->Contains(SupportedAlgorithm::SHA256, pDataAttr->GetDetails()->SHA256()))
+        return SearchTerm::Criteria::DATA_HASHSET;
+
+    return SearchTerm::Criteria::NONE;
+}
+
 FileFind::SearchTerm::Criteria FileFind::MatchContains(
     const std::shared_ptr<FileFind::SearchTerm>& aTerm,
     const std::shared_ptr<DataAttribute>& pDataAttr) const
@@ -3083,6 +3151,13 @@ FileFind::SearchTerm::Criteria FileFind::AddMatchingData(
                 continue;
             matchedDataSpecs |= aSpec;
         }
+        if (requiredDataSpecs & SearchTerm::Criteria::DATA_HASHSET)
+        {
+            SearchTerm::Criteria aSpec = MatchHashSet(aTerm, data_attr);
+            if (aSpec == SearchTerm::Criteria::NONE)
+                continue;
+            matchedDataSpecs |= aSpec;
+        }
         if (requiredDataSpecs & SearchTerm::Criteria::CONTAINS)
         {
             SearchTerm::Criteria aSpec = MatchContains(aTerm, data_attr);
@@ -3168,6 +3243,13 @@ FileFind::SearchTerm::Criteria FileFind::ExcludeMatchingData(
                     return false;
                 matchedDataSpecs |= aSpec;
             }
+            if (requiredDataSpecs & SearchTerm::Criteria::DATA_HASHSET)
+            {
+                SearchTerm::Criteria aSpec = MatchHashSet(aTerm, data_attr);
+                if (aSpec == SearchTerm::Criteria::NONE)
+                    return false;
+                matchedDataSpecs |= aSpec;
+            }
             if (requiredDataSpecs & SearchTerm::Criteria::CONTAINS)
             {
                 SearchTerm::Criteria aSpec = MatchContains(aTerm, data_attr);
@@ -3792,6 +3874,10 @@ SupportedAlgorithm FileFind::GetNeededHashAlgorithms()
         {
             retval = static_cast<SupportedAlgorithm>(retval | SupportedAlgorithm::SHA256);
         }
+        if (term->Required & SearchTerm::Criteria::DATA_HASHSET && term->HashSet)
+        {
+            retval = static_cast<SupportedAlgorithm>(retval | term->HashSet->GetAlgorithms());
+        }
         return retval;
     };
 
@@ -16,6 +16,7 @@
 #include "MFTRecord.h"
 #include "MftRecordAttribute.h"
 #include "CryptoHashStream.h"
+#include "HashIOCSet.h"
 #include "LocationSet.h"
 #include "TableOutput.h"
 #include "YaraScanner.h"
@@ -84,7 +85,8 @@ public:
             ATTR_NAME_MATCH = 1 << 28,
             ATTR_NAME_REGEX = 1 << 29,
             CONTAINS = 1 << 30,
-            YARA = 1 << 31
+            YARA = 1LL << 31,
+            DATA_HASHSET = 1LL << 32
         };
 
         friend Criteria& operator^=(Criteria& left, const Criteria rigth)
@@ -145,6 +147,9 @@ public:
         CBinaryBuffer SHA1;
         CBinaryBuffer SHA256;
 
+        std::wstring HashSetSpec;
+        std::shared_ptr<HashIOCSet> HashSet;
+
         std::wstring strHeaderRegEx;
         std::regex HeaderRegEx;
         DWORD HeaderLen = 0L;
@@ -193,7 +198,8 @@ public:
 
         static Criteria DataMask()
         {
-            return HEADER | HEADER_HEX | HEADER_REGEX | DATA_MD5 | DATA_SHA1 | DATA_SHA256 | CONTAINS | YARA;
+            return HEADER | HEADER_HEX | HEADER_REGEX | DATA_MD5 | DATA_SHA1 | DATA_SHA256 | DATA_HASHSET | CONTAINS
+                | YARA;
         };
         bool DependsOnData() const { return Required & DataMask() ? true : false; };
 
@@ -504,6 +510,8 @@ private:
     SearchTerm::Criteria
     MatchHash(const std::shared_ptr<SearchTerm>& aTerm, const std::shared_ptr<DataAttribute>& pDataAttr) const;
     SearchTerm::Criteria
+    MatchHashSet(const std::shared_ptr<SearchTerm>& aTerm, const std::shared_ptr<DataAttribute>& pDataAttr) const;
+    SearchTerm::Criteria
     MatchContains(const std::shared_ptr<SearchTerm>& aTerm, const std::shared_ptr<DataAttribute>& pDataAttr) const;
     std::pair<SearchTerm::Criteria, std::optional<MatchingRuleCollection>>
     MatchYara(const std::shared_ptr<SearchTerm>& aTerm, const std::shared_ptr<DataAttribute>& pDataAttr) const;
@@ -548,10 +548,32 @@ HRESULT FileInfo::OpenHash()
 
     details->SetHashChecked(true);
 
+    Intentions localIntentions = FilterIntentions(m_Filters);
+
+    // Files already hashed by a previous command (or collection) are not read again
+    HashCache::Key key;
+    auto cache = HashCache::GetProcessCache(_L_);
+    if (cache && FAILED(GetHashCacheKey(key)))
+        cache.reset();
+
+    const auto hashIntentions = HashCache::GetHashIntentions(localIntentions);
+    if (cache && hashIntentions != FILEINFO_NONE && cache->Lookup(key, hashIntentions, *details))
+        return S_OK;
+
     if (FAILED(hr = CheckStream()))
         return hr;
 
-    Intentions localIntentions = FilterIntentions(m_Filters);
+    if (FAILED(hr = ComputeHash(localIntentions)))
+        return hr;
+
+    if (cache && hashIntentions != FILEINFO_NONE)
+        cache->Store(key, hashIntentions, *details);
+    return S_OK;
+}
+
+HRESULT FileInfo::ComputeHash(Intentions localIntentions)
+{
+    HRESULT hr = E_FAIL;
 
     if (localIntentions & FILEINFO_MD5 || localIntentions & FILEINFO_SHA1 || localIntentions & FILEINFO_SHA256
         || localIntentions & FILEINFO_SSDEEP || localIntentions & FILEINFO_TLSH)
@@ -9,6 +9,7 @@
 
 #include "DataDetails.h"
 #include "FSUtils.h"
+#include "HashCache.h"
 #include "PEInfo.h"
 
 #include "TableOutput.h"
@@ -88,9 +89,13 @@ protected:
 
     DWORD GetRequiredAccessMask(const ColumnNameDef columnNames[]);
 
+    // identity of the data stream in the hash cache, not available by default
+    virtual HRESULT GetHashCacheKey(HashCache::Key& key) { return E_NOTIMPL; }
+
     // open methods
     HRESULT OpenFirstBytes();
     virtual HRESULT OpenHash();
+    HRESULT ComputeHash(Intentions localIntentions);
     HRESULT OpenCryptoHash(Intentions localIntentions);
     HRESULT OpenFuzzyHash(Intentions localIntentions);
     HRESULT OpenCryptoAndFuzzyHash(Intentions localIntentions);
@@ -89,6 +89,20 @@ HRESULT FileMappingStream::Read(
     return S_OK;
 }
 
+HRESULT FileMappingStream::ReadView(__in ULONGLONG cbBytes, __out View& view)
+{
+    view = View();
+
+    if (m_pMapped == nullptr || m_ullCurrentPosition >= m_ullDataSize)
+        return S_OK;
+
+    view.pData = m_pMapped + m_ullCurrentPosition;
+    view.cbData = std::min(cbBytes, m_ullDataSize - m_ullCurrentPosition);
+
+    m_ullCurrentPosition += view.cbData;
+    return S_OK;
+}
+
 HRESULT FileMappingStream::CommitSize(ULONGLONG ullNewSize)
 {
     HRESULT hr = E_FAIL;
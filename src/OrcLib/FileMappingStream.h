@@ -55,6 +55,9 @@ public:
      __in ULONGLONG cbBytes,
      __out_opt PULONGLONG pcbBytesRead);
 
+    // Lends the mapped memory: the view is valid until the stream is resized or closed
+    STDMETHOD(ReadView)(__in ULONGLONG cbBytes, __out View& view);
+
     STDMETHOD(Write)
     (__in_bcount(cbBytes) const PVOID pBuffer, __in ULONGLONG cbBytes, __out_opt PULONGLONG pcbBytesWritten);
 
@@ -16,8 +16,57 @@
 #    include "ssdeep/fuzzy.h"
 #endif
 
+#include <agents.h>
+#include <ppl.h>
+
+#include <atomic>
+
 using namespace Orc;
 
+class FuzzyHashStream::AsyncStage
+{
+public:
+    class Chunk
+    {
+    public:
+        CBinaryBuffer Buffer;
+        DWORD cbData = 0L;
+        std::atomic<int> Pending = 0;
+    };
+
+    AsyncStage()
+    {
+        for (auto& chunk : Chunks)
+        {
+            chunk = std::make_unique<Chunk>();
+            Concurrency::send(Free, chunk.get());
+        }
+    }
+
+    // Bounded queue: the reader waits for a free chunk when all of them are still being hashed
+    std::unique_ptr<Chunk> Chunks[AsyncQueueDepth];
+    Concurrency::unbounded_buffer<Chunk*> Free;
+
+    // Each algorithm has its own task (and core) and sees every chunk
+    Concurrency::unbounded_buffer<Chunk*> TLSHQueue;
+    Concurrency::unbounded_buffer<Chunk*> SSDeepQueue;
+    bool bTLSH = false;
+    bool bSSDeep = false;
+
+    std::atomic<HRESULT> hrTLSH = S_OK;
+    std::atomic<HRESULT> hrSSDeep = S_OK;
+
+    Concurrency::task_group Tasks;
+
+    HRESULT Status() const { return FAILED(hrTLSH) ? hrTLSH.load() : hrSSDeep.load(); }
+
+    void Release(Chunk* pChunk)
+    {
+        if (--pChunk->Pending == 0)
+            Concurrency::send(Free, pChunk);
+    }
+};
+
 FuzzyHashStream::SupportedAlgorithm FuzzyHashStream::GetSupportedAlgorithm(LPCWSTR szAlgo)
 {
     if (!_wcsnicmp(szAlgo, L"ssdeep", wcslen(L"ssdeep")))
@@ -93,8 +142,75 @@ HRESULT FuzzyHashStream::OpenToWrite(SupportedAlgorithm algs, const std::shared_
     return S_OK;
 }
 
+HRESULT FuzzyHashStream::StartAsync()
+{
+    m_Async = std::make_unique<AsyncStage>();
+
+    if (m_tlsh)
+    {
+        m_Async->bTLSH = true;
+        m_Async->Tasks.run([this, pAsync = m_Async.get()]() {
+            while (auto pChunk = Concurrency::receive(pAsync->TLSHQueue))
+            {
+                if (SUCCEEDED(pAsync->hrTLSH))
+                {
+                    try
+                    {
+                        m_tlsh->update(pChunk->Buffer.GetData(), pChunk->cbData);
+                    }
+                    catch (const std::bad_alloc&)
+                    {
+                        pAsync->hrTLSH = E_OUTOFMEMORY;
+                    }
+                    catch (...)
+                    {
+                        pAsync->hrTLSH = E_FAIL;
+                    }
+                }
+                pAsync->Release(pChunk);
+            }
+        });
+    }
+
+#ifdef ORC_BUILD_SSDEEP
+    if (m_ssdeep)
+    {
+        m_Async->bSSDeep = true;
+        m_Async->Tasks.run([this, pAsync = m_Async.get()]() {
+            while (auto pChunk = Concurrency::receive(pAsync->SSDeepQueue))
+            {
+                if (SUCCEEDED(pAsync->hrSSDeep) && fuzzy_update(m_ssdeep, pChunk->Buffer.GetData(), pChunk->cbData))
+                    pAsync->hrSSDeep = E_FAIL;
+                pAsync->Release(pChunk);
+            }
+        });
+    }
+#endif  // ORC_BUILD_SSDEEP
+
+    return S_OK;
+}
+
+HRESULT FuzzyHashStream::JoinAsync()
+{
+    if (!m_Async)
+        return S_OK;
+
+    if (m_Async->bTLSH)
+        Concurrency::send(m_Async->TLSHQueue, (AsyncStage::Chunk*)nullptr);
+    if (m_Async->bSSDeep)
+        Concurrency::send(m_Async->SSDeepQueue, (AsyncStage::Chunk*)nullptr);
+
+    m_Async->Tasks.wait();
+
+    HRESULT hr = m_Async->Status();
+    m_Async.reset();
+    return hr;
+}
+
 STDMETHODIMP FuzzyHashStream::Close()
 {
+    JoinAsync();
+
     if (m_tlsh)
     {
         m_tlsh->final();
@@ -105,6 +221,9 @@ STDMETHODIMP FuzzyHashStream::Close()
 
 HRESULT FuzzyHashStream::ResetHash(bool bContinue)
 {
+    // hashing tasks must be done with the current states before they are reset
+    JoinAsync();
+
     if (m_tlsh)
     {
         m_tlsh->reset();
@@ -128,11 +247,45 @@ HRESULT FuzzyHashStream::ResetHash(bool bContinue)
         m_tlsh = std::make_unique<Tlsh>();
     }
     m_bHashIsValid = true;
+    m_ullHashed = 0LL;
     return S_OK;
 }
 
 HRESULT FuzzyHashStream::HashData(LPBYTE pBuffer, DWORD dwBytesToHash)
 {
+    HRESULT hr = E_FAIL;
+
+    // small streams are hashed inline, the hashing tasks would cost more than they save
+    if (!m_Async && m_ullHashed >= m_ullAsyncThreshold && (m_tlsh || m_ssdeep))
+    {
+        if (FAILED(hr = StartAsync()))
+            return hr;
+    }
+    m_ullHashed += dwBytesToHash;
+
+    if (m_Async)
+    {
+        if (FAILED(hr = m_Async->Status()))
+            return hr;
+
+        auto pChunk = Concurrency::receive(m_Async->Free);
+
+        if (pChunk->Buffer.GetCount() < dwBytesToHash && !pChunk->Buffer.SetCount(dwBytesToHash))
+        {
+            Concurrency::send(m_Async->Free, pChunk);
+            return E_OUTOFMEMORY;
+        }
+        CopyMemory(pChunk->Buffer.GetData(), pBuffer, dwBytesToHash);
+        pChunk->cbData = dwBytesToHash;
+        pChunk->Pending = (m_Async->bTLSH ? 1 : 0) + (m_Async->bSSDeep ? 1 : 0);
+
+        if (m_Async->bTLSH)
+            Concurrency::send(m_Async->TLSHQueue, pChunk);
+        if (m_Async->bSSDeep)
+            Concurrency::send(m_Async->SSDeepQueue, pChunk);
+        return S_OK;
+    }
+
     if (m_tlsh)
     {
         m_tlsh->update(pBuffer, dwBytesToHash);
@@ -151,6 +304,10 @@ HRESULT FuzzyHashStream::HashData(LPBYTE pBuffer, DWORD dwBytesToHash)
 
 HRESULT FuzzyHashStream::GetHash(SupportedAlgorithm alg, CBinaryBuffer& Hash)
 {
+    HRESULT hr = E_FAIL;
+    if (FAILED(hr = JoinAsync()))
+        return hr;
+
     if (m_bHashIsValid)
     {
         switch (alg)
@@ -210,6 +367,8 @@ HRESULT FuzzyHashStream::GetHash(SupportedAlgorithm alg, std::wstring& Hash)
 
 FuzzyHashStream::~FuzzyHashStream()
 {
+    JoinAsync();
+
 #ifdef ORC_BUILD_SSDEEP
     if (m_ssdeep)
     {
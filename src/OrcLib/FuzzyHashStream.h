@@ -9,6 +9,8 @@
 
 #include "HashStream.h"
 
+#include <memory>
+
 #pragma managed(push, off)
 
 class Tlsh;
@@ -28,8 +30,17 @@ public:
         TLSH = 1 << 1
     };
 
+    // Fuzzy hashes are much slower to compute than data is read: past this many bytes, they are computed on other
+    // cores while the next buffers are read
+    static constexpr ULONGLONG AsyncThreshold = 4 * 1024 * 1024;
+    // Number of buffers in flight between the reader and the fuzzy hashing tasks
+    static constexpr size_t AsyncQueueDepth = 4;
+
     FuzzyHashStream(logger pLog);
 
+    // MAXULONGLONG keeps all the hashing on the thread reading or writing the stream
+    void SetAsyncThreshold(ULONGLONG ullThreshold) { m_ullAsyncThreshold = ullThreshold; }
+
     // HashStream Specifics
 
     STDMETHOD(OpenToRead(SupportedAlgorithm algs, const std::shared_ptr<ByteStream>& pChainedStream));
@@ -54,6 +65,15 @@ protected:
     SupportedAlgorithm m_Algorithms = Undefined;
     std::unique_ptr<Tlsh> m_tlsh;
     struct fuzzy_state* m_ssdeep = nullptr;
+
+    class AsyncStage;
+    std::unique_ptr<AsyncStage> m_Async;
+    ULONGLONG m_ullAsyncThreshold = AsyncThreshold;
+    ULONGLONG m_ullHashed = 0LL;
+
+    HRESULT StartAsync();
+    // Waits for all the buffers already queued to be hashed
+    HRESULT JoinAsync();
 };
 
 }  // namespace Orc
@@ -0,0 +1,254 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "GcmChunkCipher.h"
+
+#include "ByteStream.h"
+
+#include <ppl.h>
+
+using namespace Orc;
+
+HRESULT GcmChunkCipher::Initialize(
+    const BYTE* pKey,
+    const BYTE* pNoncePrefix,
+    const BYTE* pAuthHeader,
+    ULONG cbAuthHeader,
+    DWORD dwChunkSize,
+    DWORD dwSlots)
+{
+    NTSTATUS status = 0;
+
+    if (dwChunkSize == 0L || dwSlots == 0L)
+        return E_INVALIDARG;
+
+    if (!BCRYPT_SUCCESS(status = BCryptOpenAlgorithmProvider(&m_hAlgorithm, BCRYPT_AES_ALGORITHM, NULL, 0L)))
+        return HRESULT_FROM_NT(status);
+
+    if (!BCRYPT_SUCCESS(
+            status = BCryptSetProperty(
+                m_hAlgorithm,
+                BCRYPT_CHAINING_MODE,
+                (PUCHAR)BCRYPT_CHAIN_MODE_GCM,
+                (ULONG)sizeof(BCRYPT_CHAIN_MODE_GCM),
+                0L)))
+        return HRESULT_FROM_NT(status);
+
+    for (DWORD i = 0; i < dwSlots; i++)
+    {
+        BCRYPT_KEY_HANDLE hKey = NULL;
+        status = BCryptGenerateSymmetricKey(m_hAlgorithm, &hKey, NULL, 0L, (PUCHAR)pKey, KeyLength, 0L);
+        if (!BCRYPT_SUCCESS(status))
+            return HRESULT_FROM_NT(status);
+        m_Keys.push_back(hKey);
+    }
+    m_Buffers.resize(dwSlots);
+
+    m_AuthHeader.assign(pAuthHeader, pAuthHeader + cbAuthHeader);
+    CopyMemory(m_NoncePrefix, pNoncePrefix, NoncePrefixLength);
+    m_dwChunkSize = dwChunkSize;
+    return S_OK;
+}
+
+void GcmChunkCipher::GetNonce(ULONGLONG ullChunk, BYTE (&nonce)[NonceLength]) const
+{
+    CopyMemory(nonce, m_NoncePrefix, NoncePrefixLength);
+    for (int i = 0; i < 8; i++)
+        nonce[NoncePrefixLength + i] = (BYTE)(ullChunk >> (8 * (7 - i)));
+}
+
+std::vector<BYTE> GcmChunkCipher::GetAuthData(ULONGLONG ullChunk, bool bFinal) const
+{
+    std::vector<BYTE> authData(m_AuthHeader);
+    for (int i = 0; i < 8; i++)
+        authData.push_back((BYTE)(ullChunk >> (8 * (7 - i))));
+    authData.push_back(bFinal ? 1 : 0);
+    return authData;
+}
+
+HRESULT GcmChunkCipher::Seal(
+    DWORD dwSlot,
+    ULONGLONG ullChunk,
+    bool bFinal,
+    const BYTE* pPlain,
+    DWORD cbPlain,
+    BYTE* pSealed) const
+{
+    BYTE nonce[NonceLength];
+    GetNonce(ullChunk, nonce);
+
+    auto authData = GetAuthData(ullChunk, bFinal);
+
+    BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+    BCRYPT_INIT_AUTH_MODE_INFO(info);
+    info.pbNonce = nonce;
+    info.cbNonce = sizeof(nonce);
+    info.pbAuthData = authData.data();
+    info.cbAuthData = (ULONG)authData.size();
+    info.pbTag = pSealed + cbPlain;
+    info.cbTag = TagLength;
+
+    ULONG cbResult = 0L;
+    NTSTATUS status =
+        BCryptEncrypt(m_Keys[dwSlot], (PUCHAR)pPlain, cbPlain, &info, NULL, 0L, pSealed, cbPlain, &cbResult, 0L);
+    if (!BCRYPT_SUCCESS(status))
+        return HRESULT_FROM_NT(status);
+    return S_OK;
+}
+
+HRESULT GcmChunkCipher::Open(
+    DWORD dwSlot,
+    ULONGLONG ullChunk,
+    bool bFinal,
+    const BYTE* pSealed,
+    DWORD cbSealed,
+    BYTE* pPlain) const
+{
+    if (cbSealed < TagLength)
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    BYTE nonce[NonceLength];
+    GetNonce(ullChunk, nonce);
+
+    auto authData = GetAuthData(ullChunk, bFinal);
+
+    const DWORD cbCipher = cbSealed - TagLength;
+
+    BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+    BCRYPT_INIT_AUTH_MODE_INFO(info);
+    info.pbNonce = nonce;
+    info.cbNonce = sizeof(nonce);
+    info.pbAuthData = authData.data();
+    info.cbAuthData = (ULONG)authData.size();
+    info.pbTag = (PUCHAR)pSealed + cbCipher;
+    info.cbTag = TagLength;
+
+    ULONG cbResult = 0L;
+    NTSTATUS status =
+        BCryptDecrypt(m_Keys[dwSlot], (PUCHAR)pSealed, cbCipher, &info, NULL, 0L, pPlain, cbCipher, &cbResult, 0L);
+    if (!BCRYPT_SUCCESS(status))
+        return HRESULT_FROM_NT(status);
+    return S_OK;
+}
+
+HRESULT GcmChunkCipher::TransformChunks(
+    ByteStream& output,
+    ULONGLONG ullFirstChunk,
+    DWORD nbChunks,
+    const ChunkTransform& transform,
+    ULONGLONG& ullFailedChunk)
+{
+    HRESULT hr = E_FAIL;
+
+    const DWORD dwSlots = Slots();
+    std::vector<HRESULT> results(dwSlots, E_FAIL);
+    std::vector<DWORD> cbResults(dwSlots, 0L);
+
+    for (DWORD dwBatch = 0; dwBatch < nbChunks; dwBatch += dwSlots)
+    {
+        const DWORD nbBatch = std::min(dwSlots, nbChunks - dwBatch);
+
+        auto process = [&](DWORD dwSlot) {
+            results[dwSlot] = transform(dwSlot, dwBatch + dwSlot, m_Buffers[dwSlot], cbResults[dwSlot]);
+        };
+
+        if (nbBatch == 1)
+            process(0);
+        else
+            concurrency::parallel_for(0UL, nbBatch, process);
+
+        for (DWORD dwSlot = 0; dwSlot < nbBatch; dwSlot++)
+        {
+            ullFailedChunk = ullFirstChunk + dwBatch + dwSlot;
+            if (FAILED(hr = results[dwSlot]))
+                return hr;
+
+            ULONGLONG ullWritten = 0LL;
+            if (FAILED(hr = output.Write(m_Buffers[dwSlot].GetData(), cbResults[dwSlot], &ullWritten)))
+                return hr;
+        }
+    }
+    return S_OK;
+}
+
+HRESULT GcmChunkCipher::SealChunks(
+    ByteStream& output,
+    ULONGLONG ullFirstChunk,
+    const BYTE* pPlain,
+    DWORD nbChunks,
+    DWORD cbLastChunk,
+    bool bFinal,
+    ULONGLONG& ullFailedChunk)
+{
+    return TransformChunks(
+        output,
+        ullFirstChunk,
+        nbChunks,
+        [&](DWORD dwSlot, DWORD dwIndex, CBinaryBuffer& sealed, DWORD& cbSealed) {
+            const bool bLast = dwIndex + 1 == nbChunks;
+            const DWORD cbPlain = bLast ? cbLastChunk : m_dwChunkSize;
+
+            cbSealed = cbPlain + TagLength;
+            if (!sealed.CheckCount(cbSealed))
+                return E_OUTOFMEMORY;
+
+            return Seal(
+                dwSlot,
+                ullFirstChunk + dwIndex,
+                bFinal && bLast,
+                pPlain + (size_t)dwIndex * m_dwChunkSize,
+                cbPlain,
+                sealed.GetData());
+        },
+        ullFailedChunk);
+}
+
+HRESULT GcmChunkCipher::OpenChunks(
+    ByteStream& output,
+    ULONGLONG ullFirstChunk,
+    const BYTE* pSealed,
+    DWORD nbChunks,
+    DWORD cbLastSealed,
+    bool bFinal,
+    ULONGLONG& ullFailedChunk)
+{
+    const DWORD cbSealedChunk = m_dwChunkSize + TagLength;
+
+    return TransformChunks(
+        output,
+        ullFirstChunk,
+        nbChunks,
+        [&](DWORD dwSlot, DWORD dwIndex, CBinaryBuffer& plain, DWORD& cbPlain) {
+            const bool bLast = dwIndex + 1 == nbChunks;
+            const DWORD cbSealed = bLast ? cbLastSealed : cbSealedChunk;
+            if (cbSealed < TagLength)
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+            cbPlain = cbSealed - TagLength;
+            if (!plain.CheckCount(std::max(cbPlain, 1UL)))
+                return E_OUTOFMEMORY;
+
+            return Open(
+                dwSlot,
+                ullFirstChunk + dwIndex,
+                bFinal && bLast,
+                pSealed + (size_t)dwIndex * cbSealedChunk,
+                cbSealed,
+                plain.GetData());
+        },
+        ullFailedChunk);
+}
+
+GcmChunkCipher::~GcmChunkCipher()
+{
+    for (auto hKey : m_Keys)
+        BCryptDestroyKey(hKey);
+    if (m_hAlgorithm != NULL)
+        BCryptCloseAlgorithmProvider(m_hAlgorithm, 0L);
+}
@@ -0,0 +1,117 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include "BinaryBuffer.h"
+
+#include <bcrypt.h>
+
+#include <functional>
+#include <vector>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+class ByteStream;
+
+//
+// GcmChunkCipher seals data in chunks with AES-256-GCM. The nonce of a chunk is a 4 bytes prefix followed by the
+// chunk index. Its authenticated data is the caller's header followed by the chunk index and whether the chunk is the
+// last one, so that chunks cannot be reordered, dropped or truncated unnoticed.
+// Chunks are sealed (or opened) in parallel, in "slots": a CNG key handle is not meant to be shared between threads.
+//
+class ORCLIB_API GcmChunkCipher
+{
+public:
+    static constexpr ULONG KeyLength = 32;
+    static constexpr ULONG TagLength = 16;
+    static constexpr ULONG NonceLength = 12;
+    static constexpr ULONG NoncePrefixLength = 4;
+
+    // Limits shared by the formats built on chunks: larger chunk sizes read from a header are rejected
+    static constexpr DWORD MaxChunkSize = 0x4000000;
+    static constexpr DWORD MaxParallelChunks = 8L;
+
+    // ntstatus.h does not mix with windows.h
+    static constexpr HRESULT AuthenticationFailure = HRESULT_FROM_NT(0xC000A002L);  // STATUS_AUTH_TAG_MISMATCH
+
+    GcmChunkCipher() = default;
+    GcmChunkCipher(const GcmChunkCipher&) = delete;
+    GcmChunkCipher& operator=(const GcmChunkCipher&) = delete;
+
+    HRESULT Initialize(
+        const BYTE* pKey,  // KeyLength bytes
+        const BYTE* pNoncePrefix,  // NoncePrefixLength bytes
+        const BYTE* pAuthHeader,
+        ULONG cbAuthHeader,
+        DWORD dwChunkSize,
+        DWORD dwSlots);
+
+    DWORD ChunkSize() const { return m_dwChunkSize; }
+    DWORD Slots() const { return static_cast<DWORD>(m_Keys.size()); }
+
+    // Encrypts cbPlain bytes into pSealed (cbPlain bytes of cipher text followed by the tag)
+    HRESULT
+    Seal(DWORD dwSlot, ULONGLONG ullChunk, bool bFinal, const BYTE* pPlain, DWORD cbPlain, BYTE* pSealed) const;
+
+    // Decrypts and verifies cbSealed bytes (cipher text followed by the tag) into pPlain
+    HRESULT Open(DWORD dwSlot, ULONGLONG ullChunk, bool bFinal, const BYTE* pSealed, DWORD cbSealed, BYTE* pPlain) const;
+
+    // Seals nbChunks consecutive chunks of pPlain, up to Slots() at once, and writes them to output in order.
+    // The last chunk is cbLastChunk bytes long and is the final one when bFinal.
+    HRESULT SealChunks(
+        ByteStream& output,
+        ULONGLONG ullFirstChunk,
+        const BYTE* pPlain,
+        DWORD nbChunks,
+        DWORD cbLastChunk,
+        bool bFinal,
+        ULONGLONG& ullFailedChunk);
+
+    // Opens nbChunks consecutive sealed chunks of pSealed, up to Slots() at once, and writes the plain text to output.
+    // The last sealed chunk is cbLastSealed bytes long and is the final one when bFinal.
+    HRESULT OpenChunks(
+        ByteStream& output,
+        ULONGLONG ullFirstChunk,
+        const BYTE* pSealed,
+        DWORD nbChunks,
+        DWORD cbLastSealed,
+        bool bFinal,
+        ULONGLONG& ullFailedChunk);
+
+    ~GcmChunkCipher();
+
+private:
+    BCRYPT_ALG_HANDLE m_hAlgorithm = NULL;
+    std::vector<BCRYPT_KEY_HANDLE> m_Keys;
+    std::vector<CBinaryBuffer> m_Buffers;
+
+    std::vector<BYTE> m_AuthHeader;
+    BYTE m_NoncePrefix[NoncePrefixLength] = {};
+    DWORD m_dwChunkSize = 0L;
+
+    void GetNonce(ULONGLONG ullChunk, BYTE (&nonce)[NonceLength]) const;
+    std::vector<BYTE> GetAuthData(ULONGLONG ullChunk, bool bFinal) const;
+
+    // Transforms the dwIndex-th chunk of a batch into result, using the key of dwSlot
+    using ChunkTransform = std::function<HRESULT(DWORD dwSlot, DWORD dwIndex, CBinaryBuffer& result, DWORD& cbResult)>;
+
+    HRESULT TransformChunks(
+        ByteStream& output,
+        ULONGLONG ullFirstChunk,
+        DWORD nbChunks,
+        const ChunkTransform& transform,
+        ULONGLONG& ullFailedChunk);
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
@@ -0,0 +1,391 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+
+#include "stdafx.h"
+
+#include "HashCache.h"
+
+#include "DataDetails.h"
+#include "FileStream.h"
+#include "LogFileWriter.h"
+
+#include <safeint.h>
+#include <vector>
+
+using namespace Orc;
+
+constexpr auto OrcHashCacheEnv = L"DFIR-ORC_HASH_CACHE";
+
+namespace {
+
+std::mutex g_ProcessCacheLock;
+std::shared_ptr<HashCache> g_pProcessCache;
+std::wstring g_strProcessCacheFile;
+bool g_bProcessCacheChecked = false;
+
+template <typename _T>
+void Put(std::vector<BYTE>& buffer, const _T& value)
+{
+    const BYTE* pValue = reinterpret_cast<const BYTE*>(&value);
+    buffer.insert(std::end(buffer), pValue, pValue + sizeof(_T));
+}
+
+void PutBytes(std::vector<BYTE>& buffer, const CBinaryBuffer& bytes)
+{
+    Put(buffer, (BYTE)bytes.GetCount());
+    buffer.insert(std::end(buffer), bytes.GetData(), bytes.GetData() + bytes.GetCount());
+}
+
+void PutString(std::vector<BYTE>& buffer, const std::wstring& str)
+{
+    Put(buffer, (WORD)str.size());
+    const BYTE* pString = reinterpret_cast<const BYTE*>(str.data());
+    buffer.insert(std::end(buffer), pString, pString + str.size() * sizeof(WCHAR));
+}
+
+class Reader
+{
+public:
+    Reader(const CBinaryBuffer& buffer)
+        : m_pCur(buffer.GetData())
+        , m_pEnd(buffer.GetData() + buffer.GetCount())
+    {
+    }
+
+    bool AtEnd() const { return m_pCur == m_pEnd; }
+
+    template <typename _T>
+    bool Get(_T& value)
+    {
+        if ((size_t)(m_pEnd - m_pCur) < sizeof(_T))
+            return false;
+        CopyMemory(&value, m_pCur, sizeof(_T));
+        m_pCur += sizeof(_T);
+        return true;
+    }
+
+    bool GetBytes(CBinaryBuffer& bytes)
+    {
+        BYTE cbBytes = 0;
+        if (!Get(cbBytes) || (size_t)(m_pEnd - m_pCur) < cbBytes)
+            return false;
+        bytes.SetData((LPBYTE)m_pCur, cbBytes);
+        m_pCur += cbBytes;
+        return true;
+    }
+
+    bool GetString(std::wstring& str)
+    {
+        WORD cchString = 0;
+        if (!Get(cchString) || (size_t)(m_pEnd - m_pCur) < cchString * sizeof(WCHAR))
+            return false;
+        str.assign((const WCHAR*)m_pCur, cchString);
+        m_pCur += cchString * sizeof(WCHAR);
+        return true;
+    }
+
+private:
+    const BYTE* m_pCur;
+    const BYTE* m_pEnd;
+};
+
+}  // namespace
+
+Intentions HashCache::GetHashIntentions(Intentions localIntentions)
+{
+    DWORDLONG retval = localIntentions & CachedIntentions;
+
+    if (localIntentions & FILEINFO_AUTHENTICODE_STATUS || localIntentions & FILEINFO_AUTHENTICODE_SIGNER)
+        retval |= FILEINFO_PE_MD5 | FILEINFO_PE_SHA1 | FILEINFO_PE_SHA256;
+
+    return static_cast<Intentions>(retval);
+}
+
+bool HashCache::Lookup(const Key& key, Intentions hashIntentions, DataDetails& details)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+
+    auto it = m_Entries.find(key);
+    if (it == std::end(m_Entries) || (hashIntentions & ~it->second.Computed))
+    {
+        m_ullMisses++;
+        return false;
+    }
+
+    const auto& entry = it->second;
+
+    if (hashIntentions & FILEINFO_MD5)
+        details.MD5() = entry.MD5;
+    if (hashIntentions & FILEINFO_SHA1)
+        details.SHA1() = entry.SHA1;
+    if (hashIntentions & FILEINFO_SHA256)
+        details.SHA256() = entry.SHA256;
+    if (hashIntentions & FILEINFO_PE_MD5)
+        details.PeMD5() = entry.PeMD5;
+    if (hashIntentions & FILEINFO_PE_SHA1)
+        details.PeSHA1() = entry.PeSHA1;
+    if (hashIntentions & FILEINFO_PE_SHA256)
+        details.PeSHA256() = entry.PeSHA256;
+    if (hashIntentions & FILEINFO_SSDEEP)
+        details.SSDeep() = entry.SSDeep;
+    if (hashIntentions & FILEINFO_TLSH)
+        details.TLSH() = entry.TLSH;
+
+    m_ullHits++;
+    return true;
+}
+
+void HashCache::Store(const Key& key, Intentions hashIntentions, DataDetails& details)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+
+    auto& entry = m_Entries[key];
+
+    if (hashIntentions & FILEINFO_MD5)
+        entry.MD5 = details.MD5();
+    if (hashIntentions & FILEINFO_SHA1)
+        entry.SHA1 = details.SHA1();
+    if (hashIntentions & FILEINFO_SHA256)
+        entry.SHA256 = details.SHA256();
+    if (hashIntentions & FILEINFO_PE_MD5)
+        entry.PeMD5 = details.PeMD5();
+    if (hashIntentions & FILEINFO_PE_SHA1)
+        entry.PeSHA1 = details.PeSHA1();
+    if (hashIntentions & FILEINFO_PE_SHA256)
+        entry.PeSHA256 = details.PeSHA256();
+    if (hashIntentions & FILEINFO_SSDEEP)
+        entry.SSDeep = details.SSDeep();
+    if (hashIntentions & FILEINFO_TLSH)
+        entry.TLSH = details.TLSH();
+
+    entry.Computed |= hashIntentions & CachedIntentions;
+    m_bDirty = true;
+}
+
+HRESULT HashCache::Merge(const CBinaryBuffer& buffer)
+{
+    Reader reader(buffer);
+
+    CHAR magic[sizeof(Magic)];
+    DWORD dwVersion = 0L;
+    if (!reader.Get(magic) || memcmp(magic, Magic, sizeof(Magic)) || !reader.Get(dwVersion))
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    if (dwVersion != Version)
+        return HRESULT_FROM_WIN32(ERROR_REVISION_MISMATCH);
+
+    std::lock_guard<std::mutex> lock(m_Lock);
+
+    while (!reader.AtEnd())
+    {
+        Key key;
+        Entry entry;
+
+        if (!reader.Get(key.VolumeSerial) || !reader.Get(key.SnapshotID) || !reader.Get(key.FRN)
+            || !reader.Get(key.DataInstance) || !reader.Get(key.DataSize) || !reader.Get(key.LastModificationTime)
+            || !reader.Get(key.USN) || !reader.Get(entry.Computed) || !reader.GetBytes(entry.MD5)
+            || !reader.GetBytes(entry.SHA1) || !reader.GetBytes(entry.SHA256) || !reader.GetBytes(entry.PeMD5)
+            || !reader.GetBytes(entry.PeSHA1) || !reader.GetBytes(entry.PeSHA256) || !reader.GetString(entry.SSDeep)
+            || !reader.GetString(entry.TLSH))
+        {
+            // truncated: keep what was read so far
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+
+        m_Entries.emplace(key, std::move(entry));
+    }
+    return S_OK;
+}
+
+HRESULT HashCache::Serialize(std::vector<BYTE>& buffer) const
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+
+    buffer.clear();
+    Put(buffer, Magic);
+    Put(buffer, Version);
+
+    for (const auto& [key, entry] : m_Entries)
+    {
+        Put(buffer, key.VolumeSerial);
+        Put(buffer, key.SnapshotID);
+        Put(buffer, key.FRN);
+        Put(buffer, key.DataInstance);
+        Put(buffer, key.DataSize);
+        Put(buffer, key.LastModificationTime);
+        Put(buffer, key.USN);
+        Put(buffer, entry.Computed);
+        PutBytes(buffer, entry.MD5);
+        PutBytes(buffer, entry.SHA1);
+        PutBytes(buffer, entry.SHA256);
+        PutBytes(buffer, entry.PeMD5);
+        PutBytes(buffer, entry.PeSHA1);
+        PutBytes(buffer, entry.PeSHA256);
+        PutString(buffer, entry.SSDeep);
+        PutString(buffer, entry.TLSH);
+    }
+    return S_OK;
+}
+
+HRESULT HashCache::LoadFrom(const std::wstring& strFile)
+{
+    HRESULT hr = E_FAIL;
+
+    FileStream fstream(_L_);
+
+    if (FAILED(hr = fstream.ReadFrom(strFile.c_str())))
+    {
+        if (hr == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+            return S_OK;  // first run
+        log::Warning(_L_, hr, L"Failed to open hash cache %s\r\n", strFile.c_str());
+        return hr;
+    }
+
+    CBinaryBuffer buffer;
+    if (!buffer.SetCount(msl::utilities::SafeInt<size_t>(fstream.GetSize())))
+        return E_OUTOFMEMORY;
+
+    ULONGLONG ullRead = 0LL;
+    if (FAILED(hr = fstream.Read(buffer.GetData(), buffer.GetCount(), &ullRead)))
+    {
+        log::Warning(_L_, hr, L"Failed to read hash cache %s\r\n", strFile.c_str());
+        return hr;
+    }
+    buffer.SetCount((size_t)ullRead);
+
+    if (FAILED(hr = Merge(buffer)))
+        log::Warning(
+            _L_, hr, L"Invalid hash cache %s, only %I64d entries loaded\r\n", strFile.c_str(), (ULONGLONG)Count());
+    else
+        log::Verbose(_L_, L"Loaded %I64d entries from hash cache %s\r\n", (ULONGLONG)Count(), strFile.c_str());
+    return S_OK;
+}
+
+HRESULT HashCache::SaveTo(const std::wstring& strFile)
+{
+    HRESULT hr = E_FAIL;
+
+    FileStream fstream(_L_);
+
+    // Commands of a collection may complete at the same time: the file is held exclusively while it is merged
+    for (DWORD dwAttempt = 0;; dwAttempt++)
+    {
+        hr = fstream.OpenFile(
+            strFile.c_str(), GENERIC_READ | GENERIC_WRITE, 0L, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+        if (hr != HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION) || dwAttempt >= 50)
+            break;
+        Sleep(100);
+    }
+
+    if (FAILED(hr))
+    {
+        log::Warning(_L_, hr, L"Failed to open hash cache %s\r\n", strFile.c_str());
+        return hr;
+    }
+
+    // Entries saved meanwhile by other commands are kept (ours win on identical keys)
+    if (const auto ullSize = fstream.GetSize(); ullSize > 0)
+    {
+        CBinaryBuffer existing;
+        if (!existing.SetCount(msl::utilities::SafeInt<size_t>(ullSize)))
+            return E_OUTOFMEMORY;
+
+        ULONGLONG ullRead = 0LL;
+        if (SUCCEEDED(hr = fstream.Read(existing.GetData(), existing.GetCount(), &ullRead)))
+        {
+            existing.SetCount((size_t)ullRead);
+            if (FAILED(hr = Merge(existing)))
+                log::Warning(_L_, hr, L"Invalid hash cache %s, it will be rewritten\r\n", strFile.c_str());
+        }
+    }
+
+    std::vector<BYTE> buffer;
+    if (FAILED(hr = Serialize(buffer)))
+        return hr;
+
+    ULONGLONG ullWritten = 0LL;
+    if (FAILED(hr = fstream.SetFilePointer(0LL, FILE_BEGIN, nullptr))
+        || FAILED(hr = fstream.Write(buffer.data(), buffer.size(), &ullWritten))
+        || FAILED(hr = fstream.SetSize(ullWritten)))
+    {
+        log::Warning(_L_, hr, L"Failed to write hash cache %s\r\n", strFile.c_str());
+        return hr;
+    }
+
+    m_bDirty = false;
+    fstream.Close();
+    return S_OK;
+}
+
+HRESULT HashCache::ConfigureProcessCache(const logger& pLog, const std::wstring& strFile)
+{
+    HRESULT hr = E_FAIL;
+
+    if (strFile.empty())
+        return S_OK;
+
+    // The variable is inherited by all the commands we launch
+    if (!SetEnvironmentVariableW(OrcHashCacheEnv, strFile.c_str()))
+    {
+        log::Error(
+            pLog,
+            hr = HRESULT_FROM_WIN32(GetLastError()),
+            L"Failed to set %%%s%% to %s\r\n",
+            OrcHashCacheEnv,
+            strFile.c_str());
+        return hr;
+    }
+
+    log::Info(pLog, L"Hash cache is now set to %s\r\n", strFile.c_str());
+    return S_OK;
+}
+
+std::shared_ptr<HashCache> HashCache::GetProcessCache(const logger& pLog)
+{
+    std::lock_guard<std::mutex> lock(g_ProcessCacheLock);
+
+    if (g_bProcessCacheChecked)
+        return g_pProcessCache;
+    g_bProcessCacheChecked = true;
+
+    DWORD nbChars = GetEnvironmentVariableW(OrcHashCacheEnv, NULL, 0L);
+    if (nbChars == 0)
+        return nullptr;
+
+    std::wstring strFile(nbChars, L'\0');
+    nbChars = GetEnvironmentVariableW(OrcHashCacheEnv, strFile.data(), nbChars);
+    strFile.resize(nbChars);
+
+    auto cache = std::make_shared<HashCache>(pLog);
+    if (FAILED(cache->LoadFrom(strFile)))
+        return nullptr;
+
+    g_strProcessCacheFile = std::move(strFile);
+    g_pProcessCache = std::move(cache);
+    return g_pProcessCache;
+}
+
+HRESULT HashCache::FlushProcessCache(const logger& pLog)
+{
+    std::lock_guard<std::mutex> lock(g_ProcessCacheLock);
+
+    if (!g_pProcessCache)
+        return S_OK;
+
+    log::Verbose(
+        pLog,
+        L"Hash cache: %I64d hits, %I64d misses\r\n",
+        g_pProcessCache->Hits(),
+        g_pProcessCache->Misses());
+
+    if (!g_pProcessCache->IsDirty())
+        return S_OK;
+
+    return g_pProcessCache->SaveTo(g_strProcessCacheFile);
+}
@@ -0,0 +1,136 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include "BinaryBuffer.h"
+#include "CryptoUtilities.h"
+#include "FSUtils.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+class LogFileWriter;
+class DataDetails;
+
+//
+// HashCache remembers the hashes computed for a data stream so that NTFSInfo, FastFind, GetSamples, ... running in
+// the same collection (or on the next collection on the same host) do not read and hash the same files again.
+//
+// The validity key is deliberately conservative: volume, snapshot, file reference number (including the sequence
+// number), data attribute instance, data size, $STANDARD_INFORMATION last modification time and USN. Any change to
+// any of them is a cache miss.
+//
+// The process cache is enabled by setting %DFIR-ORC_HASH_CACHE% to a file path (WolfLauncher does it for all the
+// commands it runs with /HashCache=<file>). It is loaded on first use and merged back into the file on exit. As its
+// content is trusted, the cache file must be kept in a location the collected system cannot write to.
+//
+class ORCLIB_API HashCache
+{
+public:
+    class Key
+    {
+    public:
+        ULONGLONG VolumeSerial = 0LL;
+        GUID SnapshotID = GUID_NULL;
+        ULONGLONG FRN = 0LL;  // full segment number, sequence number included
+        USHORT DataInstance = 0;
+        ULONGLONG DataSize = 0LL;
+        ULONGLONG LastModificationTime = 0LL;
+        ULONGLONG USN = 0LL;
+
+        bool operator<(const Key& other) const
+        {
+            if (auto cmp = memcmp(&SnapshotID, &other.SnapshotID, sizeof(GUID)))
+                return cmp < 0;
+            return std::tie(VolumeSerial, FRN, DataInstance, DataSize, LastModificationTime, USN) < std::tie(
+                       other.VolumeSerial,
+                       other.FRN,
+                       other.DataInstance,
+                       other.DataSize,
+                       other.LastModificationTime,
+                       other.USN);
+        }
+    };
+
+    // Hash intentions a cache entry can satisfy
+    static constexpr DWORDLONG CachedIntentions = FILEINFO_MD5 | FILEINFO_SHA1 | FILEINFO_SHA256 | FILEINFO_SSDEEP
+        | FILEINFO_TLSH | FILEINFO_PE_MD5 | FILEINFO_PE_SHA1 | FILEINFO_PE_SHA256;
+
+    // Hash intentions needed to serve localIntentions (authenticode needs all the PE hashes)
+    static Intentions GetHashIntentions(Intentions localIntentions);
+
+    HashCache(logger pLog)
+        : _L_(std::move(pLog)) {};
+
+    HashCache(const HashCache&) = delete;
+
+    // Fills details with the cached hashes when all the hashIntentions were computed for this key
+    bool Lookup(const Key& key, Intentions hashIntentions, DataDetails& details);
+    void Store(const Key& key, Intentions hashIntentions, DataDetails& details);
+
+    HRESULT LoadFrom(const std::wstring& strFile);
+    // Merges the entries into the file, keeping the entries other processes saved meanwhile
+    HRESULT SaveTo(const std::wstring& strFile);
+
+    size_t Count() const
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        return m_Entries.size();
+    }
+    ULONGLONG Hits() const { return m_ullHits; }
+    ULONGLONG Misses() const { return m_ullMisses; }
+    bool IsDirty() const { return m_bDirty; }
+
+    static HRESULT ConfigureProcessCache(const logger& pLog, const std::wstring& strFile);
+    // Process wide cache, nullptr when not enabled
+    static std::shared_ptr<HashCache> GetProcessCache(const logger& pLog);
+    static HRESULT FlushProcessCache(const logger& pLog);
+
+private:
+    class Entry
+    {
+    public:
+        DWORDLONG Computed = 0LL;  // hash intentions computed, even when a hash is not available (PE hashes)
+        CBinaryBuffer MD5;
+        CBinaryBuffer SHA1;
+        CBinaryBuffer SHA256;
+        CBinaryBuffer PeMD5;
+        CBinaryBuffer PeSHA1;
+        CBinaryBuffer PeSHA256;
+        std::wstring SSDeep;
+        std::wstring TLSH;
+    };
+
+    static constexpr CHAR Magic[8] = {'O', 'R', 'C', 'H', 'A', 'S', 'H', 'C'};
+    static constexpr DWORD Version = 1L;
+
+    // Adds the entries from a cache file content, entries already known are kept
+    HRESULT Merge(const CBinaryBuffer& buffer);
+    HRESULT Serialize(std::vector<BYTE>& buffer) const;
+
+    logger _L_;
+
+    mutable std::mutex m_Lock;
+    std::map<Key, Entry> m_Entries;
+    ULONGLONG m_ullHits = 0LL;
+    ULONGLONG m_ullMisses = 0LL;
+    bool m_bDirty = false;  // entries were stored since the last save
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
@@ -0,0 +1,968 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+
+#include "stdafx.h"
+
+#include "HashEngine.h"
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+using namespace Orc;
+
+namespace {
+
+using CompressFunction = void (*)(std::uint32_t* pState, const BYTE* pData, size_t nbBlocks);
+
+const std::uint32_t g_MD5IV[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+const std::uint32_t g_SHA1IV[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+const std::uint32_t g_SHA256IV[8] =
+    {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+const std::uint32_t g_MD5K[64] = {
+    0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+    0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+    0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+    0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+    0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+    0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+    0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+    0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
+};
+
+const int g_MD5Shifts[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+alignas(16) const std::uint32_t g_SHA256K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+inline std::uint32_t RotateLeft(std::uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+inline std::uint32_t RotateRight(std::uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+inline std::uint32_t LoadLE32(const BYTE* p)
+{
+    std::uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline std::uint32_t LoadBE32(const BYTE* p)
+{
+    return _byteswap_ulong(LoadLE32(p));
+}
+
+inline void StoreLE32(BYTE* p, std::uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+inline void StoreBE32(BYTE* p, std::uint32_t value)
+{
+    StoreLE32(p, _byteswap_ulong(value));
+}
+
+//
+// Portable implementations
+//
+
+void MD5Blocks(std::uint32_t* pState, const BYTE* pData, size_t nbBlocks)
+{
+    for (; nbBlocks > 0; nbBlocks--, pData += HashEngine::BlockSize)
+    {
+        std::uint32_t M[16];
+        for (int i = 0; i < 16; i++)
+            M[i] = LoadLE32(pData + i * 4);
+
+        std::uint32_t a = pState[0], b = pState[1], c = pState[2], d = pState[3];
+
+        for (int i = 0; i < 64; i++)
+        {
+            std::uint32_t f;
+            int g;
+            if (i < 16)
+            {
+                f = (b & c) | (~b & d);
+                g = i;
+            }
+            else if (i < 32)
+            {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+            }
+            else if (i < 48)
+            {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+            }
+            else
+            {
+                f = c ^ (b | ~d);
+                g = (7 * i) % 16;
+            }
+
+            f += a + g_MD5K[i] + M[g];
+            a = d;
+            d = c;
+            c = b;
+            b += RotateLeft(f, g_MD5Shifts[i]);
+        }
+
+        pState[0] += a;
+        pState[1] += b;
+        pState[2] += c;
+        pState[3] += d;
+    }
+}
+
+void SHA1Blocks(std::uint32_t* pState, const BYTE* pData, size_t nbBlocks)
+{
+    for (; nbBlocks > 0; nbBlocks--, pData += HashEngine::BlockSize)
+    {
+        std::uint32_t W[80];
+        for (int t = 0; t < 16; t++)
+            W[t] = LoadBE32(pData + t * 4);
+        for (int t = 16; t < 80; t++)
+            W[t] = RotateLeft(W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16], 1);
+
+        std::uint32_t a = pState[0], b = pState[1], c = pState[2], d = pState[3], e = pState[4];
+
+        for (int t = 0; t < 80; t++)
+        {
+            std::uint32_t f, k;
+            if (t < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (t < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (t < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            const std::uint32_t temp = RotateLeft(a, 5) + f + e + k + W[t];
+            e = d;
+            d = c;
+            c = RotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        pState[0] += a;
+        pState[1] += b;
+        pState[2] += c;
+        pState[3] += d;
+        pState[4] += e;
+    }
+}
+
+void SHA256Blocks(std::uint32_t* pState, const BYTE* pData, size_t nbBlocks)
+{
+    for (; nbBlocks > 0; nbBlocks--, pData += HashEngine::BlockSize)
+    {
+        std::uint32_t W[64];
+        for (int t = 0; t < 16; t++)
+            W[t] = LoadBE32(pData + t * 4);
+        for (int t = 16; t < 64; t++)
+        {
+            const std::uint32_t s0 = RotateRight(W[t - 15], 7) ^ RotateRight(W[t - 15], 18) ^ (W[t - 15] >> 3);
+            const std::uint32_t s1 = RotateRight(W[t - 2], 17) ^ RotateRight(W[t - 2], 19) ^ (W[t - 2] >> 10);
+            W[t] = W[t - 16] + s0 + W[t - 7] + s1;
+        }
+
+        std::uint32_t a = pState[0], b = pState[1], c = pState[2], d = pState[3];
+        std::uint32_t e = pState[4], f = pState[5], g = pState[6], h = pState[7];
+
+        for (int t = 0; t < 64; t++)
+        {
+            const std::uint32_t S1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+            const std::uint32_t ch = (e & f) ^ (~e & g);
+            const std::uint32_t temp1 = h + S1 + ch + g_SHA256K[t] + W[t];
+            const std::uint32_t S0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+            const std::uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            const std::uint32_t temp2 = S0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + temp1;
+            d = c;
+            c = b;
+            b = a;
+            a = temp1 + temp2;
+        }
+
+        pState[0] += a;
+        pState[1] += b;
+        pState[2] += c;
+        pState[3] += d;
+        pState[4] += e;
+        pState[5] += f;
+        pState[6] += g;
+        pState[7] += h;
+    }
+}
+
+//
+// SHA extensions (SHA-NI) implementations
+//
+
+void SHA1BlocksSHANI(std::uint32_t* pState, const BYTE* pData, size_t nbBlocks)
+{
+    const __m128i MASK = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    __m128i ABCD = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pState)), 0x1B);
+    __m128i E0 = _mm_set_epi32(pState[4], 0, 0, 0);
+    __m128i E1, MSG0, MSG1, MSG2, MSG3;
+
+    for (; nbBlocks > 0; nbBlocks--, pData += HashEngine::BlockSize)
+    {
+        const __m128i ABCD_SAVE = ABCD;
+        const __m128i E0_SAVE = E0;
+
+        // Rounds 0-3
+        MSG0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0)), MASK);
+        E0 = _mm_add_epi32(E0, MSG0);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+        // Rounds 4-7
+        MSG1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 16)), MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+        // Rounds 8-11
+        MSG2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 32)), MASK);
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        // Rounds 12-15
+        MSG3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 48)), MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        // Rounds 16-19
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        // Rounds 20-23
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        // Rounds 24-27
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        // Rounds 28-31
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        // Rounds 32-35
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        // Rounds 36-39
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        // Rounds 40-43
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        // Rounds 44-47
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        // Rounds 48-51
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        // Rounds 52-55
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        // Rounds 56-59
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        // Rounds 60-63
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        // Rounds 64-67
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        // Rounds 68-71
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        // Rounds 72-75
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+        // Rounds 76-79
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+        E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pState), _mm_shuffle_epi32(ABCD, 0x1B));
+    pState[4] = _mm_extract_epi32(E0, 3);
+}
+
+void SHA256BlocksSHANI(std::uint32_t* pState, const BYTE* pData, size_t nbBlocks)
+{
+    const __m128i MASK = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    // state is reorganised as ABEF/CDGH as expected by sha256rnds2
+    __m128i TMP = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pState)), 0xB1);
+    __m128i STATE1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pState + 4)), 0x1B);
+    __m128i STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+    __m128i MSG, MSG0, MSG1, MSG2, MSG3;
+
+    for (; nbBlocks > 0; nbBlocks--, pData += HashEngine::BlockSize)
+    {
+        const __m128i ABEF_SAVE = STATE0;
+        const __m128i CDGH_SAVE = STATE1;
+
+        // Rounds 0-3
+        MSG0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 0)), MASK);
+        MSG = _mm_add_epi32(MSG0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[0])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+        // Rounds 4-7
+        MSG1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 16)), MASK);
+        MSG = _mm_add_epi32(MSG1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[4])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
+
+        // Rounds 8-11
+        MSG2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 32)), MASK);
+        MSG = _mm_add_epi32(MSG2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[8])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
+
+        // Rounds 12-15
+        MSG3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 48)), MASK);
+        MSG = _mm_add_epi32(MSG3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[12])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG0 = _mm_add_epi32(MSG0, _mm_alignr_epi8(MSG3, MSG2, 4));
+        MSG0 = _mm_sha256msg2_epu32(MSG0, MSG3);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);
+
+        // Rounds 16-19
+        MSG = _mm_add_epi32(MSG0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[16])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG1 = _mm_add_epi32(MSG1, _mm_alignr_epi8(MSG0, MSG3, 4));
+        MSG1 = _mm_sha256msg2_epu32(MSG1, MSG0);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);
+
+        // Rounds 20-23
+        MSG = _mm_add_epi32(MSG1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[20])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG2 = _mm_add_epi32(MSG2, _mm_alignr_epi8(MSG1, MSG0, 4));
+        MSG2 = _mm_sha256msg2_epu32(MSG2, MSG1);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
+
+        // Rounds 24-27
+        MSG = _mm_add_epi32(MSG2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[24])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG3 = _mm_add_epi32(MSG3, _mm_alignr_epi8(MSG2, MSG1, 4));
+        MSG3 = _mm_sha256msg2_epu32(MSG3, MSG2);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
+
+        // Rounds 28-31
+        MSG = _mm_add_epi32(MSG3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[28])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG0 = _mm_add_epi32(MSG0, _mm_alignr_epi8(MSG3, MSG2, 4));
+        MSG0 = _mm_sha256msg2_epu32(MSG0, MSG3);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);
+
+        // Rounds 32-35
+        MSG = _mm_add_epi32(MSG0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[32])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG1 = _mm_add_epi32(MSG1, _mm_alignr_epi8(MSG0, MSG3, 4));
+        MSG1 = _mm_sha256msg2_epu32(MSG1, MSG0);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);
+
+        // Rounds 36-39
+        MSG = _mm_add_epi32(MSG1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[36])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG2 = _mm_add_epi32(MSG2, _mm_alignr_epi8(MSG1, MSG0, 4));
+        MSG2 = _mm_sha256msg2_epu32(MSG2, MSG1);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
+
+        // Rounds 40-43
+        MSG = _mm_add_epi32(MSG2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[40])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG3 = _mm_add_epi32(MSG3, _mm_alignr_epi8(MSG2, MSG1, 4));
+        MSG3 = _mm_sha256msg2_epu32(MSG3, MSG2);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
+
+        // Rounds 44-47
+        MSG = _mm_add_epi32(MSG3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[44])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG0 = _mm_add_epi32(MSG0, _mm_alignr_epi8(MSG3, MSG2, 4));
+        MSG0 = _mm_sha256msg2_epu32(MSG0, MSG3);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);
+
+        // Rounds 48-51
+        MSG = _mm_add_epi32(MSG0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[48])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG1 = _mm_add_epi32(MSG1, _mm_alignr_epi8(MSG0, MSG3, 4));
+        MSG1 = _mm_sha256msg2_epu32(MSG1, MSG0);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);
+
+        // Rounds 52-55
+        MSG = _mm_add_epi32(MSG1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[52])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG2 = _mm_add_epi32(MSG2, _mm_alignr_epi8(MSG1, MSG0, 4));
+        MSG2 = _mm_sha256msg2_epu32(MSG2, MSG1);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+        // Rounds 56-59
+        MSG = _mm_add_epi32(MSG2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[56])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG3 = _mm_add_epi32(MSG3, _mm_alignr_epi8(MSG2, MSG1, 4));
+        MSG3 = _mm_sha256msg2_epu32(MSG3, MSG2);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+        // Rounds 60-63
+        MSG = _mm_add_epi32(MSG3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&g_SHA256K[60])));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pState), STATE0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pState + 4), STATE1);
+}
+
+//
+// AVX2 multi-buffer SHA256: each 32 bits lane of a __m256i holds the state of a different message
+//
+
+template <int _Bits>
+inline __m256i RotateRight(const __m256i& x)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, _Bits), _mm256_slli_epi32(x, 32 - _Bits));
+}
+
+inline __m256i Add(const __m256i& a, const __m256i& b)
+{
+    return _mm256_add_epi32(a, b);
+}
+
+inline __m256i Xor(const __m256i& a, const __m256i& b, const __m256i& c)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(a, b), c);
+}
+
+void SHA256BlockX8(__m256i* pState, const BYTE* const pBlocks[HashEngine::MultiBufferLanes])
+{
+    __m256i W[16];
+
+    __m256i a = pState[0], b = pState[1], c = pState[2], d = pState[3];
+    __m256i e = pState[4], f = pState[5], g = pState[6], h = pState[7];
+
+    for (int t = 0; t < 64; t++)
+    {
+        __m256i w;
+        if (t < 16)
+        {
+            w = _mm256_setr_epi32(
+                LoadBE32(pBlocks[0] + t * 4),
+                LoadBE32(pBlocks[1] + t * 4),
+                LoadBE32(pBlocks[2] + t * 4),
+                LoadBE32(pBlocks[3] + t * 4),
+                LoadBE32(pBlocks[4] + t * 4),
+                LoadBE32(pBlocks[5] + t * 4),
+                LoadBE32(pBlocks[6] + t * 4),
+                LoadBE32(pBlocks[7] + t * 4));
+        }
+        else
+        {
+            const __m256i& w15 = W[(t - 15) & 15];
+            const __m256i& w2 = W[(t - 2) & 15];
+            const __m256i s0 = Xor(RotateRight<7>(w15), RotateRight<18>(w15), _mm256_srli_epi32(w15, 3));
+            const __m256i s1 = Xor(RotateRight<17>(w2), RotateRight<19>(w2), _mm256_srli_epi32(w2, 10));
+            w = Add(Add(W[t & 15], s0), Add(W[(t - 7) & 15], s1));
+        }
+        W[t & 15] = w;
+
+        const __m256i S1 = Xor(RotateRight<6>(e), RotateRight<11>(e), RotateRight<25>(e));
+        const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        const __m256i temp1 = Add(Add(h, S1), Add(ch, Add(_mm256_set1_epi32(g_SHA256K[t]), w)));
+        const __m256i S0 = Xor(RotateRight<2>(a), RotateRight<13>(a), RotateRight<22>(a));
+        const __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        const __m256i temp2 = Add(S0, maj);
+
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, temp1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(temp1, temp2);
+    }
+
+    pState[0] = Add(pState[0], a);
+    pState[1] = Add(pState[1], b);
+    pState[2] = Add(pState[2], c);
+    pState[3] = Add(pState[3], d);
+    pState[4] = Add(pState[4], e);
+    pState[5] = Add(pState[5], f);
+    pState[6] = Add(pState[6], g);
+    pState[7] = Add(pState[7], h);
+}
+
+void SHA256Lanes(
+    const BYTE* const pData[],
+    const size_t cbData[],
+    const size_t pIndexes[],
+    size_t nbLanes,
+    HashEngine::SHA256Digest pDigests[])
+{
+    constexpr size_t Lanes = HashEngine::MultiBufferLanes;
+    constexpr size_t BlockSize = HashEngine::BlockSize;
+
+    static const BYTE g_Idle[BlockSize] = {0};
+
+    // the last one or two blocks of each message (remaining bytes and padding) are built apart
+    BYTE tails[Lanes][2 * BlockSize];
+    size_t fullBlocks[Lanes] = {0};
+    size_t totalBlocks[Lanes] = {0};
+    size_t maxBlocks = 0;
+
+    for (size_t lane = 0; lane < nbLanes; lane++)
+    {
+        const size_t cbMessage = cbData[pIndexes[lane]];
+        const size_t cbTail = cbMessage % BlockSize;
+
+        fullBlocks[lane] = cbMessage / BlockSize;
+        totalBlocks[lane] = fullBlocks[lane] + (cbTail + 9 > BlockSize ? 2 : 1);
+        maxBlocks = std::max(maxBlocks, totalBlocks[lane]);
+
+        const size_t cbPadded = (totalBlocks[lane] - fullBlocks[lane]) * BlockSize;
+        memset(tails[lane], 0, sizeof(tails[lane]));
+        memcpy(tails[lane], pData[pIndexes[lane]] + fullBlocks[lane] * BlockSize, cbTail);
+        tails[lane][cbTail] = 0x80;
+
+        const ULONGLONG ullBits = (ULONGLONG)cbMessage * 8;
+        for (size_t i = 0; i < 8; i++)
+            tails[lane][cbPadded - 1 - i] = (BYTE)(ullBits >> (8 * i));
+    }
+
+    __m256i state[8];
+    for (size_t i = 0; i < 8; i++)
+        state[i] = _mm256_set1_epi32(g_SHA256IV[i]);
+
+    for (size_t block = 0; block < maxBlocks; block++)
+    {
+        const BYTE* pBlocks[Lanes];
+        bool bCompleted = false;
+
+        for (size_t lane = 0; lane < Lanes; lane++)
+        {
+            if (block < fullBlocks[lane])
+                pBlocks[lane] = pData[pIndexes[lane]] + block * BlockSize;
+            else if (block < totalBlocks[lane])
+                pBlocks[lane] = tails[lane] + (block - fullBlocks[lane]) * BlockSize;
+            else
+                pBlocks[lane] = g_Idle;
+
+            bCompleted |= block + 1 == totalBlocks[lane];
+        }
+
+        SHA256BlockX8(state, pBlocks);
+
+        if (!bCompleted)
+            continue;
+
+        alignas(32) std::uint32_t words[8][Lanes];
+        for (size_t i = 0; i < 8; i++)
+            _mm256_store_si256(reinterpret_cast<__m256i*>(words[i]), state[i]);
+
+        for (size_t lane = 0; lane < nbLanes; lane++)
+        {
+            if (block + 1 != totalBlocks[lane])
+                continue;
+            for (size_t i = 0; i < 8; i++)
+                StoreBE32(pDigests[pIndexes[lane]].data() + i * 4, words[i][lane]);
+        }
+    }
+}
+
+//
+// Processor features, detected once
+//
+
+struct CompressFunctions
+{
+    CompressFunction MD5 = MD5Blocks;
+    CompressFunction SHA1 = SHA1Blocks;
+    CompressFunction SHA256 = SHA256Blocks;
+
+    bool bSHAExtensions = false;
+    bool bAVX2 = false;
+};
+
+CompressFunctions DetectCompressFunctions()
+{
+    CompressFunctions retval;
+
+    int info[4] = {0};
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return retval;
+
+    __cpuid(info, 1);
+    const bool bSSE41 = (info[2] & (1 << 19)) != 0;
+    const bool bOSXSAVE = (info[2] & (1 << 27)) != 0;
+    const bool bAVX = (info[2] & (1 << 28)) != 0;
+
+    __cpuidex(info, 7, 0);
+    retval.bSHAExtensions = bSSE41 && (info[1] & (1 << 29)) != 0;
+
+    // AVX2 also requires the OS to save the YMM registers
+    retval.bAVX2 = bAVX && bOSXSAVE && (info[1] & (1 << 5)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+
+    if (retval.bSHAExtensions)
+    {
+        retval.SHA1 = SHA1BlocksSHANI;
+        retval.SHA256 = SHA256BlocksSHANI;
+    }
+    return retval;
+}
+
+const CompressFunctions& GetCompressFunctions()
+{
+    static const CompressFunctions g_Functions = DetectCompressFunctions();
+    return g_Functions;
+}
+
+}  // namespace
+
+template <size_t _StateWords, bool _BigEndian>
+template <typename _Compress>
+void HashEngine::Context<_StateWords, _BigEndian>::Update(const BYTE* pData, size_t cbData, _Compress compress)
+{
+    size_t cbBuffered = (size_t)(ullLength % BlockSize);
+    ullLength += cbData;
+
+    if (cbBuffered > 0)
+    {
+        const size_t cbFill = std::min(BlockSize - cbBuffered, cbData);
+        memcpy(Buffer + cbBuffered, pData, cbFill);
+        pData += cbFill;
+        cbData -= cbFill;
+
+        if (cbBuffered + cbFill < BlockSize)
+            return;
+        compress(State, Buffer, 1);
+    }
+
+    if (const size_t nbBlocks = cbData / BlockSize; nbBlocks > 0)
+    {
+        compress(State, pData, nbBlocks);
+        pData += nbBlocks * BlockSize;
+        cbData -= nbBlocks * BlockSize;
+    }
+
+    if (cbData > 0)
+        memcpy(Buffer, pData, cbData);
+}
+
+template <size_t _StateWords, bool _BigEndian>
+template <typename _Compress>
+void HashEngine::Context<_StateWords, _BigEndian>::Final(BYTE* pDigest, _Compress compress) const
+{
+    // Padding is applied to a copy of the state: the context can still be updated
+    std::uint32_t state[_StateWords];
+    std::copy(std::begin(State), std::end(State), std::begin(state));
+
+    BYTE padding[2 * BlockSize] = {0};
+    const size_t cbBuffered = (size_t)(ullLength % BlockSize);
+    const size_t cbPadding = cbBuffered + 9 > BlockSize ? 2 * BlockSize : BlockSize;
+
+    memcpy(padding, Buffer, cbBuffered);
+    padding[cbBuffered] = 0x80;
+
+    const ULONGLONG ullBits = ullLength * 8;
+    for (size_t i = 0; i < 8; i++)
+    {
+        if (_BigEndian)
+            padding[cbPadding - 1 - i] = (BYTE)(ullBits >> (8 * i));
+        else
+            padding[cbPadding - 8 + i] = (BYTE)(ullBits >> (8 * i));
+    }
+
+    compress(state, padding, cbPadding / BlockSize);
+
+    for (size_t i = 0; i < _StateWords; i++)
+    {
+        if (_BigEndian)
+            StoreBE32(pDigest + i * 4, state[i]);
+        else
+            StoreLE32(pDigest + i * 4, state[i]);
+    }
+}
+
+void HashEngine::Reset(SupportedAlgorithm algs)
+{
+    m_Algorithms = algs;
+
+    std::copy(std::begin(g_MD5IV), std::end(g_MD5IV), std::begin(m_MD5.State));
+    m_MD5.ullLength = 0LL;
+    std::copy(std::begin(g_SHA1IV), std::end(g_SHA1IV), std::begin(m_SHA1.State));
+    m_SHA1.ullLength = 0LL;
+    std::copy(std::begin(g_SHA256IV), std::end(g_SHA256IV), std::begin(m_SHA256.State));
+    m_SHA256.ullLength = 0LL;
+}
+
+void HashEngine::Update(const BYTE* pData, size_t cbData)
+{
+    // Every algorithm runs over the same slice before moving on: it is read from memory only once
+    constexpr size_t SliceSize = 16 * 1024;
+
+    const auto& functions = GetCompressFunctions();
+
+    while (cbData > 0)
+    {
+        const size_t cbSlice = std::min(cbData, SliceSize);
+
+        if (m_Algorithms & SupportedAlgorithm::MD5)
+            m_MD5.Update(pData, cbSlice, functions.MD5);
+        if (m_Algorithms & SupportedAlgorithm::SHA1)
+            m_SHA1.Update(pData, cbSlice, functions.SHA1);
+        if (m_Algorithms & SupportedAlgorithm::SHA256)
+            m_SHA256.Update(pData, cbSlice, functions.SHA256);
+
+        pData += cbSlice;
+        cbData -= cbSlice;
+    }
+}
+
+HRESULT HashEngine::GetDigest(SupportedAlgorithm alg, BYTE* pDigest, DWORD cbDigest) const
+{
+    if (pDigest == nullptr)
+        return E_POINTER;
+
+    if (!(m_Algorithms & alg))
+        return MK_E_UNAVAILABLE;
+
+    const auto& functions = GetCompressFunctions();
+
+    switch (alg)
+    {
+        case SupportedAlgorithm::MD5:
+            if (cbDigest < std::tuple_size<MD5Digest>::value)
+                return E_INVALIDARG;
+            m_MD5.Final(pDigest, functions.MD5);
+            break;
+        case SupportedAlgorithm::SHA1:
+            if (cbDigest < std::tuple_size<SHA1Digest>::value)
+                return E_INVALIDARG;
+            m_SHA1.Final(pDigest, functions.SHA1);
+            break;
+        case SupportedAlgorithm::SHA256:
+            if (cbDigest < std::tuple_size<SHA256Digest>::value)
+                return E_INVALIDARG;
+            m_SHA256.Final(pDigest, functions.SHA256);
+            break;
+        default:
+            return E_INVALIDARG;
+    }
+    return S_OK;
+}
+
+HRESULT HashEngine::SHA256MultiBuffer(
+    const BYTE* const pData[],
+    const size_t cbData[],
+    size_t nbBuffers,
+    SHA256Digest pDigests[])
+{
+    if (nbBuffers == 0)
+        return S_OK;
+    if (pData == nullptr || cbData == nullptr || pDigests == nullptr)
+        return E_POINTER;
+
+    if (!HasAVX2())
+    {
+        for (size_t i = 0; i < nbBuffers; i++)
+        {
+            HashEngine engine(SupportedAlgorithm::SHA256);
+            engine.Update(pData[i], cbData[i]);
+            engine.GetDigest(SupportedAlgorithm::SHA256, pDigests[i].data(), (DWORD)pDigests[i].size());
+        }
+        return S_OK;
+    }
+
+    // Lanes of a group run in lock step: buffers of similar sizes are grouped to keep lanes busy
+    std::vector<size_t> indexes(nbBuffers);
+    std::iota(std::begin(indexes), std::end(indexes), 0);
+    std::stable_sort(std::begin(indexes), std::end(indexes), [cbData](size_t left, size_t right) {
+        return cbData[left] < cbData[right];
+    });
+
+    for (size_t first = 0; first < nbBuffers; first += MultiBufferLanes)
+    {
+        SHA256Lanes(pData, cbData, indexes.data() + first, std::min(MultiBufferLanes, nbBuffers - first), pDigests);
+    }
+    return S_OK;
+}
+
+bool HashEngine::HasSHAExtensions()
+{
+    return GetCompressFunctions().bSHAExtensions;
+}
+
+bool HashEngine::HasAVX2()
+{
+    return GetCompressFunctions().bAVX2;
+}
@@ -0,0 +1,94 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+
+#pragma once
+
+#include "OrcLib.h"
+
+#include <array>
+#include <cstdint>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+enum SupportedAlgorithm : char
+{
+    Undefined = 0,
+    MD5 = 1 << 0,
+    SHA1 = 1 << 1,
+    SHA256 = 1 << 2
+};
+
+//
+// HashEngine computes MD5, SHA1 and SHA256 without any crypto provider round trip
+//
+// All requested algorithms are run over the same slice of data while it is still in the processor cache. SHA1 and
+// SHA256 use the SHA extensions (SHA-NI) when the processor has them. SHA256MultiBuffer hashes up to 8 independent
+// (small) buffers at once in AVX2 lanes.
+//
+class ORCLIB_API HashEngine
+{
+public:
+    using MD5Digest = std::array<BYTE, 16>;
+    using SHA1Digest = std::array<BYTE, 20>;
+    using SHA256Digest = std::array<BYTE, 32>;
+
+    static constexpr size_t BlockSize = 64;
+    static constexpr size_t MultiBufferLanes = 8;
+
+    HashEngine() = default;
+    HashEngine(SupportedAlgorithm algs) { Reset(algs); }
+
+    void Reset(SupportedAlgorithm algs);
+    SupportedAlgorithm GetAlgorithms() const { return m_Algorithms; }
+
+    void Update(const BYTE* pData, size_t cbData);
+
+    // Digest of the data hashed so far: hashing may continue afterwards
+    HRESULT GetDigest(SupportedAlgorithm alg, BYTE* pDigest, DWORD cbDigest) const;
+
+    static HRESULT SHA256MultiBuffer(
+        const BYTE* const pData[],
+        const size_t cbData[],
+        size_t nbBuffers,
+        SHA256Digest pDigests[]);
+
+    static bool HasSHAExtensions();
+    static bool HasAVX2();
+
+private:
+    template <size_t _StateWords, bool _BigEndian>
+    class Context
+    {
+    public:
+        std::uint32_t State[_StateWords];
+        BYTE Buffer[BlockSize];
+        ULONGLONG ullLength = 0LL;
+
+        template <typename _Compress>
+        void Update(const BYTE* pData, size_t cbData, _Compress compress);
+
+        template <typename _Compress>
+        void Final(BYTE* pDigest, _Compress compress) const;
+    };
+
+    using MD5Context = Context<4, false>;
+    using SHA1Context = Context<5, true>;
+    using SHA256Context = Context<8, true>;
+
+    SupportedAlgorithm m_Algorithms = SupportedAlgorithm::Undefined;
+
+    MD5Context m_MD5;
+    SHA1Context m_SHA1;
+    SHA256Context m_SHA256;
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
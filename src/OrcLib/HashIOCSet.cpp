@@ -0,0 +1,320 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+
+#include "stdafx.h"
+
+#include "HashIOCSet.h"
+
+#include "EmbeddedResource.h"
+#include "FileStream.h"
+#include "ParameterCheck.h"
+#include "LogFileWriter.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+using namespace Orc;
+
+template <size_t _DigestSize>
+void HashIOCSet::DigestTable<_DigestSize>::Seal()
+{
+    std::sort(std::begin(m_Digests), std::end(m_Digests));
+    m_Digests.erase(std::unique(std::begin(m_Digests), std::end(m_Digests)), std::end(m_Digests));
+    m_Digests.shrink_to_fit();
+
+    m_Blocks = std::max<size_t>(1, (m_Digests.size() * BitsPerKey + BitsPerBlock - 1) / BitsPerBlock);
+    m_Bloom.assign(m_Blocks * WordsPerBlock, 0LLU);
+
+    for (const auto& digest : m_Digests)
+    {
+        ULONGLONG* pBlock = m_Bloom.data() + (BlockKey(digest.data()) % m_Blocks) * WordsPerBlock;
+        ULONGLONG bits = BitsKey(digest.data());
+
+        for (size_t i = 0; i < HashesPerKey; i++)
+        {
+            const auto bit = bits & (BitsPerBlock - 1);
+            pBlock[bit / 64] |= 1LLU << (bit % 64);
+            bits >>= 9;
+        }
+    }
+}
+
+template <size_t _DigestSize>
+bool HashIOCSet::DigestTable<_DigestSize>::Contains(const BYTE* pDigest) const
+{
+    if (m_Digests.empty())
+        return false;
+
+    // Digests are uniformly distributed: their own bytes are used as bloom hashes
+    const ULONGLONG* pBlock = m_Bloom.data() + (BlockKey(pDigest) % m_Blocks) * WordsPerBlock;
+    ULONGLONG bits = BitsKey(pDigest);
+
+    for (size_t i = 0; i < HashesPerKey; i++)
+    {
+        const auto bit = bits & (BitsPerBlock - 1);
+        if (!(pBlock[bit / 64] & (1LLU << (bit % 64))))
+            return false;
+        bits >>= 9;
+    }
+
+    Digest digest;
+    std::copy(pDigest, pDigest + _DigestSize, digest.begin());
+    return std::binary_search(std::cbegin(m_Digests), std::cend(m_Digests), digest);
+}
+
+HRESULT HashIOCSet::AddHash(const BYTE* pDigest, DWORD cbDigest, std::optional<ULONGLONG> ullSize)
+{
+    if (m_bSealed)
+        return E_UNEXPECTED;
+
+    switch (cbDigest)
+    {
+        case BYTES_IN_MD5_HASH:
+            m_MD5.Add(pDigest);
+            break;
+        case BYTES_IN_SHA1_HASH:
+            m_SHA1.Add(pDigest);
+            break;
+        case BYTES_IN_SHA256_HASH:
+            m_SHA256.Add(pDigest);
+            break;
+        default:
+            return E_INVALIDARG;
+    }
+
+    if (ullSize.has_value())
+        m_Sizes.push_back(ullSize.value());
+    else
+        m_bAllSized = false;
+
+    return S_OK;
+}
+
+HRESULT HashIOCSet::ParseLine(const CHAR* szLine, size_t cchLine, DWORD dwLineNumber)
+{
+    HRESULT hr = E_FAIL;
+
+    auto isSeparator = [](CHAR c) { return c == ' ' || c == '\t' || c == ',' || c == ';'; };
+
+    const CHAR* pCur = szLine;
+    const CHAR* pEnd = szLine + cchLine;
+
+    while (pCur < pEnd && isSeparator(*pCur))
+        pCur++;
+
+    if (pCur == pEnd || *pCur == '#')
+        return S_FALSE;
+
+    const CHAR* pHash = pCur;
+    while (pCur < pEnd && !isSeparator(*pCur))
+        pCur++;
+    const DWORD cchHash = (DWORD)(pCur - pHash);
+
+    std::optional<ULONGLONG> ullSize;
+
+    while (pCur < pEnd && isSeparator(*pCur))
+        pCur++;
+    if (pCur < pEnd)
+    {
+        ULONGLONG ullValue = 0LLU;
+        const CHAR* pSize = pCur;
+        while (pCur < pEnd && *pCur >= '0' && *pCur <= '9')
+        {
+            ullValue = ullValue * 10 + (*pCur - '0');
+            pCur++;
+        }
+        if (pCur == pSize)
+        {
+            log::Warning(
+                _L_,
+                E_INVALIDARG,
+                L"Invalid size in hash set %s (line %d), ignored\r\n",
+                m_strSpec.c_str(),
+                dwLineNumber);
+        }
+        else
+            ullSize = ullValue;
+    }
+
+    BYTE digest[BYTES_IN_SHA256_HASH];
+    DWORD cbDigest = 0L;
+
+    switch (cchHash)
+    {
+        case BYTES_IN_MD5_HASH * 2:
+        case BYTES_IN_SHA1_HASH * 2:
+        case BYTES_IN_SHA256_HASH * 2:
+            break;
+        default:
+            log::Warning(
+                _L_,
+                E_INVALIDARG,
+                L"Invalid hash length in hash set %s (line %d), ignored\r\n",
+                m_strSpec.c_str(),
+                dwLineNumber);
+            return S_FALSE;
+    }
+
+    if (FAILED(hr = GetBytesFromHexaString(pHash, cchHash, digest, sizeof(digest), &cbDigest)))
+    {
+        log::Warning(
+            _L_, hr, L"Invalid hexa string in hash set %s (line %d), ignored\r\n", m_strSpec.c_str(), dwLineNumber);
+        return S_FALSE;
+    }
+
+    return AddHash(digest, cbDigest, ullSize);
+}
+
+HRESULT HashIOCSet::LoadFrom(const CBinaryBuffer& buffer)
+{
+    HRESULT hr = E_FAIL;
+
+    const CHAR* pCur = (const CHAR*)buffer.GetData();
+    const CHAR* pEnd = pCur + buffer.GetCount();
+
+    // skip UTF-8 BOM if any
+    if (buffer.GetCount() >= 3 && (BYTE)pCur[0] == 0xEF && (BYTE)pCur[1] == 0xBB && (BYTE)pCur[2] == 0xBF)
+        pCur += 3;
+
+    DWORD dwLineNumber = 0L;
+    while (pCur < pEnd)
+    {
+        const CHAR* pEOL = std::find_if(pCur, pEnd, [](CHAR c) { return c == '\r' || c == '\n'; });
+
+        dwLineNumber++;
+        if (FAILED(hr = ParseLine(pCur, pEOL - pCur, dwLineNumber)))
+            return hr;
+
+        pCur = pEOL;
+        while (pCur < pEnd && (*pCur == '\r' || *pCur == '\n'))
+            pCur++;
+    }
+
+    return Seal();
+}
+
+HRESULT HashIOCSet::LoadFrom(const std::wstring& strSpec)
+{
+    HRESULT hr = E_FAIL;
+
+    m_strSpec = strSpec;
+    CBinaryBuffer buffer;
+
+    if (EmbeddedResource::IsResourceBased(strSpec))
+    {
+        if (FAILED(hr = EmbeddedResource::ExtractToBuffer(_L_, strSpec, buffer)))
+        {
+            log::Error(_L_, hr, L"Failed to find&extract hash set ressource %s\r\n", strSpec.c_str());
+            return hr;
+        }
+    }
+    else
+    {
+        FileStream fstream(_L_);
+
+        if (FAILED(hr = fstream.ReadFrom(strSpec.c_str())))
+        {
+            log::Error(_L_, hr, L"Failed to open hash set file %s\r\n", strSpec.c_str());
+            return hr;
+        }
+
+        const auto ullSize = fstream.GetSize();
+        if (!buffer.SetCount((size_t)ullSize))
+            return E_OUTOFMEMORY;
+
+        ULONGLONG ullRead = 0LL;
+        if (FAILED(hr = fstream.Read(buffer.GetData(), ullSize, &ullRead)))
+        {
+            log::Error(_L_, hr, L"Failed to read hash set file %s\r\n", strSpec.c_str());
+            return hr;
+        }
+        buffer.SetCount((size_t)ullRead);
+    }
+
+    if (FAILED(hr = LoadFrom(buffer)))
+        return hr;
+
+    log::Verbose(
+        _L_,
+        L"Loaded %I64d indicators from hash set %s (size filter: %s)\r\n",
+        (ULONGLONG)Count(),
+        strSpec.c_str(),
+        HasSizeFilter() ? L"on" : L"off");
+    return S_OK;
+}
+
+HRESULT HashIOCSet::Seal()
+{
+    m_MD5.Seal();
+    m_SHA1.Seal();
+    m_SHA256.Seal();
+
+    std::sort(std::begin(m_Sizes), std::end(m_Sizes));
+    m_Sizes.erase(std::unique(std::begin(m_Sizes), std::end(m_Sizes)), std::end(m_Sizes));
+    m_Sizes.shrink_to_fit();
+
+    m_bSealed = true;
+    return S_OK;
+}
+
+SupportedAlgorithm HashIOCSet::GetAlgorithms() const
+{
+    SupportedAlgorithm retval = SupportedAlgorithm::Undefined;
+    if (m_MD5.Count())
+        retval = static_cast<SupportedAlgorithm>(retval | SupportedAlgorithm::MD5);
+    if (m_SHA1.Count())
+        retval = static_cast<SupportedAlgorithm>(retval | SupportedAlgorithm::SHA1);
+    if (m_SHA256.Count())
+        retval = static_cast<SupportedAlgorithm>(retval | SupportedAlgorithm::SHA256);
+    return retval;
+}
+
+bool HashIOCSet::IsCandidateSize(ULONGLONG ullSize) const
+{
+    if (!HasSizeFilter())
+        return true;
+    return std::binary_search(std::cbegin(m_Sizes), std::cend(m_Sizes), ullSize);
+}
+
+bool HashIOCSet::Contains(SupportedAlgorithm alg, const CBinaryBuffer& digest) const
+{
+    switch (alg)
+    {
+        case SupportedAlgorithm::MD5:
+            return digest.GetCount() == BYTES_IN_MD5_HASH && m_MD5.Contains(digest.GetData());
+        case SupportedAlgorithm::SHA1:
+            return digest.GetCount() == BYTES_IN_SHA1_HASH && m_SHA1.Contains(digest.GetData());
+        case SupportedAlgorithm::SHA256:
+            return digest.GetCount() == BYTES_IN_SHA256_HASH && m_SHA256.Contains(digest.GetData());
+        default:
+            return false;
+    }
+}
+
+std::shared_ptr<HashIOCSet> HashIOCSet::GetCachedSet(const logger& pLog, const std::wstring& strSpec)
+{
+    // The same (large) IOC list is typically referenced by several terms: load it once
+    static std::mutex g_Lock;
+    static std::map<std::wstring, std::weak_ptr<HashIOCSet>> g_Sets;
+
+    std::lock_guard<std::mutex> lock(g_Lock);
+
+    if (auto it = g_Sets.find(strSpec); it != std::end(g_Sets))
+    {
+        if (auto cached = it->second.lock())
+            return cached;
+    }
+
+    auto retval = std::make_shared<HashIOCSet>(pLog);
+    if (FAILED(retval->LoadFrom(strSpec)))
+        return nullptr;
+
+    g_Sets[strSpec] = retval;
+    return retval;
+}
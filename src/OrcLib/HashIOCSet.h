@@ -0,0 +1,130 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include "BinaryBuffer.h"
+#include "CryptoHashStream.h"
+
+#include <array>
+#include <optional>
+#include <string>
+#include <vector>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+class LogFileWriter;
+
+//
+// HashIOCSet holds a (potentially very large) list of MD5/SHA1/SHA256 indicators
+//
+// Digests are kept per algorithm in a compact sorted array, fronted by a blocked bloom filter (one cache line
+// per digest) so that the vast majority of non matching files are rejected in O(1) with a single memory access.
+// When every indicator comes with its file size, the set also acts as a size pre-filter: files whose size is not
+// listed do not need to be read nor hashed at all.
+//
+// Expected format (file or embedded resource), one indicator per line:
+//   <hex digest>[<separator><size>]
+// where separator is any of ' ', '\t', ',' or ';'. Lines starting with '#' are comments.
+// The algorithm is deduced from the digest length (32: MD5, 40: SHA1, 64: SHA256).
+//
+class ORCLIB_API HashIOCSet
+{
+public:
+    HashIOCSet(logger pLog)
+        : _L_(std::move(pLog)) {};
+
+    HashIOCSet(const HashIOCSet&) = delete;
+    HashIOCSet(HashIOCSet&&) noexcept = default;
+
+    // Loads a set from a file path or a resource reference (res:#..., 7z:#...)
+    HRESULT LoadFrom(const std::wstring& strSpec);
+    HRESULT LoadFrom(const CBinaryBuffer& buffer);
+
+    HRESULT AddHash(const BYTE* pDigest, DWORD cbDigest, std::optional<ULONGLONG> ullSize = std::nullopt);
+    HRESULT AddHash(const CBinaryBuffer& digest, std::optional<ULONGLONG> ullSize = std::nullopt)
+    {
+        return AddHash(digest.GetData(), (DWORD)digest.GetCount(), ullSize);
+    }
+
+    // Sorts, de-duplicates and builds the bloom filters. Must be called before any lookup
+    HRESULT Seal();
+
+    SupportedAlgorithm GetAlgorithms() const;
+
+    // Returns false only when the set is certain no indicator has this size
+    bool IsCandidateSize(ULONGLONG ullSize) const;
+
+    bool Contains(SupportedAlgorithm alg, const CBinaryBuffer& digest) const;
+
+    size_t Count() const { return m_MD5.Count() + m_SHA1.Count() + m_SHA256.Count(); }
+    bool HasSizeFilter() const { return m_bAllSized && !m_Sizes.empty(); }
+
+    const std::wstring& GetSpec() const { return m_strSpec; }
+
+    static std::shared_ptr<HashIOCSet> GetCachedSet(const logger& pLog, const std::wstring& strSpec);
+
+private:
+    template <size_t _DigestSize>
+    class DigestTable
+    {
+    public:
+        using Digest = std::array<BYTE, _DigestSize>;
+
+        // 512 bits bloom blocks, matching a cache line
+        static constexpr size_t BitsPerBlock = 512;
+        static constexpr size_t WordsPerBlock = BitsPerBlock / 64;
+        static constexpr size_t BitsPerKey = 10;
+        static constexpr size_t HashesPerKey = 6;
+
+        void Add(const BYTE* pDigest)
+        {
+            Digest digest;
+            std::copy(pDigest, pDigest + _DigestSize, digest.begin());
+            m_Digests.push_back(digest);
+        }
+
+        void Seal();
+
+        bool Contains(const BYTE* pDigest) const;
+
+        size_t Count() const { return m_Digests.size(); }
+
+    private:
+        static ULONGLONG BlockKey(const BYTE* pDigest) { return *reinterpret_cast<const ULONGLONG*>(pDigest); }
+        static ULONGLONG BitsKey(const BYTE* pDigest)
+        {
+            return *reinterpret_cast<const ULONGLONG*>(pDigest + sizeof(ULONGLONG));
+        }
+
+        std::vector<Digest> m_Digests;
+        std::vector<ULONGLONG> m_Bloom;
+        size_t m_Blocks = 0;
+    };
+
+    logger _L_;
+
+    std::wstring m_strSpec;
+
+    DigestTable<BYTES_IN_MD5_HASH> m_MD5;
+    DigestTable<BYTES_IN_SHA1_HASH> m_SHA1;
+    DigestTable<BYTES_IN_SHA256_HASH> m_SHA256;
+
+    std::vector<ULONGLONG> m_Sizes;
+    bool m_bAllSized = true;
+    bool m_bSealed = false;
+
+    HRESULT ParseLine(const CHAR* szLine, size_t cchLine, DWORD dwLineNumber);
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
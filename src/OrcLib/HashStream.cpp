@@ -86,6 +86,65 @@ HRESULT HashStream::Write(
     return S_OK;
 }
 
+HRESULT HashStream::ReadView(__in ULONGLONG cbBytes, __out View& view)
+{
+    HRESULT hr = E_FAIL;
+
+    view = View();
+
+    if (m_bWriteOnly)
+        return E_NOTIMPL;
+    if (cbBytes > MAXDWORD)
+        return E_INVALIDARG;
+    if (m_pChainedStream == nullptr)
+        return E_POINTER;
+
+    if (m_pChainedStream->CanRead() != S_OK)
+        return HRESULT_FROM_WIN32(ERROR_INVALID_ACCESS);
+
+    if (FAILED(hr = m_pChainedStream->ReadView(cbBytes, view)))
+        return hr;
+
+    if (!view.empty())
+    {
+        if (FAILED(hr = HashData(const_cast<LPBYTE>(view.pData), (DWORD)view.cbData)))
+            return hr;
+    }
+    return S_OK;
+}
+
+HRESULT HashStream::CommitView(__in const View& view, __out_opt PULONGLONG pcbBytesWritten)
+{
+    HRESULT hr = E_FAIL;
+
+    if (pcbBytesWritten)
+        *pcbBytesWritten = 0LL;
+
+    if (view.cbData > MAXDWORD)
+    {
+        log::Error(_L_, E_INVALIDARG, L"Too many bytes to Hash\r\n");
+        return E_INVALIDARG;
+    }
+
+    if (view.empty())
+        return S_OK;
+
+    if (FAILED(hr = HashData(const_cast<LPBYTE>(view.pData), (DWORD)view.cbData)))
+        return hr;
+
+    if (m_pChainedStream != nullptr && m_bWriteOnly)
+    {
+        if (m_pChainedStream->CanWrite() != S_OK)
+            return HRESULT_FROM_WIN32(ERROR_INVALID_ACCESS);
+
+        return m_pChainedStream->CommitView(view, pcbBytesWritten);
+    }
+
+    if (pcbBytesWritten)
+        *pcbBytesWritten = view.cbData;
+    return S_OK;
+}
+
 HRESULT
 HashStream::SetFilePointer(__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer)
 {
@@ -73,6 +73,10 @@ public:
     STDMETHOD(SetFilePointer)
     (__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer);
 
+    // Data is hashed where the chained stream lent it
+    STDMETHOD(ReadView)(__in ULONGLONG cbBytes, __out View& view);
+    STDMETHOD(CommitView)(__in const View& view, __out_opt PULONGLONG pcbBytesWritten);
+
     STDMETHOD_(ULONG64, GetSize)()
     {
         if (m_pChainedStream == nullptr)
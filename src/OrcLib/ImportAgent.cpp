@@ -133,6 +133,12 @@ HRESULT ImportAgent::UnWrapMessage(
         log::Error(_L_, hr, L"Failed to unwrap envelopped message\r\n");
         return hr;
     }
+    else if (pDecodeStream->GetFormat() == MessageStream::Format::Chunked && FAILED(hr = pDecodeStream->Close()))
+    {
+        // The final chunk of a chunked envelope is only known, and verified, at Close
+        log::Error(_L_, hr, L"Failed to complete envelopped message\r\n");
+        return hr;
+    }
     else
     {
         PCCERT_CONTEXT pDecryptor = pDecodeStream->GetDecryptor();
@@ -355,7 +361,7 @@ HRESULT ImportAgent::ExpandItem(ImportItem& input)
 
                 if (Archive::GetArchiveFormat(item.NameInArchive) != ArchiveFormat::Unknown)
                 {
-                    SendRequest(ImportMessage::MakeExpandRequest(std::move(*found)));
+                    ScheduleExpansion(ImportMessage::MakeExpandRequest(std::move(*found)));
                     log::Verbose(_L_, L"\tArchive %s has been extracted\r\n", strItemName.c_str());
                 }
                 else
@@ -393,6 +399,7 @@ HRESULT ImportAgent::ExpandItem(ImportItem& input)
         output_item.InputFile = input.InputFile;
         output_item.FullName = item.Path;
         output_item.bPrefixSubItem = true;
+        output_item.dwNestingLevel = input.dwNestingLevel + 1;
 
         if (input.bPrefixSubItem)
         {
@@ -466,6 +473,46 @@ HRESULT ImportAgent::ExpandItem(ImportItem& input)
     return S_OK;
 }
 
+void ImportAgent::ScheduleExpansion(const ImportMessage::Message& request)
+{
+    ChargeRequest(request);
+
+    static_cast<void>(InterlockedIncrement(&m_lInProgressItems));
+
+    RunExpansion(request);
+}
+
+void ImportAgent::RunExpansion(const ImportMessage::Message& request)
+{
+    auto& level = m_Levels[std::min(request->m_item.dwNestingLevel, MaxNestingLevels - 1)];
+
+    static_cast<void>(InterlockedIncrement(&level.Progress.lQueued));
+
+    // Tasks run from a task are queued on the worker running it and stolen by idle ones
+    const auto it = m_Tasks.push_back(make_task<std::function<void()>>([this, request, &level]() {
+        level.Slots.acquire(1LL);
+        static_cast<void>(InterlockedDecrement(&level.Progress.lQueued));
+        static_cast<void>(InterlockedIncrement(&level.Progress.lInProgress));
+
+        HRESULT hr = ExpandItem(request->m_item);
+
+        static_cast<void>(InterlockedDecrement(&level.Progress.lInProgress));
+        level.Slots.release(1LL);
+
+        if (FAILED(hr))
+        {
+            static_cast<void>(InterlockedIncrement(&level.Progress.lFailed));
+            SendResult(ImportNotification::MakeFailureNotification(hr, request->m_item));
+        }
+        else
+        {
+            static_cast<void>(InterlockedIncrement(&level.Progress.lExpanded));
+            SendResult(ImportNotification::MakeExtractNotification(request->m_item));
+        }
+    }));
+    m_TaskGroup.run(*it);
+}
+
 HRESULT ImportAgent::ExtractItem(ImportItem& input)
 {
     HRESULT hr = E_FAIL;
@@ -677,16 +724,8 @@ HRESULT ImportAgent::ImportOneItem(ImportMessage::Message request)
                 }
                 break;
                 case ImportMessage::Expand:
-                {
-                    const auto it = m_Tasks.push_back(make_task<std::function<void()>>([this, request]() {
-                        HRESULT hr = E_FAIL;
-                        if (FAILED(hr = ExpandItem(request->m_item)))
-                            SendResult(ImportNotification::MakeFailureNotification(hr, request->m_item));
-                        else
-                            SendResult(ImportNotification::MakeExtractNotification(request->m_item));
-                    }));
-                    m_TaskGroup.run(*it);
-                }
+                    RunExpansion(request);
+                    break;
             }
         }
         break;
@@ -785,6 +824,18 @@ void ImportAgent::run()
         send(m_QueuedItems, *value);
         if (*value > 0)
         {
+            for (DWORD i = 0; i < MaxNestingLevels; i++)
+            {
+                const auto progress = ExpansionProgress(i);
+                if (progress.lQueued > 0L || progress.lInProgress > 0L)
+                    log::Verbose(
+                        _L_,
+                        L"Level %d archives: %d waiting, %d being expanded, %d expanded\r\n",
+                        i,
+                        progress.lQueued,
+                        progress.lInProgress,
+                        progress.lExpanded);
+            }
             return;
         }
         log::Info(_L_, L"Queue is empty, completing agents...\r\n", *value);
@@ -845,9 +896,30 @@ void ImportAgent::run()
     return;
 }
 
+ImportAgent::LevelProgress ImportAgent::ExpansionProgress(DWORD dwLevel) const
+{
+    return m_Levels[std::min(dwLevel, MaxNestingLevels - 1)].Progress;
+}
+
 HRESULT ImportAgent::Statistics(const logger& pLog)
 {
-    log::Info(pLog, L"\tMain extraction agent: %d items\r\n\r\n", m_ulItemProcessed);
+    log::Info(pLog, L"\tMain extraction agent: %d items\r\n", m_ulItemProcessed);
+
+    for (DWORD i = 0; i < MaxNestingLevels; i++)
+    {
+        const auto progress = ExpansionProgress(i);
+        if (progress.lExpanded == 0L && progress.lFailed == 0L)
+            continue;
+
+        log::Info(
+            pLog,
+            L"\t\tLevel %d%s archives: %d expanded, %d failed\r\n",
+            i,
+            i == MaxNestingLevels - 1 ? L"+" : L"",
+            progress.lExpanded,
+            progress.lFailed);
+    }
+    log::Info(pLog, L"\r\n");
 
     for (const auto& flow : m_SqlDataFlow)
     {
@@ -28,6 +28,7 @@
 #include "ImportBytesSemaphore.h"
 
 #include <agents.h>
+#include <array>
 #include <concurrent_vector.h>
 #include <ppl.h>
 
@@ -94,8 +95,25 @@ public:
     {
         m_memSemaphore.SetCapacity(40LL * 1024 * 1024 * 1024);
         m_fileSemaphore.SetCapacity(100LL * 1024 * 1024 * 1024);
+
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        for (auto& level : m_Levels)
+            level.Slots.SetCapacity(si.dwNumberOfProcessors);
     }
 
+    // Nested archives deeper than this are accounted with the last level
+    static constexpr DWORD MaxNestingLevels = 4;
+
+    class LevelProgress
+    {
+    public:
+        LONG lQueued = 0L;  // waiting for an expansion slot
+        LONG lInProgress = 0L;
+        LONG lExpanded = 0L;
+        LONG lFailed = 0L;
+    };
+
     HRESULT InitializeOutputs(
         const OutputSpec& output,
         const OutputSpec& importOutput,
@@ -107,14 +125,7 @@ public:
 
     bool SendRequest(const ImportMessage::Message& request)
     {
-        if (request->Item().ullFileBytesCharged > 0LL)
-        {
-            m_fileSemaphore.acquire(request->Item().ullFileBytesCharged);
-        }
-        if (request->Item().ullMemBytesCharged > 0LL)
-        {
-            m_memSemaphore.acquire(request->Item().ullMemBytesCharged);
-        }
+        ChargeRequest(request);
 
         if (request->m_Request == ImportMessage::RequestType::Complete)
             return Concurrency::send(m_import_target, request);
@@ -133,6 +144,9 @@ public:
 
     Concurrency::ISource<LONG>& QueuedItemsCount() { return m_QueuedItems; }
 
+    // Expansions of archives nested at dwLevel (0 for input files)
+    LevelProgress ExpansionProgress(DWORD dwLevel) const;
+
     HRESULT Statistics(const logger& pLog);
 
     ~ImportAgent(void) = default;
@@ -164,6 +178,16 @@ private:
 
     ImportMessage::PriorityMessageBuffer m_SqlMessageBuffer;
 
+    // Each nesting level has its own expansion slots: outer archives wait for a slot while the archives they
+    // contain keep being expanded
+    class ExpansionLevel
+    {
+    public:
+        ImportBytesSemaphore Slots;
+        LevelProgress Progress;
+    };
+    std::array<ExpansionLevel, MaxNestingLevels> m_Levels;
+
     std::vector<std::unique_ptr<SqlMessageDataFlow>> m_SqlDataFlow;
     std::vector<std::unique_ptr<SqlImportAgent>> m_pAgents;
 
@@ -187,6 +211,18 @@ private:
         return Concurrency::send(m_target, notification);
     }
 
+    void ChargeRequest(const ImportMessage::Message& request)
+    {
+        if (request->Item().ullFileBytesCharged > 0LL)
+        {
+            m_fileSemaphore.acquire(request->Item().ullFileBytesCharged);
+        }
+        if (request->Item().ullMemBytesCharged > 0LL)
+        {
+            m_memSemaphore.acquire(request->Item().ullMemBytesCharged);
+        }
+    }
+
     ImportMessage::Message GetRequest() { return Concurrency::receive<ImportMessage::Message>(m_source); }
 
     ImportMessage::Message TriageNewItem(const ImportItem& input, ImportItem& newItem);
@@ -197,6 +233,10 @@ private:
 
     HRESULT ExpandItem(ImportItem& input);
 
+    // Nested archives are expanded by tasks of their own, without going back through the request queue
+    void ScheduleExpansion(const ImportMessage::Message& request);
+    void RunExpansion(const ImportMessage::Message& request);
+
     HRESULT ExtractItem(ImportItem& input);
 
     HRESULT ImportOneItem(ImportMessage::Message request);
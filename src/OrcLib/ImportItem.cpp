@@ -131,6 +131,8 @@ ImportItem::ImportItemFormat ImportItem::GetFileFormat()
             return Format = ImportItem::ImportItemFormat::Archive;
         if (equalCaseInsensitive(ext, L".cab"))
             return Format = ImportItem::ImportItemFormat::Archive;
+        if (equalCaseInsensitive(ext, L".zst"))
+            return Format = ImportItem::ImportItemFormat::Archive;
     }
 
     if (Stream != nullptr)
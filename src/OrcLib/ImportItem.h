@@ -98,6 +98,9 @@ public:
 
     bool bPrefixSubItem = false;
 
+    // 0 for input files, 1 for items of an input archive, ...
+    DWORD dwNestingLevel = 0L;
+
 public:
     ImportItem() = default;
 
@@ -118,6 +121,7 @@ public:
         std::swap(isToExtract, other.isToExtract);
         std::swap(isToImport, other.isToImport);
         std::swap(isToExpand, other.isToExpand);
+        std::swap(dwNestingLevel, other.dwNestingLevel);
     }
 
     ImportItem(const ImportItem&) = default;
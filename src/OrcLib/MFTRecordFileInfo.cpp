@@ -279,6 +279,26 @@ HRESULT MFTRecordFileInfo::WriteSecDescrID(ITableOutput& output)
     return output.WriteInteger(m_pMFTRecord->m_pStandardInformation->SecurityId);
 }
 
+HRESULT MFTRecordFileInfo::GetHashCacheKey(HashCache::Key& key)
+{
+    if (m_pMFTRecord == nullptr || m_pDataAttr == nullptr || m_pMFTRecord->m_pStandardInformation == nullptr)
+        return E_POINTER;
+
+    key.VolumeSerial = m_pVolReader->VolumeSerialNumber();
+    if (auto snapshot_reader = std::dynamic_pointer_cast<SnapshotVolumeReader>(m_pVolReader))
+        key.SnapshotID = snapshot_reader->GetSnapshotID();
+
+    key.FRN = m_pMFTRecord->GetSafeMFTSegmentNumber();
+    key.DataInstance = m_pDataAttr->Header()->Instance;
+    if (m_pDataAttr->Header()->FormCode == RESIDENT_FORM)
+        key.DataSize = m_pDataAttr->Header()->Form.Resident.ValueLength;
+    else
+        key.DataSize = m_pDataAttr->Header()->Form.Nonresident.FileSize;
+    key.LastModificationTime = m_pMFTRecord->m_pStandardInformation->LastModificationTime;
+    key.USN = m_pMFTRecord->m_pStandardInformation->USN;
+    return S_OK;
+}
+
 HRESULT MFTRecordFileInfo::WriteSizeInBytes(ITableOutput& output)
 {
     HRESULT hr = E_FAIL;
@@ -98,6 +98,8 @@ private:
 
     virtual HRESULT Open();
 
+    virtual HRESULT GetHashCacheKey(HashCache::Key& key);
+
     virtual ULONGLONG GetFileReferenceNumber()
     {
         if (m_pMFTRecord == nullptr)
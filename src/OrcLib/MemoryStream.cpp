@@ -145,6 +145,19 @@ HRESULT MemoryStream::Read(
     return S_OK;
 }
 
+HRESULT MemoryStream::ReadView(__in ULONGLONG cbBytes, __out View& view)
+{
+    view = View();
+
+    if (m_pBuffer)
+    {
+        view.pData = &m_pBuffer[m_dwCurrFilePointer];
+        view.cbData = std::min(m_cbBuffer - m_dwCurrFilePointer, static_cast<size_t>(cbBytes));
+        m_dwCurrFilePointer += static_cast<size_t>(view.cbData);
+    }
+    return S_OK;
+}
+
 HRESULT MemoryStream::CommitBuffer(size_t dwPosition, size_t dwCommitSize)
 {
     HRESULT hr = E_FAIL;
@@ -388,6 +401,14 @@ HRESULT MemoryStream::SetSize(ULONG64 ullNewSize)
 {
     if (ullNewSize > MAXDWORD)
         return E_INVALIDARG;
+
+    // Truncating only drops the end of the data, the buffer is kept
+    if (ullNewSize <= m_cbBuffer)
+    {
+        m_cbBuffer = (size_t)ullNewSize;
+        m_dwCurrFilePointer = std::min(m_dwCurrFilePointer, m_cbBuffer);
+        return S_OK;
+    }
     return SetBufferSize(0LL, (size_t)ullNewSize);
 }
 
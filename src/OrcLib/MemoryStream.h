@@ -60,6 +60,9 @@ public:
      __in ULONGLONG cbBytes,
      __out_opt PULONGLONG pcbBytesRead);
 
+    // Lends the stream's memory: the view is valid until the stream is written to, resized or closed
+    STDMETHOD(ReadView)(__in ULONGLONG cbBytes, __out View& view);
+
     STDMETHOD(Write)
     (__in_bcount(cbBytesToWrite) const PVOID pWriteBuffer,
      __in ULONGLONG cbBytesToWrite,
@@ -14,6 +14,14 @@ namespace Orc {
 
 class ORCLIB_API MessageStream : public ChainingStream
 {
+public:
+    // CMS is a PKCS#7 enveloped message, Chunked a chunked AES-GCM envelope (see EnvelopeStructures.h)
+    enum class Format
+    {
+        CMS,
+        Chunked
+    };
+
 protected:
     CMSG_STREAM_INFO m_StreamInfo;
 
@@ -15,10 +15,11 @@
 
 #include "CryptoHashStream.h"
 #include "FuzzyHashStream.h"
-#include "MemoryStream.h"
 
 #include "libpehash-pe.h"
 
+#include <algorithm>
+
 #pragma comment(lib, "Crypt32.lib")
 
 using namespace Orc;
@@ -517,304 +518,274 @@ HRESULT PEInfo::OpenSecurityDirectory()
     return S_OK;
 }
 
-HRESULT PEInfo::OpenAllHash(Intentions localIntentions)
+HRESULT PEInfo::GetPeHashRanges(const BYTE* pHeaders, size_t cbHeaders, ULONGLONG ullFileSize, PeHashRanges& ranges)
 {
-    HRESULT hr = E_FAIL;
-
-    DWORD dwMajor = 0L, dwMinor = 0L;
-    SystemDetails::GetOSVersion(dwMajor, dwMinor);
+    PE_IMAGE pe_img;
+    if (parse_pe(pHeaders, cbHeaders, &pe_img) < 0)
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
 
-    const auto& details = m_FileInfo.GetDetails();
+    const auto secdir = pe_get_secdir(&pe_img);
 
-    if (details->PeHashAvailable() && details->HashAvailable())
-        return S_OK;
+    const ULONGLONG ullCheckSum = pe_img.mPeCoffHeaderOffset + pe_get_checksum_offset(&pe_img);
+    const ULONGLONG ullSecDir = (const BYTE*)secdir - pHeaders;
+    const ULONGLONG ullSizeOfHeaders = pe_get_sizeof_headers(&pe_img);
 
-    SupportedAlgorithm algs = SupportedAlgorithm::Undefined;
-    if (localIntentions & FILEINFO_MD5)
-        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::MD5);
-    if (localIntentions & FILEINFO_SHA1)
-        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::SHA1);
-    if (localIntentions & FILEINFO_SHA256)
-        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::SHA256);
-
-    SupportedAlgorithm pe_algs = SupportedAlgorithm::Undefined;
-    if (localIntentions & FILEINFO_PE_MD5)
-        pe_algs = static_cast<SupportedAlgorithm>(pe_algs | SupportedAlgorithm::MD5);
-    if (localIntentions & FILEINFO_PE_SHA1)
-        pe_algs = static_cast<SupportedAlgorithm>(pe_algs | SupportedAlgorithm::SHA1);
-    if (localIntentions & FILEINFO_PE_SHA256)
-        pe_algs = static_cast<SupportedAlgorithm>(pe_algs | SupportedAlgorithm::SHA256);
+    // Apparently, MS padds PEs with zeroes on 8 modulo...
+    const ULONGLONG ullPaddedSize = (ullFileSize + 7) & ~7LLU;
+    if (secdir->Size > ullPaddedSize)
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
 
-    FuzzyHashStream::SupportedAlgorithm fuzzy_algs = FuzzyHashStream::SupportedAlgorithm::Undefined;
-    if (localIntentions & FILEINFO_SSDEEP)
-        fuzzy_algs = static_cast<FuzzyHashStream::SupportedAlgorithm>(fuzzy_algs | FuzzyHashStream::SSDeep);
-    if (localIntentions & FILEINFO_TLSH)
-        fuzzy_algs = static_cast<FuzzyHashStream::SupportedAlgorithm>(fuzzy_algs | FuzzyHashStream::TLSH);
+    // Same chunks as calc_pe_chunks_real: the checksum, the security directory entry and the certificates are not
+    // hashed
+    ranges = {{0LL, ullCheckSum},
+              {ullCheckSum + sizeof(DWORD), ullSecDir},
+              {ullSecDir + sizeof(IMAGE_DATA_DIRECTORY), ullSizeOfHeaders},
+              {ullSizeOfHeaders, ullPaddedSize - secdir->Size}};
 
-    if (localIntentions & FILEINFO_AUTHENTICODE_STATUS || localIntentions & FILEINFO_AUTHENTICODE_SIGNER)
+    for (size_t i = 0; i < ranges.size(); i++)
     {
-        pe_algs = static_cast<SupportedAlgorithm>(
-            pe_algs | SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1 | SupportedAlgorithm::SHA256);
+        const auto ullNext = (i < ranges.size() - 1) ? ranges[i + 1].first : ullPaddedSize;
+        if (ranges[i].first > ranges[i].second || ranges[i].second > ullNext)
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
     }
+    return S_OK;
+}
 
-    auto stream = m_FileInfo.GetDetails()->GetDataStream();
+HRESULT PEInfo::SinglePassHash(
+    SupportedAlgorithm algs,
+    FuzzyHashStream::SupportedAlgorithm fuzzy_algs,
+    SupportedAlgorithm pe_algs)
+{
+    const auto& details = m_FileInfo.GetDetails();
+
+    auto stream = details->GetDataStream();
     if (stream == nullptr)
         return E_POINTER;
 
-    stream->SetFilePointer(0L, FILE_BEGIN, NULL);
-
-    // Load data in a memory stream
-
-    auto memstream = std::make_shared<MemoryStream>(_L_);
-    if (memstream == nullptr)
-        return E_OUTOFMEMORY;
+    return SinglePassHash(_L_, *stream, algs, fuzzy_algs, pe_algs, *details);
+}
 
-    if (FAILED(hr = memstream->OpenForReadWrite()))
-        return hr;
+HRESULT PEInfo::SinglePassHash(
+    const logger& pLog,
+    ByteStream& stream,
+    SupportedAlgorithm algs,
+    FuzzyHashStream::SupportedAlgorithm fuzzy_algs,
+    SupportedAlgorithm pe_algs,
+    DataDetails& details)
+{
+    HRESULT hr = E_FAIL;
 
-    if (FAILED(hr = memstream->SetSize(stream->GetSize())))
-        return hr;
-    ULONGLONG ullWritten = 0LL;
-    if (FAILED(hr = stream->CopyTo(*memstream, &ullWritten)))
+    if (FAILED(hr = stream.SetFilePointer(0L, FILE_BEGIN, NULL)))
         return hr;
 
-    // Crypto hash
-    CBinaryBuffer pData;
-    memstream->GrabBuffer(pData);
+    std::shared_ptr<CryptoHashStream> hashstream;
+    if (algs != SupportedAlgorithm::Undefined)
     {
-
-        auto hashstream = std::make_shared<CryptoHashStream>(_L_);
-        hashstream->OpenToWrite(algs, nullptr);
-
-        ULONGLONG ullHashed = 0LL;
-        hashstream->Write(pData.GetData(), ullWritten, &ullHashed);
-
-        if (algs & SupportedAlgorithm::MD5
-            && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::MD5, m_FileInfo.GetDetails()->MD5())))
-        {
-            if (hr != MK_E_UNAVAILABLE)
-                return hr;
-        }
-        if (algs & SupportedAlgorithm::SHA1
-            && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::SHA1, m_FileInfo.GetDetails()->SHA1())))
-        {
-            if (hr != MK_E_UNAVAILABLE)
-                return hr;
-        }
-        if (algs & SupportedAlgorithm::SHA256
-            && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::SHA256, m_FileInfo.GetDetails()->SHA256())))
-        {
-            if (hr != MK_E_UNAVAILABLE)
-                return hr;
-        }
+        hashstream = std::make_shared<CryptoHashStream>(pLog);
+        if (FAILED(hr = hashstream->OpenToWrite(algs, nullptr)))
+            return hr;
     }
 
-    // Fuzzy hash
+    std::shared_ptr<FuzzyHashStream> fuzzy_hashstream;
+    if (fuzzy_algs != FuzzyHashStream::SupportedAlgorithm::Undefined)
     {
-        auto hashstream = std::make_shared<FuzzyHashStream>(_L_);
-        hashstream->OpenToWrite(fuzzy_algs, nullptr);
-
-        ULONGLONG ullHashed = 0LL;
-        hashstream->Write(pData.GetData(), ullWritten, &ullHashed);
-
-        if (fuzzy_algs & FuzzyHashStream::SupportedAlgorithm::SSDeep
-            && FAILED(
-                hr = hashstream->GetHash(
-                    FuzzyHashStream::SupportedAlgorithm::SSDeep, m_FileInfo.GetDetails()->SSDeep())))
-        {
-            if (hr != MK_E_UNAVAILABLE)
-                return hr;
-        }
-        if (fuzzy_algs & FuzzyHashStream::SupportedAlgorithm::TLSH
-            && FAILED(
-                hr = hashstream->GetHash(FuzzyHashStream::SupportedAlgorithm::TLSH, m_FileInfo.GetDetails()->TLSH())))
-        {
-            if (hr != MK_E_UNAVAILABLE)
-                return hr;
-        }
+        fuzzy_hashstream = std::make_shared<FuzzyHashStream>(pLog);
+        if (FAILED(hr = fuzzy_hashstream->OpenToWrite(fuzzy_algs, nullptr)))
+            return hr;
     }
 
-    if ((ullWritten % 8) != 0)
+    std::shared_ptr<CryptoHashStream> pe_hashstream;
+    if (pe_algs != SupportedAlgorithm::Undefined)
     {
-        // Apparently, MS padds PEs with zeroes on 8 modulo...
-        DWORD dwToAdd = 8 - (ullWritten % 8);
-        const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-        ULONGLONG ullPaddingWritten = 0LL;
-        if (FAILED(hr = memstream->Write((LPVOID)padding, dwToAdd, &ullPaddingWritten)))
+        pe_hashstream = std::make_shared<CryptoHashStream>(pLog);
+        if (FAILED(hr = pe_hashstream->OpenToWrite(pe_algs, nullptr)))
             return hr;
     }
 
-    // Pe Hash
-    {
-        typedef struct _PEChunks
-        {
-            uint32_t offset;
-            uint32_t length;
-        } PEChunks;
-
-        const unsigned int MaxChunks = 256;
-        PEChunks chunks[MaxChunks];
-        ZeroMemory((BYTE*)chunks, sizeof(chunks));
-        uint32_t cChunks = calc_pe_chunks_real(pData.GetData(), pData.GetCount(), (uint32_t*)chunks, MaxChunks);
+    PeHashRanges ranges;
+    bool bPeHashPlanned = false;
 
-        if (cChunks == -1)
-            return S_OK;
-
-        // Check if chunks are OK
-        for (uint32_t i = 0; i < cChunks; ++i)
+    // Feeds the part of [ullOffset, ullOffset + cbData) which is covered by the PE hash
+    auto pe_hash = [&](const BYTE* pData, ULONGLONG ullOffset, ULONGLONG cbData) -> HRESULT {
+        for (const auto& [ullBegin, ullEnd] : ranges)
         {
-            auto nextOffset = (i < (cChunks - 1)) ? chunks[i + 1].offset : pData.GetCount();
-            if (chunks[i].offset + chunks[i].length > nextOffset)
-            {
-                log::Warning(_L_, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Invalid chunk size for PE hash\r\n");
-                return S_OK;
-            }
+            const auto ullFrom = std::max(ullBegin, ullOffset);
+            const auto ullTo = std::min(ullEnd, ullOffset + cbData);
+            if (ullFrom >= ullTo)
+                continue;
+
+            ULONGLONG ullHashed = 0LL;
+            const auto hrWrite =
+                pe_hashstream->Write((PVOID)(pData + (ullFrom - ullOffset)), ullTo - ullFrom, &ullHashed);
+            if (FAILED(hrWrite))
+                return hrWrite;
         }
+        return S_OK;
+    };
 
-        auto pe_hashstream = std::make_shared<CryptoHashStream>(_L_);
-        pe_hashstream->OpenToWrite(pe_algs, nullptr);
+    CBinaryBuffer buffer;
+    if (!buffer.SetCount(DEFAULT_READ_SIZE))
+        return E_OUTOFMEMORY;
 
-        ULONGLONG ullPeHashed = 0LL;
-        for (uint32_t i = 0; i < cChunks; ++i)
-        {
-            ULONGLONG ullThisWriteHashed = 0LL;
-            if (FAILED(
-                    hr = pe_hashstream->Write(
-                        pData.GetData() + chunks[i].offset, chunks[i].length, &ullThisWriteHashed)))
-                return hr;
-            ullPeHashed += ullThisWriteHashed;
-        }
+    // Single sequential read: flat, fuzzy and PE hashes are all fed from the same buffer
+    ULONGLONG ullOffset = 0LL;
+    for (;;)
+    {
+        ULONGLONG ullRead = 0LL;
+        if (FAILED(hr = stream.Read(buffer.GetData(), buffer.GetCount(), &ullRead)))
+            return hr;
+        if (ullRead == 0)
+            break;
 
-        if (pe_algs & SupportedAlgorithm::MD5
-            && FAILED(hr = pe_hashstream->GetHash(SupportedAlgorithm::MD5, m_FileInfo.GetDetails()->PeMD5())))
+        if (ullOffset == 0LL && pe_hashstream)
         {
-            if (hr != MK_E_UNAVAILABLE)
-                return hr;
-        }
-        if (pe_algs & SupportedAlgorithm::SHA1
-            && FAILED(hr = pe_hashstream->GetHash(SupportedAlgorithm::SHA1, m_FileInfo.GetDetails()->PeSHA1())))
-        {
-            if (hr != MK_E_UNAVAILABLE)
-                return hr;
+            // The hashed ranges only depend on the headers (in this first buffer) and the file size
+            if (FAILED(hr = GetPeHashRanges(buffer.GetData(), (size_t)ullRead, stream.GetSize(), ranges)))
+                log::Verbose(pLog, L"Invalid PE headers, no PE hash computed\r\n");
+            else
+                bPeHashPlanned = true;
         }
-        if (pe_algs & SupportedAlgorithm::SHA256
-            && FAILED(hr = pe_hashstream->GetHash(SupportedAlgorithm::SHA256, m_FileInfo.GetDetails()->PeSHA256())))
-        {
-            if (hr != MK_E_UNAVAILABLE)
-                return hr;
-        }
-    }
-    return S_OK;
-}
 
-HRESULT PEInfo::OpenPeHash(Intentions localIntentions)
-{
-    HRESULT hr = E_FAIL;
-    if (m_FileInfo.GetDetails()->PeHashAvailable())
-        return S_OK;
+        ULONGLONG ullHashed = 0LL;
+        if (hashstream && FAILED(hr = hashstream->Write(buffer.GetData(), ullRead, &ullHashed)))
+            return hr;
+        if (fuzzy_hashstream && FAILED(hr = fuzzy_hashstream->Write(buffer.GetData(), ullRead, &ullHashed)))
+            return hr;
+        if (bPeHashPlanned && FAILED(hr = pe_hash(buffer.GetData(), ullOffset, ullRead)))
+            return hr;
 
-    if (FAILED(hr = CheckPEInformation()))
-        return hr;
-    if (!HasPEHeader())
-    {
-        return HRESULT_FROM_WIN32(ERROR_INVALID_DATATYPE);
+        ullOffset += ullRead;
     }
 
-    DWORD dwMajor = 0L, dwMinor = 0L;
-    SystemDetails::GetOSVersion(dwMajor, dwMinor);
-
-    auto stream = m_FileInfo.GetDetails()->GetDataStream();
-
-    if (stream == nullptr)
-        return E_POINTER;
-    stream->SetFilePointer(0L, FILE_BEGIN, NULL);
-
-    // Load data in a memory stream
-
-    auto memstream = std::make_shared<MemoryStream>(_L_);
-    if (memstream == nullptr)
-        return E_OUTOFMEMORY;
-
-    if (FAILED(hr = memstream->OpenForReadWrite()))
-        return hr;
-
-    if (FAILED(hr = memstream->SetSize(stream->GetSize())))
-        return hr;
-
-    ULONGLONG ullWritten = 0LL;
-    if (FAILED(hr = stream->CopyTo(*memstream, &ullWritten)))
-        return hr;
-
-    if ((ullWritten % 8) != 0)
+    if (bPeHashPlanned && (ullOffset % 8) != 0)
     {
-        // Apparently, MS padds PEs with zeroes on 8 modulo...
-        DWORD dwToAdd = 8 - (ullWritten % 8);
-        const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-        ULONGLONG ullBytesWritten = 0LL;
-        if (FAILED(hr = memstream->Write((LPVOID)padding, dwToAdd, &ullBytesWritten)))
+        const BYTE padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        if (FAILED(hr = pe_hash(padding, ullOffset, 8 - (ullOffset % 8))))
             return hr;
     }
 
-    CBinaryBuffer pData;
-    memstream->GrabBuffer(pData);
-
-    typedef struct _PEChunks
+    if (algs & SupportedAlgorithm::MD5 && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::MD5, details.MD5())))
     {
-        uint32_t offset;
-        uint32_t length;
-    } PEChunks;
-
-    const unsigned int MaxChunks = 256;
-    PEChunks chunks[MaxChunks];
-    ZeroMemory((BYTE*)chunks, sizeof(chunks));
-    int cChunks = calc_pe_chunks_real(pData.GetData(), pData.GetCount(), (uint32_t*)chunks, MaxChunks);
-
-    if (cChunks == -1)
-        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
-
-    auto hashstream = std::make_shared<CryptoHashStream>(_L_);
-
-    SupportedAlgorithm algs = SupportedAlgorithm::Undefined;
-    if (localIntentions & FILEINFO_PE_MD5)
-        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::MD5);
-    if (localIntentions & FILEINFO_PE_SHA1)
-        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::SHA1);
-    if (localIntentions & FILEINFO_PE_SHA256)
-        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::SHA256);
-    if (localIntentions & FILEINFO_AUTHENTICODE_STATUS || localIntentions & FILEINFO_AUTHENTICODE_SIGNER)
+        if (hr != MK_E_UNAVAILABLE)
+            return hr;
+    }
+    if (algs & SupportedAlgorithm::SHA1 && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::SHA1, details.SHA1())))
+    {
+        if (hr != MK_E_UNAVAILABLE)
+            return hr;
+    }
+    if (algs & SupportedAlgorithm::SHA256
+        && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::SHA256, details.SHA256())))
     {
-        algs = static_cast<SupportedAlgorithm>(
-            algs | SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1 | SupportedAlgorithm::SHA256);
+        if (hr != MK_E_UNAVAILABLE)
+            return hr;
     }
-    hashstream->OpenToWrite(algs, nullptr);
 
-    ULONGLONG ullHashed = 0LL;
-    for (int i = 0; i < cChunks; ++i)
+    if (fuzzy_algs & FuzzyHashStream::SupportedAlgorithm::SSDeep
+        && FAILED(hr = fuzzy_hashstream->GetHash(FuzzyHashStream::SupportedAlgorithm::SSDeep, details.SSDeep())))
     {
-        ULONGLONG ullThisWriteHashed = 0LL;
-        if (FAILED(hr = hashstream->Write(pData.GetData() + chunks[i].offset, chunks[i].length, &ullThisWriteHashed)))
+        if (hr != MK_E_UNAVAILABLE)
             return hr;
-        ullHashed += ullThisWriteHashed;
     }
+    if (fuzzy_algs & FuzzyHashStream::SupportedAlgorithm::TLSH
+        && FAILED(hr = fuzzy_hashstream->GetHash(FuzzyHashStream::SupportedAlgorithm::TLSH, details.TLSH())))
+    {
+        if (hr != MK_E_UNAVAILABLE)
+            return hr;
+    }
+
+    if (!bPeHashPlanned)
+        return pe_hashstream ? S_FALSE : S_OK;
 
-    if (algs & SupportedAlgorithm::MD5
-        && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::MD5, m_FileInfo.GetDetails()->PeMD5())))
+    if (pe_algs & SupportedAlgorithm::MD5
+        && FAILED(hr = pe_hashstream->GetHash(SupportedAlgorithm::MD5, details.PeMD5())))
     {
         if (hr != MK_E_UNAVAILABLE)
             return hr;
     }
-    if (algs & SupportedAlgorithm::SHA1
-        && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::SHA1, m_FileInfo.GetDetails()->PeSHA1())))
+    if (pe_algs & SupportedAlgorithm::SHA1
+        && FAILED(hr = pe_hashstream->GetHash(SupportedAlgorithm::SHA1, details.PeSHA1())))
     {
         if (hr != MK_E_UNAVAILABLE)
             return hr;
     }
-    if (algs & SupportedAlgorithm::SHA256
-        && FAILED(hr = hashstream->GetHash(SupportedAlgorithm::SHA256, m_FileInfo.GetDetails()->PeSHA256())))
+    if (pe_algs & SupportedAlgorithm::SHA256
+        && FAILED(hr = pe_hashstream->GetHash(SupportedAlgorithm::SHA256, details.PeSHA256())))
     {
         if (hr != MK_E_UNAVAILABLE)
             return hr;
     }
+    return S_OK;
+}
 
+static SupportedAlgorithm GetPeHashAlgorithms(Intentions localIntentions)
+{
+    SupportedAlgorithm pe_algs = SupportedAlgorithm::Undefined;
+    if (localIntentions & FILEINFO_PE_MD5)
+        pe_algs = static_cast<SupportedAlgorithm>(pe_algs | SupportedAlgorithm::MD5);
+    if (localIntentions & FILEINFO_PE_SHA1)
+        pe_algs = static_cast<SupportedAlgorithm>(pe_algs | SupportedAlgorithm::SHA1);
+    if (localIntentions & FILEINFO_PE_SHA256)
+        pe_algs = static_cast<SupportedAlgorithm>(pe_algs | SupportedAlgorithm::SHA256);
+
+    if (localIntentions & FILEINFO_AUTHENTICODE_STATUS || localIntentions & FILEINFO_AUTHENTICODE_SIGNER)
+    {
+        pe_algs = static_cast<SupportedAlgorithm>(
+            pe_algs | SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1 | SupportedAlgorithm::SHA256);
+    }
+    return pe_algs;
+}
+
+HRESULT PEInfo::OpenAllHash(Intentions localIntentions)
+{
+    HRESULT hr = E_FAIL;
+
+    const auto& details = m_FileInfo.GetDetails();
+
+    if (details->PeHashAvailable() && details->HashAvailable())
+        return S_OK;
+
+    SupportedAlgorithm algs = SupportedAlgorithm::Undefined;
+    if (localIntentions & FILEINFO_MD5)
+        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::MD5);
+    if (localIntentions & FILEINFO_SHA1)
+        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::SHA1);
+    if (localIntentions & FILEINFO_SHA256)
+        algs = static_cast<SupportedAlgorithm>(algs | SupportedAlgorithm::SHA256);
+
+    FuzzyHashStream::SupportedAlgorithm fuzzy_algs = FuzzyHashStream::SupportedAlgorithm::Undefined;
+    if (localIntentions & FILEINFO_SSDEEP)
+        fuzzy_algs = static_cast<FuzzyHashStream::SupportedAlgorithm>(fuzzy_algs | FuzzyHashStream::SSDeep);
+    if (localIntentions & FILEINFO_TLSH)
+        fuzzy_algs = static_cast<FuzzyHashStream::SupportedAlgorithm>(fuzzy_algs | FuzzyHashStream::TLSH);
+
+    // an invalid PE layout only leaves the PE hashes empty
+    if (FAILED(hr = SinglePassHash(algs, fuzzy_algs, GetPeHashAlgorithms(localIntentions))))
+        return hr;
+    return S_OK;
+}
+
+HRESULT PEInfo::OpenPeHash(Intentions localIntentions)
+{
+    HRESULT hr = E_FAIL;
+    if (m_FileInfo.GetDetails()->PeHashAvailable())
+        return S_OK;
+
+    if (FAILED(hr = CheckPEInformation()))
+        return hr;
+    if (!HasPEHeader())
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATATYPE);
+    }
+
+    if (FAILED(
+            hr = SinglePassHash(
+                SupportedAlgorithm::Undefined,
+                FuzzyHashStream::SupportedAlgorithm::Undefined,
+                GetPeHashAlgorithms(localIntentions))))
+        return hr;
+
+    if (hr == S_FALSE)
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
     return S_OK;
 }
@@ -10,6 +10,11 @@
 #include "OrcLib.h"
 #include "DataDetails.h"
 #include "FSUtils.h"
+#include "FuzzyHashStream.h"
+#include "HashEngine.h"
+
+#include <utility>
+#include <vector>
 
 #pragma managed(push, off)
 
@@ -46,9 +51,30 @@ public:
     HRESULT OpenPeHash(Intentions localIntentions);
     HRESULT OpenAllHash(Intentions localIntentions);
 
+    // [begin, end) file offsets covered by the PE hash, computed from the headers and the file size only
+    using PeHashRanges = std::vector<std::pair<ULONGLONG, ULONGLONG>>;
+    static HRESULT
+    GetPeHashRanges(const BYTE* pHeaders, size_t cbHeaders, ULONGLONG ullFileSize, PeHashRanges& ranges);
+
+    // Reads stream once for the flat, fuzzy and PE hashes, stored in details. S_FALSE when PE hashes could not be
+    // computed
+    static HRESULT SinglePassHash(
+        const logger& pLog,
+        ByteStream& stream,
+        SupportedAlgorithm algs,
+        FuzzyHashStream::SupportedAlgorithm fuzzy_algs,
+        SupportedAlgorithm pe_algs,
+        DataDetails& details);
+
 private:
     logger _L_;
     FileInfo& m_FileInfo;
+
+    // SinglePassHash on the file's data stream
+    HRESULT SinglePassHash(
+        SupportedAlgorithm algs,
+        FuzzyHashStream::SupportedAlgorithm fuzzy_algs,
+        SupportedAlgorithm pe_algs);
 };
 }  // namespace Orc
 
@@ -11,13 +11,129 @@
 
 #include "LogFileWriter.h"
 #include "CryptoUtilities.h"
+#include "GcmChunkCipher.h"
 
 #include <boost/scope_exit.hpp>
 
+#include <bcrypt.h>
+
+#include <array>
+#include <thread>
+
 using namespace Orc;
 
 constexpr auto ENCRYPT_ALGORITHM = CALG_AES_256;
 
+namespace {
+
+constexpr BYTE ChunkedMagic[8] = {'O', 'R', 'C', 'G', 'C', 'M', '0', '1'};
+constexpr DWORD ChunkedVersion = 1L;
+constexpr DWORD ChunkedIterations = 100000L;
+
+constexpr ULONG ChunkTagLength = GcmChunkCipher::TagLength;
+
+#pragma pack(push, 1)
+struct ChunkedHeader
+{
+    BYTE Magic[8];
+    DWORD Version;
+    DWORD ChunkSize;
+    DWORD Iterations;
+    BYTE Salt[16];
+    BYTE NoncePrefix[GcmChunkCipher::NoncePrefixLength];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ChunkedHeader) == 40, "The chunked header is 40 bytes long");
+
+HRESULT ReadFully(ByteStream& stream, BYTE* pBuffer, ULONGLONG cbBytes, ULONGLONG& cbBytesRead)
+{
+    HRESULT hr = E_FAIL;
+
+    cbBytesRead = 0LL;
+    while (cbBytesRead < cbBytes)
+    {
+        ULONGLONG cbThisRead = 0LL;
+        if (FAILED(hr = stream.Read(pBuffer + cbBytesRead, cbBytes - cbBytesRead, &cbThisRead)))
+            return hr;
+        if (cbThisRead == 0LL)
+            break;
+        cbBytesRead += cbThisRead;
+    }
+    return S_OK;
+}
+
+}  // namespace
+
+class PasswordEncryptedStream::ChunkedCipher
+{
+public:
+    // The header is authenticated with each chunk
+    ChunkedHeader Header;
+    GcmChunkCipher Gcm;
+
+    // Encryption
+    ULONGLONG ullChunksWritten = 0LL;
+    ULONGLONG ullBytesWritten = 0LL;
+    bool bFinalWritten = false;
+
+    // Decryption, sizes are MAXULONGLONG while they are unknown (the chained stream is a pipe)
+    ULONGLONG ullCipherSize = 0LL;
+    ULONGLONG ullCipherPosition = sizeof(ChunkedHeader);
+    ULONGLONG ullPlainSize = 0LL;
+    ULONGLONG ullPosition = 0LL;
+    ULONGLONG ullCachedChunk = MAXULONGLONG;
+    CBinaryBuffer CipherChunk;
+    CBinaryBuffer PlainChunk;
+    DWORD cbPlainChunk = 0L;
+
+    // Without the cipher size, the chunk following CipherChunk is read ahead to find the final one
+    ULONGLONG ullNextChunk = 0LL;
+    CBinaryBuffer NextChunk;
+    DWORD cbNextChunk = 0L;
+    bool bNextChunkRead = false;
+
+    ChunkedCipher() { ZeroMemory(&Header, sizeof(Header)); }
+
+    HRESULT DeriveKeys(const std::wstring& pwd, DWORD dwKeyCount)
+    {
+        NTSTATUS status = 0;
+
+        BCRYPT_ALG_HANDLE hPrf = NULL;
+        status = BCryptOpenAlgorithmProvider(&hPrf, BCRYPT_SHA256_ALGORITHM, NULL, BCRYPT_ALG_HANDLE_HMAC_FLAG);
+        if (!BCRYPT_SUCCESS(status))
+            return HRESULT_FROM_NT(status);
+        BOOST_SCOPE_EXIT(hPrf) { BCryptCloseAlgorithmProvider(hPrf, 0L); }
+        BOOST_SCOPE_EXIT_END;
+
+        std::array<BYTE, GcmChunkCipher::KeyLength> key;
+        BOOST_SCOPE_EXIT(&key) { SecureZeroMemory(key.data(), key.size()); }
+        BOOST_SCOPE_EXIT_END;
+
+        if (!BCRYPT_SUCCESS(
+                status = BCryptDeriveKeyPBKDF2(
+                    hPrf,
+                    (PUCHAR)pwd.c_str(),
+                    (ULONG)(pwd.size() * sizeof(WCHAR)),
+                    Header.Salt,
+                    sizeof(Header.Salt),
+                    Header.Iterations,
+                    key.data(),
+                    (ULONG)key.size(),
+                    0L)))
+            return HRESULT_FROM_NT(status);
+
+        return Gcm.Initialize(
+            key.data(), Header.NoncePrefix, (const BYTE*)&Header, sizeof(Header), Header.ChunkSize, dwKeyCount);
+    }
+};
+
+PasswordEncryptedStream::PasswordEncryptedStream(logger pLog)
+    : ChainingStream(std::move(pLog))
+{
+    m_bEncrypting = boost::indeterminate;
+}
+
 HRESULT PasswordEncryptedStream::GetKeyMaterial(const std::wstring& pwd)
 {
     HRESULT hr = E_FAIL;
@@ -72,6 +188,21 @@ PasswordEncryptedStream::OpenToEncrypt(const std::wstring& pwd, const std::share
     return S_OK;
 }
 
+HRESULT PasswordEncryptedStream::OpenToEncrypt(
+    const std::wstring& pwd,
+    const std::shared_ptr<ByteStream>& pChainedStream,
+    Format format,
+    DWORD dwChunkSize)
+{
+    if (format == Format::CryptoAPI)
+        return OpenToEncrypt(pwd, pChainedStream);
+
+    m_bEncrypting = true;
+    m_pChainedStream = pChainedStream;
+
+    return OpenChunkedToEncrypt(pwd, dwChunkSize);
+}
+
 HRESULT
 PasswordEncryptedStream::OpenToDecrypt(const std::wstring& pwd, const std::shared_ptr<ByteStream>& pChainedStream)
 {
@@ -80,12 +211,375 @@ PasswordEncryptedStream::OpenToDecrypt(const std::wstring& pwd, const std::share
 
     m_pChainedStream = pChainedStream;
 
+    if (m_pChainedStream != nullptr && m_pChainedStream->CanRead() == S_OK)
+    {
+        ChunkedHeader header;
+        ULONGLONG cbHeader = 0LL;
+        if (FAILED(hr = ReadFully(*m_pChainedStream, (BYTE*)&header, sizeof(header), cbHeader)))
+            return hr;
+
+        if (cbHeader == sizeof(header) && !memcmp(header.Magic, ChunkedMagic, sizeof(ChunkedMagic)))
+        {
+            m_pChunked = std::make_unique<ChunkedCipher>();
+            m_pChunked->Header = header;
+            return OpenChunkedToDecrypt(pwd);
+        }
+
+        if (m_pChainedStream->CanSeek() == S_OK)
+        {
+            if (FAILED(hr = m_pChainedStream->SetFilePointer(0LL, FILE_BEGIN, NULL)))
+                return hr;
+        }
+        else if (cbHeader > 0LL)
+        {
+            // CryptoAPI cipher text: what was read is decrypted first
+            if (!m_ReadAhead.CheckCount((size_t)cbHeader))
+                return E_OUTOFMEMORY;
+            CopyMemory(m_ReadAhead.GetData(), &header, (size_t)cbHeader);
+            m_dwReadAhead = (DWORD)cbHeader;
+        }
+    }
+
     if (FAILED(hr = GetKeyMaterial(pwd)))
         return hr;
 
     return S_OK;
 }
 
+HRESULT PasswordEncryptedStream::OpenChunkedToEncrypt(const std::wstring& pwd, DWORD dwChunkSize)
+{
+    HRESULT hr = E_FAIL;
+    NTSTATUS status = 0;
+
+    if (m_pChainedStream == nullptr)
+        return E_POINTER;
+
+    if (dwChunkSize == 0L || dwChunkSize > GcmChunkCipher::MaxChunkSize)
+    {
+        log::Error(_L_, hr = E_INVALIDARG, L"Invalid chunk size (%d bytes)\r\n", dwChunkSize);
+        return hr;
+    }
+
+    m_pChunked = std::make_unique<ChunkedCipher>();
+
+    auto& header = m_pChunked->Header;
+    CopyMemory(header.Magic, ChunkedMagic, sizeof(ChunkedMagic));
+    header.Version = ChunkedVersion;
+    header.ChunkSize = dwChunkSize;
+    header.Iterations = ChunkedIterations;
+
+    status = BCryptGenRandom(NULL, header.Salt, sizeof(header.Salt), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+    if (BCRYPT_SUCCESS(status))
+        status = BCryptGenRandom(NULL, header.NoncePrefix, sizeof(header.NoncePrefix), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+    if (!BCRYPT_SUCCESS(status))
+    {
+        log::Error(_L_, hr = HRESULT_FROM_NT(status), L"Failed to generate salt\r\n");
+        return hr;
+    }
+
+    const auto dwCores = std::max(1u, std::thread::hardware_concurrency());
+    if (FAILED(hr = m_pChunked->DeriveKeys(pwd, std::min<DWORD>(GcmChunkCipher::MaxParallelChunks, dwCores))))
+    {
+        log::Error(_L_, hr, L"Failed to derive chunk keys\r\n");
+        return hr;
+    }
+
+    ULONGLONG ullWritten = 0LL;
+    if (FAILED(hr = m_pChainedStream->Write(&header, sizeof(header), &ullWritten)))
+    {
+        log::Error(_L_, hr, L"Failed to write chunked header\r\n");
+        return hr;
+    }
+    return S_OK;
+}
+
+HRESULT PasswordEncryptedStream::OpenChunkedToDecrypt(const std::wstring& pwd)
+{
+    HRESULT hr = E_FAIL;
+
+    const auto& header = m_pChunked->Header;
+    if (header.Version != ChunkedVersion || header.ChunkSize == 0L || header.ChunkSize > GcmChunkCipher::MaxChunkSize
+        || header.Iterations == 0L)
+    {
+        log::Error(_L_, hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Invalid chunked header\r\n");
+        return hr;
+    }
+
+    if (FAILED(hr = m_pChunked->DeriveKeys(pwd, 1L)))
+    {
+        log::Error(_L_, hr, L"Failed to derive chunk key\r\n");
+        return hr;
+    }
+
+    // A pipe's size is unknown: its chunks are read in sequence until the final one
+    const auto ullCipherSize = m_pChainedStream->GetSize();
+    if (ullCipherSize == MAXULONGLONG)
+    {
+        m_pChunked->ullCipherSize = m_pChunked->ullPlainSize = MAXULONGLONG;
+        return S_OK;
+    }
+
+    // Every stream holds at least its final chunk, the last one possibly shorter
+    const ULONGLONG cbSealedChunk = (ULONGLONG)header.ChunkSize + ChunkTagLength;
+    const auto ullBody = ullCipherSize > sizeof(ChunkedHeader) ? ullCipherSize - sizeof(ChunkedHeader) : 0LL;
+    const auto ullRemainder = ullBody % cbSealedChunk;
+
+    if (ullBody == 0LL || (ullRemainder != 0LL && ullRemainder < ChunkTagLength))
+    {
+        log::Error(_L_, hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Truncated chunked stream\r\n");
+        return hr;
+    }
+
+    m_pChunked->ullCipherSize = ullCipherSize;
+    m_pChunked->ullPlainSize = (ullBody / cbSealedChunk) * header.ChunkSize
+        + (ullRemainder != 0LL ? ullRemainder - ChunkTagLength : 0LL);
+    return S_OK;
+}
+
+HRESULT PasswordEncryptedStream::WriteChunks(DWORD nbChunks, DWORD cbLastChunk, bool bFinal)
+{
+    HRESULT hr = E_FAIL;
+
+    auto& cipher = *m_pChunked;
+    const DWORD dwChunkSize = cipher.Header.ChunkSize;
+
+    ULONGLONG ullFailedChunk = 0LL;
+    if (FAILED(
+            hr = cipher.Gcm.SealChunks(
+                *m_pChainedStream,
+                cipher.ullChunksWritten,
+                m_Buffer.GetData(),
+                nbChunks,
+                cbLastChunk,
+                bFinal,
+                ullFailedChunk)))
+    {
+        log::Error(_L_, hr, L"Failed to encrypt or write chunk %I64d\r\n", ullFailedChunk);
+        return hr;
+    }
+    cipher.ullChunksWritten += nbChunks;
+
+    const DWORD dwConsumed = (nbChunks - 1) * dwChunkSize + cbLastChunk;
+    _ASSERT(dwConsumed <= m_dwBufferedData);
+
+    if (dwConsumed < m_dwBufferedData)
+        MoveMemory(m_Buffer.GetData(), m_Buffer.GetData() + dwConsumed, m_dwBufferedData - dwConsumed);
+    m_dwBufferedData -= dwConsumed;
+    return S_OK;
+}
+
+HRESULT PasswordEncryptedStream::ChunkedWrite(const BYTE* pWriteBuffer, ULONGLONG cbBytesToWrite)
+{
+    HRESULT hr = E_FAIL;
+
+    auto& cipher = *m_pChunked;
+    const DWORD dwChunkSize = cipher.Header.ChunkSize;
+    const DWORD nbSlots = cipher.Gcm.Slots();
+
+    if (cipher.bFinalWritten)
+    {
+        log::Error(_L_, hr = E_ILLEGAL_METHOD_CALL, L"Cannot write past the final chunk\r\n");
+        return hr;
+    }
+
+    // The last chunk is kept until Close or more data comes: it may turn out to be the final one
+    const size_t cbBatch = (size_t)nbSlots * dwChunkSize;
+    if (!m_Buffer.CheckCount(cbBatch + dwChunkSize))
+        return E_OUTOFMEMORY;
+
+    ULONGLONG cbWritten = 0LL;
+    while (cbWritten < cbBytesToWrite)
+    {
+        const auto cbToCopy = std::min<ULONGLONG>(cbBytesToWrite - cbWritten, cbBatch + dwChunkSize - m_dwBufferedData);
+
+        CopyMemory(m_Buffer.GetData() + m_dwBufferedData, pWriteBuffer + cbWritten, (size_t)cbToCopy);
+        m_dwBufferedData += (DWORD)cbToCopy;
+        cbWritten += cbToCopy;
+        cipher.ullBytesWritten += cbToCopy;
+
+        if (m_dwBufferedData > cbBatch)
+        {
+            if (FAILED(hr = WriteChunks(nbSlots, dwChunkSize, false)))
+                return hr;
+        }
+    }
+    return S_OK;
+}
+
+HRESULT PasswordEncryptedStream::ChunkedClose()
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_bEncrypting)
+    {
+        // Closing again does not add another final chunk
+        if (m_pChunked->bFinalWritten)
+            return S_OK;
+
+        const DWORD dwChunkSize = m_pChunked->Header.ChunkSize;
+
+        // An empty stream still gets its (empty) final chunk
+        const DWORD nbChunks = m_dwBufferedData == 0L ? 1L : (m_dwBufferedData + dwChunkSize - 1) / dwChunkSize;
+        const DWORD cbLastChunk = m_dwBufferedData - (nbChunks - 1) * dwChunkSize;
+
+        if (FAILED(hr = WriteChunks(nbChunks, cbLastChunk, true)))
+            return hr;
+        m_pChunked->bFinalWritten = true;
+    }
+
+    return m_pChainedStream->Close();
+}
+
+HRESULT PasswordEncryptedStream::ReadNextChunk(ULONGLONG ullChunk, DWORD& cbSealed, bool& bFinal)
+{
+    HRESULT hr = E_FAIL;
+
+    auto& cipher = *m_pChunked;
+    const DWORD cbSealedChunk = cipher.Header.ChunkSize + ChunkTagLength;
+
+    if (ullChunk != cipher.ullNextChunk)
+    {
+        log::Error(
+            _L_,
+            hr = HRESULT_FROM_WIN32(ERROR_SEEK),
+            L"Chunk %I64d cannot be read out of sequence from a stream of unknown size\r\n",
+            ullChunk);
+        return hr;
+    }
+
+    if (!cipher.CipherChunk.CheckCount(cbSealedChunk) || !cipher.NextChunk.CheckCount(cbSealedChunk))
+        return E_OUTOFMEMORY;
+
+    ULONGLONG cbRead = 0LL;
+    if (!cipher.bNextChunkRead)
+    {
+        if (FAILED(hr = ReadFully(*m_pChainedStream, cipher.NextChunk.GetData(), cbSealedChunk, cbRead)))
+            return hr;
+        cipher.cbNextChunk = (DWORD)cbRead;
+        cipher.bNextChunkRead = true;
+    }
+
+    std::swap(cipher.CipherChunk, cipher.NextChunk);
+    cbSealed = cipher.cbNextChunk;
+    if (cbSealed < ChunkTagLength)
+    {
+        log::Error(_L_, hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Truncated chunked stream\r\n");
+        return hr;
+    }
+
+    // Only a full chunk can be followed by another one
+    cbRead = 0LL;
+    if (cbSealed == cbSealedChunk
+        && FAILED(hr = ReadFully(*m_pChainedStream, cipher.NextChunk.GetData(), cbSealedChunk, cbRead)))
+        return hr;
+
+    cipher.cbNextChunk = (DWORD)cbRead;
+    cipher.ullNextChunk++;
+    bFinal = cbRead == 0LL;
+    return S_OK;
+}
+
+HRESULT PasswordEncryptedStream::ReadChunk(ULONGLONG ullChunk)
+{
+    HRESULT hr = E_FAIL;
+
+    auto& cipher = *m_pChunked;
+    if (cipher.ullCachedChunk == ullChunk)
+        return S_OK;
+
+    cipher.ullCachedChunk = MAXULONGLONG;
+
+    DWORD cbSealed = 0L;
+    bool bFinal = false;
+
+    if (cipher.ullCipherSize == MAXULONGLONG)
+    {
+        if (FAILED(hr = ReadNextChunk(ullChunk, cbSealed, bFinal)))
+            return hr;
+    }
+    else
+    {
+        const ULONGLONG cbSealedChunk = (ULONGLONG)cipher.Header.ChunkSize + ChunkTagLength;
+        const ULONGLONG ullOffset = sizeof(ChunkedHeader) + ullChunk * cbSealedChunk;
+        if (ullOffset >= cipher.ullCipherSize)
+            return E_INVALIDARG;
+
+        cbSealed = (DWORD)std::min(cbSealedChunk, cipher.ullCipherSize - ullOffset);
+        bFinal = ullOffset + cbSealed == cipher.ullCipherSize;
+
+        if (!cipher.CipherChunk.CheckCount(cbSealed))
+            return E_OUTOFMEMORY;
+
+        // Sequential reads do not seek, so that a stream which cannot seek is read chunk after chunk
+        if (ullOffset != cipher.ullCipherPosition)
+        {
+            cipher.ullCipherPosition = MAXULONGLONG;
+            if (FAILED(hr = m_pChainedStream->SetFilePointer(ullOffset, FILE_BEGIN, NULL)))
+                return hr;
+            cipher.ullCipherPosition = ullOffset;
+        }
+
+        ULONGLONG cbRead = 0LL;
+        hr = ReadFully(*m_pChainedStream, cipher.CipherChunk.GetData(), cbSealed, cbRead);
+        cipher.ullCipherPosition = SUCCEEDED(hr) ? ullOffset + cbRead : MAXULONGLONG;
+        if (FAILED(hr))
+            return hr;
+        if (cbRead != cbSealed)
+        {
+            log::Error(_L_, hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), L"Failed to read chunk %I64d\r\n", ullChunk);
+            return hr;
+        }
+    }
+
+    if (!cipher.PlainChunk.CheckCount(cbSealed))
+        return E_OUTOFMEMORY;
+
+    if (FAILED(
+            hr = cipher.Gcm.Open(
+                0L, ullChunk, bFinal, cipher.CipherChunk.GetData(), cbSealed, cipher.PlainChunk.GetData())))
+    {
+        if (hr == GcmChunkCipher::AuthenticationFailure)
+            log::Error(_L_, hr, L"Chunk %I64d failed authentication (wrong password or altered data)\r\n", ullChunk);
+        else
+            log::Error(_L_, hr, L"Failed to decrypt chunk %I64d\r\n", ullChunk);
+        return hr;
+    }
+
+    cipher.cbPlainChunk = cbSealed - ChunkTagLength;
+    cipher.ullCachedChunk = ullChunk;
+
+    if (bFinal)
+        cipher.ullPlainSize = ullChunk * cipher.Header.ChunkSize + cipher.cbPlainChunk;
+    return S_OK;
+}
+
+HRESULT PasswordEncryptedStream::ChunkedRead(BYTE* pReadBuffer, ULONGLONG cbBytes, ULONGLONG& cbBytesRead)
+{
+    HRESULT hr = E_FAIL;
+
+    auto& cipher = *m_pChunked;
+    const DWORD dwChunkSize = cipher.Header.ChunkSize;
+
+    cbBytesRead = 0LL;
+    while (cbBytesRead < cbBytes && cipher.ullPosition < cipher.ullPlainSize)
+    {
+        if (FAILED(hr = ReadChunk(cipher.ullPosition / dwChunkSize)))
+            return hr;
+
+        // The final chunk of a stream of unknown size was just read
+        if (cipher.ullPosition >= cipher.ullPlainSize)
+            break;
+
+        const DWORD dwOffset = (DWORD)(cipher.ullPosition % dwChunkSize);
+        const auto cbToCopy = std::min<ULONGLONG>(cipher.cbPlainChunk - dwOffset, cbBytes - cbBytesRead);
+
+        CopyMemory(pReadBuffer + cbBytesRead, cipher.PlainChunk.GetData() + dwOffset, (size_t)cbToCopy);
+        cbBytesRead += cbToCopy;
+        cipher.ullPosition += cbToCopy;
+    }
+    return S_OK;
+}
+
 HRESULT PasswordEncryptedStream::EncryptData(CBinaryBuffer& pData, BOOL bFinal, DWORD& dwEncryptedBytes)
 {
     HRESULT hr = E_FAIL;
@@ -195,9 +689,31 @@ HRESULT PasswordEncryptedStream::Read(
 
     *pcbBytesRead = 0;
 
+    if (m_pChunked)
+    {
+        if (m_bEncrypting)
+            return HRESULT_FROM_WIN32(ERROR_INVALID_ACCESS);
+        return ChunkedRead((BYTE*)pReadBuffer, cbBytes, *pcbBytesRead);
+    }
+
     ULONGLONG cbBytesRead = 0L;
-    if (FAILED(hr = m_pChainedStream->Read(pReadBuffer, cbBytes, &cbBytesRead)))
-        return hr;
+    if (m_dwReadAhead > 0L)
+    {
+        cbBytesRead = std::min<ULONGLONG>(m_dwReadAhead, cbBytes);
+        CopyMemory(pReadBuffer, m_ReadAhead.GetData(), (size_t)cbBytesRead);
+        m_dwReadAhead -= (DWORD)cbBytesRead;
+        MoveMemory(m_ReadAhead.GetData(), m_ReadAhead.GetData() + cbBytesRead, m_dwReadAhead);
+    }
+
+    if (cbBytesRead < cbBytes)
+    {
+        ULONGLONG cbChainedRead = 0LL;
+        if (FAILED(
+                hr = m_pChainedStream->Read(
+                    (BYTE*)pReadBuffer + cbBytesRead, cbBytes - cbBytesRead, &cbChainedRead)))
+            return hr;
+        cbBytesRead += cbChainedRead;
+    }
 
     if (cbBytesRead > 0)
     {
@@ -223,7 +739,18 @@ HRESULT PasswordEncryptedStream::Read(
 
         *pcbBytesRead = dwBytesDecrypted;
 
-        if (dwBytesDecrypted < cbBytesRead && !bFinal)
+        if (dwBytesDecrypted < cbBytesRead && !bFinal && m_pChainedStream->CanSeek() != S_OK)
+        {
+            // Left overs are kept for the next read as the chained stream cannot go back
+            const DWORD cbLeftOvers = (DWORD)(cbBytesRead - dwBytesDecrypted);
+            if (!m_ReadAhead.CheckCount((size_t)m_dwReadAhead + cbLeftOvers))
+                return E_OUTOFMEMORY;
+
+            MoveMemory(m_ReadAhead.GetData() + cbLeftOvers, m_ReadAhead.GetData(), m_dwReadAhead);
+            CopyMemory(m_ReadAhead.GetData(), (BYTE*)pReadBuffer + dwBytesDecrypted, cbLeftOvers);
+            m_dwReadAhead += cbLeftOvers;
+        }
+        else if (dwBytesDecrypted < cbBytesRead && !bFinal)
         {
             if (FAILED(hr = m_pChainedStream->SetFilePointer(dwBytesDecrypted - cbBytesRead, FILE_CURRENT, NULL)))
             {
@@ -261,6 +788,17 @@ HRESULT PasswordEncryptedStream::Write(
     if (pWriteBuffer == NULL)
         return E_POINTER;
 
+    if (m_pChunked)
+    {
+        if (!m_bEncrypting)
+            return E_NOTIMPL;
+        if (FAILED(hr = ChunkedWrite((const BYTE*)pWriteBuffer, cbBytesToWrite)))
+            return hr;
+        if (pcbBytesWritten)
+            *pcbBytesWritten = cbBytesToWrite;
+        return S_OK;
+    }
+
     DWORD dwLeftOvers = m_dwBufferedData % m_dwBlockLen;
     DWORD dwToProcess = m_dwBufferedData - (m_dwBufferedData % m_dwBlockLen);
 
@@ -321,13 +859,71 @@ HRESULT PasswordEncryptedStream::SetFilePointer(
 {
     if (m_pChainedStream == nullptr)
         return E_POINTER;
+
+    if (m_pChunked)
+    {
+        // Positions are in plain text
+        if (m_bEncrypting)
+        {
+            if (DistanceToMove != 0LL || dwMoveMethod != FILE_CURRENT)
+                return E_NOTIMPL;
+            if (pCurrPointer)
+                *pCurrPointer = m_pChunked->ullBytesWritten;
+            return S_OK;
+        }
+
+        LONGLONG llPosition = 0LL;
+        switch (dwMoveMethod)
+        {
+            case FILE_BEGIN:
+                llPosition = DistanceToMove;
+                break;
+            case FILE_CURRENT:
+                llPosition = (LONGLONG)m_pChunked->ullPosition + DistanceToMove;
+                break;
+            case FILE_END:
+                if (m_pChunked->ullPlainSize == MAXULONGLONG)
+                    return E_NOTIMPL;
+                llPosition = (LONGLONG)m_pChunked->ullPlainSize + DistanceToMove;
+                break;
+            default:
+                return E_INVALIDARG;
+        }
+        if (llPosition < 0LL)
+            return HRESULT_FROM_WIN32(ERROR_NEGATIVE_SEEK);
+
+        m_pChunked->ullPosition = llPosition;
+        if (pCurrPointer)
+            *pCurrPointer = m_pChunked->ullPosition;
+        return S_OK;
+    }
+
     return m_pChainedStream->SetFilePointer(DistanceToMove, dwMoveMethod, pCurrPointer);
 }
 
+ULONG64 PasswordEncryptedStream::GetSize()
+{
+    if (m_pChainedStream == nullptr)
+        return 0LL;
+
+    if (m_pChunked)
+        return m_bEncrypting ? m_pChunked->ullBytesWritten : m_pChunked->ullPlainSize;
+
+    ULONG64 ullSize = m_pChainedStream->GetSize();
+    return ullSize % m_dwBlockLen == 0 ? ullSize : (ullSize / m_dwBlockLen) * (m_dwBlockLen + 1);
+}
+
 HRESULT PasswordEncryptedStream::Close()
 {
     HRESULT hr = E_FAIL;
 
+    if (m_pChunked)
+    {
+        if (m_pChainedStream == nullptr)
+            return S_OK;
+        return ChunkedClose();
+    }
+
     if (m_dwBufferedData > 0)
     {
         DWORD dwToProcess = m_dwBufferedData;
@@ -359,6 +955,9 @@ HRESULT PasswordEncryptedStream::Close()
             return hr;
         }
         _ASSERT(ullWritten == dwToProcess);
+
+        // Closing again does not encrypt the last block twice
+        m_dwBufferedData = 0L;
         return m_pChainedStream->Close();
     }
 
@@ -11,15 +11,52 @@
 
 #include <boost/logic/tribool.hpp>
 
+#include <memory>
+
 #pragma managed(push, off)
 
 namespace Orc {
 
 class LogFileWriter;
 
+//
+// PasswordEncryptedStream encrypts or decrypts the chained stream with a key derived from a password.
+//
+// Format::CryptoAPI is one AES-256 CryptoAPI session over the whole stream.
+// Format::Chunked splits the data in chunks of ChunkSize bytes, each one sealed with AES-256-GCM (its own nonce and
+// tag, the chunk index and a final flag being authenticated) under a PBKDF2-SHA256 key: chunks are encrypted in
+// parallel on write and any chunk can be decrypted and verified on its own, so the decrypting stream can seek.
+// OpenToDecrypt recognizes the format from the chunked header: a stream which cannot seek is decrypted sequentially
+// and, when its size is unknown (a pipe), its final chunk is the one found followed by the end of the stream.
+//
 class PasswordEncryptedStream : public ChainingStream
 {
+public:
+    enum class Format
+    {
+        CryptoAPI,
+        Chunked
+    };
+
+    static constexpr DWORD DefaultChunkSize = 0x100000;
+
 private:
+    class ChunkedCipher;
+    std::unique_ptr<ChunkedCipher> m_pChunked;
+
+    HRESULT OpenChunkedToEncrypt(const std::wstring& pwd, DWORD dwChunkSize);
+    HRESULT OpenChunkedToDecrypt(const std::wstring& pwd);
+
+    // Seals nbChunks chunks of plain text from m_Buffer in parallel and writes them, the last one possibly final
+    HRESULT WriteChunks(DWORD nbChunks, DWORD cbLastChunk, bool bFinal);
+    HRESULT ReadChunk(ULONGLONG ullChunk);
+    // Reads the chunks of a stream of unknown size in sequence, one chunk ahead
+    HRESULT ReadNextChunk(ULONGLONG ullChunk, DWORD& cbSealed, bool& bFinal);
+
+    HRESULT ChunkedRead(BYTE* pReadBuffer, ULONGLONG cbBytes, ULONGLONG& cbBytesRead);
+    HRESULT ChunkedWrite(const BYTE* pWriteBuffer, ULONGLONG cbBytesToWrite);
+    HRESULT ChunkedClose();
+
     HCRYPTPROV m_hCryptProv = NULL;
     HCRYPTKEY m_hKey = NULL;
     DWORD m_dwBlockLen = 0L;
@@ -28,17 +65,17 @@ private:
     CBinaryBuffer m_Buffer;
     DWORD m_dwBufferedData = 0L;
 
+    // Cipher text read from the chained stream but not decrypted yet (header lookup, partial block)
+    CBinaryBuffer m_ReadAhead;
+    DWORD m_dwReadAhead = 0L;
+
     HRESULT GetKeyMaterial(const std::wstring& pwd);
 
     HRESULT EncryptData(CBinaryBuffer& pData, BOOL bFinal, DWORD& dwEncryptedBytes);
     HRESULT DecryptData(CBinaryBuffer& pData, BOOL bFinal, DWORD& dwDecryptedBytes);
 
 public:
-    PasswordEncryptedStream(logger pLog)
-        : ChainingStream(std::move(pLog))
-    {
-        m_bEncrypting = boost::indeterminate;
-    }
+    PasswordEncryptedStream(logger pLog);
 
     STDMETHOD(IsOpen)()
     {
@@ -58,9 +95,20 @@ public:
             return S_OK;
         return ChainingStream::CanWrite();
     };
-    STDMETHOD(CanSeek)() { return S_FALSE; };
+    STDMETHOD(CanSeek)()
+    {
+        // chunks can be decrypted independently
+        if (m_pChunked && !m_bEncrypting && m_pChainedStream != nullptr)
+            return m_pChainedStream->CanSeek();
+        return S_FALSE;
+    };
 
     STDMETHOD(OpenToEncrypt)(const std::wstring& pwd, const std::shared_ptr<ByteStream>& pChainedStream);
+    STDMETHOD(OpenToEncrypt)
+    (const std::wstring& pwd,
+     const std::shared_ptr<ByteStream>& pChainedStream,
+     Format format,
+     DWORD dwChunkSize = DefaultChunkSize);
     STDMETHOD(OpenToDecrypt)(const std::wstring& pwd, const std::shared_ptr<ByteStream>& pChainedStream);
 
     STDMETHOD(Read)
@@ -76,17 +124,13 @@ public:
     STDMETHOD(SetFilePointer)
     (__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer);
 
-    STDMETHOD_(ULONG64, GetSize)()
-    {
-        if (m_pChainedStream == nullptr)
-            return 0;
-        ULONG64 ullSize = m_pChainedStream->GetSize();
-        return ullSize % m_dwBlockLen == 0 ? ullSize : (ullSize / m_dwBlockLen) * (m_dwBlockLen + 1);
-    }
+    STDMETHOD_(ULONG64, GetSize)();
     STDMETHOD(SetSize)(ULONG64 ullSize)
     {
         if (m_pChainedStream == nullptr)
             return S_OK;
+        if (m_pChunked)
+            return E_NOTIMPL;
         return m_pChainedStream->SetSize(
             ullSize % m_dwBlockLen == 0 ? ullSize : (ullSize / m_dwBlockLen) * (m_dwBlockLen + 1));
     }
@@ -64,6 +64,25 @@ TeeStream::Write(__in_bcount(cbBytes) const PVOID pBuffer, __in ULONGLONG cbByte
     return hr;
 }
 
+HRESULT TeeStream::CommitView(__in const View& view, __out_opt PULONGLONG pcbBytesWritten)
+{
+    if (view.cbData > MAXDWORD)
+        return E_INVALIDARG;
+
+    HRESULT hr = S_OK;
+
+    for (const auto& stream : m_Streams)
+    {
+        auto stream_hr = E_FAIL;
+        if (stream && FAILED(stream_hr = stream->CommitView(view, pcbBytesWritten)))
+            hr = stream_hr;
+    }
+
+    if (pcbBytesWritten)
+        *pcbBytesWritten = view.cbData;
+    return hr;
+}
+
 HRESULT
 TeeStream::SetFilePointer(__in LONGLONG lDistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pqwCurrPointer)
 {
@@ -65,6 +65,9 @@ public:
      __in ULONGLONG cbBytesToWrite,
      __out_opt PULONGLONG pcbBytesWritten);
 
+    // The same view is lent to all the streams
+    STDMETHOD(CommitView)(__in const View& view, __out_opt PULONGLONG pcbBytesWritten);
+
     STDMETHOD(SetFilePointer)
     (__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer);
 
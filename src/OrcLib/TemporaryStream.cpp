@@ -16,12 +16,281 @@
 
 #include <boost/algorithm/string/replace.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+
+#include <ppl.h>
+
 using namespace std;
 
 using namespace Orc;
 
+namespace {
+
+constexpr auto OrcTempMemoryEnv = L"DFIR-ORC_TEMP_MEMORY";
+constexpr auto OrcTempCompressionEnv = L"DFIR-ORC_TEMP_COMPRESSION";
+
+constexpr ULONGLONG MaxDefaultBudget = 1024LL * 1024 * 1024;
+
+// Writes queued behind a spilled stream before the writer blocks, larger writes are not queued
+constexpr ULONGLONG MaxWriteBehind = 8LL * 1024 * 1024;
+
+}  // namespace
+
+class TemporaryStream::MemoryBudget
+{
+public:
+    static MemoryBudget& Instance()
+    {
+        // Never destroyed: temporary streams held by static objects are released after the static destructors ran
+        static MemoryBudget* g_pBudget = new MemoryBudget();
+        return *g_pBudget;
+    }
+
+    // Accounts cbDelta more bytes for pStream (whose lock is held) and makes it the most recently written stream.
+    // When the budget is exceeded, the least recently written streams move to disk: returns true when that was not
+    // enough and pStream should move too
+    bool Charge(const logger& pLog, TemporaryStream* pStream, ULONGLONG cbDelta)
+    {
+        std::vector<std::pair<TemporaryStream*, std::unique_lock<std::mutex>>> victims;
+        bool bSpillSelf = false;
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+
+            m_ullInUse += cbDelta;
+
+            if (pStream->m_bInBudget)
+                m_LRU.splice(m_LRU.end(), m_LRU, pStream->m_BudgetEntry);
+            else
+            {
+                pStream->m_BudgetEntry = m_LRU.insert(m_LRU.end(), pStream);
+                pStream->m_bInBudget = true;
+            }
+
+            if (m_ullInUse <= m_ullBudget)
+                return false;
+
+            ULONGLONG ullToReclaim = m_ullInUse - m_ullBudget;
+            for (auto pVictim : m_LRU)
+            {
+                if (pVictim == pStream)
+                    continue;
+
+                // A busy stream is skipped: its owner may be waiting on the budget too
+                std::unique_lock<std::mutex> victimLock(pVictim->m_Lock, std::try_to_lock);
+                if (!victimLock.owns_lock() || pVictim->m_cbCharged == 0LL)
+                    continue;
+
+                const auto cbVictim = pVictim->m_cbCharged;
+                victims.emplace_back(pVictim, std::move(victimLock));
+
+                if (cbVictim >= ullToReclaim)
+                {
+                    ullToReclaim = 0LL;
+                    break;
+                }
+                ullToReclaim -= cbVictim;
+            }
+            bSpillSelf = ullToReclaim > 0LL;
+        }
+
+        for (auto& victim : victims)
+        {
+            HRESULT hr = E_FAIL;
+            if (FAILED(hr = victim.first->MoveToFileStream()))
+                log::Warning(pLog, hr, L"Failed to move temporary stream to disk to reclaim memory\r\n");
+        }
+        return bSpillSelf;
+    }
+
+    // Forgets pStream (whose lock is held), cbCharged bytes being released
+    void Remove(TemporaryStream* pStream, ULONGLONG cbCharged)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+
+        if (pStream->m_bInBudget)
+        {
+            m_LRU.erase(pStream->m_BudgetEntry);
+            pStream->m_bInBudget = false;
+        }
+        m_ullInUse -= cbCharged;
+    }
+
+    void Release(ULONGLONG cbCharged)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_ullInUse -= cbCharged;
+    }
+
+    ULONGLONG GetBudget() const { return m_ullBudget; }
+    void SetBudget(ULONGLONG ullBudget) { m_ullBudget = ullBudget; }
+    ULONGLONG GetInUse() const { return m_ullInUse; }
+
+    bool GetCompression() const { return m_bCompress; }
+    void SetCompression(bool bCompress) { m_bCompress = bCompress; }
+
+private:
+    MemoryBudget()
+    {
+        MEMORYSTATUSEX status;
+        status.dwLength = sizeof(status);
+        if (GlobalMemoryStatusEx(&status))
+            m_ullBudget = std::min(status.ullTotalPhys / 8, MaxDefaultBudget);
+
+        WCHAR szValue[MAX_PATH];
+        if (GetEnvironmentVariableW(OrcTempMemoryEnv, szValue, MAX_PATH) > 0)
+        {
+            const auto ullMB = wcstoull(szValue, nullptr, 10);
+            if (ullMB > 0)
+                m_ullBudget = ullMB * 1024 * 1024;
+        }
+
+        m_bCompress = GetEnvironmentVariableW(OrcTempCompressionEnv, NULL, 0L) != 0;
+    }
+
+    std::mutex m_Lock;
+    std::list<TemporaryStream*> m_LRU;
+
+    std::atomic<ULONGLONG> m_ullBudget = 256LL * 1024 * 1024;
+    std::atomic<ULONGLONG> m_ullInUse = 0LL;
+    std::atomic<bool> m_bCompress = false;
+};
+
+class TemporaryStream::WriteBehind
+{
+public:
+    WriteBehind(std::shared_ptr<FileStream> pFileStream)
+        : m_pFileStream(std::move(pFileStream))
+    {
+    }
+
+    // Queues data to write at ullOffset, the cbCharged bytes being given back to the budget once written
+    HRESULT Enqueue(ULONGLONG ullOffset, CBinaryBuffer&& data, ULONGLONG cbCharged)
+    {
+        std::unique_lock<std::mutex> lock(m_Lock);
+
+        m_Cond.wait(lock, [this]() { return m_cbQueued < MaxWriteBehind || FAILED(m_hr); });
+        if (FAILED(m_hr))
+        {
+            MemoryBudget::Instance().Release(cbCharged);
+            return m_hr;
+        }
+
+        m_cbQueued += data.GetCount();
+        m_Queue.push_back({ullOffset, std::move(data), cbCharged});
+
+        if (!m_bRunning)
+        {
+            m_bRunning = true;
+            m_Tasks.run([this]() { Drain(); });
+        }
+        return S_OK;
+    }
+
+    // Waits for the queued writes, returns the first failure
+    HRESULT Wait()
+    {
+        m_Tasks.wait();
+
+        std::lock_guard<std::mutex> lock(m_Lock);
+        return m_hr;
+    }
+
+    ~WriteBehind() { m_Tasks.wait(); }
+
+private:
+    struct Item
+    {
+        ULONGLONG ullOffset;
+        CBinaryBuffer Data;
+        ULONGLONG cbCharged;
+    };
+
+    void Drain()
+    {
+        for (;;)
+        {
+            Item item;
+            HRESULT hr = S_OK;
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                if (m_Queue.empty())
+                {
+                    m_bRunning = false;
+                    m_Cond.notify_all();
+                    return;
+                }
+                item = std::move(m_Queue.front());
+                m_Queue.pop_front();
+                hr = m_hr;
+            }
+
+            const auto cbData = item.Data.GetCount();
+            if (SUCCEEDED(hr) && SUCCEEDED(hr = m_pFileStream->SetFilePointer(item.ullOffset, FILE_BEGIN, NULL)))
+            {
+                ULONGLONG ullWritten = 0LL;
+                hr = m_pFileStream->Write(item.Data.GetData(), cbData, &ullWritten);
+            }
+
+            item.Data.RemoveAll();
+            MemoryBudget::Instance().Release(item.cbCharged);
+
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_cbQueued -= cbData;
+            if (FAILED(hr) && SUCCEEDED(m_hr))
+                m_hr = hr;
+            m_Cond.notify_all();
+        }
+    }
+
+    std::shared_ptr<FileStream> m_pFileStream;
+
+    std::mutex m_Lock;
+    std::condition_variable m_Cond;
+    std::deque<Item> m_Queue;
+    ULONGLONG m_cbQueued = 0LL;
+    bool m_bRunning = false;
+    HRESULT m_hr = S_OK;
+
+    concurrency::task_group m_Tasks;
+};
+
+ULONGLONG TemporaryStream::GetMemoryBudget()
+{
+    return MemoryBudget::Instance().GetBudget();
+}
+
+void TemporaryStream::SetMemoryBudget(ULONGLONG ullBudget)
+{
+    MemoryBudget::Instance().SetBudget(ullBudget);
+}
+
+ULONGLONG TemporaryStream::GetMemoryInUse()
+{
+    return MemoryBudget::Instance().GetInUse();
+}
+
+bool TemporaryStream::GetSpillCompression()
+{
+    return MemoryBudget::Instance().GetCompression();
+}
+
+void TemporaryStream::SetSpillCompression(bool bCompress)
+{
+    MemoryBudget::Instance().SetCompression(bCompress);
+}
+
+TemporaryStream::TemporaryStream(logger pLog)
+    : ByteStream(std::move(pLog))
+    , m_dwMemThreshold(0L)
+{
+}
+
 STDMETHODIMP TemporaryStream::CanRead()
 {
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
         return m_pMemStream->CanRead();
     if (m_pFileStream)
@@ -31,6 +300,8 @@ STDMETHODIMP TemporaryStream::CanRead()
 
 STDMETHODIMP TemporaryStream::CanWrite()
 {
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
         return m_pMemStream->CanWrite();
     if (m_pFileStream)
@@ -40,6 +311,8 @@ STDMETHODIMP TemporaryStream::CanWrite()
 
 STDMETHODIMP TemporaryStream::CanSeek()
 {
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
         return m_pMemStream->CanSeek();
     if (m_pFileStream)
@@ -55,6 +328,8 @@ STDMETHODIMP TemporaryStream::Open(
 {
     HRESULT hr = E_FAIL;
 
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     m_bReleaseOnClose = bReleaseOnClose;
 
     if (strTempDir.empty())
@@ -91,7 +366,8 @@ STDMETHODIMP TemporaryStream::Open(
     if (FAILED(hr = m_pMemStream->OpenForReadWrite(dwMemThreshold)))
     {
         log::Verbose(_L_, L"Failed to open memstream for %s bytes, using file stream\r\n", dwMemThreshold);
-        if (FAILED(hr = MoveToFileStream(nullptr)))
+        m_pMemStream = nullptr;
+        if (FAILED(hr = MoveToFileStream()))
         {
             log::Error(_L_, hr, L"Failed to Open temporary stream into a file stream");
             return hr;
@@ -106,21 +382,29 @@ STDMETHODIMP TemporaryStream::Read(
     __in ULONGLONG cbBytes,
     __out_opt PULONGLONG pcbBytesRead)
 {
+    HRESULT hr = E_FAIL;
+
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
         return m_pMemStream->Read(pBuffer, cbBytes, pcbBytesRead);
     if (m_pFileStream)
+    {
+        if (FAILED(hr = FlushWriteBehind()))
+            return hr;
         return m_pFileStream->Read(pBuffer, cbBytes, pcbBytesRead);
+    }
 
     return HRESULT_FROM_WIN32(ERROR_INVALID_STATE);
 }
 
-HRESULT TemporaryStream::MoveToFileStream(const std::shared_ptr<ByteStream>& aStream)
+HRESULT TemporaryStream::MoveToFileStream()
 {
     HRESULT hr = E_FAIL;
 
     log::Verbose(_L_, L"INFO: Moving TemporaryStream to a file stream\r\n");
 
-    m_pFileStream = std::make_shared<FileStream>(_L_);
+    auto pFileStream = std::make_shared<FileStream>(_L_);
 
     HANDLE hTempFile = INVALID_HANDLE_VALUE;
 
@@ -134,29 +418,99 @@ HRESULT TemporaryStream::MoveToFileStream(const std::shared_ptr<ByteStream>& aSt
                 FILE_ATTRIBUTE_TEMPORARY | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED)))
         return hr;
 
-    if (FAILED(hr = m_pFileStream->OpenHandle(hTempFile)))
+    if (MemoryBudget::Instance().GetCompression())
+    {
+        USHORT usFormat = COMPRESSION_FORMAT_DEFAULT;
+        DWORD dwReturned = 0L;
+        if (!DeviceIoControl(
+                hTempFile, FSCTL_SET_COMPRESSION, &usFormat, sizeof(usFormat), NULL, 0L, &dwReturned, NULL))
+        {
+            log::Verbose(
+                _L_,
+                L"Failed to compress temporary file %s (%d)\r\n",
+                m_strFileName.c_str(),
+                HRESULT_FROM_WIN32(GetLastError()));
+        }
+        else
+            m_bFileCompressed = true;
+    }
+
+    if (FAILED(hr = pFileStream->OpenHandle(hTempFile)))
         return hr;
 
-    ULONGLONG ullCurPos = 0LL;
-    if (aStream != nullptr)
-    {
+    m_pFileStream = pFileStream;
 
-        ULONGLONG ullBytes = 0LL;
-        if (FAILED(hr = aStream->CopyTo(m_pFileStream, &ullBytes)))
+    if (m_pMemStream != nullptr)
+    {
+        ULONGLONG ullCurPos = 0LL;
+        if (FAILED(hr = m_pMemStream->SetFilePointer(0LL, FILE_CURRENT, &ullCurPos)))
             return hr;
 
-        if (FAILED(hr = aStream->SetFilePointer(0LL, FILE_CURRENT, &ullCurPos)))
-            return hr;
+        // The memory goes to the writer as is, the budget gets it back once it is on disk
+        CBinaryBuffer data;
+        m_pMemStream->GrabBuffer(data);
+        m_pMemStream = nullptr;
+
+        const auto cbCharged = m_cbCharged;
+        MemoryBudget::Instance().Remove(this, 0LL);
+        m_cbCharged = 0LL;
 
-        aStream->Close();
+        m_pWriteBehind = std::make_unique<WriteBehind>(m_pFileStream);
+        m_bWriteBehindPending = true;
+        m_ullWriteBehindPosition = ullCurPos;
+
+        if (FAILED(hr = m_pWriteBehind->Enqueue(0LL, std::move(data), cbCharged)))
+            return hr;
     }
 
-    if (FAILED(hr = m_pFileStream->SetFilePointer(ullCurPos, FILE_BEGIN, NULL)))
+    return S_OK;
+}
+
+HRESULT TemporaryStream::FlushWriteBehind()
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_pWriteBehind == nullptr || !m_bWriteBehindPending)
+        return S_OK;
+
+    m_bWriteBehindPending = false;
+
+    if (FAILED(hr = m_pWriteBehind->Wait()))
+    {
+        log::Error(_L_, hr, L"Failed to write temporary stream to disk\r\n");
         return hr;
+    }
+
+    return m_pFileStream->SetFilePointer(m_ullWriteBehindPosition, FILE_BEGIN, NULL);
+}
+
+HRESULT TemporaryStream::UpdateCharge()
+{
+    HRESULT hr = E_FAIL;
+
+    const auto ullSize = m_pMemStream->GetSize();
+    if (ullSize <= m_cbCharged)
+        return S_OK;
+
+    const auto cbDelta = ullSize - m_cbCharged;
+    m_cbCharged = ullSize;
 
+    if (MemoryBudget::Instance().Charge(_L_, this, cbDelta))
+    {
+        // The data is still safe in memory when this fails
+        log::Verbose(_L_, L"INFO: Temporary streams memory budget exhausted\r\n");
+        if (FAILED(hr = MoveToFileStream()))
+            log::Warning(_L_, hr, L"Failed to move temporary stream to disk\r\n");
+    }
     return S_OK;
 }
 
+void TemporaryStream::ReleaseCharge()
+{
+    MemoryBudget::Instance().Remove(this, m_cbCharged);
+    m_cbCharged = 0LL;
+}
+
 STDMETHODIMP TemporaryStream::Write(
     __in_bcount(cbBytes) const PVOID pBuffer,
     __in ULONGLONG cbBytes,
@@ -164,8 +518,40 @@ STDMETHODIMP TemporaryStream::Write(
 {
     HRESULT hr = E_FAIL;
 
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pFileStream)
-        return m_pFileStream->Write(pBuffer, cbBytes, pcbBytesWritten);
+    {
+        if (m_pWriteBehind == nullptr || cbBytes > MaxWriteBehind)
+        {
+            if (FAILED(hr = FlushWriteBehind()))
+                return hr;
+            return m_pFileStream->Write(pBuffer, cbBytes, pcbBytesWritten);
+        }
+
+        if (!m_bWriteBehindPending)
+        {
+            if (FAILED(hr = m_pFileStream->SetFilePointer(0LL, FILE_CURRENT, &m_ullWriteBehindPosition)))
+                return hr;
+            m_bWriteBehindPending = true;
+        }
+
+        CBinaryBuffer data;
+        if (!data.SetCount((size_t)cbBytes))
+            return E_OUTOFMEMORY;
+        CopyMemory(data.GetData(), pBuffer, (size_t)cbBytes);
+
+        if (FAILED(hr = m_pWriteBehind->Enqueue(m_ullWriteBehindPosition, std::move(data), 0LL)))
+        {
+            log::Error(_L_, hr, L"Failed to write temporary stream to disk\r\n");
+            return hr;
+        }
+        m_ullWriteBehindPosition += cbBytes;
+
+        if (pcbBytesWritten)
+            *pcbBytesWritten = cbBytes;
+        return S_OK;
+    }
 
     if (m_pMemStream == nullptr)
         return E_POINTER;
@@ -174,17 +560,36 @@ STDMETHODIMP TemporaryStream::Write(
 
     if ((ullMemStreamSize + cbBytes) > m_dwMemThreshold)
     {
-        if (FAILED(hr = MoveToFileStream(m_pMemStream)))
+        if (FAILED(hr = MoveToFileStream()))
             return hr;
 
-        m_pMemStream = nullptr;
+        // Queued behind the data accumulated so far
+        if (cbBytes <= MaxWriteBehind)
+        {
+            CBinaryBuffer data;
+            if (!data.SetCount((size_t)cbBytes))
+                return E_OUTOFMEMORY;
+            CopyMemory(data.GetData(), pBuffer, (size_t)cbBytes);
+
+            if (FAILED(hr = m_pWriteBehind->Enqueue(m_ullWriteBehindPosition, std::move(data), 0LL)))
+                return hr;
+            m_ullWriteBehindPosition += cbBytes;
+
+            if (pcbBytesWritten)
+                *pcbBytesWritten = cbBytes;
+            return S_OK;
+        }
 
+        if (FAILED(hr = FlushWriteBehind()))
+            return hr;
         if (FAILED(hr = m_pFileStream->Write(pBuffer, cbBytes, pcbBytesWritten)))
             return hr;
     }
     else
     {
-        return m_pMemStream->Write(pBuffer, cbBytes, pcbBytesWritten);
+        if (FAILED(hr = m_pMemStream->Write(pBuffer, cbBytes, pcbBytesWritten)))
+            return hr;
+        return UpdateCharge();
     }
 
     return S_OK;
@@ -193,20 +598,34 @@ STDMETHODIMP TemporaryStream::Write(
 STDMETHODIMP
 TemporaryStream::SetFilePointer(__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer)
 {
+    HRESULT hr = E_FAIL;
+
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
         return m_pMemStream->SetFilePointer(DistanceToMove, dwMoveMethod, pCurrPointer);
     if (m_pFileStream)
+    {
+        if (FAILED(hr = FlushWriteBehind()))
+            return hr;
         return m_pFileStream->SetFilePointer(DistanceToMove, dwMoveMethod, pCurrPointer);
+    }
 
     return S_OK;
 }
 
 ULONG64 TemporaryStream::GetSize()
 {
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
         return m_pMemStream->GetSize();
     if (m_pFileStream)
+    {
+        if (FAILED(FlushWriteBehind()))
+            return 0LL;
         return m_pFileStream->GetSize();
+    }
     return 0LL;
 }
 
@@ -214,13 +633,23 @@ STDMETHODIMP TemporaryStream::SetSize(ULONG64 ullSize)
 {
     HRESULT hr = E_FAIL;
 
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
+    {
         if (FAILED(hr = m_pMemStream->SetSize(ullSize)))
             return hr;
+        if (FAILED(hr = UpdateCharge()))
+            return hr;
+    }
 
     if (m_pFileStream)
+    {
+        if (FAILED(hr = FlushWriteBehind()))
+            return hr;
         if (FAILED(hr = m_pFileStream->SetSize(ullSize)))
             return hr;
+    }
 
     return S_OK;
 }
@@ -232,14 +661,21 @@ STDMETHODIMP TemporaryStream::Close()
     if (!m_bReleaseOnClose)
         return S_OK;
 
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
     {
         if (FAILED(hr = m_pMemStream->Close()))
             return hr;
         m_pMemStream = nullptr;
+        ReleaseCharge();
     }
     if (m_pFileStream)
     {
+        if (FAILED(hr = FlushWriteBehind()))
+            return hr;
+        m_pWriteBehind = nullptr;
+
         if (FAILED(hr = m_pFileStream->Close()))
             return hr;
         m_pFileStream = nullptr;
@@ -251,6 +687,8 @@ STDMETHODIMP TemporaryStream::MoveTo(LPCWSTR lpszNewFileName)
 {
     HRESULT hr = E_FAIL;
 
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
     {
         FileStream fileStream(_L_);
@@ -267,9 +705,39 @@ STDMETHODIMP TemporaryStream::MoveTo(LPCWSTR lpszNewFileName)
         }
         m_pMemStream->Close();
         m_pMemStream = nullptr;
+        ReleaseCharge();
     }
     else if (m_pFileStream)
     {
+        if (FAILED(hr = FlushWriteBehind()))
+            return hr;
+        m_pWriteBehind = nullptr;
+
+        if (m_bFileCompressed)
+        {
+            // The renamed file would keep the compression of the spill, it is only meant for the temporary file
+            USHORT usFormat = COMPRESSION_FORMAT_NONE;
+            DWORD dwReturned = 0L;
+            if (!DeviceIoControl(
+                    m_pFileStream->GetHandle(),
+                    FSCTL_SET_COMPRESSION,
+                    &usFormat,
+                    sizeof(usFormat),
+                    NULL,
+                    0L,
+                    &dwReturned,
+                    NULL))
+            {
+                log::Warning(
+                    _L_,
+                    HRESULT_FROM_WIN32(GetLastError()),
+                    L"Failed to uncompress temporary file %s before moving it to %s\r\n",
+                    m_strFileName.c_str(),
+                    lpszNewFileName);
+            }
+            m_bFileCompressed = false;
+        }
+
         m_pFileStream->Close();
         m_pFileStream = nullptr;
 
@@ -289,6 +757,8 @@ STDMETHODIMP TemporaryStream::MoveTo(const std::shared_ptr<ByteStream> pStream)
 {
     HRESULT hr = E_FAIL;
 
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
     {
         ULONGLONG ullWritten = 0LL;
@@ -298,9 +768,14 @@ STDMETHODIMP TemporaryStream::MoveTo(const std::shared_ptr<ByteStream> pStream)
         }
         m_pMemStream->Close();
         m_pMemStream = nullptr;
+        ReleaseCharge();
     }
     if (m_pFileStream)
     {
+        if (FAILED(hr = FlushWriteBehind()))
+            return hr;
+        m_pWriteBehind = nullptr;
+
         ULONGLONG ullWritten = 0LL;
         if (FAILED(hr = m_pFileStream->CopyTo(pStream, &ullWritten)))
         {
@@ -324,6 +799,8 @@ STDMETHODIMP TemporaryStream::MoveTo(const std::shared_ptr<ByteStream> pStream)
 
 STDMETHODIMP TemporaryStream::IsMemoryStream()
 {
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pMemStream)
         return S_OK;
     return S_FALSE;
@@ -331,6 +808,8 @@ STDMETHODIMP TemporaryStream::IsMemoryStream()
 
 STDMETHODIMP TemporaryStream::IsFileStream()
 {
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     if (m_pFileStream)
         return S_OK;
     return S_FALSE;
@@ -340,7 +819,13 @@ TemporaryStream::~TemporaryStream(void)
 {
     HRESULT hr = E_FAIL;
 
+    std::lock_guard<std::mutex> lock(m_Lock);
+
     m_pMemStream = nullptr;
+    ReleaseCharge();
+
+    // Waits for the pending writes
+    m_pWriteBehind = nullptr;
 
     if (m_pFileStream)
     {
@@ -9,7 +9,9 @@
 
 #include "ByteStream.h"
 
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #pragma managed(push, off)
@@ -19,13 +21,50 @@ namespace Orc {
 class MemoryStream;
 class FileStream;
 
+//
+// TemporaryStream keeps its data in memory until it grows past its own threshold or the memory budget shared by all
+// the temporary streams of the process runs out. The budget is reclaimed from the least recently written streams
+// first.
+//
+// A stream moving to disk hands its memory to a background writer and returns immediately: the writer flushes it, and
+// the writes that follow, to the temporary file while the caller goes on. Any other operation waits for the writer.
+//
+// The budget defaults to an eighth of the physical memory (1GB at most) and can be set in MB with
+// %DFIR-ORC_TEMP_MEMORY%. Temporary files are NTFS compressed when %DFIR-ORC_TEMP_COMPRESSION% is set.
+//
 class ORCLIB_API TemporaryStream : public ByteStream
 {
+public:
+    static ULONGLONG GetMemoryBudget();
+    static void SetMemoryBudget(ULONGLONG ullBudget);
+    // Bytes held in memory by all temporary streams, including the ones being written to disk
+    static ULONGLONG GetMemoryInUse();
+
+    static bool GetSpillCompression();
+    static void SetSpillCompression(bool bCompress);
+
 private:
+    class MemoryBudget;
+    friend class MemoryBudget;
+    class WriteBehind;
+
+    // Guards the streams against the budget moving them to disk from another thread
+    std::mutex m_Lock;
+
     std::shared_ptr<MemoryStream> m_pMemStream;
 
     std::shared_ptr<FileStream> m_pFileStream;
     std::wstring m_strFileName;
+    bool m_bFileCompressed = false;  // NTFS compression set on the spilled file
+
+    std::unique_ptr<WriteBehind> m_pWriteBehind;
+    bool m_bWriteBehindPending = false;
+    ULONGLONG m_ullWriteBehindPosition = 0LL;
+
+    // Budget bookkeeping, the entry being guarded by the budget's lock
+    ULONGLONG m_cbCharged = 0LL;
+    std::list<TemporaryStream*>::iterator m_BudgetEntry;
+    bool m_bInBudget = false;
 
     DWORD m_dwMemThreshold;
     std::wstring m_strTemp;
@@ -33,14 +72,14 @@ private:
 
     bool m_bReleaseOnClose = true;
 
-    HRESULT MoveToFileStream(const std::shared_ptr<ByteStream>& aStream);
+    // Moves the in-memory data (if any) to a temporary file, m_Lock must be held
+    HRESULT MoveToFileStream();
+    HRESULT FlushWriteBehind();
+    HRESULT UpdateCharge();
+    void ReleaseCharge();
 
 public:
-    TemporaryStream(logger pLog)
-        : ByteStream(std::move(pLog))
-        , m_dwMemThreshold(0L)
-    {
-    }
+    TemporaryStream(logger pLog);
 
     STDMETHOD(IsOpen)() { return m_pMemStream || m_pFileStream ? S_OK : S_FALSE; };
     STDMETHOD(CanRead)();
@@ -127,3 +127,47 @@ HRESULT UnitTestHelper::ExtractArchive(
 
     return S_OK;
 }
+
+std::vector<BYTE> Orc::Test::MakeData(size_t cbData, BYTE seed)
+{
+    std::vector<BYTE> data(cbData);
+    for (size_t i = 0; i < cbData; i++)
+        data[i] = (BYTE)((i % 251) + seed);
+    return data;
+}
+
+std::vector<BYTE> Orc::Test::GetContent(ByteStream& stream)
+{
+    std::vector<BYTE> content((size_t)stream.GetSize());
+    ULONGLONG ullRead = 0LL;
+    Assert::IsTrue(S_OK == stream.SetFilePointer(0LL, FILE_BEGIN, NULL));
+    Assert::IsTrue(S_OK == stream.Read(content.data(), content.size(), &ullRead));
+    Assert::IsTrue(ullRead == content.size());
+    return content;
+}
+
+FailingStream::FailingStream(logger pLog, const std::vector<BYTE>& data, ULONGLONG cbReadable)
+    : MemoryStream(std::move(pLog))
+    , m_cbReadable(cbReadable)
+{
+    Assert::IsTrue(S_OK == OpenForReadOnly((PVOID)data.data(), data.size()));
+}
+
+HRESULT FailingStream::Read(
+    __out_bcount_part(cbBytes, *pcbBytesRead) PVOID pReadBuffer,
+    __in ULONGLONG cbBytes,
+    __out_opt PULONGLONG pcbBytesRead)
+{
+    ULONG64 ullPosition = 0LL;
+    if (FAILED(MemoryStream::SetFilePointer(0LL, FILE_CURRENT, &ullPosition)))
+        return E_FAIL;
+    if (ullPosition + cbBytes > m_cbReadable)
+        return HRESULT_FROM_WIN32(ERROR_CRC);
+    return MemoryStream::Read(pReadBuffer, cbBytes, pcbBytesRead);
+}
+
+double Orc::Test::MBPerSec(ULONGLONG ullBytes, const std::chrono::steady_clock::time_point& start)
+{
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return ((double)ullBytes / (1024 * 1024)) / elapsed.count();
+}
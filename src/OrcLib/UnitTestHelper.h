@@ -7,9 +7,12 @@
 //
 #pragma once
 
+#include <chrono>
 #include <string>
+#include <vector>
 
 #include "ArchiveExtract.h"
+#include "MemoryStream.h"
 
 #pragma managed(push, off)
 
@@ -40,6 +43,31 @@ public:
 private:
     std::wstring m_strAccumulator;
 };
+
+// Repeating test pattern, buffers made with distinct seeds differ
+std::vector<BYTE> MakeData(size_t cbData, BYTE seed = 0);
+
+// Reads the whole stream from its start
+std::vector<BYTE> GetContent(ByteStream& stream);
+
+// A memory stream whose reads fail past its first cbReadable bytes, as a damaged file's would
+class FailingStream : public MemoryStream
+{
+public:
+    FailingStream(logger pLog, const std::vector<BYTE>& data, ULONGLONG cbReadable);
+
+    STDMETHOD(Read)
+    (__out_bcount_part(cbBytes, *pcbBytesRead) PVOID pReadBuffer,
+     __in ULONGLONG cbBytes,
+     __out_opt PULONGLONG pcbBytesRead);
+
+private:
+    ULONGLONG m_cbReadable;
+};
+
+// Throughput of a benchmark which processed ullBytes since start
+double MBPerSec(ULONGLONG ullBytes, const std::chrono::steady_clock::time_point& start);
+
 }  // namespace Test
 
 }  // namespace Orc
@@ -13,6 +13,9 @@
 #include "XORStream.h"
 
 #include "LogFileWriter.h"
+#include "HashEngine.h"
+
+#include <immintrin.h>
 
 using namespace std;
 namespace fs = std::experimental::filesystem;
@@ -47,42 +50,108 @@ HRESULT XORStream::OpenForXOR(const shared_ptr<ByteStream>& pChained)
     return S_OK;
 }
 
-HRESULT XORStream::XORMemory(LPBYTE pDest, DWORD cbDestBytes, LPBYTE pSrc, DWORD cbSrcBytes, LPDWORD pdwXORed)
+namespace {
+
+bool HasSSE2()
 {
-    DWORD dwToXOR = min(cbSrcBytes, cbDestBytes);
-    DWORD* pdwDstCurr = (DWORD*)pDest;
-    DWORD* pdwSrcCurr = (DWORD*)pSrc;
+#ifdef _M_X64
+    return true;
+#else
+    static const bool bSSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != FALSE;
+    return bSSE2;
+#endif
+}
 
-    DWORD dwXORed = 0;
+}  // namespace
+
+void XORStream::XORBuffer(BYTE* pDest, const BYTE* pSrc, size_t cbBytes, DWORD& dwPattern)
+{
+    size_t i = 0;
 
-    for (DWORD i = 0; i < (dwToXOR / sizeof(DWORD)); i++)
+    // Vector lengths are multiples of the pattern length: the pattern stays aligned on the stream position
+    if (cbBytes >= 32 && HashEngine::HasAVX2())
     {
-        *pdwDstCurr = *pdwSrcCurr ^ m_CurrentXORPattern;
-        pdwDstCurr++;
-        pdwSrcCurr++;
-        dwXORed += 4;
+        const __m256i pattern = _mm256_set1_epi32(static_cast<int>(dwPattern));
+        for (; i + 128 <= cbBytes; i += 128)
+        {
+            const auto p0 = reinterpret_cast<const __m256i*>(pSrc + i);
+            const auto d0 = reinterpret_cast<__m256i*>(pDest + i);
+
+            __m256i v0 = _mm256_loadu_si256(p0);
+            __m256i v1 = _mm256_loadu_si256(p0 + 1);
+            __m256i v2 = _mm256_loadu_si256(p0 + 2);
+            __m256i v3 = _mm256_loadu_si256(p0 + 3);
+            _mm256_storeu_si256(d0, _mm256_xor_si256(v0, pattern));
+            _mm256_storeu_si256(d0 + 1, _mm256_xor_si256(v1, pattern));
+            _mm256_storeu_si256(d0 + 2, _mm256_xor_si256(v2, pattern));
+            _mm256_storeu_si256(d0 + 3, _mm256_xor_si256(v3, pattern));
+        }
+        for (; i + 32 <= cbBytes; i += 32)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDest + i), _mm256_xor_si256(v, pattern));
+        }
+        _mm256_zeroupper();
     }
 
-    if (dwToXOR % sizeof(DWORD))
+    if (cbBytes - i >= 16 && HasSSE2())
     {
-        DWORD bytestoshift = dwToXOR % sizeof(DWORD);
-        PBYTE pbSrcCur = (PBYTE)pdwSrcCurr;
-        PBYTE pbDstCur = (PBYTE)pdwDstCurr;
-        PBYTE pbXORPattCur = (PBYTE)&m_CurrentXORPattern;
-
-        for (DWORD i = 0; i < bytestoshift; i++)
+        const __m128i pattern = _mm_set1_epi32(static_cast<int>(dwPattern));
+        for (; i + 16 <= cbBytes; i += 16)
         {
-            *pbDstCur = *pbSrcCur ^ *pbXORPattCur;
-            pbDstCur++;
-            pbSrcCur++;
-            pbXORPattCur++;
-            dwXORed++;
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + i), _mm_xor_si128(v, pattern));
         }
+    }
 
-        m_CurrentXORPattern = (DWORD)RotateRight32(m_CurrentXORPattern, bytestoshift * 8);
+    for (; i + sizeof(DWORD) <= cbBytes; i += sizeof(DWORD))
+    {
+        DWORD dwValue;
+        memcpy(&dwValue, pSrc + i, sizeof(DWORD));
+        dwValue ^= dwPattern;
+        memcpy(pDest + i, &dwValue, sizeof(DWORD));
     }
+
+    if (const auto bytestoshift = cbBytes - i)
+    {
+        const auto pbXORPatt = reinterpret_cast<const BYTE*>(&dwPattern);
+        for (size_t j = 0; j < bytestoshift; j++)
+            pDest[i + j] = pSrc[i + j] ^ pbXORPatt[j];
+
+        dwPattern = (DWORD)RotateRight32(dwPattern, static_cast<DWORD>(bytestoshift * 8));
+    }
+}
+
+HRESULT XORStream::XORMemory(LPBYTE pDest, DWORD cbDestBytes, LPBYTE pSrc, DWORD cbSrcBytes, LPDWORD pdwXORed)
+{
+    DWORD dwToXOR = min(cbSrcBytes, cbDestBytes);
+
+    XORBuffer(pDest, pSrc, dwToXOR, m_CurrentXORPattern);
+
     if (pdwXORed)
-        *pdwXORed = dwXORed;
+        *pdwXORed = dwToXOR;
+    return S_OK;
+}
+
+HRESULT XORStream::SetFilePointer(
+    __in LONGLONG DistanceToMove,
+    __in DWORD dwMoveMethod,
+    __out_opt PULONG64 pCurrPointer)
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_pChainedStream == nullptr)
+        return E_POINTER;
+
+    ULONG64 ullPosition = 0LL;
+    if (FAILED(hr = m_pChainedStream->SetFilePointer(DistanceToMove, dwMoveMethod, &ullPosition)))
+        return hr;
+
+    // The pattern is aligned on the stream position
+    m_CurrentXORPattern = (DWORD)RotateRight32(m_OriginalXORPattern, static_cast<DWORD>((ullPosition % 4) * 8));
+
+    if (pCurrPointer)
+        *pCurrPointer = ullPosition;
     return S_OK;
 }
 
@@ -296,31 +365,37 @@ HRESULT XORStream::Write(
         return E_INVALIDARG;
     }
 
-    CBinaryBuffer buffer;
+    ULONGLONG cbBytesWritten = 0;
+
+    if (!m_OriginalXORPattern)
+    {
+        if (FAILED(hr = m_pChainedStream->Write(pWriteBuffer, cbBytesToWrite, &cbBytesWritten)))
+            return hr;
+
+        *pcbBytesWritten = cbBytesWritten;
+        return S_OK;
+    }
 
-    if (!buffer.SetCount((DWORD)cbBytesToWrite))
+    // The caller's buffer is read only: it is XOR'ed into a buffer kept from one write to the next
+    if (!m_WriteBuffer.CheckCount(static_cast<size_t>(cbBytesToWrite)))
         return E_OUTOFMEMORY;
 
-    if (m_OriginalXORPattern)
-    {
-        DWORD dwXORed = 0;
+    DWORD dwXORed = 0;
 
-        XORMemory(
-            (PBYTE)buffer.GetData(),
-            static_cast<DWORD>(buffer.GetCount()),
-            (PBYTE)pWriteBuffer,
-            static_cast<DWORD>(cbBytesToWrite),
-            &dwXORed);
+    XORMemory(
+        (PBYTE)m_WriteBuffer.GetData(),
+        static_cast<DWORD>(cbBytesToWrite),
+        (PBYTE)pWriteBuffer,
+        static_cast<DWORD>(cbBytesToWrite),
+        &dwXORed);
 
-        if (dwXORed != cbBytesToWrite)
-        {
-            log::Error(_L_, E_FAIL, L"XOR before WriteFile failed\r\n");
-            return E_FAIL;
-        }
+    if (dwXORed != cbBytesToWrite)
+    {
+        log::Error(_L_, E_FAIL, L"XOR before WriteFile failed\r\n");
+        return E_FAIL;
     }
-    ULONGLONG cbBytesWritten = 0;
 
-    if (FAILED(hr = m_pChainedStream->Write(buffer.GetData(), buffer.GetCount(), &cbBytesWritten)))
+    if (FAILED(hr = m_pChainedStream->Write(m_WriteBuffer.GetData(), cbBytesToWrite, &cbBytesWritten)))
         return hr;
 
     *pcbBytesWritten = cbBytesWritten;
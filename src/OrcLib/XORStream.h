@@ -22,6 +22,7 @@ class ORCLIB_API XORStream : public ChainingStream
 protected:
     DWORD m_OriginalXORPattern;
     DWORD m_CurrentXORPattern;
+    CBinaryBuffer m_WriteBuffer;
 
 public:
     XORStream(logger pLog)
@@ -71,12 +72,7 @@ public:
      __out_opt PULONGLONG pcbBytesWritten);
 
     STDMETHOD(SetFilePointer)
-    (__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer)
-    {
-        if (m_pChainedStream == nullptr)
-            return E_POINTER;
-        return m_pChainedStream->SetFilePointer(DistanceToMove, dwMoveMethod, pCurrPointer);
-    }
+    (__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer);
 
     STDMETHOD_(ULONG64, GetSize)()
     {
@@ -109,6 +105,10 @@ public:
 
     STDMETHOD(SetXORPattern)(DWORD dwPattern);
     STDMETHOD(XORMemory)(LPBYTE pDest, DWORD cbDestBytes, LPBYTE pSrc, DWORD cbSrcBytes, LPDWORD pdwXORed);
+
+    // XORs cbBytes with dwPattern (AVX2 or SSE2 when available), in place when pDest == pSrc.
+    // dwPattern is rotated to stay aligned on the position following the data.
+    static void XORBuffer(BYTE* pDest, const BYTE* pSrc, size_t cbBytes, DWORD& dwPattern);
 };
 
 }  // namespace Orc
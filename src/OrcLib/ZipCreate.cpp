@@ -27,6 +27,7 @@
 #include "XORStream.h"
 #include "InByteStreamWrapper.h"
 #include "OutByteStreamWrapper.h"
+#include "ZipStreamWriter.h"
 
 #include "ArchiveUpdateCallback.h"
 #include "ArchiveOpenCallback.h"
@@ -70,22 +71,55 @@ ZipCreate::CompressionLevel ZipCreate::GetCompressionLevel(const std::wstring& s
     return ZipCreate::CompressionLevel::Fast;
 }
 
-HRESULT ZipCreate::SetCompressionLevel(const CComPtr<IOutArchive>& pArchiver, CompressionLevel level)
+void ZipCreate::GetArchiveProperties(
+    DWORD dwThreads,
+    std::vector<const wchar_t*>& names,
+    std::vector<CPropVariant>& values) const
+{
+    names = {L"x"};
+    values = {static_cast<UInt32>(m_CompressionLevel)};
+
+    // "mt" lets LZMA2 compress independent blocks of the solid stream on dwThreads threads
+    if (dwThreads != 0L)
+    {
+        names.push_back(L"mt");
+        values.push_back(static_cast<UInt32>(dwThreads));
+    }
+
+    if (m_FormatGUID == CLSID_CFormat7z)
+    {
+        // Small entries sorted by type ("qs") share bounded solid blocks: similar content compresses together and
+        // extracting one entry never decodes more than a block
+        names.push_back(L"s");
+        if (m_dwSolidBlockMB == 0L)
+            values.push_back(false);
+        else
+        {
+            const auto strSolid = std::to_wstring(SolidBlockFiles) + L"f" + std::to_wstring(m_dwSolidBlockMB) + L"m";
+            values.push_back(strSolid.c_str());
+        }
+
+        names.push_back(L"qs");
+        values.push_back(true);
+    }
+}
+
+HRESULT ZipCreate::SetCompressionLevel(const CComPtr<IOutArchive>& pArchiver, DWORD dwThreads)
 {
     HRESULT hr = E_FAIL;
 
     if (!pArchiver)
         return E_POINTER;
 
-    const size_t numProps = 1;
-    const wchar_t* names[numProps] = {L"x"};
-    CPropVariant values[numProps] = {static_cast<UInt32>(level)};  // test with
+    std::vector<const wchar_t*> names;
+    std::vector<CPropVariant> values;
+    GetArchiveProperties(dwThreads, names, values);
 
     CComPtr<ISetProperties> setter;
     if (FAILED(hr = pArchiver->QueryInterface(IID_ISetProperties, reinterpret_cast<void**>(&setter))))
         return hr;
 
-    if (FAILED(hr = setter->SetProperties(names, values, numProps)))
+    if (FAILED(hr = setter->SetProperties(names.data(), values.data(), (UInt32)names.size())))
         return hr;
 
     return S_OK;
@@ -140,8 +174,198 @@ ZipCreate::InitArchive(__in const std::shared_ptr<ByteStream>& pOutputStream, Ar
 
 HRESULT ZipCreate::SetCompressionLevel(__in const std::wstring& strLevel)
 {
-    m_CompressionLevel = GetCompressionLevel(strLevel);
+    // "<level>[,threads=<count>][,policy=off][,solid=<block size in MB, 0 for none>]"
+    const auto strCompression =
+        ParseCompressionLevel(strLevel, [this](const std::wstring& strOption, const std::wstring& strValue) {
+            if (equalCaseInsensitive(strOption, L"threads"))
+                m_dwThreads = static_cast<DWORD>(_wtoi(strValue.c_str()));
+            else if (equalCaseInsensitive(strOption, L"solid"))
+                m_dwSolidBlockMB = static_cast<DWORD>(_wtoi(strValue.c_str()));
+            else if (equalCaseInsensitive(strOption, L"policy"))
+                m_bCompressionPolicy = !equalCaseInsensitive(strValue, L"off");
+            else
+                return false;
+            return true;
+        });
+
+    m_CompressionLevel = GetCompressionLevel(strCompression);
+    return S_OK;
+}
 
+DWORD ZipCreate::GetThreadCount() const
+{
+    if (m_dwThreads == 0L)
+        return 0L;
+    if (m_CompressionLevel == None)
+        return 1L;
+
+    DWORD dwThreads = m_dwThreads;
+
+    // Estimated memory used by each thread: the LZMA2 encoder and its block buffers use about 16 times its
+    // dictionary, a deflate worker keeps up to ZipStreamWriter::EntryMemoryThreshold of output in memory
+    ULONGLONG ullPerThread = 0LL;
+    if (m_FormatGUID == CLSID_CFormatZip)
+        ullPerThread = ZipStreamWriter::EntryMemoryThreshold + 8 * 1024 * 1024;
+    else
+    {
+        const ULONGLONG ullDictionary =
+            m_CompressionLevel <= Normal ? 1LL << (m_CompressionLevel * 2 + 14) : 1LL << (m_CompressionLevel / 2 + 22);
+        ullPerThread = ullDictionary * 16 + 8 * 1024 * 1024;
+    }
+
+    // Only half of the available memory is given to compression
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+    {
+        const auto ullMaxThreads = std::max(status.ullAvailPhys / 2 / ullPerThread, 1ULL);
+        if (dwThreads > ullMaxThreads)
+        {
+            log::Verbose(
+                _L_,
+                L"Compression threads limited to %I64u (%I64u MB available)\r\n",
+                ullMaxThreads,
+                status.ullAvailPhys / (1024 * 1024));
+            dwThreads = static_cast<DWORD>(ullMaxThreads);
+        }
+    }
+    return std::max(dwThreads, 1UL);
+}
+
+STDMETHODIMP ZipCreate::Internal_AppendQueue(bool bFinal)
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_pZipWriter == nullptr)
+    {
+        auto pWriter = std::make_unique<ZipStreamWriter>(_L_);
+        if (FAILED(hr = pWriter->Open(m_ArchiveStream, static_cast<DWORD>(m_CompressionLevel))))
+        {
+            log::Error(_L_, hr, L"Failed to initialize zip writer for %s\r\n", m_ArchiveName.c_str());
+            return hr;
+        }
+
+        fs::path tempdir;
+        if (!m_ArchiveName.empty())
+            tempdir = fs::path(m_ArchiveName).parent_path();
+        pWriter->SetThreads(GetThreadCount(), tempdir.wstring());
+        pWriter->SetPolicy(m_bCompressionPolicy);
+
+        m_pZipWriter = std::move(pWriter);
+    }
+
+    ArchiveItems queue;
+    {
+        concurrency::critical_section::scoped_lock sl(m_cs);
+        std::swap(queue, m_Queue);
+    }
+
+    std::vector<ZipStreamWriter::Source> sources;
+    sources.reserve(queue.size());
+    for (auto& item : queue)
+    {
+        item.currentStatus = Archive::ArchiveItem::Status::Processing;
+
+        ZipStreamWriter::Source source;
+        source.NameInArchive = item.NameInArchive;
+        source.Stream = item.Stream;
+        source.Modified = item.modifiedTime;
+
+        // A duplicate's stream is closed, its reference entry is added in its place
+        if (m_bDeduplicate)
+        {
+            source.Replace = [this, &item](ULONGLONG ullSize, ZipStreamWriter::Source& replacement) {
+                HRESULT hr = E_FAIL;
+
+                Duplicate duplicate;
+                if ((hr = FindDuplicate(item, ullSize, duplicate)) != S_OK)
+                    return hr;
+
+                const auto pDuplicate = item.Stream;
+                if (FAILED(hr = MakeReference(item, std::move(duplicate))))
+                    return hr;
+                pDuplicate->Close();
+
+                replacement.NameInArchive = item.NameInArchive;
+                replacement.Stream = item.Stream;
+                replacement.Modified = item.modifiedTime;
+                return S_OK;
+            };
+        }
+        sources.push_back(std::move(source));
+    }
+
+    const size_t first_entry = m_pZipWriter->GetEntryCount();
+
+    std::vector<HRESULT> results;
+    if (FAILED(hr = m_pZipWriter->AddEntries(sources, results)))
+        log::Error(_L_, hr, L"Failed to append queued items to %s\r\n", m_ArchiveName.c_str());
+    sources.clear();
+
+    // AddEntries appends the successful items in their queued order
+    DWORD dwIndex = static_cast<DWORD>(first_entry);
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        auto& item = queue[i];
+
+        if (FAILED(results[i]))
+        {
+            // The writer dropped the partial entry from a seekable archive, otherwise the archive is failed
+            log::Error(_L_, results[i], L"Failed to archive %s\r\n", item.NameInArchive.c_str());
+
+            // A later duplicate cannot refer to it
+            for (auto it = begin(m_Contents); it != end(m_Contents);)
+                it = it->second == item.NameInArchive ? m_Contents.erase(it) : std::next(it);
+
+            if (item.Stream != nullptr)
+            {
+                item.Stream->Close();
+                item.Stream = nullptr;
+            }
+            continue;
+        }
+        log::Verbose(_L_, L"INFO: Archive of %s succeed\r\n", item.NameInArchive.c_str());
+
+        item.Index = dwIndex++;
+        item.Compression = m_pZipWriter->GetEntryDecision(item.Index);
+        item.Size = m_pZipWriter->GetEntrySize(item.Index);
+        item.CompressedSize = m_pZipWriter->GetEntryCompressedSize(item.Index);
+
+        auto hashstream = std::dynamic_pointer_cast<CryptoHashStream>(ByteStream::GetHashStream(item.Stream));
+        if (hashstream)
+        {
+            hashstream->GetMD5(item.MD5);
+            hashstream->GetSHA1(item.SHA1);
+            m_pZipWriter->SetEntryHashes(item.Index, item.MD5, item.SHA1);
+        }
+        hashstream = nullptr;
+
+        item.currentStatus = Archive::ArchiveItem::Status::Done;
+
+        // CLOSE
+        item.Stream = nullptr;
+
+        {
+            concurrency::critical_section::scoped_lock sl(m_cs);
+            m_Indexes[item.Index] = m_Items.size();
+            m_Items.push_back(std::move(item));
+        }
+
+        if (m_Callback)
+            m_Callback(m_Items.back());
+    }
+
+    if (FAILED(hr))
+        return hr;
+
+    if (bFinal)
+    {
+        if (FAILED(hr = m_pZipWriter->Close()))
+        {
+            log::Error(_L_, hr, L"Failed to complete %s\r\n", m_ArchiveName.c_str());
+            return hr;
+        }
+    }
     return S_OK;
 }
 
@@ -149,6 +373,10 @@ STDMETHODIMP ZipCreate::Internal_FlushQueue(bool bFinal)
 {
     HRESULT hr = E_FAIL;
 
+    // Previously flushed entries never need to be read back from a zip: append the queue to the archive
+    if (m_FormatGUID == CLSID_CFormatZip && m_Password.empty())
+        return Internal_AppendQueue(bFinal);
+
     const auto pZipLib = ZipLibrary::CreateZipLibrary(_L_);
     if (pZipLib == nullptr)
     {
@@ -166,7 +394,7 @@ STDMETHODIMP ZipCreate::Internal_FlushQueue(bool bFinal)
             return hr;
         }
 
-        if (FAILED(hr = SetCompressionLevel(pArchiver, m_CompressionLevel)))
+        if (FAILED(hr = SetCompressionLevel(pArchiver, GetThreadCount())))
             return hr;
 
         if (pArchiver == nullptr)
@@ -308,7 +536,16 @@ STDMETHODIMP ZipCreate::Complete()
 {
     HRESULT hr = E_FAIL;
 
-    if (FAILED(Internal_FlushQueue(true)))
+    // Duplicates are found as the queue is archived, the manifest lists them once it is
+    if (m_bDeduplicate)
+    {
+        if (FAILED(hr = Internal_FlushQueue(false)))
+            return hr;
+        if (FAILED(hr = AddDeduplicationManifest()))
+            log::Error(_L_, hr, L"Failed to add deduplication manifest\r\n");
+    }
+
+    if (FAILED(hr = Internal_FlushQueue(true)))
         return hr;
 
     std::for_each(begin(m_Items), end(m_Items), [](ArchiveItem& item) {
@@ -11,6 +11,7 @@
 #include "OrcLib.h"
 
 #include "ArchiveCreate.h"
+#include "PropVariant.h"
 
 #include "7zip/IStream.h"
 #include "7zip/Archive/IArchive.h"
@@ -21,6 +22,7 @@ namespace Orc {
 
 class ZipLibrary;
 class TemporaryStream;
+class ZipStreamWriter;
 
 class ORCLIB_API ZipCreate : public ArchiveCreate
 {
@@ -38,6 +40,10 @@ public:
         Ultra = 9
     } CompressionLevel;
 
+    // 7z solid blocks are bounded in size and number of entries
+    static constexpr DWORD DefaultSolidBlockMB = 32L;
+    static constexpr DWORD SolidBlockFiles = 4096L;
+
 public:
     CompressionLevel GetCompressionLevel(const std::wstring& strLevel);
 
@@ -48,6 +54,13 @@ public:
 
     STDMETHOD(SetCompressionLevel)(__in const std::wstring& strLevel);
 
+    // Properties set on 7-Zip's archive handler for the format and compression options, with dwThreads threads (0
+    // for 7-Zip's default)
+    void GetArchiveProperties(
+        DWORD dwThreads,
+        std::vector<const wchar_t*>& names,
+        std::vector<lib7z::CPropVariant>& values) const;
+
     STDMETHOD(FlushQueue)();
     STDMETHOD(Complete)();
     STDMETHOD(Abort)();
@@ -61,12 +74,22 @@ private:
     std::wstring m_ArchiveName;
     GUID m_FormatGUID;
     CompressionLevel m_CompressionLevel;
+    DWORD m_dwThreads = 0L;  // 0: 7-Zip's default for 7z, one thread for zip
+    bool m_bCompressionPolicy = true;  // zip only: 7-Zip compresses a whole update with the same coder
+    DWORD m_dwSolidBlockMB = DefaultSolidBlockMB;  // 7z only: 0 disables solid compression
+
+    // Zip archives without password are written front to back, without rewriting previous flushes
+    std::unique_ptr<ZipStreamWriter> m_pZipWriter;
 
     ZipCreate(logger pLo, bool bComputeHash = false, DWORD XORPattern = 0x00000000);
 
-    STDMETHOD(SetCompressionLevel)(const CComPtr<IOutArchive>& pArchiver, CompressionLevel level);
+    STDMETHOD(SetCompressionLevel)(const CComPtr<IOutArchive>& pArchiver, DWORD dwThreads);
+
+    // Worker threads for the compression, limited by the available memory. 0 when no count was given
+    DWORD GetThreadCount() const;
 
     STDMETHOD(Internal_FlushQueue)(bool bFinal);
+    STDMETHOD(Internal_AppendQueue)(bool bFinal);
 };
 
 }  // namespace Orc
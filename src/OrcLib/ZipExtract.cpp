@@ -8,6 +8,7 @@
 
 #include "stdafx.h"
 
+#include <algorithm>
 #include <filesystem>
 
 #include <7zip/7zip.h>
@@ -17,6 +18,7 @@
 
 #include "ZipExtract.h"
 #include "ZipLibrary.h"
+#include "ZipStreamReader.h"
 
 #include "FileStream.h"
 #include "XORStream.h"
@@ -43,6 +45,76 @@ ZipExtract::ZipExtract(logger pLog, bool bComputeHash)
 
 ZipExtract::~ZipExtract(void) {}
 
+HRESULT ZipExtract::ExtractFromIndex(
+    ZipStreamReader& reader,
+    const ItemShouldBeExtractedCallback& pShouldBeExtracted,
+    const MakeOutputStream& MakeWriteAbleStream)
+{
+    HRESULT hr = E_FAIL;
+
+    const auto& entries = reader.Entries();
+
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const auto& strName = entries[i].Name;
+        if (strName.empty() || strName.back() == L'\\')
+            continue;  // directory
+        if (pShouldBeExtracted(strName))
+            indexes.push_back(i);
+    }
+
+    // Outputs are made on this thread, before their entry is inflated
+    std::vector<Archive::ArchiveItem> items(indexes.size());
+    auto makeOutput = [&](const ZipStreamReader::Entry& entry) -> std::shared_ptr<ByteStream> {
+        const size_t index = &entry - entries.data();
+        auto& item = items[std::lower_bound(std::begin(indexes), std::end(indexes), index) - std::begin(indexes)];
+
+        item.Index = (DWORD)index;
+        item.NameInArchive = entry.Name;
+        item.Size = entry.UncompressedSize;
+        item.modifiedTime = entry.Modified;
+        item.Compression = entry.Decision;
+        item.Stream = ArchiveExtractCallback::MakeStreamToWrite(_L_, item, MakeWriteAbleStream, m_bComputeHash);
+        return item.Stream;
+    };
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+
+    std::vector<HRESULT> results;
+    if (FAILED(hr = reader.ExtractEntries(indexes, makeOutput, results, si.dwNumberOfProcessors)))
+    {
+        log::Error(_L_, hr, L"Failed when extracting archive\r\n");
+        return hr;
+    }
+
+    HRESULT hrResult = S_OK;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        auto& item = items[i];
+        if (FAILED(results[i]))
+        {
+            log::Error(_L_, results[i], L"Failed to extract %s\r\n", entries[indexes[i]].Name.c_str());
+            hrResult = results[i];
+            continue;
+        }
+
+        auto hashstream = std::dynamic_pointer_cast<CryptoHashStream>(ByteStream::GetHashStream(item.Stream));
+        if (hashstream)
+        {
+            hashstream->GetMD5(item.MD5);
+            hashstream->GetSHA1(item.SHA1);
+        }
+
+        if (m_Callback)
+            m_Callback(item);
+
+        m_Items.push_back(std::move(item));
+    }
+    return hrResult;
+}
+
 STDMETHODIMP ZipExtract::Extract(
     __in ArchiveExtract::MakeArchiveStream makeArchiveStream,
     __in const ItemShouldBeExtractedCallback pShouldBeExtracted,
@@ -64,19 +136,37 @@ STDMETHODIMP ZipExtract::Extract(
         return E_FAIL;
     }
 
-    CComPtr<IInArchive> archive;
+    std::shared_ptr<ByteStream> InputStream;
 
-    if (FAILED(hr = pZipLib->CreateObject(&CLSID_CFormat7z, &IID_IInArchive, reinterpret_cast<void**>(&archive))))
+    if (FAILED(hr = makeArchiveStream(InputStream)))
     {
-        log::Error(_L_, hr, L"Failed to create archive reader\r\n");
+        log::Error(_L_, hr, L"Failed to make archive stream\r\n");
         return hr;
     }
 
-    std::shared_ptr<ByteStream> InputStream;
+    // The central directory of a zip archive is an index of its entries: they are read directly, in parallel
+    const bool bZip = ZipStreamReader::IsZip(*InputStream);
+    if (bZip && m_Password.empty())
+    {
+        ZipStreamReader reader(_L_);
+        const auto& entries = reader.Entries();
 
-    if (FAILED(hr = makeArchiveStream(InputStream)))
+        const auto isEncrypted = [](const ZipStreamReader::Entry& entry) { return entry.Encrypted; };
+
+        if (SUCCEEDED(reader.Open(InputStream)) && std::none_of(std::cbegin(entries), std::cend(entries), isEncrypted))
+            return ExtractFromIndex(reader, pShouldBeExtracted, MakeWriteAbleStream);
+
+        log::Verbose(_L_, L"Zip archive is read by 7zip\r\n");
+        if (FAILED(hr = InputStream->SetFilePointer(0LL, FILE_BEGIN, NULL)))
+            return hr;
+    }
+
+    CComPtr<IInArchive> archive;
+    const GUID& formatGUID = bZip ? CLSID_CFormatZip : CLSID_CFormat7z;
+
+    if (FAILED(hr = pZipLib->CreateObject(&formatGUID, &IID_IInArchive, reinterpret_cast<void**>(&archive))))
     {
-        log::Error(_L_, hr, L"Failed to make archive stream\r\n");
+        log::Error(_L_, hr, L"Failed to create archive reader\r\n");
         return hr;
     }
 
@@ -15,6 +15,8 @@
 
 namespace Orc {
 
+class ZipStreamReader;
+
 class ORCLIB_API ZipExtract : public ArchiveExtract
 {
     friend class ArchiveExtract;
@@ -30,6 +32,13 @@ public:
      __in MakeOutputStream MakeWriteAbleStream);
 
     ~ZipExtract(void);
+
+private:
+    // Extracts a zip archive through its central directory, inflating entries on several threads
+    HRESULT ExtractFromIndex(
+        ZipStreamReader& reader,
+        const ItemShouldBeExtractedCallback& pShouldBeExtracted,
+        const MakeOutputStream& MakeWriteAbleStream);
 };
 
 }  // namespace Orc
@@ -37,6 +37,7 @@ class Lib7z
         NArchive::N7z::Register();
         NCompress::NBcj::RegisterCodecBCJ();
         NCompress::NBcj2::RegisterCodecBCJ2();
+        NCompress::NDeflate::RegisterCodecDeflate();
         NCompress::NLzma::RegisterCodecLZMA();
         NCompress::NLzma2::RegisterCodecLZMA2();
     }
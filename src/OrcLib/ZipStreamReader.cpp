@@ -0,0 +1,603 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include <7zip/7zip.h>
+
+#include "ZipStreamReader.h"
+
+#include "7zip/ICoder.h"
+#include "7zip/IStream.h"
+
+#include "ByteStream.h"
+#include "LogFileWriter.h"
+#include "MemoryStream.h"
+#include "WideAnsi.h"
+#include "ZipLibrary.h"
+#include "ZipStructures.h"
+
+#include <algorithm>
+
+#include <ppl.h>
+
+using namespace Orc;
+using namespace Orc::Zip;
+
+namespace {
+
+constexpr size_t MaxCommentLength = 0xFFFF;
+
+// The whole central directory is read in memory: a larger one is taken for a corrupted record
+constexpr ULONGLONG MaxCentralDirectorySize = 512 * 1024 * 1024;
+
+// Feeds the decoder with the entry's compressed data only
+class LimitedInStream : public ISequentialInStream
+{
+public:
+    LimitedInStream(ByteStream& input, ULONGLONG ullLimit)
+        : m_Input(input)
+        , m_ullRemaining(ullLimit)
+    {
+    }
+    virtual ~LimitedInStream() {}
+
+    STDMETHOD(QueryInterface)(REFIID iid, void** ppvObject)
+    {
+        if (iid == __uuidof(IUnknown) || iid == IID_ISequentialInStream)
+        {
+            *ppvObject = static_cast<ISequentialInStream*>(this);
+            AddRef();
+            return S_OK;
+        }
+        return E_NOINTERFACE;
+    }
+    STDMETHOD_(ULONG, AddRef)() { return static_cast<ULONG>(InterlockedIncrement(&m_refCount)); }
+    STDMETHOD_(ULONG, Release)()
+    {
+        ULONG res = static_cast<ULONG>(InterlockedDecrement(&m_refCount));
+        if (res == 0)
+            delete this;
+        return res;
+    }
+
+    STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize)
+    {
+        ULONGLONG ullRead = 0LL;
+        HRESULT hr = S_OK;
+
+        if (m_ullRemaining > 0)
+            hr = m_Input.Read(data, std::min<ULONGLONG>(size, m_ullRemaining), &ullRead);
+        m_ullRemaining -= ullRead;
+
+        if (processedSize != NULL)
+            *processedSize = (UInt32)ullRead;
+        return hr;
+    }
+
+private:
+    long m_refCount = 0L;
+    ByteStream& m_Input;
+    ULONGLONG m_ullRemaining;
+};
+
+// Writes the decoded data, computing its CRC and size on the way
+class CRCOutStream : public ISequentialOutStream
+{
+public:
+    DWORD CRC = 0xFFFFFFFF;
+    ULONGLONG Size = 0LL;
+
+    CRCOutStream(ByteStream& output)
+        : m_Output(output)
+    {
+    }
+    virtual ~CRCOutStream() {}
+
+    STDMETHOD(QueryInterface)(REFIID iid, void** ppvObject)
+    {
+        if (iid == __uuidof(IUnknown) || iid == IID_ISequentialOutStream)
+        {
+            *ppvObject = static_cast<ISequentialOutStream*>(this);
+            AddRef();
+            return S_OK;
+        }
+        return E_NOINTERFACE;
+    }
+    STDMETHOD_(ULONG, AddRef)() { return static_cast<ULONG>(InterlockedIncrement(&m_refCount)); }
+    STDMETHOD_(ULONG, Release)()
+    {
+        ULONG res = static_cast<ULONG>(InterlockedDecrement(&m_refCount));
+        if (res == 0)
+            delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize)
+    {
+        ULONGLONG ullWritten = 0LL;
+        HRESULT hr = m_Output.Write((const PVOID)data, size, &ullWritten);
+
+        UpdateCRC(CRC, reinterpret_cast<const BYTE*>(data), (size_t)ullWritten);
+        Size += ullWritten;
+
+        if (processedSize != NULL)
+            *processedSize = (UInt32)ullWritten;
+        return hr;
+    }
+
+private:
+    long m_refCount = 0L;
+    ByteStream& m_Output;
+};
+
+std::wstring IndexKey(const std::wstring& strName)
+{
+    std::wstring retval(strName);
+    std::replace(std::begin(retval), std::end(retval), L'/', L'\\');
+    return retval;
+}
+
+}  // namespace
+
+bool ZipStreamReader::IsZip(ByteStream& input)
+{
+    if (input.CanSeek() != S_OK)
+        return false;
+
+    ULONGLONG ullPosition = 0LL;
+    if (FAILED(input.SetFilePointer(0LL, FILE_CURRENT, &ullPosition)))
+        return false;
+
+    DWORD dwSignature = 0L;
+    ULONGLONG ullRead = 0LL;
+    const bool bZip = SUCCEEDED(input.SetFilePointer(0LL, FILE_BEGIN, NULL))
+        && SUCCEEDED(input.Read(&dwSignature, sizeof(dwSignature), &ullRead)) && ullRead == sizeof(dwSignature)
+        && (dwSignature == LocalFileHeaderSignature || dwSignature == EndOfCentralDirectorySignature);
+
+    input.SetFilePointer(ullPosition, FILE_BEGIN, NULL);
+    return bZip;
+}
+
+ZipStreamReader::ZipStreamReader(logger pLog)
+    : _L_(std::move(pLog))
+{
+}
+
+ZipStreamReader::~ZipStreamReader() {}
+
+HRESULT ZipStreamReader::ReadAt(ULONGLONG ullOffset, PVOID pBuffer, ULONGLONG cbBuffer)
+{
+    HRESULT hr = E_FAIL;
+
+    if (FAILED(hr = m_pInput->SetFilePointer(ullOffset, FILE_BEGIN, NULL)))
+        return hr;
+
+    ULONGLONG ullRead = 0LL;
+    while (ullRead < cbBuffer)
+    {
+        ULONGLONG ullThisRead = 0LL;
+        if (FAILED(hr = m_pInput->Read((BYTE*)pBuffer + ullRead, cbBuffer - ullRead, &ullThisRead)))
+            return hr;
+        if (ullThisRead == 0LL)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        ullRead += ullThisRead;
+    }
+    return S_OK;
+}
+
+HRESULT ZipStreamReader::Open(const std::shared_ptr<ByteStream>& pInput)
+{
+    HRESULT hr = E_FAIL;
+
+    if (pInput == nullptr)
+        return E_POINTER;
+    if (pInput->CanSeek() != S_OK)
+    {
+        log::Error(_L_, E_INVALIDARG, L"Zip archive stream must be seekable\r\n");
+        return E_INVALIDARG;
+    }
+
+    m_pInput = pInput;
+    m_Entries.clear();
+    m_Index.clear();
+
+    const ULONGLONG ullSize = m_pInput->GetSize();
+    if (ullSize < sizeof(EndOfCentralDirectory))
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    // The end of central directory record is followed by a comment of up to 64KB
+    const auto cbTail = std::min<ULONGLONG>(ullSize, sizeof(EndOfCentralDirectory) + MaxCommentLength);
+    std::vector<BYTE> tail((size_t)cbTail);
+    if (FAILED(hr = ReadAt(ullSize - cbTail, tail.data(), cbTail)))
+        return hr;
+
+    size_t endOffset = tail.size() - sizeof(EndOfCentralDirectory) + 1;
+    do
+    {
+        endOffset--;
+        if (*reinterpret_cast<const DWORD*>(tail.data() + endOffset) == EndOfCentralDirectorySignature)
+            break;
+    } while (endOffset > 0);
+
+    const auto& end = *reinterpret_cast<const EndOfCentralDirectory*>(tail.data() + endOffset);
+    if (end.Signature != EndOfCentralDirectorySignature)
+    {
+        log::Error(_L_, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Zip end of central directory not found\r\n");
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    ULONGLONG ullEntries = end.TotalEntries;
+    ULONGLONG cbDirectory = end.CentralDirectorySize;
+    ULONGLONG ullDirectoryOffset = end.CentralDirectoryOffset;
+
+    const ULONGLONG ullEndPosition = ullSize - cbTail + endOffset;
+    if (ullEndPosition >= sizeof(Zip64EndOfCentralDirectoryLocator))
+    {
+        Zip64EndOfCentralDirectoryLocator locator;
+        if (SUCCEEDED(ReadAt(ullEndPosition - sizeof(locator), &locator, sizeof(locator)))
+            && locator.Signature == Zip64LocatorSignature)
+        {
+            Zip64EndOfCentralDirectory end64;
+            if (FAILED(hr = ReadAt(locator.EndOfCentralDirectoryOffset, &end64, sizeof(end64))))
+                return hr;
+            if (end64.Signature != Zip64EndOfCentralDirectorySignature)
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+            ullEntries = end64.TotalEntries;
+            cbDirectory = end64.CentralDirectorySize;
+            ullDirectoryOffset = end64.CentralDirectoryOffset;
+        }
+    }
+
+    if (FAILED(hr = ReadCentralDirectory(ullDirectoryOffset, cbDirectory, ullEntries)))
+    {
+        log::Error(_L_, hr, L"Failed to read zip central directory\r\n");
+        return hr;
+    }
+    return S_OK;
+}
+
+HRESULT ZipStreamReader::ReadCentralDirectory(ULONGLONG ullOffset, ULONGLONG cbDirectory, ULONGLONG ullEntries)
+{
+    HRESULT hr = E_FAIL;
+
+    const ULONGLONG ullSize = m_pInput->GetSize();
+    if (cbDirectory > ullSize || ullOffset > ullSize - cbDirectory)
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    if (cbDirectory > MaxCentralDirectorySize)
+    {
+        log::Error(
+            _L_,
+            HRESULT_FROM_WIN32(ERROR_INVALID_DATA),
+            L"Zip central directory is too large (%I64u bytes)\r\n",
+            cbDirectory);
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    std::vector<BYTE> directory((size_t)cbDirectory);
+    if (FAILED(hr = ReadAt(ullOffset, directory.data(), cbDirectory)))
+        return hr;
+
+    m_Entries.reserve((size_t)std::min<ULONGLONG>(ullEntries, cbDirectory / sizeof(CentralFileHeader)));
+
+    size_t position = 0;
+    while (position + sizeof(CentralFileHeader) <= directory.size())
+    {
+        const auto& header = *reinterpret_cast<const CentralFileHeader*>(directory.data() + position);
+        if (header.Signature != CentralFileHeaderSignature)
+            break;
+
+        const size_t cbRecord =
+            sizeof(CentralFileHeader) + header.NameLength + header.ExtraLength + header.CommentLength;
+        if (position + cbRecord > directory.size())
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+        Entry entry;
+        entry.Method = header.Method;
+        entry.Encrypted = (header.Flags & 0x0001) != 0;
+        entry.CRC = header.CRC;
+        entry.CompressedSize = header.CompressedSize;
+        entry.UncompressedSize = header.UncompressedSize;
+        entry.Offset = header.LocalHeaderOffset;
+
+        const auto pName = reinterpret_cast<const CHAR*>(directory.data() + position + sizeof(CentralFileHeader));
+        if (FAILED(hr = AnsiToWide(_L_, std::string_view(pName, header.NameLength), entry.Name)))
+            return hr;
+        std::replace(std::begin(entry.Name), std::end(entry.Name), L'/', L'\\');
+
+        FILETIME local;
+        if (DosDateTimeToFileTime(header.Date, header.Time, &local))
+            LocalFileTimeToFileTime(&local, &entry.Modified);
+
+        const BYTE* pExtra = reinterpret_cast<const BYTE*>(pName) + header.NameLength;
+        const BYTE* pExtraEnd = pExtra + header.ExtraLength;
+        while (pExtra + 2 * sizeof(WORD) <= pExtraEnd)
+        {
+            const WORD wID = *reinterpret_cast<const WORD*>(pExtra);
+            const WORD cbField = *reinterpret_cast<const WORD*>(pExtra + sizeof(WORD));
+            const BYTE* pField = pExtra + 2 * sizeof(WORD);
+            if (pField + cbField > pExtraEnd)
+                break;
+
+            if (wID == Zip64ExtraID)
+            {
+                // Only the values that did not fit, in this order
+                const BYTE* pValue = pField;
+                const BYTE* pFieldEnd = pField + cbField;
+                for (auto pSize : {&entry.UncompressedSize, &entry.CompressedSize, &entry.Offset})
+                {
+                    if (*pSize != Zip32Max)
+                        continue;
+                    if (pValue + sizeof(ULONGLONG) > pFieldEnd)
+                        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                    *pSize = *reinterpret_cast<const ULONGLONG*>(pValue);
+                    pValue += sizeof(ULONGLONG);
+                }
+            }
+            else if (wID == OrcIndexExtraID && cbField + 2 * sizeof(WORD) >= sizeof(OrcIndexExtra))
+            {
+                const auto& index = *reinterpret_cast<const OrcIndexExtra*>(pExtra);
+                if (index.Decision < CompressionPolicy::DecisionCount)
+                    entry.Decision = static_cast<CompressionPolicy::Decision>(index.Decision);
+                if (index.Flags & OrcIndexHasMD5)
+                    entry.MD5.SetData(const_cast<LPBYTE>(index.MD5), sizeof(index.MD5));
+                if (index.Flags & OrcIndexHasSHA1)
+                    entry.SHA1.SetData(const_cast<LPBYTE>(index.SHA1), sizeof(index.SHA1));
+            }
+            pExtra = pField + cbField;
+        }
+
+        m_Index.emplace(IndexKey(entry.Name), m_Entries.size());
+        m_Entries.push_back(std::move(entry));
+        position += cbRecord;
+    }
+
+    if (m_Entries.size() != ullEntries)
+        log::Warning(
+            _L_,
+            HRESULT_FROM_WIN32(ERROR_INVALID_DATA),
+            L"Zip central directory lists %Iu entries, %I64u expected\r\n",
+            m_Entries.size(),
+            ullEntries);
+    return S_OK;
+}
+
+size_t ZipStreamReader::Find(const std::wstring& strName) const
+{
+    auto it = m_Index.find(IndexKey(strName));
+    if (it == std::end(m_Index))
+        return (size_t)-1;
+    return it->second;
+}
+
+HRESULT ZipStreamReader::GetDataOffset(const Entry& entry, ULONGLONG& ullDataOffset)
+{
+    HRESULT hr = E_FAIL;
+
+    LocalFileHeader header;
+    if (FAILED(hr = ReadAt(entry.Offset, &header, sizeof(header))))
+        return hr;
+    if (header.Signature != LocalFileHeaderSignature)
+    {
+        log::Error(_L_, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Invalid local header for %s\r\n", entry.Name.c_str());
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    ullDataOffset = entry.Offset + sizeof(header) + header.NameLength + header.ExtraLength;
+    return S_OK;
+}
+
+HRESULT ZipStreamReader::Decompress(const Entry& entry, ByteStream& input, ByteStream& output)
+{
+    HRESULT hr = E_FAIL;
+
+    CComPtr<LimitedInStream> pIn = new LimitedInStream(input, entry.CompressedSize);
+    CComPtr<CRCOutStream> pOut = new CRCOutStream(output);
+
+    switch (entry.Method)
+    {
+        case ZipMethodStored: {
+            CBinaryBuffer buffer;
+            if (!buffer.SetCount((size_t)std::min<ULONGLONG>(DEFAULT_READ_SIZE, entry.CompressedSize) + 1))
+                return E_OUTOFMEMORY;
+
+            for (;;)
+            {
+                UInt32 cbRead = 0;
+                if (FAILED(hr = pIn->Read(buffer.GetData(), (UInt32)buffer.GetCount(), &cbRead)))
+                    return hr;
+                if (cbRead == 0)
+                    break;
+
+                UInt32 cbWritten = 0;
+                if (FAILED(hr = pOut->Write(buffer.GetData(), cbRead, &cbWritten)))
+                    return hr;
+            }
+            break;
+        }
+        case ZipMethodDeflated: {
+            if (m_pZipLib == nullptr)
+                return E_NOT_VALID_STATE;
+
+            CComPtr<ICompressCoder> pDecoder;
+            if (FAILED(
+                    hr = m_pZipLib->CreateObject(
+                        &CLSID_DeflateDecoder, &IID_ICompressCoder, reinterpret_cast<void**>(&pDecoder))))
+            {
+                log::Error(_L_, hr, L"Failed to create deflate decoder\r\n");
+                return hr;
+            }
+
+            if (FAILED(hr = pDecoder->Code(pIn, pOut, nullptr, &entry.UncompressedSize, nullptr)))
+                return hr;
+            break;
+        }
+        default:
+            log::Error(
+                _L_,
+                HRESULT_FROM_WIN32(ERROR_UNSUPPORTED_COMPRESSION),
+                L"Unsupported compression method %d for %s\r\n",
+                entry.Method,
+                entry.Name.c_str());
+            return HRESULT_FROM_WIN32(ERROR_UNSUPPORTED_COMPRESSION);
+    }
+
+    if (pOut->Size != entry.UncompressedSize || ~pOut->CRC != entry.CRC)
+    {
+        log::Error(
+            _L_, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"CRC error when extracting %s\r\n", entry.Name.c_str());
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    return S_OK;
+}
+
+HRESULT ZipStreamReader::Extract(size_t index, ByteStream& output)
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_pInput == nullptr)
+        return E_NOT_VALID_STATE;
+    if (index >= m_Entries.size())
+        return E_INVALIDARG;
+
+    const auto& entry = m_Entries[index];
+
+    if (entry.Encrypted)
+    {
+        log::Error(_L_, E_ACCESSDENIED, L"Encrypted entry %s cannot be extracted\r\n", entry.Name.c_str());
+        return E_ACCESSDENIED;
+    }
+
+    if (entry.Method != ZipMethodStored && m_pZipLib == nullptr)
+    {
+        m_pZipLib = ZipLibrary::CreateZipLibrary(_L_);
+        if (m_pZipLib == nullptr)
+        {
+            log::Error(_L_, E_FAIL, L"FAILED to load 7zip.dll\r\n");
+            return E_FAIL;
+        }
+    }
+
+    ULONGLONG ullDataOffset = 0LL;
+    if (FAILED(hr = GetDataOffset(entry, ullDataOffset)))
+        return hr;
+    if (FAILED(hr = m_pInput->SetFilePointer(ullDataOffset, FILE_BEGIN, NULL)))
+        return hr;
+
+    return Decompress(entry, *m_pInput, output);
+}
+
+HRESULT ZipStreamReader::ExtractEntries(
+    const std::vector<size_t>& indexes,
+    const MakeOutputStream& makeOutput,
+    std::vector<HRESULT>& results,
+    DWORD dwThreads)
+{
+    HRESULT hr = E_FAIL;
+
+    results.assign(indexes.size(), E_FAIL);
+
+    if (m_pInput == nullptr)
+        return E_NOT_VALID_STATE;
+
+    m_pZipLib = ZipLibrary::CreateZipLibrary(_L_);
+    if (m_pZipLib == nullptr)
+    {
+        log::Error(_L_, E_FAIL, L"FAILED to load 7zip.dll\r\n");
+        return E_FAIL;
+    }
+
+    // Reading in archive order keeps the input sequential
+    std::vector<size_t> order(indexes.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(std::begin(order), std::end(order), [this, &indexes](size_t left, size_t right) {
+        const auto leftIndex = indexes[left] < m_Entries.size() ? m_Entries[indexes[left]].Offset : MAXULONGLONG;
+        const auto rightIndex = indexes[right] < m_Entries.size() ? m_Entries[indexes[right]].Offset : MAXULONGLONG;
+        return leftIndex < rightIndex;
+    });
+
+    dwThreads = std::max(dwThreads, 1UL);
+
+    for (size_t first = 0; first < order.size(); first += dwThreads)
+    {
+        const size_t last = std::min(first + dwThreads, order.size());
+
+        std::vector<std::shared_ptr<ByteStream>> outputs(last - first);
+        std::vector<CBinaryBuffer> compressed(last - first);
+
+        // Outputs are made and small entries read on this thread, in order
+        for (size_t i = first; i < last; i++)
+        {
+            const auto slot = order[i];
+            if (indexes[slot] >= m_Entries.size())
+            {
+                results[slot] = E_INVALIDARG;
+                continue;
+            }
+            const auto& entry = m_Entries[indexes[slot]];
+            if (entry.Encrypted)
+            {
+                results[slot] = E_ACCESSDENIED;
+                continue;
+            }
+
+            outputs[i - first] = makeOutput(entry);
+            if (outputs[i - first] == nullptr)
+            {
+                log::Error(_L_, E_FAIL, L"Failed to create output stream for %s\r\n", entry.Name.c_str());
+                continue;
+            }
+
+            results[slot] = S_OK;
+            if (entry.CompressedSize > ParallelEntryMaxSize)
+                continue;
+
+            ULONGLONG ullDataOffset = 0LL;
+            if (FAILED(results[slot] = GetDataOffset(entry, ullDataOffset)))
+                continue;
+
+            auto& buffer = compressed[i - first];
+            if (!buffer.SetCount((size_t)entry.CompressedSize))
+                results[slot] = E_OUTOFMEMORY;
+            else if (entry.CompressedSize > 0LL)
+                results[slot] = ReadAt(ullDataOffset, buffer.GetData(), entry.CompressedSize);
+        }
+
+        concurrency::parallel_for(first, last, [&](size_t i) {
+            const auto slot = order[i];
+            if (FAILED(results[slot]) || indexes[slot] >= m_Entries.size())
+                return;
+
+            const auto& entry = m_Entries[indexes[slot]];
+            if (entry.CompressedSize > ParallelEntryMaxSize)
+                return;
+
+            auto& buffer = compressed[i - first];
+            auto pInput = std::make_shared<MemoryStream>(_L_);
+            if (FAILED(results[slot] = pInput->OpenForReadOnly(buffer.GetData(), buffer.GetCount())))
+                return;
+
+            results[slot] = Decompress(entry, *pInput, *outputs[i - first]);
+            buffer.RemoveAll();
+        });
+
+        // Large entries are inflated from the archive itself
+        for (size_t i = first; i < last; i++)
+        {
+            const auto slot = order[i];
+            if (SUCCEEDED(results[slot]) && m_Entries[indexes[slot]].CompressedSize > ParallelEntryMaxSize)
+                results[slot] = Extract(indexes[slot], *outputs[i - first]);
+
+            if (outputs[i - first] != nullptr)
+                outputs[i - first]->Close();
+        }
+    }
+    return S_OK;
+}
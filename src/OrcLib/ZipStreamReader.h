@@ -0,0 +1,104 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include "BinaryBuffer.h"
+#include "CompressionPolicy.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+class ByteStream;
+class LogFileWriter;
+class ZipLibrary;
+
+//
+// ZipStreamReader uses the central directory of a zip archive as an index: Open only reads the directory, then each
+// entry is extracted by seeking to its data. Entries written by ZipStreamWriter also come with their hashes and
+// compression decision.
+//
+// ExtractEntries reads the compressed entries in archive order and inflates them on several threads.
+//
+class ORCLIB_API ZipStreamReader
+{
+public:
+    class Entry
+    {
+    public:
+        std::wstring Name;
+        WORD Method = 0;
+        bool Encrypted = false;
+        DWORD CRC = 0L;
+        ULONGLONG CompressedSize = 0LL;
+        ULONGLONG UncompressedSize = 0LL;
+        ULONGLONG Offset = 0LL;  // of the local header
+        FILETIME Modified = {0L, 0L};
+        CompressionPolicy::Decision Decision = CompressionPolicy::Decision::Default;
+        CBinaryBuffer MD5;  // empty when the archive does not have them
+        CBinaryBuffer SHA1;
+    };
+
+    using MakeOutputStream = std::function<std::shared_ptr<ByteStream>(const Entry& entry)>;
+
+    // Compressed entries up to this size are inflated in parallel from memory, larger ones from the archive
+    static constexpr ULONGLONG ParallelEntryMaxSize = 16 * 1024 * 1024;
+
+    static bool IsZip(ByteStream& input);
+
+    ZipStreamReader(logger pLog);
+
+    // pInput must be seekable
+    HRESULT Open(const std::shared_ptr<ByteStream>& pInput);
+
+    const std::vector<Entry>& Entries() const { return m_Entries; }
+
+    // Index of the entry named strName ('\' and '/' are equivalent), -1 when there is none
+    size_t Find(const std::wstring& strName) const;
+
+    // Extracts an entry and checks its CRC
+    HRESULT Extract(size_t index, ByteStream& output);
+
+    // Extracts the entries (indexes in m_Entries) to the streams made by makeOutput, results holds the status of each
+    HRESULT ExtractEntries(
+        const std::vector<size_t>& indexes,
+        const MakeOutputStream& makeOutput,
+        std::vector<HRESULT>& results,
+        DWORD dwThreads);
+
+    ~ZipStreamReader();
+
+private:
+    HRESULT ReadAt(ULONGLONG ullOffset, PVOID pBuffer, ULONGLONG cbBuffer);
+    HRESULT ReadCentralDirectory(ULONGLONG ullOffset, ULONGLONG cbDirectory, ULONGLONG ullEntries);
+
+    // Offset of the entry's data, after its local header
+    HRESULT GetDataOffset(const Entry& entry, ULONGLONG& ullDataOffset);
+
+    // Decompresses input (the entry's compressed data) into output
+    HRESULT Decompress(const Entry& entry, ByteStream& input, ByteStream& output);
+
+    logger _L_;
+    std::unique_ptr<ZipLibrary> m_pZipLib;
+    std::shared_ptr<ByteStream> m_pInput;
+
+    std::vector<Entry> m_Entries;
+    std::unordered_map<std::wstring, size_t> m_Index;
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
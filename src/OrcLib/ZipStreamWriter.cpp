@@ -0,0 +1,859 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include <7zip/7zip.h>
+
+#include "ZipStreamWriter.h"
+
+#include "7zip/ICoder.h"
+#include "7zip/IStream.h"
+
+#include "ByteStream.h"
+#include "CompressionPolicy.h"
+#include "LogFileWriter.h"
+#include "PropVariant.h"
+#include "TemporaryStream.h"
+#include "WideAnsi.h"
+#include "ZipLibrary.h"
+#include "ZipStructures.h"
+
+#include <algorithm>
+#include <array>
+
+#include <ppl.h>
+
+using namespace lib7z;
+
+using namespace Orc;
+using namespace Orc::Zip;
+
+namespace {
+
+// Reads the entry's data (its sample first) for the encoder, computing its CRC and size on the way
+class CRCInStream : public ISequentialInStream
+{
+public:
+    DWORD CRC = 0xFFFFFFFF;
+    ULONGLONG Size = 0LL;
+
+    CRCInStream(ByteStream& input, const CBinaryBuffer& sample)
+        : m_Input(input)
+        , m_Sample(sample)
+    {
+    }
+    virtual ~CRCInStream() {}
+
+    STDMETHOD(QueryInterface)(REFIID iid, void** ppvObject)
+    {
+        if (iid == __uuidof(IUnknown) || iid == IID_ISequentialInStream)
+        {
+            *ppvObject = static_cast<ISequentialInStream*>(this);
+            AddRef();
+            return S_OK;
+        }
+        return E_NOINTERFACE;
+    }
+    STDMETHOD_(ULONG, AddRef)() { return static_cast<ULONG>(InterlockedIncrement(&m_refCount)); }
+    STDMETHOD_(ULONG, Release)()
+    {
+        ULONG res = static_cast<ULONG>(InterlockedDecrement(&m_refCount));
+        if (res == 0)
+            delete this;
+        return res;
+    }
+
+    STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize)
+    {
+        HRESULT hr = S_OK;
+        ULONGLONG ullRead = 0LL;
+
+        if (m_cbSampleRead < m_Sample.GetCount())
+        {
+            ullRead = std::min<ULONGLONG>(size, m_Sample.GetCount() - m_cbSampleRead);
+            CopyMemory(data, m_Sample.GetData() + m_cbSampleRead, (size_t)ullRead);
+            m_cbSampleRead += (size_t)ullRead;
+        }
+        else
+            hr = m_Input.Read(data, size, &ullRead);
+
+        UpdateCRC(CRC, reinterpret_cast<const BYTE*>(data), (size_t)ullRead);
+        Size += ullRead;
+
+        if (processedSize != NULL)
+            *processedSize = (UInt32)ullRead;
+        return hr;
+    }
+
+private:
+    long m_refCount = 0L;
+    ByteStream& m_Input;
+    const CBinaryBuffer& m_Sample;
+    size_t m_cbSampleRead = 0;
+};
+
+// Writes the encoder's output, counting the compressed bytes
+class CountingOutStream : public ISequentialOutStream
+{
+public:
+    ULONGLONG Size = 0LL;
+
+    CountingOutStream(ByteStream& output)
+        : m_Output(output)
+    {
+    }
+    virtual ~CountingOutStream() {}
+
+    STDMETHOD(QueryInterface)(REFIID iid, void** ppvObject)
+    {
+        if (iid == __uuidof(IUnknown) || iid == IID_ISequentialOutStream)
+        {
+            *ppvObject = static_cast<ISequentialOutStream*>(this);
+            AddRef();
+            return S_OK;
+        }
+        return E_NOINTERFACE;
+    }
+    STDMETHOD_(ULONG, AddRef)() { return static_cast<ULONG>(InterlockedIncrement(&m_refCount)); }
+    STDMETHOD_(ULONG, Release)()
+    {
+        ULONG res = static_cast<ULONG>(InterlockedDecrement(&m_refCount));
+        if (res == 0)
+            delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize)
+    {
+        ULONGLONG ullWritten = 0LL;
+        HRESULT hr = m_Output.Write((const PVOID)data, size, &ullWritten);
+
+        Size += ullWritten;
+
+        if (processedSize != NULL)
+            *processedSize = (UInt32)ullWritten;
+        return hr;
+    }
+
+private:
+    long m_refCount = 0L;
+    ByteStream& m_Output;
+};
+
+}  // namespace
+
+ZipStreamWriter::ZipStreamWriter(logger pLog)
+    : _L_(std::move(pLog))
+{
+}
+
+ZipStreamWriter::~ZipStreamWriter() {}
+
+HRESULT ZipStreamWriter::Open(const std::shared_ptr<ByteStream>& pOutput, DWORD dwLevel)
+{
+    if (pOutput == nullptr)
+        return E_POINTER;
+
+    if (dwLevel != StoredLevel)
+    {
+        m_pZipLib = ZipLibrary::CreateZipLibrary(_L_);
+        if (m_pZipLib == nullptr)
+        {
+            log::Error(_L_, E_FAIL, L"FAILED to load 7zip.dll\r\n");
+            return E_FAIL;
+        }
+    }
+
+    m_ullStart = 0LL;
+    if (pOutput->CanSeek() == S_OK)
+    {
+        HRESULT hr = E_FAIL;
+        if (FAILED(hr = pOutput->SetFilePointer(0LL, FILE_CURRENT, &m_ullStart)))
+            return hr;
+    }
+
+    m_pOutput = pOutput;
+    m_dwLevel = std::min(dwLevel, 9UL);
+    m_Statistics = CompressionPolicy::Statistics();
+    m_ullOffset = 0LL;
+    m_bClosed = false;
+    m_hrFailed = S_OK;
+    m_Entries.clear();
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::WriteOutput(const void* pData, size_t cbData)
+{
+    HRESULT hr = E_FAIL;
+
+    ULONGLONG ullWritten = 0LL;
+    if (FAILED(hr = m_pOutput->Write((const PVOID)pData, cbData, &ullWritten)))
+        return hr;
+
+    m_ullOffset += ullWritten;
+    if (ullWritten != cbData)
+        return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::SetEntryHashes(size_t index, const CBinaryBuffer& md5, const CBinaryBuffer& sha1)
+{
+    if (index >= m_Entries.size())
+        return E_INVALIDARG;
+
+    auto& entry = m_Entries[index];
+    if (md5.GetCount() == entry.MD5.size())
+    {
+        std::copy(md5.GetData(), md5.GetData() + md5.GetCount(), std::begin(entry.MD5));
+        entry.HashFlags |= OrcIndexHasMD5;
+    }
+    if (sha1.GetCount() == entry.SHA1.size())
+    {
+        std::copy(sha1.GetData(), sha1.GetData() + sha1.GetCount(), std::begin(entry.SHA1));
+        entry.HashFlags |= OrcIndexHasSHA1;
+    }
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::SetPolicy(bool bEnabled)
+{
+    m_bPolicy = bEnabled;
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::SetThreads(DWORD dwThreads, const std::wstring& strTempDir)
+{
+    m_dwThreads = std::max(dwThreads, 1UL);
+    m_strTempDir = strTempDir;
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::StoreEntry(ByteStream& input, const CBinaryBuffer& sample, ByteStream& output, Entry& entry)
+{
+    HRESULT hr = E_FAIL;
+
+    // Sizes already in the local header, the data must still match them
+    const bool bMeasured = (entry.Flags & ZipDataDescriptorFlag) == 0;
+    const DWORD dwMeasuredCRC = entry.CRC;
+    const ULONGLONG ullMeasuredSize = entry.UncompressedSize;
+    entry.CompressedSize = entry.UncompressedSize = 0LL;
+
+    DWORD crc = 0xFFFFFFFF;
+    auto store = [&](const BYTE* pData, ULONGLONG cbData) -> HRESULT {
+        UpdateCRC(crc, pData, (size_t)cbData);
+
+        ULONGLONG ullWritten = 0LL;
+        if (FAILED(hr = output.Write((const PVOID)pData, cbData, &ullWritten)))
+            return hr;
+        entry.CompressedSize += ullWritten;
+        if (ullWritten != cbData)
+            return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+
+        entry.UncompressedSize += cbData;
+        return S_OK;
+    };
+
+    if (sample.GetCount() > 0 && FAILED(hr = store(sample.GetData(), sample.GetCount())))
+        return hr;
+
+    CBinaryBuffer buffer;
+    if (!buffer.SetCount(DEFAULT_READ_SIZE))
+        return E_OUTOFMEMORY;
+
+    for (;;)
+    {
+        ULONGLONG ullRead = 0LL;
+        if (FAILED(hr = input.Read(buffer.GetData(), buffer.GetCount(), &ullRead)))
+            return hr;
+        if (ullRead == 0LL)
+            break;
+
+        if (FAILED(hr = store(buffer.GetData(), ullRead)))
+            return hr;
+    }
+
+    entry.CRC = ~crc;
+    if (bMeasured && (entry.CRC != dwMeasuredCRC || entry.UncompressedSize != ullMeasuredSize))
+    {
+        log::Error(
+            _L_,
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA),
+            L"Entry %S changed while it was stored\r\n",
+            entry.Name.c_str());
+        return hr;
+    }
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::MeasureEntry(ByteStream& input, const CBinaryBuffer& sample, Entry& entry) const
+{
+    HRESULT hr = E_FAIL;
+
+    if (entry.Method != ZipMethodStored || input.CanSeek() != S_OK)
+        return S_FALSE;
+
+    ULONG64 ullStart = 0LL;
+    if (FAILED(hr = input.SetFilePointer(0LL, FILE_CURRENT, &ullStart)))
+        return hr;
+
+    DWORD crc = 0xFFFFFFFF;
+    UpdateCRC(crc, sample.GetData(), sample.GetCount());
+    ULONGLONG ullSize = sample.GetCount();
+
+    CBinaryBuffer buffer;
+    if (!buffer.SetCount(DEFAULT_READ_SIZE))
+        return E_OUTOFMEMORY;
+
+    for (;;)
+    {
+        ULONGLONG ullRead = 0LL;
+        if (FAILED(hr = input.Read(buffer.GetData(), buffer.GetCount(), &ullRead)))
+            return hr;
+        if (ullRead == 0LL)
+            break;
+
+        UpdateCRC(crc, buffer.GetData(), (size_t)ullRead);
+        ullSize += ullRead;
+    }
+
+    if (FAILED(hr = input.SetFilePointer(ullStart, FILE_BEGIN, NULL)))
+        return hr;
+
+    entry.Flags &= ~ZipDataDescriptorFlag;
+    entry.CRC = ~crc;
+    entry.CompressedSize = entry.UncompressedSize = ullSize;
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::DeflateEntry(ByteStream& input, const CBinaryBuffer& sample, ByteStream& output, Entry& entry)
+{
+    HRESULT hr = E_FAIL;
+
+    CComPtr<ICompressCoder> pEncoder;
+    if (FAILED(
+            hr = m_pZipLib->CreateObject(
+                &CLSID_DeflateEncoder, &IID_ICompressCoder, reinterpret_cast<void**>(&pEncoder))))
+    {
+        log::Error(_L_, hr, L"Failed to create deflate encoder\r\n");
+        return hr;
+    }
+
+    CComQIPtr<ICompressSetCoderProperties, &IID_ICompressSetCoderProperties> pProperties = pEncoder;
+    if (pProperties != nullptr)
+    {
+        const PROPID propID = NCoderPropID::kLevel;
+        CPropVariant value = static_cast<UInt32>(entry.Level);
+        if (FAILED(hr = pProperties->SetCoderProperties(&propID, &value, 1)))
+            log::Warning(_L_, hr, L"Failed to set deflate level %d\r\n", entry.Level);
+    }
+
+    CComPtr<CRCInStream> pIn = new CRCInStream(input, sample);
+    CComPtr<CountingOutStream> pOut = new CountingOutStream(output);
+
+    hr = pEncoder->Code(pIn, pOut, nullptr, nullptr, nullptr);
+
+    entry.CompressedSize = pOut->Size;
+    if (FAILED(hr))
+        return hr;
+
+    entry.CRC = ~pIn->CRC;
+    entry.UncompressedSize = pIn->Size;
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::CompressEntry(ByteStream& input, const CBinaryBuffer& sample, ByteStream& output, Entry& entry)
+{
+    if (entry.Method == ZipMethodStored)
+        return StoreEntry(input, sample, output, entry);
+    return DeflateEntry(input, sample, output, entry);
+}
+
+HRESULT ZipStreamWriter::SampleEntry(ByteStream& input, CBinaryBuffer& sample, Entry& entry) const
+{
+    HRESULT hr = E_FAIL;
+
+    entry.Decision = CompressionPolicy::Decision::Default;
+    entry.Level = m_dwLevel;
+
+    if (m_dwLevel != StoredLevel && m_bPolicy)
+    {
+        if (!sample.SetCount(CompressionPolicy::SampleSize))
+            return E_OUTOFMEMORY;
+
+        size_t cbSample = 0;
+        bool bComplete = false;
+        while (cbSample < sample.GetCount())
+        {
+            ULONGLONG ullRead = 0LL;
+            if (FAILED(hr = input.Read(sample.GetData() + cbSample, sample.GetCount() - cbSample, &ullRead)))
+                return hr;
+            if (ullRead == 0LL)
+            {
+                bComplete = true;
+                break;
+            }
+            cbSample += (size_t)ullRead;
+        }
+        sample.SetCount(cbSample);
+
+        entry.Decision = CompressionPolicy::Evaluate(sample.GetData(), cbSample, bComplete);
+        switch (entry.Decision)
+        {
+            case CompressionPolicy::Decision::Store:
+                entry.Level = StoredLevel;
+                break;
+            case CompressionPolicy::Decision::Fast:
+                entry.Level = std::min(m_dwLevel, CompressionPolicy::FastLevel);
+                break;
+            default:
+                break;
+        }
+    }
+
+    entry.Method = entry.Level == StoredLevel ? ZipMethodStored : ZipMethodDeflated;
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::PrepareEntry(const std::wstring& strNameInArchive, FILETIME modified, Entry& entry) const
+{
+    HRESULT hr = E_FAIL;
+
+    std::wstring strName(strNameInArchive);
+    std::replace(std::begin(strName), std::end(strName), L'\\', L'/');
+    if (FAILED(hr = WideToAnsi(_L_, strName, entry.Name)))
+        return hr;
+    if (entry.Name.size() > Zip16Max)
+        return HRESULT_FROM_WIN32(ERROR_FILENAME_EXCED_RANGE);
+
+    if (modified.dwHighDateTime == 0L && modified.dwLowDateTime == 0L)
+        GetSystemTimeAsFileTime(&modified);
+
+    FILETIME local;
+    if (!FileTimeToLocalFileTime(&modified, &local) || !FileTimeToDosDateTime(&local, &entry.DosDate, &entry.DosTime))
+    {
+        entry.DosDate = (1 << 5) | 1;  // 1980/01/01
+        entry.DosTime = 0;
+    }
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::WriteLocalHeader(Entry& entry)
+{
+    HRESULT hr = E_FAIL;
+
+    entry.Offset = m_ullOffset;
+
+    LocalFileHeader header;
+    header.Flags = entry.Flags;
+    header.Method = entry.Method;
+    header.Time = entry.DosTime;
+    header.Date = entry.DosDate;
+    header.NameLength = (WORD)entry.Name.size();
+    header.ExtraLength = sizeof(LocalZip64Extra);
+
+    LocalZip64Extra extra;
+    if ((entry.Flags & ZipDataDescriptorFlag) == 0)
+    {
+        header.CRC = entry.CRC;
+        extra.UncompressedSize = entry.UncompressedSize;
+        extra.CompressedSize = entry.CompressedSize;
+    }
+
+    if (FAILED(hr = WriteOutput(&header, sizeof(header)))
+        || FAILED(hr = WriteOutput(entry.Name.data(), entry.Name.size()))
+        || FAILED(hr = WriteOutput(&extra, sizeof(extra))))
+        return hr;
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::WriteDataDescriptor(const Entry& entry)
+{
+    if ((entry.Flags & ZipDataDescriptorFlag) == 0)
+        return S_OK;
+
+    DataDescriptor descriptor;
+    descriptor.CRC = entry.CRC;
+    descriptor.CompressedSize = entry.CompressedSize;
+    descriptor.UncompressedSize = entry.UncompressedSize;
+
+    return WriteOutput(&descriptor, sizeof(descriptor));
+}
+
+HRESULT ZipStreamWriter::RollbackEntry(const Entry& entry, HRESULT hrEntry)
+{
+    HRESULT hr = E_FAIL;
+
+    const ULONGLONG ullEntryStart = m_ullStart + entry.Offset;
+    if (m_pOutput->CanSeek() == S_OK
+        && SUCCEEDED(hr = m_pOutput->SetFilePointer((LONGLONG)ullEntryStart, FILE_BEGIN, NULL))
+        && SUCCEEDED(hr = m_pOutput->SetSize(ullEntryStart)))
+    {
+        m_ullOffset = entry.Offset;
+        return S_OK;
+    }
+
+    // The following entries cannot be appended after a partial one
+    log::Error(
+        _L_,
+        hrEntry,
+        L"Failed to drop entry %S from the zip archive, the archive is not usable\r\n",
+        entry.Name.c_str());
+    m_hrFailed = hrEntry;
+    return hrEntry;
+}
+
+HRESULT ZipStreamWriter::ReplaceEntry(const Source& source, const Entry& entry, bool bWritten)
+{
+    HRESULT hr = E_FAIL;
+
+    if (!source.Replace)
+        return S_FALSE;
+
+    // A written entry can only be dropped from an output which can seek
+    if (bWritten && m_pOutput->CanSeek() != S_OK)
+        return S_FALSE;
+
+    Source replacement;
+    if (FAILED(hr = source.Replace(entry.UncompressedSize, replacement)) || hr == S_FALSE)
+        return S_FALSE;
+
+    if (bWritten && FAILED(hr = RollbackEntry(entry, E_FAIL)))
+        return hr;
+
+    return AddEntry(replacement);
+}
+
+HRESULT ZipStreamWriter::AddEntry(
+    const std::wstring& strNameInArchive,
+    const std::shared_ptr<ByteStream>& pInput,
+    FILETIME modified)
+{
+    Source source;
+    source.NameInArchive = strNameInArchive;
+    source.Stream = pInput;
+    source.Modified = modified;
+    return AddEntry(source);
+}
+
+HRESULT ZipStreamWriter::AddEntry(const Source& source)
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_pOutput == nullptr || m_bClosed)
+        return E_NOT_VALID_STATE;
+    if (FAILED(m_hrFailed))
+        return m_hrFailed;
+    if (source.Stream == nullptr)
+        return E_POINTER;
+
+    const auto& strNameInArchive = source.NameInArchive;
+    const auto& pInput = source.Stream;
+
+    Entry entry;
+    if (FAILED(hr = PrepareEntry(strNameInArchive, source.Modified, entry)))
+        return hr;
+
+    CBinaryBuffer sample;
+    if (FAILED(hr = SampleEntry(*pInput, sample, entry)))
+    {
+        log::Error(_L_, hr, L"Failed to read %s\r\n", strNameInArchive.c_str());
+        return hr;
+    }
+
+    if (FAILED(hr = MeasureEntry(*pInput, sample, entry)))
+    {
+        log::Error(_L_, hr, L"Failed to read %s\r\n", strNameInArchive.c_str());
+        return hr;
+    }
+
+    if (FAILED(hr = WriteLocalHeader(entry)))
+    {
+        log::Error(_L_, hr, L"Failed to write zip header for %s\r\n", strNameInArchive.c_str());
+        RollbackEntry(entry, hr);
+        return hr;
+    }
+
+    hr = CompressEntry(*pInput, sample, *m_pOutput, entry);
+    m_ullOffset += entry.CompressedSize;
+    if (FAILED(hr))
+    {
+        log::Error(_L_, hr, L"Failed to compress %s\r\n", strNameInArchive.c_str());
+        RollbackEntry(entry, hr);
+        return hr;
+    }
+
+    if (FAILED(hr = WriteDataDescriptor(entry)))
+    {
+        log::Error(_L_, hr, L"Failed to write zip data descriptor for %s\r\n", strNameInArchive.c_str());
+        RollbackEntry(entry, hr);
+        return hr;
+    }
+
+    if ((hr = ReplaceEntry(source, entry, true)) != S_FALSE)
+        return hr;
+
+    m_Statistics.Add(entry.Decision, entry.UncompressedSize, entry.CompressedSize);
+    m_Entries.push_back(std::move(entry));
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::AddEntries(const std::vector<Source>& sources, std::vector<HRESULT>& results)
+{
+    HRESULT hr = E_FAIL;
+
+    results.assign(sources.size(), E_FAIL);
+
+    if (m_pOutput == nullptr || m_bClosed)
+        return E_NOT_VALID_STATE;
+    if (FAILED(m_hrFailed))
+        return m_hrFailed;
+
+    // Stored entries cost nothing but I/O: they are written straight to the output
+    if (m_dwThreads <= 1 || m_dwLevel == StoredLevel || sources.size() <= 1)
+    {
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            results[i] = AddEntry(sources[i]);
+            if (FAILED(m_hrFailed))
+                return m_hrFailed;
+        }
+        return S_OK;
+    }
+
+    // Entries are deflated by batches of m_dwThreads into temporary streams, then appended in their order. Entries the
+    // policy stores are copied from their source when appended
+    for (size_t first = 0; first < sources.size(); first += m_dwThreads)
+    {
+        const size_t last = std::min(first + m_dwThreads, sources.size());
+
+        std::vector<Entry> entries(last - first);
+        std::vector<CBinaryBuffer> samples(last - first);
+        std::vector<std::shared_ptr<TemporaryStream>> compressed(last - first);
+
+        concurrency::parallel_for(first, last, [&](size_t i) {
+            const auto& source = sources[i];
+            auto& entry = entries[i - first];
+            auto& sample = samples[i - first];
+
+            if (source.Stream == nullptr)
+            {
+                results[i] = E_POINTER;
+                return;
+            }
+
+            if (FAILED(results[i] = PrepareEntry(source.NameInArchive, source.Modified, entry)))
+                return;
+
+            if (FAILED(results[i] = SampleEntry(*source.Stream, sample, entry)))
+            {
+                log::Error(_L_, results[i], L"Failed to read %s\r\n", source.NameInArchive.c_str());
+                return;
+            }
+            if (entry.Method == ZipMethodStored)
+                return;
+
+            auto pTemp = std::make_shared<TemporaryStream>(_L_);
+            if (FAILED(results[i] = pTemp->Open(m_strTempDir, L"ZipEntry", EntryMemoryThreshold)))
+            {
+                log::Error(_L_, results[i], L"Failed to create temp stream for %s\r\n", source.NameInArchive.c_str());
+                return;
+            }
+
+            if (FAILED(results[i] = CompressEntry(*source.Stream, sample, *pTemp, entry)))
+            {
+                log::Error(_L_, results[i], L"Failed to compress %s\r\n", source.NameInArchive.c_str());
+                return;
+            }
+            compressed[i - first] = std::move(pTemp);
+        });
+
+        for (size_t i = first; i < last; i++)
+        {
+            if (FAILED(results[i]))
+                continue;
+
+            auto& entry = entries[i - first];
+            auto& pTemp = compressed[i - first];
+
+            if (pTemp == nullptr && FAILED(results[i] = MeasureEntry(*sources[i].Stream, samples[i - first], entry)))
+            {
+                log::Error(_L_, results[i], L"Failed to read %s\r\n", sources[i].NameInArchive.c_str());
+                continue;
+            }
+
+            // A deflated entry is replaced before anything of it is written
+            if (pTemp != nullptr && (hr = ReplaceEntry(sources[i], entry, false)) != S_FALSE)
+            {
+                pTemp->Close();
+                pTemp = nullptr;
+                results[i] = hr;
+                if (FAILED(m_hrFailed))
+                    return m_hrFailed;
+                continue;
+            }
+            const bool bStreamed = pTemp == nullptr;
+
+            if (FAILED(hr = WriteLocalHeader(entry)))
+            {
+                log::Error(_L_, hr, L"Failed to write zip header for %s\r\n", sources[i].NameInArchive.c_str());
+                results[i] = hr;
+                if (FAILED(RollbackEntry(entry, hr)))
+                    return hr;
+                continue;
+            }
+
+            if (pTemp == nullptr)
+            {
+                hr = CompressEntry(*sources[i].Stream, samples[i - first], *m_pOutput, entry);
+                m_ullOffset += entry.CompressedSize;
+            }
+            else
+            {
+                ULONGLONG ullCopied = 0LL;
+                if (SUCCEEDED(hr = pTemp->SetFilePointer(0LL, FILE_BEGIN, NULL)))
+                    hr = pTemp->CopyTo(*m_pOutput, &ullCopied);
+                m_ullOffset += ullCopied;
+                pTemp->Close();
+                pTemp = nullptr;
+
+                if (SUCCEEDED(hr) && ullCopied != entry.CompressedSize)
+                    hr = HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+            }
+
+            if (FAILED(hr) || FAILED(hr = WriteDataDescriptor(entry)))
+            {
+                log::Error(_L_, hr, L"Failed to write %s to the zip archive\r\n", sources[i].NameInArchive.c_str());
+                results[i] = hr;
+                if (FAILED(RollbackEntry(entry, hr)))
+                    return hr;
+                continue;
+            }
+
+            if (bStreamed && (hr = ReplaceEntry(sources[i], entry, true)) != S_FALSE)
+            {
+                results[i] = hr;
+                if (FAILED(m_hrFailed))
+                    return m_hrFailed;
+                continue;
+            }
+
+            results[i] = S_OK;
+            m_Statistics.Add(entry.Decision, entry.UncompressedSize, entry.CompressedSize);
+            m_Entries.push_back(std::move(entry));
+        }
+    }
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::WriteCentralDirectory()
+{
+    HRESULT hr = E_FAIL;
+
+    const ULONGLONG ullDirectoryOffset = m_ullOffset;
+
+    std::vector<BYTE> directory;
+    auto append = [&directory](const void* pData, size_t cbData) {
+        auto pBytes = reinterpret_cast<const BYTE*>(pData);
+        directory.insert(std::end(directory), pBytes, pBytes + cbData);
+    };
+
+    for (const auto& entry : m_Entries)
+    {
+        // The zip64 extra only holds the values that do not fit, in this order
+        std::vector<ULONGLONG> extraValues;
+
+        CentralFileHeader header;
+        header.Flags = entry.Flags;
+        header.Method = entry.Method;
+        header.Time = entry.DosTime;
+        header.Date = entry.DosDate;
+        header.CRC = entry.CRC;
+
+        header.UncompressedSize = entry.UncompressedSize >= Zip32Max ? Zip32Max : (DWORD)entry.UncompressedSize;
+        if (header.UncompressedSize == Zip32Max)
+            extraValues.push_back(entry.UncompressedSize);
+
+        header.CompressedSize = entry.CompressedSize >= Zip32Max ? Zip32Max : (DWORD)entry.CompressedSize;
+        if (header.CompressedSize == Zip32Max)
+            extraValues.push_back(entry.CompressedSize);
+
+        header.LocalHeaderOffset = entry.Offset >= Zip32Max ? Zip32Max : (DWORD)entry.Offset;
+        if (header.LocalHeaderOffset == Zip32Max)
+            extraValues.push_back(entry.Offset);
+
+        const WORD cbExtraValues = (WORD)(extraValues.size() * sizeof(ULONGLONG));
+
+        OrcIndexExtra index;
+        index.Decision = static_cast<BYTE>(entry.Decision);
+        index.Flags = entry.HashFlags;
+        std::copy(std::cbegin(entry.MD5), std::cend(entry.MD5), index.MD5);
+        std::copy(std::cbegin(entry.SHA1), std::cend(entry.SHA1), index.SHA1);
+
+        header.NameLength = (WORD)entry.Name.size();
+        header.ExtraLength = (extraValues.empty() ? 0 : 2 * sizeof(WORD) + cbExtraValues) + sizeof(OrcIndexExtra);
+
+        append(&header, sizeof(header));
+        append(entry.Name.data(), entry.Name.size());
+        if (!extraValues.empty())
+        {
+            append(&Zip64ExtraID, sizeof(WORD));
+            append(&cbExtraValues, sizeof(WORD));
+            append(extraValues.data(), cbExtraValues);
+        }
+        append(&index, sizeof(index));
+    }
+
+    const ULONGLONG ullDirectorySize = directory.size();
+    const ULONGLONG ullEntries = m_Entries.size();
+
+    EndOfCentralDirectory end;
+    end.DiskEntries = end.TotalEntries = ullEntries >= Zip16Max ? Zip16Max : (WORD)ullEntries;
+    end.CentralDirectorySize = ullDirectorySize >= Zip32Max ? Zip32Max : (DWORD)ullDirectorySize;
+    end.CentralDirectoryOffset = ullDirectoryOffset >= Zip32Max ? Zip32Max : (DWORD)ullDirectoryOffset;
+
+    if (end.TotalEntries == Zip16Max || end.CentralDirectorySize == Zip32Max
+        || end.CentralDirectoryOffset == Zip32Max)
+    {
+        Zip64EndOfCentralDirectory end64;
+        end64.DiskEntries = end64.TotalEntries = ullEntries;
+        end64.CentralDirectorySize = ullDirectorySize;
+        end64.CentralDirectoryOffset = ullDirectoryOffset;
+
+        Zip64EndOfCentralDirectoryLocator locator;
+        locator.EndOfCentralDirectoryOffset = ullDirectoryOffset + ullDirectorySize;
+
+        append(&end64, sizeof(end64));
+        append(&locator, sizeof(locator));
+    }
+    append(&end, sizeof(end));
+
+    if (FAILED(hr = WriteOutput(directory.data(), directory.size())))
+    {
+        log::Error(_L_, hr, L"Failed to write zip central directory\r\n");
+        return hr;
+    }
+    return S_OK;
+}
+
+HRESULT ZipStreamWriter::Close()
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_pOutput == nullptr || m_bClosed)
+        return S_OK;
+    if (FAILED(m_hrFailed))
+        return m_hrFailed;
+
+    if (FAILED(hr = WriteCentralDirectory()))
+        return hr;
+
+    m_bClosed = true;
+    m_Statistics.Log(_L_);
+    log::Verbose(_L_, L"Zip archive complete: %Iu entries, %I64d bytes\r\n", m_Entries.size(), m_ullOffset);
+    return S_OK;
+}
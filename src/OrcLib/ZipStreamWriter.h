@@ -0,0 +1,173 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include "CompressionPolicy.h"
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+class ByteStream;
+class LogFileWriter;
+class ZipLibrary;
+
+//
+// ZipStreamWriter writes a zip archive front to back: each entry (local header, data and data descriptor) is appended
+// to the output as it is added and the central directory is written once, on Close. Entries stored from a seekable
+// input are read ahead for their CRC: their local header carries their sizes and they have no data descriptor.
+//
+// The output is never read back and is only rewound to drop an entry which failed half way, so it can be any writable
+// stream: when it cannot seek, such a failure leaves the archive failed. Entries are deflated with the 7-zip encoder
+// (stored when the level is 0) and always carry zip64 sizes, the central directory only using zip64 records when the
+// archive needs them.
+//
+// Unless disabled with SetPolicy, the CompressionPolicy picks each entry's level from its first bytes.
+//
+// The central directory entries carry an extra field with the entry's compression decision and hashes (see
+// ZipStructures.h), which ZipStreamReader reads back as an index of the archive.
+//
+// With more than one thread, AddEntries deflates its entries concurrently into temporary streams and appends them in
+// their original order.
+//
+// A source can be replaced once it was read in full (ArchiveCreate replaces duplicates by a reference entry): an entry
+// deflated in a temporary stream is replaced before it is appended, one already written is dropped first, which needs
+// an output that can seek.
+//
+class ORCLIB_API ZipStreamWriter
+{
+public:
+    // Deflate level, from 0 (stored) to 9
+    static constexpr DWORD StoredLevel = 0L;
+
+    // Compressed data kept in memory per entry being deflated in parallel, before spilling to the temp directory
+    static constexpr DWORD EntryMemoryThreshold = 16 * 1024 * 1024;
+
+    class Source
+    {
+    public:
+        std::wstring NameInArchive;
+        std::shared_ptr<ByteStream> Stream;
+        FILETIME Modified = {0L, 0L};
+
+        // Called with the entry's size once Stream was read in full: S_OK and the source to add in its place, S_FALSE
+        // to keep the entry
+        std::function<HRESULT(ULONGLONG ullSize, Source& replacement)> Replace;
+    };
+
+    ZipStreamWriter(logger pLog);
+
+    HRESULT Open(const std::shared_ptr<ByteStream>& pOutput, DWORD dwLevel);
+
+    // Chooses each entry's level with CompressionPolicy (the default), or uses the archive's level for all
+    HRESULT SetPolicy(bool bEnabled);
+
+    // Number of entries AddEntries deflates at once, and where their compressed data is spilled
+    HRESULT SetThreads(DWORD dwThreads, const std::wstring& strTempDir = L"");
+
+    // Reads pInput to its end into a new entry. On failure, what was written of the entry is dropped
+    HRESULT
+    AddEntry(const std::wstring& strNameInArchive, const std::shared_ptr<ByteStream>& pInput, FILETIME modified);
+
+    // Adds the sources in their order, results holds the status of each one. Fails when the archive could not be
+    // written, a source that cannot be read is only skipped
+    HRESULT AddEntries(const std::vector<Source>& sources, std::vector<HRESULT>& results);
+
+    // Writes the central directory, the output stream is left open
+    HRESULT Close();
+
+    size_t GetEntryCount() const { return m_Entries.size(); }
+    ULONGLONG GetArchiveSize() const { return m_ullOffset; }
+
+    CompressionPolicy::Decision GetEntryDecision(size_t index) const { return m_Entries[index].Decision; }
+    ULONGLONG GetEntrySize(size_t index) const { return m_Entries[index].UncompressedSize; }
+    ULONGLONG GetEntryCompressedSize(size_t index) const { return m_Entries[index].CompressedSize; }
+
+    // Hashes of an added entry, written in the central directory
+    HRESULT SetEntryHashes(size_t index, const CBinaryBuffer& md5, const CBinaryBuffer& sha1);
+    const CompressionPolicy::Statistics& GetStatistics() const { return m_Statistics; }
+
+    ~ZipStreamWriter();
+
+private:
+    class Entry
+    {
+    public:
+        std::string Name;
+        WORD Flags = ZipFlags;
+        WORD Method = 0;
+        DWORD Level = 0L;
+        CompressionPolicy::Decision Decision = CompressionPolicy::Decision::Default;
+        WORD DosTime = 0;
+        WORD DosDate = 0;
+        DWORD CRC = 0L;
+        ULONGLONG CompressedSize = 0LL;
+        ULONGLONG UncompressedSize = 0LL;
+        ULONGLONG Offset = 0LL;
+        BYTE HashFlags = 0;
+        std::array<BYTE, 16> MD5 = {};
+        std::array<BYTE, 20> SHA1 = {};
+    };
+
+    HRESULT WriteOutput(const void* pData, size_t cbData);
+
+    HRESULT AddEntry(const Source& source);
+
+    // S_FALSE when the source is not replaced, otherwise the result of adding its replacement. bWritten tells the entry
+    // was written and must first be dropped
+    HRESULT ReplaceEntry(const Source& source, const Entry& entry, bool bWritten);
+
+    HRESULT PrepareEntry(const std::wstring& strNameInArchive, FILETIME modified, Entry& entry) const;
+
+    // Reads the entry's first bytes into sample and chooses its method and level
+    HRESULT SampleEntry(ByteStream& input, CBinaryBuffer& sample, Entry& entry) const;
+
+    // Compresses sample then the rest of input into output, filling entry's CRC and sizes
+    HRESULT CompressEntry(ByteStream& input, const CBinaryBuffer& sample, ByteStream& output, Entry& entry);
+    HRESULT StoreEntry(ByteStream& input, const CBinaryBuffer& sample, ByteStream& output, Entry& entry);
+    HRESULT DeflateEntry(ByteStream& input, const CBinaryBuffer& sample, ByteStream& output, Entry& entry);
+
+    // Reads a stored entry's remaining input ahead for its CRC and size then rewinds it, S_FALSE when it cannot seek
+    HRESULT MeasureEntry(ByteStream& input, const CBinaryBuffer& sample, Entry& entry) const;
+
+    HRESULT WriteLocalHeader(Entry& entry);
+    // Only written for the entries whose local header could not carry the sizes
+    HRESULT WriteDataDescriptor(const Entry& entry);
+
+    // Truncates the output back to the entry's local header, the archive fails when the output cannot seek
+    HRESULT RollbackEntry(const Entry& entry, HRESULT hrEntry);
+
+    HRESULT WriteCentralDirectory();
+
+    logger _L_;
+    std::unique_ptr<ZipLibrary> m_pZipLib;
+    std::shared_ptr<ByteStream> m_pOutput;
+    DWORD m_dwLevel = 5L;
+    DWORD m_dwThreads = 1L;
+    bool m_bPolicy = true;
+    std::wstring m_strTempDir;
+    ULONGLONG m_ullStart = 0LL;  // output position of the archive, when it can seek
+    ULONGLONG m_ullOffset = 0LL;
+    bool m_bClosed = false;
+    HRESULT m_hrFailed = S_OK;
+
+    std::vector<Entry> m_Entries;
+    CompressionPolicy::Statistics m_Statistics;
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
@@ -0,0 +1,175 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include <array>
+
+#pragma managed(push, off)
+
+namespace Orc::Zip {
+
+// 7-zip coders are created from {23170F69-40C1-279x-<method id>}, 2790 for decoders, 2791 for encoders and 040108
+// being Deflate
+const GUID CLSID_DeflateDecoder = {0x23170F69, 0x40C1, 0x2790, {0x08, 0x01, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00}};
+const GUID CLSID_DeflateEncoder = {0x23170F69, 0x40C1, 0x2791, {0x08, 0x01, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00}};
+
+constexpr WORD ZipVersion = 45;  // zip64
+constexpr WORD ZipDataDescriptorFlag = 0x0008;
+constexpr WORD ZipFlags = ZipDataDescriptorFlag | 0x0800;  // data descriptor, UTF-8 names
+constexpr WORD ZipMethodStored = 0;
+constexpr WORD ZipMethodDeflated = 8;
+constexpr WORD Zip64ExtraID = 0x0001;
+constexpr WORD OrcIndexExtraID = 0x4F52;  // "RO"
+constexpr BYTE OrcIndexHasMD5 = 0x01;
+constexpr BYTE OrcIndexHasSHA1 = 0x02;
+constexpr DWORD Zip32Max = 0xFFFFFFFF;
+constexpr WORD Zip16Max = 0xFFFF;
+
+constexpr DWORD LocalFileHeaderSignature = 0x04034b50;
+constexpr DWORD CentralFileHeaderSignature = 0x02014b50;
+constexpr DWORD Zip64EndOfCentralDirectorySignature = 0x06064b50;
+constexpr DWORD Zip64LocatorSignature = 0x07064b50;
+constexpr DWORD EndOfCentralDirectorySignature = 0x06054b50;
+
+#pragma pack(push, 1)
+struct LocalFileHeader
+{
+    DWORD Signature = LocalFileHeaderSignature;
+    WORD VersionNeeded = ZipVersion;
+    WORD Flags = ZipFlags;
+    WORD Method;
+    WORD Time;
+    WORD Date;
+    DWORD CRC = 0L;
+    DWORD CompressedSize = Zip32Max;
+    DWORD UncompressedSize = Zip32Max;
+    WORD NameLength;
+    WORD ExtraLength;
+};
+
+// Sizes are only known once the data is written unless the entry is stored from a seekable input: otherwise they go in
+// the data descriptor
+struct LocalZip64Extra
+{
+    WORD HeaderID = Zip64ExtraID;
+    WORD Size = 2 * sizeof(ULONGLONG);
+    ULONGLONG UncompressedSize = 0LL;
+    ULONGLONG CompressedSize = 0LL;
+};
+
+struct DataDescriptor
+{
+    DWORD Signature = 0x08074b50;
+    DWORD CRC;
+    ULONGLONG CompressedSize;
+    ULONGLONG UncompressedSize;
+};
+
+struct CentralFileHeader
+{
+    DWORD Signature = CentralFileHeaderSignature;
+    WORD VersionMadeBy = ZipVersion;
+    WORD VersionNeeded = ZipVersion;
+    WORD Flags = ZipFlags;
+    WORD Method;
+    WORD Time;
+    WORD Date;
+    DWORD CRC;
+    DWORD CompressedSize;
+    DWORD UncompressedSize;
+    WORD NameLength;
+    WORD ExtraLength;
+    WORD CommentLength = 0;
+    WORD DiskStart = 0;
+    WORD InternalAttributes = 0;
+    DWORD ExternalAttributes = FILE_ATTRIBUTE_NORMAL;
+    DWORD LocalHeaderOffset;
+};
+
+struct Zip64EndOfCentralDirectory
+{
+    DWORD Signature = Zip64EndOfCentralDirectorySignature;
+    ULONGLONG RecordSize = sizeof(Zip64EndOfCentralDirectory) - sizeof(DWORD) - sizeof(ULONGLONG);
+    WORD VersionMadeBy = ZipVersion;
+    WORD VersionNeeded = ZipVersion;
+    DWORD Disk = 0L;
+    DWORD CentralDirectoryDisk = 0L;
+    ULONGLONG DiskEntries;
+    ULONGLONG TotalEntries;
+    ULONGLONG CentralDirectorySize;
+    ULONGLONG CentralDirectoryOffset;
+};
+
+struct Zip64EndOfCentralDirectoryLocator
+{
+    DWORD Signature = Zip64LocatorSignature;
+    DWORD Disk = 0L;
+    ULONGLONG EndOfCentralDirectoryOffset;
+    DWORD TotalDisks = 1L;
+};
+
+struct EndOfCentralDirectory
+{
+    DWORD Signature = EndOfCentralDirectorySignature;
+    WORD Disk = 0;
+    WORD CentralDirectoryDisk = 0;
+    WORD DiskEntries;
+    WORD TotalEntries;
+    DWORD CentralDirectorySize;
+    DWORD CentralDirectoryOffset;
+    WORD CommentLength = 0;
+};
+
+// Extra field of the central directory entries written by ZipStreamWriter: the entry's hashes and compression, so
+// that the central directory can serve as an index of the collected artefacts
+struct OrcIndexExtra
+{
+    WORD HeaderID = OrcIndexExtraID;
+    WORD Size = sizeof(OrcIndexExtra) - 2 * sizeof(WORD);
+    BYTE Version = 1;
+    BYTE Decision = 0;
+    BYTE Flags = 0;
+    BYTE MD5[16] = {};
+    BYTE SHA1[20] = {};
+};
+#pragma pack(pop)
+
+static_assert(sizeof(LocalFileHeader) == 30, "Zip local file header is 30 bytes long");
+static_assert(sizeof(CentralFileHeader) == 46, "Zip central file header is 46 bytes long");
+static_assert(sizeof(Zip64EndOfCentralDirectory) == 56, "Zip64 end of central directory is 56 bytes long");
+static_assert(sizeof(Zip64EndOfCentralDirectoryLocator) == 20, "Zip64 locator is 20 bytes long");
+static_assert(sizeof(EndOfCentralDirectory) == 22, "Zip end of central directory is 22 bytes long");
+static_assert(sizeof(OrcIndexExtra) == 43, "Orc index extra field is 43 bytes long");
+
+inline const std::array<DWORD, 256>& CRCTable()
+{
+    static const std::array<DWORD, 256> table = []() {
+        std::array<DWORD, 256> retval;
+        for (DWORD i = 0; i < 256; i++)
+        {
+            DWORD crc = i;
+            for (int j = 0; j < 8; j++)
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+            retval[i] = crc;
+        }
+        return retval;
+    }();
+    return table;
+}
+
+// crc is the running value, initialized with 0xFFFFFFFF and inverted at the end
+inline void UpdateCRC(DWORD& crc, const BYTE* pData, size_t cbData)
+{
+    const auto& table = CRCTable();
+    for (size_t i = 0; i < cbData; i++)
+        crc = table[(crc ^ pData[i]) & 0xFF] ^ (crc >> 8);
+}
+
+}  // namespace Orc::Zip
+
+#pragma managed(pop)
@@ -0,0 +1,450 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+
+#include "stdafx.h"
+
+#include "ZstdCreate.h"
+
+#include <algorithm>
+
+#include <zstd.h>
+
+#include "FileStream.h"
+#include "CryptoHashStream.h"
+#include "LogFileWriter.h"
+#include "WideAnsi.h"
+
+#include "CaseInsensitive.h"
+
+using namespace std;
+
+using namespace Orc;
+using namespace Orc::Zstd;
+
+ZstdCreate::ZstdCreate(logger pLog, bool bComputeHash, DWORD XORPattern)
+    : ArchiveCreate(std::move(pLog), bComputeHash, XORPattern)
+{
+}
+
+int ZstdCreate::GetCompressionLevel(const std::wstring& strLevel)
+{
+    if (equalCaseInsensitive(strLevel, L"None"))
+        return std::max(ZSTD_minCLevel(), -5);  // fast levels, still compressing a bit
+    if (equalCaseInsensitive(strLevel, L"Fastest"))
+        return 1;
+    if (equalCaseInsensitive(strLevel, L"Fast"))
+        return 3;
+    if (equalCaseInsensitive(strLevel, L"Normal"))
+        return 6;
+    if (equalCaseInsensitive(strLevel, L"Maximum"))
+        return 12;
+    if (equalCaseInsensitive(strLevel, L"Ultra"))
+        return 19;
+
+    if (!strLevel.empty() && std::all_of(std::cbegin(strLevel), std::cend(strLevel), iswdigit))
+        return std::min(_wtoi(strLevel.c_str()), ZSTD_maxCLevel());
+
+    log::Warning(
+        _L_,
+        E_INVALIDARG,
+        L"Selecting default compression level (unrecognised parameter was %s)\r\n",
+        strLevel.c_str());
+    return DefaultLevel;
+}
+
+STDMETHODIMP ZstdCreate::InitArchive(PCWSTR pwzArchivePath, Archive::ArchiveCallback pCallback)
+{
+    HRESULT hr = E_FAIL;
+
+    auto filestream = make_shared<FileStream>(_L_);
+
+    m_ArchiveName = pwzArchivePath;
+    if (FAILED(
+            hr = filestream->OpenFile(pwzArchivePath, GENERIC_WRITE | GENERIC_READ, 0L, NULL, CREATE_ALWAYS, 0L, NULL)))
+    {
+        log::Error(_L_, hr, L"Failed to open %s for writing\r\n", pwzArchivePath);
+        return hr;
+    }
+
+    return InitArchive(filestream, pCallback);
+}
+
+STDMETHODIMP
+ZstdCreate::InitArchive(__in const std::shared_ptr<ByteStream>& pOutputStream, Archive::ArchiveCallback pCallback)
+{
+    if (pOutputStream == nullptr)
+        return E_POINTER;
+
+    m_ArchiveStream = pOutputStream;
+    m_Callback = pCallback;
+    m_ullOffset = 0LL;
+    m_Index.clear();
+    m_ullIndexEntries = 0LL;
+    return S_OK;
+}
+
+HRESULT ZstdCreate::SetCompressionLevel(__in const std::wstring& strLevel)
+{
+    // "<level>[,threads=<count>]"
+    const auto strCompression =
+        ParseCompressionLevel(strLevel, [this](const std::wstring& strOption, const std::wstring& strValue) {
+            if (!equalCaseInsensitive(strOption, L"threads"))
+                return false;
+            m_dwThreads = static_cast<DWORD>(_wtoi(strValue.c_str()));
+            return true;
+        });
+
+    m_Level = GetCompressionLevel(strCompression);
+    return S_OK;
+}
+
+HRESULT ZstdCreate::InitContext()
+{
+    if (m_pContext != nullptr)
+        return S_OK;
+
+    m_pContext = ZSTD_createCCtx();
+    if (m_pContext == nullptr)
+        return E_OUTOFMEMORY;
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    const DWORD dwThreads = m_dwThreads == 0L ? si.dwNumberOfProcessors : m_dwThreads;
+
+    size_t result = ZSTD_CCtx_setParameter(m_pContext, ZSTD_c_compressionLevel, m_Level);
+    if (!ZSTD_isError(result))
+        result = ZSTD_CCtx_setParameter(m_pContext, ZSTD_c_checksumFlag, 1);
+    if (ZSTD_isError(result))
+    {
+        log::Error(_L_, E_INVALIDARG, L"Failed to set zstd parameters: %S\r\n", ZSTD_getErrorName(result));
+        return E_INVALIDARG;
+    }
+
+    // Fails when zstd is built without multithreading: the entries are then compressed on this thread
+    result = ZSTD_CCtx_setParameter(m_pContext, ZSTD_c_nbWorkers, dwThreads > 1 ? static_cast<int>(dwThreads) : 0);
+    if (ZSTD_isError(result))
+        log::Verbose(_L_, L"zstd compression runs on a single thread: %S\r\n", ZSTD_getErrorName(result));
+
+    m_InBuffer.resize(ZSTD_CStreamInSize());
+    m_OutBuffer.resize(ZSTD_CStreamOutSize());
+    return S_OK;
+}
+
+HRESULT ZstdCreate::WriteOutput(const BYTE* pData, size_t cbData)
+{
+    HRESULT hr = E_FAIL;
+
+    ULONGLONG ullWritten = 0LL;
+    if (FAILED(hr = m_ArchiveStream->Write((const PVOID)pData, cbData, &ullWritten)))
+        return hr;
+    if (ullWritten != cbData)
+        return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+
+    m_ullOffset += ullWritten;
+    return S_OK;
+}
+
+HRESULT ZstdCreate::RollbackItem(const ArchiveItem& item, const IndexEntry& entry)
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_ullOffset == entry.Offset)
+        return S_OK;
+
+    // The index is what is read back: without seeking, an unlisted partial frame is left behind
+    if (m_ArchiveStream->CanSeek() != S_OK)
+    {
+        log::Warning(
+            _L_,
+            S_OK,
+            L"Partial frame of %s is left unlisted in %s\r\n",
+            item.NameInArchive.c_str(),
+            m_ArchiveName.c_str());
+        return S_FALSE;
+    }
+
+    if (FAILED(hr = m_ArchiveStream->SetFilePointer((LONGLONG)entry.Offset, FILE_BEGIN, NULL))
+        || FAILED(hr = m_ArchiveStream->SetSize(entry.Offset)))
+    {
+        log::Error(_L_, hr, L"Failed to drop partial frame of %s\r\n", item.NameInArchive.c_str());
+        return hr;
+    }
+
+    m_ullOffset = entry.Offset;
+    return S_OK;
+}
+
+HRESULT ZstdCreate::CompressItem(ArchiveItem& item, IndexEntry& entry)
+{
+    HRESULT hr = E_FAIL;
+
+    entry.Offset = m_ullOffset;
+    entry.Modified = item.modifiedTime;
+
+    size_t result = ZSTD_CCtx_reset(m_pContext, ZSTD_reset_session_only);
+    if (ZSTD_isError(result))
+        return E_FAIL;
+
+    for (;;)
+    {
+        ULONGLONG ullRead = 0LL;
+        if (FAILED(hr = item.Stream->Read(m_InBuffer.data(), m_InBuffer.size(), &ullRead)))
+        {
+            log::Error(_L_, hr, L"Failed to read %s\r\n", item.NameInArchive.c_str());
+            return hr;
+        }
+        entry.UncompressedSize += ullRead;
+
+        // The frame is ended when the input is exhausted
+        const auto mode = ullRead == 0LL ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input = {m_InBuffer.data(), static_cast<size_t>(ullRead), 0};
+
+        bool bDone = false;
+        do
+        {
+            ZSTD_outBuffer output = {m_OutBuffer.data(), m_OutBuffer.size(), 0};
+
+            const size_t remaining = ZSTD_compressStream2(m_pContext, &output, &input, mode);
+            if (ZSTD_isError(remaining))
+            {
+                log::Error(
+                    _L_,
+                    E_FAIL,
+                    L"Failed to compress %s: %S\r\n",
+                    item.NameInArchive.c_str(),
+                    ZSTD_getErrorName(remaining));
+                return E_FAIL;
+            }
+
+            if (FAILED(hr = WriteOutput(m_OutBuffer.data(), output.pos)))
+            {
+                log::Error(_L_, hr, L"Failed to write %s to archive\r\n", item.NameInArchive.c_str());
+                return hr;
+            }
+            entry.CompressedSize += output.pos;
+
+            bDone = mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size;
+        } while (!bDone);
+
+        if (mode == ZSTD_e_end)
+            break;
+    }
+    return S_OK;
+}
+
+STDMETHODIMP ZstdCreate::FlushQueue()
+{
+    HRESULT hr = E_FAIL;
+
+    if (m_ArchiveStream == nullptr)
+        return E_NOT_VALID_STATE;
+
+    if (FAILED(hr = InitContext()))
+    {
+        log::Error(_L_, hr, L"Failed to initialize zstd compression\r\n");
+        return hr;
+    }
+
+    ArchiveItems queue;
+    {
+        concurrency::critical_section::scoped_lock sl(m_cs);
+        std::swap(queue, m_Queue);
+    }
+
+    // Failed items are not archived, their streams are closed
+    const auto closeItem = [](ArchiveItem& item) {
+        if (item.Stream != nullptr)
+        {
+            item.Stream->Close();
+            item.Stream = nullptr;
+        }
+    };
+
+    HRESULT hrResult = m_hrFailed;
+
+    // A failed item's partial frame is dropped when the archive can seek, the next item is written in its place. Once a
+    // partial frame cannot be dropped, the archive is not written any further
+    const auto failItem = [&](ArchiveItem& item, const IndexEntry& entry, HRESULT hrItem) {
+        log::Error(_L_, hrItem, L"Failed to archive %s\r\n", item.NameInArchive.c_str());
+        hrResult = hrItem;
+
+        const auto hrRollback = RollbackItem(item, entry);
+        if (FAILED(hrRollback))
+            hrResult = m_hrFailed = hrRollback;
+        closeItem(item);
+    };
+
+    for (auto& item : queue)
+    {
+        if (FAILED(m_hrFailed))
+        {
+            log::Error(_L_, m_hrFailed, L"Failed to archive %s\r\n", item.NameInArchive.c_str());
+            closeItem(item);
+            continue;
+        }
+
+        item.currentStatus = Archive::ArchiveItem::Status::Processing;
+
+        std::string strName;
+        if (FAILED(hr = WideToAnsi(_L_, item.NameInArchive, strName)) || strName.size() > MAXWORD)
+        {
+            log::Error(_L_, hr, L"Invalid name in archive %s\r\n", item.NameInArchive.c_str());
+            hrResult = FAILED(hr) ? hr : E_INVALIDARG;
+            closeItem(item);
+            continue;
+        }
+
+        IndexEntry entry;
+        if (FAILED(hr = CompressItem(item, entry)))
+        {
+            failItem(item, entry, hr);
+            continue;
+        }
+
+        // A duplicate is only known once compressed: its frame is replaced by its reference entry
+        Duplicate duplicate;
+        if (m_ArchiveStream->CanSeek() == S_OK && FindDuplicate(item, entry.UncompressedSize, duplicate) == S_OK)
+        {
+            if (SUCCEEDED(hr = RollbackItem(item, entry)))
+            {
+                closeItem(item);
+                entry = IndexEntry();
+                entry.Offset = m_ullOffset;
+
+                if (SUCCEEDED(hr = MakeReference(item, std::move(duplicate)))
+                    && SUCCEEDED(hr = WideToAnsi(_L_, item.NameInArchive, strName)))
+                    hr = strName.size() > MAXWORD ? E_INVALIDARG : CompressItem(item, entry);
+            }
+            if (FAILED(hr))
+            {
+                failItem(item, entry, hr);
+                continue;
+            }
+        }
+        log::Verbose(_L_, L"INFO: Archive of %s succeed\r\n", item.NameInArchive.c_str());
+
+        auto hashstream = std::dynamic_pointer_cast<CryptoHashStream>(ByteStream::GetHashStream(item.Stream));
+        if (hashstream)
+        {
+            hashstream->GetMD5(item.MD5);
+            hashstream->GetSHA1(item.SHA1);
+        }
+        hashstream = nullptr;
+
+        if (item.MD5.GetCount() == sizeof(entry.MD5))
+        {
+            entry.Flags |= IndexHasMD5;
+            memcpy(entry.MD5, item.MD5.GetData(), sizeof(entry.MD5));
+        }
+        if (item.SHA1.GetCount() == sizeof(entry.SHA1))
+        {
+            entry.Flags |= IndexHasSHA1;
+            memcpy(entry.SHA1, item.SHA1.GetData(), sizeof(entry.SHA1));
+        }
+        entry.NameLength = static_cast<WORD>(strName.size());
+
+        const auto pEntry = reinterpret_cast<const BYTE*>(&entry);
+        m_Index.insert(m_Index.end(), pEntry, pEntry + sizeof(entry));
+        m_Index.insert(m_Index.end(), strName.begin(), strName.end());
+
+        item.Index = static_cast<DWORD>(m_ullIndexEntries++);
+        item.Size = entry.UncompressedSize;
+        item.CompressedSize = entry.CompressedSize;
+        item.currentStatus = Archive::ArchiveItem::Status::Done;
+
+        // CLOSE
+        item.Stream = nullptr;
+
+        {
+            concurrency::critical_section::scoped_lock sl(m_cs);
+            m_Indexes[item.Index] = m_Items.size();
+            m_Items.push_back(std::move(item));
+        }
+
+        if (m_Callback)
+            m_Callback(m_Items.back());
+    }
+    return hrResult;
+}
+
+HRESULT ZstdCreate::WriteIndex()
+{
+    HRESULT hr = E_FAIL;
+
+    IndexFooter footer;
+    footer.EntryCount = m_ullIndexEntries;
+    footer.IndexSize = static_cast<DWORD>(m_Index.size() + sizeof(footer));
+
+    SkippableFrameHeader header;
+    header.Size = footer.IndexSize;
+
+    if (FAILED(hr = WriteOutput(reinterpret_cast<const BYTE*>(&header), sizeof(header))))
+        return hr;
+    if (FAILED(hr = WriteOutput(m_Index.data(), m_Index.size())))
+        return hr;
+    if (FAILED(hr = WriteOutput(reinterpret_cast<const BYTE*>(&footer), sizeof(footer))))
+        return hr;
+
+    m_Index.clear();
+    return S_OK;
+}
+
+STDMETHODIMP ZstdCreate::Complete()
+{
+    HRESULT hr = E_FAIL;
+
+    if (FAILED(hr = FlushQueue()))
+        log::Error(_L_, hr, L"Failed to archive some items to %s\r\n", m_ArchiveName.c_str());
+
+    // Duplicates are found as the queue is archived, the manifest lists them once it is
+    if (FAILED(hr = AddDeduplicationManifest()))
+        log::Error(_L_, hr, L"Failed to add deduplication manifest\r\n");
+    else if (FAILED(hr = FlushQueue()))
+        log::Error(_L_, hr, L"Failed to archive deduplication manifest to %s\r\n", m_ArchiveName.c_str());
+
+    if (FAILED(m_hrFailed))
+    {
+        m_ArchiveStream->Close();
+        return m_hrFailed;
+    }
+
+    if (FAILED(hr = WriteIndex()))
+    {
+        log::Error(_L_, hr, L"Failed to write index of %s\r\n", m_ArchiveName.c_str());
+        return hr;
+    }
+
+    std::for_each(begin(m_Items), end(m_Items), [](ArchiveItem& item) {
+        // Now that the archive is complete, get back to items and close associated streams
+        if (item.Stream != nullptr)
+        {
+            item.Stream->Close();
+            item.Stream = nullptr;
+        }
+    });
+
+    m_ArchiveStream->Close();
+
+    if (m_pContext != nullptr)
+    {
+        ZSTD_freeCCtx(m_pContext);
+        m_pContext = nullptr;
+    }
+    return S_OK;
+}
+
+STDMETHODIMP ZstdCreate::Abort()
+{
+    return S_OK;
+}
+
+ZstdCreate::~ZstdCreate(void)
+{
+    if (m_pContext != nullptr)
+        ZSTD_freeCCtx(m_pContext);
+}
@@ -0,0 +1,79 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+
+#pragma once
+
+#include "OrcLib.h"
+
+#include "ArchiveCreate.h"
+#include "ZstdStructures.h"
+
+#pragma managed(push, off)
+
+struct ZSTD_CCtx_s;
+
+namespace Orc {
+
+//
+// ZstdCreate writes each entry as a zstd frame, compressed by zstd's own worker threads, and the index of the
+// entries when the archive is complete (see ZstdStructures.h). Entries are appended when the queue is flushed.
+//
+class ORCLIB_API ZstdCreate : public ArchiveCreate
+{
+    friend class ArchiveCreate;
+    friend class std::_Ref_count_obj<ZstdCreate>;
+
+public:
+    static constexpr int DefaultLevel = 3;
+
+    // "None", "Fastest", ... "Ultra" or a zstd level
+    int GetCompressionLevel(const std::wstring& strLevel);
+
+    // ArchiveCompress methods
+    STDMETHOD(InitArchive)(__in PCWSTR pwzArchivePath, Archive::ArchiveCallback pCallback = nullptr);
+    STDMETHOD(InitArchive)
+    (__in const std::shared_ptr<ByteStream>& pOutputStream, Archive::ArchiveCallback pCallback = nullptr);
+
+    STDMETHOD(SetCompressionLevel)(__in const std::wstring& strLevel);
+
+    STDMETHOD(FlushQueue)();
+    STDMETHOD(Complete)();
+    STDMETHOD(Abort)();
+    // end of ArchiveCompress methods
+
+    ~ZstdCreate(void);
+
+private:
+    std::shared_ptr<ByteStream> m_ArchiveStream;
+    std::wstring m_ArchiveName;
+    ULONGLONG m_ullOffset = 0LL;
+    HRESULT m_hrFailed = S_OK;  // a partial frame could not be dropped: nothing more is written
+
+    int m_Level = DefaultLevel;
+    DWORD m_dwThreads = 0L;  // 0: one per processor
+
+    ZSTD_CCtx_s* m_pContext = nullptr;
+    std::vector<BYTE> m_InBuffer;
+    std::vector<BYTE> m_OutBuffer;
+
+    // The index, names included, is written by Complete
+    std::vector<BYTE> m_Index;
+    ULONGLONG m_ullIndexEntries = 0LL;
+
+    ZstdCreate(logger pLog, bool bComputeHash = false, DWORD XORPattern = 0x00000000);
+
+    HRESULT InitContext();
+    HRESULT WriteOutput(const BYTE* pData, size_t cbData);
+    HRESULT RollbackItem(const ArchiveItem& item, const Zstd::IndexEntry& entry);
+    HRESULT CompressItem(ArchiveItem& item, Zstd::IndexEntry& entry);
+    HRESULT WriteIndex();
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
@@ -0,0 +1,266 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+
+#include "stdafx.h"
+
+#include "ZstdExtract.h"
+
+#include <zstd.h>
+
+#include "ArchiveExtractCallback.h"
+#include "CryptoHashStream.h"
+#include "LogFileWriter.h"
+#include "WideAnsi.h"
+#include "ZstdStructures.h"
+
+#include <algorithm>
+
+using namespace std;
+
+using namespace Orc;
+using namespace Orc::Zstd;
+
+ZstdExtract::ZstdExtract(logger pLog, bool bComputeHash)
+    : ArchiveExtract(std::move(pLog), bComputeHash)
+{
+}
+
+ZstdExtract::~ZstdExtract(void) {}
+
+bool ZstdExtract::IsZstd(ByteStream& input)
+{
+    if (input.CanSeek() != S_OK)
+        return false;
+
+    ULONGLONG ullPosition = 0LL;
+    if (FAILED(input.SetFilePointer(0LL, FILE_CURRENT, &ullPosition)))
+        return false;
+
+    DWORD dwMagic = 0L;
+    ULONGLONG ullRead = 0LL;
+    const bool bZstd = SUCCEEDED(input.SetFilePointer(0LL, FILE_BEGIN, NULL))
+        && SUCCEEDED(input.Read(&dwMagic, sizeof(dwMagic), &ullRead)) && ullRead == sizeof(dwMagic)
+        && (dwMagic == FrameMagic || dwMagic == IndexFrameMagic);
+
+    input.SetFilePointer(ullPosition, FILE_BEGIN, NULL);
+    return bZstd;
+}
+
+HRESULT ZstdExtract::ReadIndex(const logger& pLog, ByteStream& input, std::vector<Entry>& entries)
+{
+    HRESULT hr = E_FAIL;
+
+    entries.clear();
+
+    const ULONGLONG ullSize = input.GetSize();
+    if (ullSize < sizeof(SkippableFrameHeader) + sizeof(IndexFooter))
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    IndexFooter footer;
+    ULONGLONG ullRead = 0LL;
+    if (FAILED(hr = input.SetFilePointer(ullSize - sizeof(footer), FILE_BEGIN, NULL))
+        || FAILED(hr = input.Read(&footer, sizeof(footer), &ullRead)))
+        return hr;
+
+    if (ullRead != sizeof(footer) || footer.Magic != IndexFooterMagic || footer.IndexSize < sizeof(footer)
+        || footer.IndexSize > ullSize - sizeof(SkippableFrameHeader))
+    {
+        log::Error(pLog, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"zstd archive index not found\r\n");
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    if (footer.Version > IndexVersion)
+    {
+        log::Error(pLog, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Unsupported zstd archive index version\r\n");
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    const ULONGLONG ullFrameOffset = ullSize - footer.IndexSize - sizeof(SkippableFrameHeader);
+
+    std::vector<BYTE> index(sizeof(SkippableFrameHeader) + footer.IndexSize - sizeof(footer));
+    if (FAILED(hr = input.SetFilePointer(ullFrameOffset, FILE_BEGIN, NULL))
+        || FAILED(hr = input.Read(index.data(), index.size(), &ullRead)))
+        return hr;
+
+    const auto& header = *reinterpret_cast<const SkippableFrameHeader*>(index.data());
+    if (ullRead != index.size() || header.Magic != IndexFrameMagic || header.Size != footer.IndexSize)
+    {
+        log::Error(pLog, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Invalid zstd archive index frame\r\n");
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    entries.reserve(static_cast<size_t>(std::min<ULONGLONG>(footer.EntryCount, index.size() / sizeof(IndexEntry))));
+
+    size_t position = sizeof(SkippableFrameHeader);
+    while (position + sizeof(IndexEntry) <= index.size())
+    {
+        const auto& indexEntry = *reinterpret_cast<const IndexEntry*>(index.data() + position);
+        position += sizeof(IndexEntry);
+
+        if (position + indexEntry.NameLength > index.size()
+            || indexEntry.Offset + indexEntry.CompressedSize > ullFrameOffset)
+            return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+        Entry entry;
+        entry.Offset = indexEntry.Offset;
+        entry.CompressedSize = indexEntry.CompressedSize;
+        entry.UncompressedSize = indexEntry.UncompressedSize;
+        entry.Modified = indexEntry.Modified;
+        if (indexEntry.Flags & IndexHasMD5)
+            entry.MD5.SetData(const_cast<LPBYTE>(indexEntry.MD5), sizeof(indexEntry.MD5));
+        if (indexEntry.Flags & IndexHasSHA1)
+            entry.SHA1.SetData(const_cast<LPBYTE>(indexEntry.SHA1), sizeof(indexEntry.SHA1));
+
+        const auto pName = reinterpret_cast<const CHAR*>(index.data() + position);
+        if (FAILED(hr = AnsiToWide(pLog, std::string_view(pName, indexEntry.NameLength), entry.Name)))
+            return hr;
+        position += indexEntry.NameLength;
+
+        entries.push_back(std::move(entry));
+    }
+
+    if (entries.size() != footer.EntryCount)
+    {
+        log::Error(pLog, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Truncated zstd archive index\r\n");
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    return S_OK;
+}
+
+HRESULT ZstdExtract::Decompress(const Entry& entry, ByteStream& input, ByteStream& output)
+{
+    HRESULT hr = E_FAIL;
+
+    if (FAILED(hr = input.SetFilePointer(entry.Offset, FILE_BEGIN, NULL)))
+        return hr;
+
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> pContext(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    if (pContext == nullptr)
+        return E_OUTOFMEMORY;
+
+    std::vector<BYTE> inBuffer(ZSTD_DStreamInSize());
+    std::vector<BYTE> outBuffer(ZSTD_DStreamOutSize());
+
+    ULONGLONG ullRemaining = entry.CompressedSize;
+    ULONGLONG ullWritten = 0LL;
+    size_t result = 0;
+
+    while (ullRemaining > 0LL)
+    {
+        ULONGLONG ullRead = 0LL;
+        if (FAILED(hr = input.Read(inBuffer.data(), std::min<ULONGLONG>(inBuffer.size(), ullRemaining), &ullRead)))
+            return hr;
+        if (ullRead == 0LL)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        ullRemaining -= ullRead;
+
+        ZSTD_inBuffer in = {inBuffer.data(), static_cast<size_t>(ullRead), 0};
+        while (in.pos < in.size)
+        {
+            ZSTD_outBuffer out = {outBuffer.data(), outBuffer.size(), 0};
+
+            result = ZSTD_decompressStream(pContext.get(), &out, &in);
+            if (ZSTD_isError(result))
+            {
+                log::Error(
+                    _L_,
+                    HRESULT_FROM_WIN32(ERROR_INVALID_DATA),
+                    L"Failed to decompress %s: %S\r\n",
+                    entry.Name.c_str(),
+                    ZSTD_getErrorName(result));
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+
+            ULONGLONG ullThisWrite = 0LL;
+            if (out.pos > 0 && FAILED(hr = output.Write(outBuffer.data(), out.pos, &ullThisWrite)))
+                return hr;
+            ullWritten += ullThisWrite;
+        }
+    }
+
+    // result is 0 once the frame is complete, its checksum verified
+    if (result != 0 || ullWritten != entry.UncompressedSize)
+    {
+        log::Error(
+            _L_, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), L"Incomplete zstd frame for %s\r\n", entry.Name.c_str());
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    return S_OK;
+}
+
+STDMETHODIMP ZstdExtract::Extract(
+    __in ArchiveExtract::MakeArchiveStream makeArchiveStream,
+    __in const ItemShouldBeExtractedCallback pShouldBeExtracted,
+    __in ArchiveExtract::MakeOutputStream MakeWriteAbleStream)
+{
+    HRESULT hr = E_FAIL;
+
+    if (makeArchiveStream == nullptr)
+        return E_INVALIDARG;
+    if (pShouldBeExtracted == nullptr)
+        return E_INVALIDARG;
+    if (MakeWriteAbleStream == nullptr)
+        return E_INVALIDARG;
+
+    std::shared_ptr<ByteStream> InputStream;
+
+    if (FAILED(hr = makeArchiveStream(InputStream)))
+    {
+        log::Error(_L_, hr, L"Failed to make archive stream\r\n");
+        return hr;
+    }
+
+    std::vector<Entry> entries;
+    if (FAILED(hr = ReadIndex(_L_, *InputStream, entries)))
+    {
+        log::Error(_L_, hr, L"Failed to read archive index\r\n");
+        return hr;
+    }
+
+    HRESULT hrResult = S_OK;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const auto& entry = entries[i];
+        if (!pShouldBeExtracted(entry.Name))
+            continue;
+
+        ArchiveItem item;
+        item.Index = static_cast<DWORD>(i);
+        item.NameInArchive = entry.Name;
+        item.Size = entry.UncompressedSize;
+        item.modifiedTime = entry.Modified;
+
+        item.Stream = ArchiveExtractCallback::MakeStreamToWrite(_L_, item, MakeWriteAbleStream, m_bComputeHash);
+        if (item.Stream == nullptr)
+        {
+            hrResult = E_FAIL;
+            continue;
+        }
+
+        hr = Decompress(entry, *InputStream, *item.Stream);
+        item.Stream->Close();
+        if (FAILED(hr))
+        {
+            log::Error(_L_, hr, L"Failed to extract %s\r\n", entry.Name.c_str());
+            hrResult = hr;
+            continue;
+        }
+
+        auto hashstream = std::dynamic_pointer_cast<CryptoHashStream>(ByteStream::GetHashStream(item.Stream));
+        if (hashstream)
+        {
+            hashstream->GetMD5(item.MD5);
+            hashstream->GetSHA1(item.SHA1);
+        }
+
+        if (m_Callback)
+            m_Callback(item);
+
+        m_Items.push_back(std::move(item));
+    }
+    return hrResult;
+}
@@ -0,0 +1,60 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#include "OrcLib.h"
+
+#include "ArchiveExtract.h"
+
+#pragma managed(push, off)
+
+namespace Orc {
+
+//
+// ZstdExtract reads the index at the end of an archive written by ZstdCreate and only decompresses the frames of the
+// selected entries.
+//
+class ORCLIB_API ZstdExtract : public ArchiveExtract
+{
+    friend class ArchiveExtract;
+    friend class std::_Ref_count_obj<ZstdExtract>;
+
+public:
+    class Entry
+    {
+    public:
+        std::wstring Name;
+        ULONGLONG Offset = 0LL;
+        ULONGLONG CompressedSize = 0LL;
+        ULONGLONG UncompressedSize = 0LL;
+        FILETIME Modified = {0L, 0L};
+        CBinaryBuffer MD5;  // empty when the entry was archived without hashes
+        CBinaryBuffer SHA1;
+    };
+
+    static bool IsZstd(ByteStream& input);
+
+    // Reads the index of the archive, input must be seekable
+    static HRESULT ReadIndex(const logger& pLog, ByteStream& input, std::vector<Entry>& entries);
+
+    STDMETHOD(Extract)
+    (__in MakeArchiveStream makeArchiveStream,
+     __in const ItemShouldBeExtractedCallback pShouldBeExtracted,
+     __in MakeOutputStream MakeWriteAbleStream);
+
+    ~ZstdExtract(void);
+
+private:
+    ZstdExtract(logger pLog, bool bComputeHash = false);
+
+    HRESULT Decompress(const Entry& entry, ByteStream& input, ByteStream& output);
+};
+
+}  // namespace Orc
+
+#pragma managed(pop)
@@ -0,0 +1,65 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#pragma once
+
+#pragma managed(push, off)
+
+//
+// A zstd archive is a plain sequence of zstd frames, one per entry, followed by a skippable frame holding the index
+// of the entries. Decompressing it with the zstd tool gives the entries' contents one after the other.
+//
+// Index frame:
+//  SkippableFrameHeader
+//  IndexEntry + UTF-8 name, for each entry
+//  IndexFooter
+//
+namespace Orc::Zstd {
+
+constexpr DWORD FrameMagic = 0xFD2FB528;
+constexpr DWORD IndexFrameMagic = 0x184D2A5B;  // one of the 16 skippable frame magics
+constexpr DWORD IndexFooterMagic = 0x5A43524F;  // "ORCZ"
+constexpr DWORD IndexVersion = 1L;
+
+constexpr BYTE IndexHasMD5 = 0x01;
+constexpr BYTE IndexHasSHA1 = 0x02;
+
+#pragma pack(push, 1)
+struct SkippableFrameHeader
+{
+    DWORD Magic = IndexFrameMagic;
+    DWORD Size = 0L;  // of the frame's content
+};
+
+struct IndexEntry
+{
+    ULONGLONG Offset = 0LL;  // of the entry's frame
+    ULONGLONG CompressedSize = 0LL;
+    ULONGLONG UncompressedSize = 0LL;
+    FILETIME Modified = {0L, 0L};
+    BYTE Flags = 0;
+    BYTE MD5[16] = {};
+    BYTE SHA1[20] = {};
+    WORD NameLength = 0;  // in bytes
+};
+
+struct IndexFooter
+{
+    ULONGLONG EntryCount = 0LL;
+    DWORD Version = IndexVersion;
+    DWORD IndexSize = 0L;  // content of the index frame, footer included
+    DWORD Magic = IndexFooterMagic;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(SkippableFrameHeader) == 8, "Zstd skippable frame header is 8 bytes long");
+static_assert(sizeof(IndexEntry) == 71, "Zstd archive index entry is 71 bytes long");
+static_assert(sizeof(IndexFooter) == 20, "Zstd archive index footer is 20 bytes long");
+
+}  // namespace Orc::Zstd
+
+#pragma managed(pop)
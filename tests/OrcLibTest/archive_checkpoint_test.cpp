@@ -0,0 +1,78 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "ArchiveCheckpoint.h"
+#include "LogFileWriter.h"
+
+#include <chrono>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(ArchiveCheckpointTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(ArchiveCheckpointManifest)
+    {
+        Assert::IsTrue(ArchiveCheckpoint::GetVolumeName(L"c:\\out\\archive.7z", 2) == L"c:\\out\\archive_0002.7z");
+        Assert::IsTrue(ArchiveCheckpoint::GetVolumeName(L"c:\\out.d\\archive", 12) == L"c:\\out.d\\archive_0012");
+
+        WCHAR szTempDir[MAX_PATH];
+        Assert::IsTrue(GetTempPath(MAX_PATH, szTempDir) > 0);
+        const std::wstring strManifest = std::wstring(szTempDir) + L"ArchiveCheckpointManifest.manifest.csv";
+
+        const auto interval = std::chrono::seconds(60);
+        {
+            ArchiveCheckpoint checkpoint(_L_, L"archive.7z", strManifest, 1024 * 1024, interval);
+            Assert::IsTrue(S_OK == checkpoint.Reset());
+            Assert::IsTrue(S_FALSE == checkpoint.Load());
+            Assert::IsTrue(checkpoint.GetNextVolume() == 1);
+
+            Assert::IsTrue(!checkpoint.IsVolumeFull(1024, std::chrono::seconds(1)));
+            Assert::IsTrue(checkpoint.IsVolumeFull(1024 * 1024, std::chrono::seconds(1)));
+            Assert::IsTrue(checkpoint.IsVolumeFull(1024, interval));
+
+            Assert::IsTrue(S_OK == checkpoint.AddVolume(1, {L"GetThis", L"NTFSInfo"}, false));
+            Assert::IsTrue(S_OK == checkpoint.AddVolume(2, {}, false));
+        }
+
+        // an interrupted run is resumed after its last volume
+        ArchiveCheckpoint resumed(_L_, L"archive.7z", strManifest, 1024 * 1024, interval);
+        Assert::IsTrue(S_OK == resumed.Load());
+        Assert::IsTrue(resumed.IsResumed());
+        Assert::IsTrue(resumed.GetNextVolume() == 3);
+        Assert::IsTrue(resumed.GetVolumes().size() == 2 && resumed.GetVolumes()[1].Name == L"archive_0002.7z");
+        Assert::IsTrue(resumed.IsUnitComplete(L"NTFSInfo") && !resumed.IsUnitComplete(L"Registry"));
+
+        Assert::IsTrue(S_OK == resumed.AddVolume(3, {L"Registry"}, true));
+
+        ArchiveCheckpoint completed(_L_, L"archive.7z", strManifest, 1024 * 1024, interval);
+        Assert::IsTrue(S_OK == completed.Load());
+        Assert::IsTrue(completed.IsComplete() && !completed.IsResumed());
+        Assert::IsTrue(completed.IsUnitComplete(L"Registry"));
+
+        Assert::IsTrue(S_OK == completed.Reset());
+    }
+};
+}  // namespace Orc::Test
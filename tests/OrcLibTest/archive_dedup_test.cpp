@@ -0,0 +1,96 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "ArchiveCreate.h"
+#include "ArchiveExtract.h"
+#include "LogFileWriter.h"
+#include "MemoryStream.h"
+
+#include <map>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(ArchiveDedupTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(ArchiveDeduplication)
+    {
+        const auto data = MakeData(128 * 1024, 5);
+
+        // the duplicate is found from the hash computed while it is compressed, then dropped for its reference
+        for (const auto format : {ArchiveFormat::Zstd, ArchiveFormat::Zip})
+        {
+            auto pArchive = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+            auto compressor = ArchiveCreate::MakeCreate(format, _L_, false);
+            Assert::IsTrue(compressor != nullptr);
+            Assert::IsTrue(S_OK == compressor->InitArchive(pArchive));
+            compressor->SetDeduplication(true);
+
+            Assert::IsTrue(S_OK == compressor->AddBuffer(L"first", (PVOID)data.data(), (DWORD)data.size()));
+            Assert::IsTrue(S_OK == compressor->AddBuffer(L"other", (PVOID)data.data(), (DWORD)data.size() - 1));
+            Assert::IsTrue(S_OK == compressor->AddBuffer(L"second", (PVOID)data.data(), (DWORD)data.size()));
+            Assert::IsTrue(S_OK == compressor->AddBuffer(L"small", (PVOID)data.data(), 64));
+            Assert::IsTrue(S_OK == compressor->AddBuffer(L"small_copy", (PVOID)data.data(), 64));
+
+            // an entry added without deduplication is stored as it is
+            auto pKept = std::make_shared<MemoryStream>(_L_);
+            ULONGLONG ullWritten = 0LL;
+            Assert::IsTrue(S_OK == pKept->OpenForReadWrite());
+            Assert::IsTrue(S_OK == pKept->Write((PVOID)data.data(), data.size(), &ullWritten));
+            Assert::IsTrue(S_OK == compressor->AddStream(L"kept", L"kept", pKept, false));
+            Assert::IsTrue(S_OK == compressor->Complete());
+
+            // the duplicate is a reference to the first entry, listed in the manifest
+            std::map<std::wstring, ULONGLONG> sizes;
+            auto extractor = ArchiveExtract::MakeExtractor(format, _L_, false);
+            Assert::IsTrue(
+                S_OK
+                == extractor->Extract(
+                    [&pArchive](std::shared_ptr<ByteStream>& stream) {
+                        stream = pArchive;
+                        return S_OK;
+                    },
+                    [](const std::wstring&) { return true; },
+                    [&sizes, this](Archive::ArchiveItem& item) {
+                        auto pOutput = std::make_shared<MemoryStream>(_L_);
+                        pOutput->OpenForReadWrite();
+                        sizes[item.NameInArchive] = item.Size;
+                        return pOutput;
+                    }));
+
+            Assert::IsTrue(extractor->Items().size() == 7);
+            Assert::IsTrue(sizes[L"first"] == data.size() && sizes[L"other"] == data.size() - 1);
+            Assert::IsTrue(sizes.count(L"second") == 0 && sizes[L"second.ref"] == wcslen(L"first"));
+
+            // below the minimum size, duplicates are stored as they are
+            Assert::IsTrue(sizes[L"small"] == 64 && sizes[L"small_copy"] == 64);
+            Assert::IsTrue(sizes[L"kept"] == data.size());
+            Assert::IsTrue(sizes.count(ArchiveCreate::DeduplicationManifest) == 1);
+        }
+    }
+};
+}  // namespace Orc::Test
@@ -10,7 +10,12 @@
 #include "LogFileWriter.h"
 
 #include "FileStream.h"
+#include "MemoryStream.h"
+#include "CryptoHashStream.h"
 #include "Authenticode.h"
+#include "PEInfo.h"
+
+#include "libpehash-pe.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace Orc;
@@ -47,5 +52,142 @@ public:
             Assert::IsTrue(SUCCEEDED(authenticode.Verify(LR"(c:\windows\system32\mrt.exe)", fstream, data)));
         }
     }
+
+    TEST_METHOD(PeHashRangesTest)
+    {
+        auto fstream = std::make_shared<FileStream>(_L_);
+        if (FAILED(fstream->ReadFrom(LR"(c:\windows\system32\kernel32.dll)")))
+            return;
+
+        const auto ullFileSize = fstream->GetSize();
+
+        // calc_pe_chunks_real works on the whole file, padded with zeroes to a multiple of 8
+        CBinaryBuffer data;
+        data.SetCount((size_t)((ullFileSize + 7) & ~7LLU));
+        data.ZeroMe();
+        ULONGLONG ullRead = 0LL;
+        Assert::IsTrue(SUCCEEDED(fstream->Read(data.GetData(), ullFileSize, &ullRead)));
+        Assert::IsTrue(ullRead == ullFileSize);
+
+        uint32_t chunks[2 * 256];
+        const int cChunks = calc_pe_chunks_real(data.GetData(), data.GetCount(), chunks, 256);
+        Assert::IsTrue(cChunks == 4);
+
+        // the ranges are planned from the headers only
+        PEInfo::PeHashRanges ranges;
+        Assert::IsTrue(SUCCEEDED(PEInfo::GetPeHashRanges(data.GetData(), 4096, ullFileSize, ranges)));
+        Assert::IsTrue(ranges.size() == (size_t)cChunks);
+
+        for (int i = 0; i < cChunks; i++)
+        {
+            Assert::IsTrue(ranges[i].first == chunks[i * 2]);
+            Assert::IsTrue(ranges[i].second - ranges[i].first == chunks[i * 2 + 1]);
+        }
+
+        // malformed headers are rejected
+        data.GetData()[0] = 'X';
+        Assert::IsTrue(FAILED(PEInfo::GetPeHashRanges(data.GetData(), 4096, ullFileSize, ranges)));
+    }
+
+    TEST_METHOD(SinglePassHashTest)
+    {
+        // A minimal PE32: headers, one section larger than a read buffer and a certificate table whose end is not
+        // aligned on 8 bytes
+        constexpr DWORD dwPeOffset = 0x80;
+        constexpr DWORD dwSizeOfHeaders = 0x200;
+        constexpr DWORD dwSectionSize = DEFAULT_READ_SIZE + 0x1234;
+        constexpr DWORD dwCertificateSize = 0x81;
+
+        std::vector<BYTE> image(dwSizeOfHeaders + dwSectionSize + dwCertificateSize);
+        for (size_t i = dwSizeOfHeaders; i < image.size(); i++)
+            image[i] = (BYTE)((i * 7) ^ (i >> 11));
+
+        auto pDos = reinterpret_cast<IMAGE_DOS_HEADER*>(image.data());
+        pDos->e_magic = IMAGE_DOS_SIGNATURE;
+        pDos->e_lfanew = dwPeOffset;
+
+        auto pNt = reinterpret_cast<IMAGE_NT_HEADERS32*>(image.data() + dwPeOffset);
+        pNt->Signature = IMAGE_NT_SIGNATURE;
+        pNt->FileHeader.Machine = IMAGE_FILE_MACHINE_I386;
+        pNt->FileHeader.NumberOfSections = 1;
+        pNt->FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER32);
+        pNt->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR32_MAGIC;
+        pNt->OptionalHeader.CheckSum = 0x12345678;
+        pNt->OptionalHeader.SizeOfHeaders = dwSizeOfHeaders;
+        pNt->OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+
+        auto& security = pNt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY];
+        security.VirtualAddress = dwSizeOfHeaders + dwSectionSize;
+        security.Size = dwCertificateSize;
+
+        auto pSection = IMAGE_FIRST_SECTION(pNt);
+        memcpy(pSection->Name, ".text", 5);
+        pSection->SizeOfRawData = dwSectionSize;
+        pSection->PointerToRawData = dwSizeOfHeaders;
+
+        const auto algs = static_cast<SupportedAlgorithm>(
+            SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1 | SupportedAlgorithm::SHA256);
+
+        // flat hashes, over the whole image
+        CBinaryBuffer md5, sha1, sha256;
+        {
+            CryptoHashStream hashstream(_L_);
+            Assert::IsTrue(SUCCEEDED(hashstream.OpenToWrite(algs, nullptr)));
+            ULONGLONG ullHashed = 0LL;
+            Assert::IsTrue(SUCCEEDED(hashstream.Write(image.data(), image.size(), &ullHashed)));
+            Assert::IsTrue(SUCCEEDED(hashstream.GetMD5(md5)));
+            Assert::IsTrue(SUCCEEDED(hashstream.GetSHA1(sha1)));
+            Assert::IsTrue(SUCCEEDED(hashstream.GetSHA256(sha256)));
+        }
+
+        // PE hashes, over the chunks of the zero padded image
+        CBinaryBuffer pe_md5, pe_sha1, pe_sha256;
+        {
+            std::vector<BYTE> padded(image);
+            padded.resize((padded.size() + 7) & ~7LLU);
+
+            uint32_t chunks[2 * 256];
+            const int cChunks = calc_pe_chunks_real(padded.data(), padded.size(), chunks, 256);
+            Assert::IsTrue(cChunks == 4);
+
+            CryptoHashStream hashstream(_L_);
+            Assert::IsTrue(SUCCEEDED(hashstream.OpenToWrite(algs, nullptr)));
+            for (int i = 0; i < cChunks; i++)
+            {
+                ULONGLONG ullHashed = 0LL;
+                Assert::IsTrue(
+                    SUCCEEDED(hashstream.Write(padded.data() + chunks[i * 2], chunks[i * 2 + 1], &ullHashed)));
+            }
+            Assert::IsTrue(SUCCEEDED(hashstream.GetMD5(pe_md5)));
+            Assert::IsTrue(SUCCEEDED(hashstream.GetSHA1(pe_sha1)));
+            Assert::IsTrue(SUCCEEDED(hashstream.GetSHA256(pe_sha256)));
+        }
+
+        MemoryStream stream(_L_);
+        Assert::IsTrue(SUCCEEDED(stream.OpenForReadOnly(image.data(), image.size())));
+
+        DataDetails details;
+        Assert::IsTrue(
+            S_OK
+            == PEInfo::SinglePassHash(
+                _L_, stream, algs, FuzzyHashStream::SupportedAlgorithm::Undefined, algs, details));
+
+        Assert::IsTrue(details.MD5() == md5);
+        Assert::IsTrue(details.SHA1() == sha1);
+        Assert::IsTrue(details.SHA256() == sha256);
+        Assert::IsTrue(details.PeMD5() == pe_md5);
+        Assert::IsTrue(details.PeSHA1() == pe_sha1);
+        Assert::IsTrue(details.PeSHA256() == pe_sha256);
+
+        // without valid headers, only the flat hashes are computed
+        image[0] = 'X';
+        DataDetails invalid;
+        Assert::IsTrue(
+            S_FALSE
+            == PEInfo::SinglePassHash(
+                _L_, stream, algs, FuzzyHashStream::SupportedAlgorithm::Undefined, algs, invalid));
+        Assert::IsTrue(invalid.SHA256().GetCount() > 0);
+        Assert::IsTrue(invalid.PeSHA256().GetCount() == 0);
+    }
 };
 }  // namespace Orc::Test
@@ -0,0 +1,100 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "LogFileWriter.h"
+#include "BinaryBuffer.h"
+#include "BufferPool.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(BufferPoolTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(BufferPoolSizeClassTest)
+    {
+        Assert::IsTrue(BufferPool::GetSizeClass(100) == BufferPool::NotPooled);
+        Assert::IsTrue(BufferPool::GetSizeClass(0x10000) == 0);
+        Assert::IsTrue(BufferPool::GetSizeClass(0x10001) == 1);
+        Assert::IsTrue(BufferPool::GetSizeClass(0x200000) == 2);
+        Assert::IsTrue(BufferPool::GetSizeClass(0x1000000) == 3);
+        Assert::IsTrue(BufferPool::GetSizeClass(0x1000001) == BufferPool::NotPooled);
+    }
+
+    TEST_METHOD(BufferPoolReuseTest)
+    {
+        auto& pool = BufferPool::Instance();
+
+        BYTE* pData = nullptr;
+        {
+            CBinaryBuffer buffer(true);
+            Assert::IsTrue(buffer.SetCount(0x200000));
+            pData = buffer.GetData();
+            buffer.GetData()[0] = 0xAA;
+
+            // grows inside its 4MB block, the data stays in place
+            Assert::IsTrue(buffer.SetCount(0x300000));
+            Assert::IsTrue(buffer.GetData() == pData && buffer[0] == 0xAA);
+        }
+
+        // the block was cached by this thread
+        const auto before = pool.GetStatistics();
+        {
+            CBinaryBuffer buffer;
+            Assert::IsTrue(buffer.SetCount(0x400000));
+            Assert::IsTrue(buffer.GetData() == pData);
+
+            // too large for the pool, the data is moved out of the block
+            buffer[1] = 0xBB;
+            Assert::IsTrue(buffer.SetCount(0x1100000));
+            Assert::IsTrue(buffer.GetData() != pData && buffer[1] == 0xBB);
+        }
+        const auto after = pool.GetStatistics();
+
+        Assert::IsTrue(after.ThreadCacheHits == before.ThreadCacheHits + 1);
+        Assert::IsTrue(after.HighWater >= 0x400000);
+    }
+
+    TEST_METHOD(BufferPoolTrimTest)
+    {
+        auto& pool = BufferPool::Instance();
+
+        // the caches of the other threads (those of earlier tests) are left as they are
+        pool.Trim();
+        const auto before = pool.GetStatistics();
+
+        {
+            // more blocks than this thread caches: the others go to the node cache
+            std::vector<CBinaryBuffer> buffers(16);
+            for (auto& buffer : buffers)
+                Assert::IsTrue(buffer.SetCount(0x100000));
+        }
+        Assert::IsTrue(pool.GetStatistics().Cached >= before.Cached + 16 * 0x100000);
+
+        pool.Trim();
+        const auto after = pool.GetStatistics();
+        Assert::IsTrue(after.Cached == before.Cached);
+        Assert::IsTrue(after.InUse == before.InUse);
+    }
+};
+}  // namespace Orc::Test
@@ -0,0 +1,85 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "LogFileWriter.h"
+#include "XORStream.h"
+#include "MemoryStream.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(ByteStreamTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(ByteStreamPipelinedCopyTest)
+    {
+        std::vector<BYTE> data(1024 * 1024 + 17);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (BYTE)(i * 7 + (i >> 9));
+
+        auto pSource = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pSource->OpenForReadOnly(data.data(), data.size()));
+
+        auto pDestination = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pDestination->OpenForReadWrite((DWORD)data.size()));
+
+        // XOR'ed on read and XOR'ed back on write: the copy is the original data
+        auto pReadXOR = std::make_shared<XORStream>(_L_);
+        Assert::IsTrue(S_OK == pReadXOR->SetXORPattern(0xDDCCBBAA));
+        Assert::IsTrue(S_OK == pReadXOR->OpenForXOR(pSource));
+
+        auto pWriteXOR = std::make_shared<XORStream>(_L_);
+        Assert::IsTrue(S_OK == pWriteXOR->SetXORPattern(0xDDCCBBAA));
+        Assert::IsTrue(S_OK == pWriteXOR->OpenForXOR(pDestination));
+
+        // the XOR stream does not lend views: 17 chunks of 64KB are read ahead of the writes
+        ULONGLONG ullCopied = 0LL;
+        Assert::IsTrue(S_OK == pReadXOR->CopyTo(*pWriteXOR, 0x10000, 4, &ullCopied));
+        Assert::IsTrue(ullCopied == data.size());
+        Assert::IsTrue(pDestination->GetSize() == data.size());
+        Assert::IsTrue(!memcmp(data.data(), pDestination->GetConstBuffer().GetData(), data.size()));
+    }
+
+    TEST_METHOD(ByteStreamPipelinedCopyFailureTest)
+    {
+        std::vector<BYTE> data(1024 * 1024);
+
+        auto pSource = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pSource->OpenForReadOnly(data.data(), data.size()));
+
+        auto pReadXOR = std::make_shared<XORStream>(_L_);
+        Assert::IsTrue(S_OK == pReadXOR->SetXORPattern(0xDDCCBBAA));
+        Assert::IsTrue(S_OK == pReadXOR->OpenForXOR(pSource));
+
+        // a read only destination: the first write fails while the reader is still reading ahead
+        std::vector<BYTE> readOnly(data.size());
+        auto pDestination = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pDestination->OpenForReadOnly(readOnly.data(), readOnly.size()));
+
+        ULONGLONG ullCopied = 0LL;
+        Assert::IsTrue(FAILED(pReadXOR->CopyTo(*pDestination, 0x10000, 4, &ullCopied)));
+        Assert::IsTrue(ullCopied == 0LL);
+    }
+};
+}  // namespace Orc::Test
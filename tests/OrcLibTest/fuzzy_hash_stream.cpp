@@ -69,5 +69,50 @@ public:
 
         return;
     }
+
+    TEST_METHOD(FuzzyHashStreamAsyncTest)
+    {
+        // past AsyncThreshold the hashes are computed by the hashing tasks
+        std::vector<BYTE> data(FuzzyHashStream::AsyncThreshold + 3 * 1024 * 1024 + 17);
+        DWORD dwSeed = 0x4F524321;
+        for (auto& byte : data)
+        {
+            dwSeed = dwSeed * 1103515245 + 12345;
+            byte = (BYTE)(dwSeed >> 16);
+        }
+
+        const auto algs =
+            static_cast<FuzzyHashStream::SupportedAlgorithm>(FuzzyHashStream::SSDeep | FuzzyHashStream::TLSH);
+
+        std::wstring ssdeep[2], tlsh[2];
+        for (size_t i = 0; i < 2; i++)
+        {
+            auto devnull = std::make_shared<DevNullStream>(_L_);
+            Assert::IsTrue(SUCCEEDED(devnull->Open()));
+
+            auto fuzzy_stream = std::make_unique<FuzzyHashStream>(_L_);
+            if (i == 1)
+                fuzzy_stream->SetAsyncThreshold(MAXULONGLONG);
+            Assert::IsTrue(SUCCEEDED(fuzzy_stream->OpenToWrite(algs, devnull)));
+
+            for (size_t offset = 0; offset < data.size(); offset += 0x10000)
+            {
+                ULONGLONG ullWritten = 0LL;
+                const auto cbWrite = std::min<size_t>(0x10000, data.size() - offset);
+                Assert::IsTrue(SUCCEEDED(fuzzy_stream->Write(data.data() + offset, cbWrite, &ullWritten)));
+                Assert::IsTrue(ullWritten == cbWrite);
+            }
+            Assert::IsTrue(SUCCEEDED(fuzzy_stream->Close()));
+
+            Assert::IsTrue(SUCCEEDED(fuzzy_stream->GetHash(FuzzyHashStream::TLSH, tlsh[i])));
+#ifdef ORC_BUILD_SSDEEP
+            Assert::IsTrue(SUCCEEDED(fuzzy_stream->GetHash(FuzzyHashStream::SSDeep, ssdeep[i])));
+#endif  // ORC_BUILD_SSDEEP
+        }
+
+        Assert::IsFalse(tlsh[0].empty());
+        Assert::AreEqual(tlsh[1].c_str(), tlsh[0].c_str(), L"TLSH computed asynchronously does not match");
+        Assert::AreEqual(ssdeep[1].c_str(), ssdeep[0].c_str(), L"SSDeep computed asynchronously does not match");
+    }
 };
 }  // namespace Orc::Test
@@ -0,0 +1,135 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "LogFileWriter.h"
+#include "HashCache.h"
+#include "DataDetails.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(HashCacheTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+    static HashCache::Key MakeKey()
+    {
+        HashCache::Key key;
+        key.VolumeSerial = 0x1234567890ABCDEFLL;
+        key.FRN = 0x0005000000001234LL;
+        key.DataInstance = 3;
+        key.DataSize = 4096;
+        key.LastModificationTime = 132000000000000000LL;
+        key.USN = 42;
+        return key;
+    }
+
+    static CBinaryBuffer MakeDigest(size_t cbDigest, BYTE seed)
+    {
+        CBinaryBuffer retval;
+        retval.SetCount(cbDigest);
+        for (size_t i = 0; i < cbDigest; i++)
+            retval.GetData()[i] = (BYTE)(seed + i);
+        return retval;
+    }
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(HashCacheLookupTest)
+    {
+        HashCache cache(_L_);
+
+        DataDetails details;
+        details.MD5() = MakeDigest(BYTES_IN_MD5_HASH, 1);
+        details.SHA1() = MakeDigest(BYTES_IN_SHA1_HASH, 2);
+        details.SSDeep() = L"3:abc:def";
+
+        const auto hashed = static_cast<Intentions>(FILEINFO_MD5 | FILEINFO_SHA1 | FILEINFO_SSDEEP);
+        cache.Store(MakeKey(), hashed, details);
+
+        DataDetails cached;
+        Assert::IsTrue(cache.Lookup(MakeKey(), static_cast<Intentions>(FILEINFO_MD5 | FILEINFO_SSDEEP), cached));
+        Assert::IsTrue(cached.MD5() == details.MD5());
+        Assert::IsTrue(cached.SSDeep() == details.SSDeep());
+
+        // SHA256 was never computed for this file
+        Assert::IsFalse(cache.Lookup(MakeKey(), static_cast<Intentions>(FILEINFO_MD5 | FILEINFO_SHA256), cached));
+
+        // the file was modified
+        auto key = MakeKey();
+        key.USN++;
+        Assert::IsFalse(cache.Lookup(key, FILEINFO_MD5, cached));
+
+        // the file record was re-used
+        key = MakeKey();
+        key.FRN += 0x0001000000000000LL;
+        Assert::IsFalse(cache.Lookup(key, FILEINFO_MD5, cached));
+
+        // authenticode needs the PE hashes
+        Assert::IsTrue(
+            HashCache::GetHashIntentions(FILEINFO_AUTHENTICODE_STATUS)
+            == static_cast<Intentions>(FILEINFO_PE_MD5 | FILEINFO_PE_SHA1 | FILEINFO_PE_SHA256));
+    }
+
+    TEST_METHOD(HashCachePersistenceTest)
+    {
+        std::wstring strFile(MAX_PATH, L'\0');
+        strFile.resize(GetTempPathW(MAX_PATH, strFile.data()));
+        strFile.append(L"hash_cache_test.bin");
+        DeleteFileW(strFile.c_str());
+
+        DataDetails details;
+        details.SHA256() = MakeDigest(BYTES_IN_SHA256_HASH, 3);
+        details.TLSH() = L"T1A2B3";
+        {
+            HashCache cache(_L_);
+            Assert::IsTrue(SUCCEEDED(cache.LoadFrom(strFile)));
+            Assert::IsTrue(cache.Count() == 0);
+
+            // a non PE file: the PE hashes were computed but are not available
+            cache.Store(
+                MakeKey(), static_cast<Intentions>(FILEINFO_SHA256 | FILEINFO_TLSH | FILEINFO_PE_SHA1), details);
+            Assert::IsTrue(SUCCEEDED(cache.SaveTo(strFile)));
+        }
+
+        {
+            // another command saves its own entries in the same file
+            HashCache cache(_L_);
+            auto key = MakeKey();
+            key.FRN++;
+            cache.Store(key, FILEINFO_SHA256, details);
+            Assert::IsTrue(SUCCEEDED(cache.SaveTo(strFile)));
+        }
+
+        HashCache cache(_L_);
+        Assert::IsTrue(SUCCEEDED(cache.LoadFrom(strFile)));
+        Assert::IsTrue(cache.Count() == 2);
+
+        DataDetails cached;
+        Assert::IsTrue(cache.Lookup(
+            MakeKey(), static_cast<Intentions>(FILEINFO_SHA256 | FILEINFO_TLSH | FILEINFO_PE_SHA1), cached));
+        Assert::IsTrue(cached.SHA256() == details.SHA256());
+        Assert::IsTrue(cached.TLSH() == details.TLSH());
+        Assert::IsTrue(cached.PeSHA1().GetCount() == 0);
+
+        DeleteFileW(strFile.c_str());
+    }
+};
+}  // namespace Orc::Test
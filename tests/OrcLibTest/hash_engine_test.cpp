@@ -0,0 +1,193 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "LogFileWriter.h"
+#include "CryptoHashStream.h"
+#include "HashEngine.h"
+
+#include <chrono>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(HashEngineTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+    // Reference digest, computed with the CryptoAPI provider
+    static CBinaryBuffer CryptoAPIHash(HCRYPTPROV hProv, ALG_ID algId, const BYTE* pData, size_t cbData)
+    {
+        HCRYPTHASH hHash = NULL;
+        Assert::IsTrue(CryptCreateHash(hProv, algId, 0, 0, &hHash) == TRUE);
+        Assert::IsTrue(CryptHashData(hHash, pData, (DWORD)cbData, 0) == TRUE);
+
+        DWORD cbHash = 0L;
+        DWORD cbParam = sizeof(cbHash);
+        Assert::IsTrue(CryptGetHashParam(hHash, HP_HASHSIZE, (BYTE*)&cbHash, &cbParam, 0) == TRUE);
+
+        CBinaryBuffer retval;
+        retval.SetCount(cbHash);
+        Assert::IsTrue(CryptGetHashParam(hHash, HP_HASHVAL, retval.GetData(), &cbHash, 0) == TRUE);
+        CryptDestroyHash(hHash);
+        return retval;
+    }
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(HashEngineCryptoAPITest)
+    {
+        HCRYPTPROV hProv = NULL;
+        Assert::IsTrue(SUCCEEDED(CryptoUtilities::AcquireContext(_L_, hProv)));
+
+        const auto data = MakeData(100000);
+        const auto algs = static_cast<SupportedAlgorithm>(
+            SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1 | SupportedAlgorithm::SHA256);
+
+        // lengths around the padding boundaries, fed in chunks not aligned on blocks
+        for (size_t cbLength : {0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 16385, 100000})
+        {
+            HashEngine engine(algs);
+            for (size_t offset = 0; offset < cbLength; offset += 7)
+                engine.Update(data.data() + offset, std::min<size_t>(7, cbLength - offset));
+
+            BYTE digest[BYTES_IN_SHA256_HASH];
+
+            Assert::IsTrue(SUCCEEDED(engine.GetDigest(SupportedAlgorithm::MD5, digest, sizeof(digest))));
+            Assert::IsTrue(!memcmp(
+                digest, CryptoAPIHash(hProv, CALG_MD5, data.data(), cbLength).GetData(), BYTES_IN_MD5_HASH));
+
+            Assert::IsTrue(SUCCEEDED(engine.GetDigest(SupportedAlgorithm::SHA1, digest, sizeof(digest))));
+            Assert::IsTrue(!memcmp(
+                digest, CryptoAPIHash(hProv, CALG_SHA1, data.data(), cbLength).GetData(), BYTES_IN_SHA1_HASH));
+
+            Assert::IsTrue(SUCCEEDED(engine.GetDigest(SupportedAlgorithm::SHA256, digest, sizeof(digest))));
+            Assert::IsTrue(!memcmp(
+                digest, CryptoAPIHash(hProv, CALG_SHA_256, data.data(), cbLength).GetData(), BYTES_IN_SHA256_HASH));
+        }
+
+        CryptReleaseContext(hProv, 0);
+    }
+
+    TEST_METHOD(HashEngineMultiBufferTest)
+    {
+        const auto data = MakeData(1024 * 1024);
+
+        std::vector<const BYTE*> buffers;
+        std::vector<size_t> sizes;
+        for (size_t i = 0; i < 37; i++)
+        {
+            buffers.push_back(data.data() + i * 4096);
+            sizes.push_back((i * 997) % 5000);
+        }
+
+        std::vector<HashEngine::SHA256Digest> digests(buffers.size());
+        Assert::IsTrue(SUCCEEDED(
+            HashEngine::SHA256MultiBuffer(buffers.data(), sizes.data(), buffers.size(), digests.data())));
+
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            HashEngine engine(SupportedAlgorithm::SHA256);
+            engine.Update(buffers[i], sizes[i]);
+
+            HashEngine::SHA256Digest digest;
+            Assert::IsTrue(
+                SUCCEEDED(engine.GetDigest(SupportedAlgorithm::SHA256, digest.data(), (DWORD)digest.size())));
+            Assert::IsTrue(digest == digests[i]);
+        }
+    }
+
+    // Kept small for the unit test runs, excluded with /TestCaseFilter:"TestCategory!=Benchmark"
+    BEGIN_TEST_METHOD_ATTRIBUTE(HashEngineBenchmark)
+    TEST_METHOD_ATTRIBUTE(L"TestCategory", L"Benchmark")
+    END_TEST_METHOD_ATTRIBUTE()
+
+    TEST_METHOD(HashEngineBenchmark)
+    {
+        HCRYPTPROV hProv = NULL;
+        Assert::IsTrue(SUCCEEDED(CryptoUtilities::AcquireContext(_L_, hProv)));
+
+        const auto data = MakeData(8 * 1024 * 1024);
+        const auto algs = static_cast<SupportedAlgorithm>(
+            SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1 | SupportedAlgorithm::SHA256);
+
+        log::Info(
+            _L_,
+            L"\r\nSHA extensions: %s, AVX2: %s\r\n",
+            HashEngine::HasSHAExtensions() ? L"yes" : L"no",
+            HashEngine::HasAVX2() ? L"yes" : L"no");
+
+        {
+            auto start = std::chrono::steady_clock::now();
+            CryptoAPIHash(hProv, CALG_MD5, data.data(), data.size());
+            CryptoAPIHash(hProv, CALG_SHA1, data.data(), data.size());
+            CryptoAPIHash(hProv, CALG_SHA_256, data.data(), data.size());
+            log::Info(_L_, L"CryptoAPI MD5+SHA1+SHA256    : %.2f MB/sec\r\n", MBPerSec(data.size(), start));
+        }
+
+        {
+            auto hashstream = std::make_shared<CryptoHashStream>(_L_);
+            Assert::IsTrue(SUCCEEDED(hashstream->OpenToWrite(algs, nullptr)));
+
+            auto start = std::chrono::steady_clock::now();
+
+            // same chunk size as ByteStream::CopyTo
+            constexpr size_t cbChunk = 1024 * 1024;
+            for (size_t offset = 0; offset < data.size(); offset += cbChunk)
+            {
+                ULONGLONG ullWritten = 0LL;
+                Assert::IsTrue(SUCCEEDED(hashstream->Write((PVOID)(data.data() + offset), cbChunk, &ullWritten)));
+            }
+            CBinaryBuffer sha256;
+            Assert::IsTrue(SUCCEEDED(hashstream->GetSHA256(sha256)));
+            log::Info(_L_, L"CryptoHashStream MD5+SHA1+SHA256: %.2f MB/sec\r\n", MBPerSec(data.size(), start));
+        }
+
+        {
+            // many small files
+            constexpr size_t cbFile = 4096;
+            std::vector<const BYTE*> buffers;
+            std::vector<size_t> sizes;
+            for (size_t offset = 0; offset < data.size(); offset += cbFile)
+            {
+                buffers.push_back(data.data() + offset);
+                sizes.push_back(cbFile);
+            }
+            std::vector<HashEngine::SHA256Digest> digests(buffers.size());
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < buffers.size(); i++)
+            {
+                HashEngine engine(SupportedAlgorithm::SHA256);
+                engine.Update(buffers[i], sizes[i]);
+                engine.GetDigest(SupportedAlgorithm::SHA256, digests[i].data(), (DWORD)digests[i].size());
+            }
+            log::Info(_L_, L"SHA256 of 4KB buffers, one at a time: %.2f MB/sec\r\n", MBPerSec(data.size(), start));
+
+            start = std::chrono::steady_clock::now();
+            Assert::IsTrue(SUCCEEDED(
+                HashEngine::SHA256MultiBuffer(buffers.data(), sizes.data(), buffers.size(), digests.data())));
+            log::Info(_L_, L"SHA256 of 4KB buffers, multi-buffer  : %.2f MB/sec\r\n", MBPerSec(data.size(), start));
+        }
+
+        CryptReleaseContext(hProv, 0);
+    }
+};
+}  // namespace Orc::Test
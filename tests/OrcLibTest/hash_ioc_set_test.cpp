@@ -0,0 +1,117 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "LogFileWriter.h"
+#include "HashIOCSet.h"
+#include "ParameterCheck.h"
+#include "FileFind.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(HashIOCSetTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+    static CBinaryBuffer FromHex(const WCHAR* szHex)
+    {
+        CBinaryBuffer retval;
+        GetBytesFromHexaString(szHex, (DWORD)wcslen(szHex), retval);
+        return retval;
+    }
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(HashIOCSetBasicTest)
+    {
+        const char szSet[] =
+            "# test indicators\r\n"
+            "37D3A19FF4697F91FDC4C3A0690AD8C5\r\n"
+            "d5b412319a66be9dcb40ea0ee09bb76271c5e748,5\n"
+            "C7504B38F7A3606314FD11D526888D4EC4584E9E08C833C125038F2EB0DFD16E;5\r\n"
+            "not a hash\r\n";
+
+        CBinaryBuffer buffer((LPBYTE)szSet, sizeof(szSet) - 1);
+
+        HashIOCSet set(_L_);
+        Assert::IsTrue(SUCCEEDED(set.LoadFrom(buffer)));
+
+        Assert::IsTrue(set.Count() == 3);
+        Assert::IsTrue(
+            set.GetAlgorithms()
+            == static_cast<SupportedAlgorithm>(
+                SupportedAlgorithm::MD5 | SupportedAlgorithm::SHA1 | SupportedAlgorithm::SHA256));
+
+        Assert::IsTrue(set.Contains(SupportedAlgorithm::MD5, FromHex(L"37D3A19FF4697F91FDC4C3A0690AD8C5")));
+        Assert::IsFalse(set.Contains(SupportedAlgorithm::MD5, FromHex(L"37D3A19FF4697F91FDC4C3A0690AD8C6")));
+        Assert::IsTrue(set.Contains(SupportedAlgorithm::SHA1, FromHex(L"D5B412319A66BE9DCB40EA0EE09BB76271C5E748")));
+        Assert::IsTrue(set.Contains(
+            SupportedAlgorithm::SHA256, FromHex(L"C7504B38F7A3606314FD11D526888D4EC4584E9E08C833C125038F2EB0DFD16E")));
+
+        // the MD5 has no size: no size pre-filtering is possible
+        Assert::IsFalse(set.HasSizeFilter());
+        Assert::IsTrue(set.IsCandidateSize(42));
+    }
+
+    TEST_METHOD(HashIOCSetSizeFilterTest)
+    {
+        HashIOCSet set(_L_);
+
+        // A large set of pseudo random digests, all with a known size
+        BYTE digest[BYTES_IN_SHA256_HASH];
+        ULONGLONG state = 0x9E3779B97F4A7C15LLU;
+        for (ULONGLONG i = 0; i < 100000; i++)
+        {
+            for (auto& b : digest)
+            {
+                state = state * 6364136223846793005LLU + 1442695040888963407LLU;
+                b = (BYTE)(state >> 56);
+            }
+            Assert::IsTrue(SUCCEEDED(set.AddHash(digest, sizeof(digest), 4096 + (i % 64))));
+        }
+        Assert::IsTrue(SUCCEEDED(set.Seal()));
+
+        Assert::IsTrue(set.HasSizeFilter());
+        Assert::IsTrue(set.IsCandidateSize(4096));
+        Assert::IsFalse(set.IsCandidateSize(4095));
+
+        Assert::IsTrue(set.Contains(SupportedAlgorithm::SHA256, CBinaryBuffer(digest, sizeof(digest))));
+
+        ZeroMemory(digest, sizeof(digest));
+        Assert::IsFalse(set.Contains(SupportedAlgorithm::SHA256, CBinaryBuffer(digest, sizeof(digest))));
+    }
+
+    TEST_METHOD(HashSetCriteriaIsDistinctFromYara)
+    {
+        FileFind::SearchTerm yara;
+        yara.Required = FileFind::SearchTerm::Criteria::YARA;
+
+        Assert::IsFalse(yara.Required & FileFind::SearchTerm::Criteria::DATA_HASHSET);
+        Assert::IsTrue(yara.GetDescription().find(L"Hash in set") == std::wstring::npos);
+        Assert::IsTrue(yara.DependsOnData());
+
+        FileFind::SearchTerm hashset;
+        hashset.Required = FileFind::SearchTerm::Criteria::DATA_HASHSET;
+
+        Assert::IsFalse(hashset.Required & FileFind::SearchTerm::Criteria::YARA);
+        Assert::IsTrue(hashset.DependsOnData());
+    }
+};
+}  // namespace Orc::Test
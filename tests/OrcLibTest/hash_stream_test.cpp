@@ -10,6 +10,7 @@
 #include "LogFileWriter.h"
 #include "CryptoHashStream.h"
 #include "MemoryStream.h"
+#include "TeeStream.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace Orc;
@@ -196,5 +197,46 @@ public:
             Assert::IsTrue(!memcmp(md5.GetData(), md5Result, sizeof(md5Result)));
         }
     }
+
+    TEST_METHOD(HashStreamViewTest)
+    {
+        unsigned char data[5] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE};
+        unsigned char md5Result[16] = {
+            0x37, 0xD3, 0xA1, 0x9F, 0xF4, 0x69, 0x7F, 0x91, 0xFD, 0xC4, 0xC3, 0xA0, 0x69, 0x0A, 0xD8, 0xC5};
+
+        auto pMemStream = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pMemStream->OpenForReadOnly(data, sizeof(data)));
+
+        // the memory stream lends its own buffer
+        ByteStream::View view;
+        Assert::IsTrue(S_OK == pMemStream->ReadView(3, view));
+        Assert::IsTrue(view.pData == data && view.cbData == 3);
+        Assert::IsTrue(S_OK == pMemStream->SetFilePointer(0LL, FILE_BEGIN, NULL));
+
+        auto readHash = std::make_shared<CryptoHashStream>(_L_);
+        Assert::IsTrue(S_OK == readHash->OpenToRead(SupportedAlgorithm::MD5, pMemStream));
+
+        // the view is hashed on read and on write, copied into the memory stream
+        auto writeHash = std::make_shared<CryptoHashStream>(_L_);
+        Assert::IsTrue(S_OK == writeHash->OpenToWrite(SupportedAlgorithm::MD5, nullptr));
+        auto pCopyStream = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pCopyStream->OpenForReadWrite(sizeof(data)));
+
+        auto tee = std::make_shared<TeeStream>(_L_);
+        Assert::IsTrue(S_OK == tee->Open({writeHash, pCopyStream}));
+
+        ULONGLONG ullCopied = 0LL;
+        Assert::IsTrue(S_OK == readHash->CopyTo(tee, 2, &ullCopied));
+        Assert::IsTrue(ullCopied == sizeof(data));
+        Assert::IsTrue(!memcmp(data, pCopyStream->GetConstBuffer().GetData(), sizeof(data)));
+
+        for (const auto& hashstream : {readHash, writeHash})
+        {
+            CBinaryBuffer md5;
+            Assert::IsTrue(S_OK == hashstream->GetHash(SupportedAlgorithm::MD5, md5));
+            Assert::IsTrue(md5.GetCount() == sizeof(md5Result));
+            Assert::IsTrue(!memcmp(md5.GetData(), md5Result, sizeof(md5Result)));
+        }
+    }
 };
 }  // namespace Orc::Test
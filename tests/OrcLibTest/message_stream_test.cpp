@@ -0,0 +1,250 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "LogFileWriter.h"
+#include "EncodeMessageStream.h"
+#include "DecodeMessageStream.h"
+#include "EnvelopeStructures.h"
+#include "MemoryStream.h"
+
+#include <ncrypt.h>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(MessageStreamTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+    static constexpr DWORD ChunkSize = 0x1000;
+
+    // A self-signed RSA certificate whose private key is in the key storage provider
+    class TestCertificate
+    {
+    public:
+        PCCERT_CONTEXT Context = NULL;
+
+        TestCertificate(const WCHAR* szName, bool bInStore)
+        {
+            NCRYPT_PROV_HANDLE hProvider = NULL;
+            Assert::IsTrue(ERROR_SUCCESS == NCryptOpenStorageProvider(&hProvider, MS_KEY_STORAGE_PROVIDER, 0L));
+
+            Assert::IsTrue(
+                ERROR_SUCCESS
+                == NCryptCreatePersistedKey(
+                    hProvider, &m_hKey, BCRYPT_RSA_ALGORITHM, szName, 0L, NCRYPT_OVERWRITE_KEY_FLAG));
+            NCryptFreeObject(hProvider);
+
+            DWORD dwLength = 2048;
+            DWORD dwUsage = NCRYPT_ALLOW_ALL_USAGES;
+            Assert::IsTrue(
+                ERROR_SUCCESS
+                == NCryptSetProperty(m_hKey, NCRYPT_LENGTH_PROPERTY, (PBYTE)&dwLength, sizeof(dwLength), 0L));
+            Assert::IsTrue(
+                ERROR_SUCCESS
+                == NCryptSetProperty(m_hKey, NCRYPT_KEY_USAGE_PROPERTY, (PBYTE)&dwUsage, sizeof(dwUsage), 0L));
+            Assert::IsTrue(ERROR_SUCCESS == NCryptFinalizeKey(m_hKey, 0L));
+
+            const std::wstring strSubject = std::wstring(L"CN=") + szName;
+            BYTE subject[256];
+            DWORD cbSubject = sizeof(subject);
+            Assert::IsTrue(CertStrToName(
+                X509_ASN_ENCODING, strSubject.c_str(), CERT_X500_NAME_STR, NULL, subject, &cbSubject, NULL));
+            CERT_NAME_BLOB subjectBlob = {cbSubject, subject};
+
+            CRYPT_KEY_PROV_INFO providerInfo = {
+                const_cast<LPWSTR>(szName), const_cast<LPWSTR>(MS_KEY_STORAGE_PROVIDER), 0L, 0L, 0L, NULL, 0L};
+
+            PCCERT_CONTEXT pCertificate =
+                CertCreateSelfSignCertificate(m_hKey, &subjectBlob, 0L, &providerInfo, NULL, NULL, NULL, NULL);
+            Assert::IsTrue(pCertificate != NULL);
+
+            if (!bInStore)
+            {
+                Context = pCertificate;
+                return;
+            }
+
+            // DecodeMessageStream looks for the recipient's certificate in the user's store
+            m_hStore = CertOpenSystemStore(NULL, L"MY");
+            Assert::IsTrue(m_hStore != NULL);
+            Assert::IsTrue(CertAddCertificateContextToStore(
+                m_hStore, pCertificate, CERT_STORE_ADD_REPLACE_EXISTING, &Context));
+            CertFreeCertificateContext(pCertificate);
+        }
+
+        CBinaryBuffer Encoded() const { return CBinaryBuffer(Context->pbCertEncoded, Context->cbCertEncoded); }
+
+        ~TestCertificate()
+        {
+            if (m_hStore != NULL)
+            {
+                // Deleting the certificate frees its context
+                CertDeleteCertificateFromStore(Context);
+                CertCloseStore(m_hStore, 0L);
+            }
+            else if (Context != NULL)
+                CertFreeCertificateContext(Context);
+
+            if (m_hKey != NULL)
+                NCryptDeleteKey(m_hKey, 0L);
+        }
+
+    private:
+        NCRYPT_KEY_HANDLE m_hKey = NULL;
+        HCERTSTORE m_hStore = NULL;
+    };
+
+    std::vector<BYTE> Encode(const std::vector<const TestCertificate*>& recipients, const std::vector<BYTE>& data)
+    {
+        auto pCipherStream = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pCipherStream->OpenForReadWrite());
+
+        auto pEncode = std::make_shared<EncodeMessageStream>(_L_);
+        for (const auto recipient : recipients)
+            Assert::IsTrue(S_OK == pEncode->AddRecipient(recipient->Encoded()));
+        Assert::IsTrue(S_OK == pEncode->Initialize(pCipherStream, MessageStream::Format::Chunked, ChunkSize));
+
+        for (size_t i = 0; i < data.size(); i += 1000)
+        {
+            ULONGLONG ullWritten = 0LL;
+            const auto cbThisWrite = std::min<size_t>(1000, data.size() - i);
+            Assert::IsTrue(S_OK == pEncode->Write((PVOID)(data.data() + i), cbThisWrite, &ullWritten));
+        }
+        Assert::IsTrue(S_OK == pEncode->Close());
+
+        const auto buffer = pCipherStream->GetConstBuffer();
+        return std::vector<BYTE>(buffer.GetData(), buffer.GetData() + buffer.GetCount());
+    }
+
+    // Returns the first failure of the writes or of Close
+    HRESULT Decode(const std::vector<BYTE>& cipher, std::vector<BYTE>& data, PCCERT_CONTEXT* ppDecryptor = nullptr)
+    {
+        HRESULT hr = E_FAIL;
+
+        auto pClearStream = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pClearStream->OpenForReadWrite());
+
+        auto pDecode = std::make_shared<DecodeMessageStream>(_L_);
+        Assert::IsTrue(S_OK == pDecode->Initialize(pClearStream));
+
+        for (size_t i = 0; i < cipher.size(); i += 777)
+        {
+            ULONGLONG ullWritten = 0LL;
+            const auto cbThisWrite = std::min<size_t>(777, cipher.size() - i);
+            if (FAILED(hr = pDecode->Write((PVOID)(cipher.data() + i), cbThisWrite, &ullWritten)))
+                return hr;
+        }
+        if (FAILED(hr = pDecode->Close()))
+            return hr;
+
+        Assert::IsTrue(pDecode->GetFormat() == MessageStream::Format::Chunked);
+        if (ppDecryptor != nullptr)
+            *ppDecryptor = CertDuplicateCertificateContext(pDecode->GetDecryptor());
+
+        const auto buffer = pClearStream->GetConstBuffer();
+        data.assign(buffer.GetData(), buffer.GetData() + buffer.GetCount());
+        return S_OK;
+    }
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(ChunkedEnvelopeRoundTripTest)
+    {
+        TestCertificate recipient(L"OrcMessageStreamTest", true);
+
+        // empty, exactly one chunk and more chunks than are opened in parallel
+        for (const size_t cbData : {(size_t)0, (size_t)ChunkSize, (size_t)ChunkSize * 20 + 17})
+        {
+            const auto data = MakeData(cbData);
+            const auto cipher = Encode({&recipient}, data);
+
+            std::vector<BYTE> result;
+            Assert::IsTrue(S_OK == Decode(cipher, result));
+            Assert::IsTrue(result == data);
+        }
+    }
+
+    TEST_METHOD(ChunkedEnvelopeTruncatedTest)
+    {
+        TestCertificate recipient(L"OrcMessageStreamTest", true);
+
+        const auto data = MakeData(ChunkSize * 4);
+        auto cipher = Encode({&recipient}, data);
+
+        // dropping the final chunk leaves a complete (but not final) chunk at the end
+        cipher.resize(cipher.size() - (ChunkSize + GcmChunkCipher::TagLength));
+
+        std::vector<BYTE> result;
+        Assert::IsTrue(FAILED(Decode(cipher, result)));
+    }
+
+    TEST_METHOD(ChunkedEnvelopeTamperTest)
+    {
+        TestCertificate recipient(L"OrcMessageStreamTest", true);
+
+        const auto data = MakeData(ChunkSize * 3 + 100);
+        const auto cipher = Encode({&recipient}, data);
+
+        {
+            // cipher text of the chunk before the last one
+            auto altered = cipher;
+            altered[altered.size() - (ChunkSize + GcmChunkCipher::TagLength) - 200] ^= 0x01;
+
+            std::vector<BYTE> result;
+            Assert::IsTrue(GcmChunkCipher::AuthenticationFailure == Decode(altered, result));
+        }
+        {
+            // nonce prefix of the header, authenticated with each chunk
+            auto altered = cipher;
+            altered[offsetof(Envelope::Header, NoncePrefix)] ^= 0x01;
+
+            std::vector<BYTE> result;
+            Assert::IsTrue(GcmChunkCipher::AuthenticationFailure == Decode(altered, result));
+        }
+    }
+
+    TEST_METHOD(ChunkedEnvelopeRecipientsTest)
+    {
+        TestCertificate unknown(L"OrcMessageStreamTestUnknown", false);
+        TestCertificate recipient(L"OrcMessageStreamTest", true);
+
+        const auto data = MakeData(ChunkSize * 2 + 5);
+
+        // the recipient whose key is available is found whatever its position
+        for (const auto& recipients : {std::vector<const TestCertificate*> {&unknown, &recipient},
+                                       std::vector<const TestCertificate*> {&recipient, &unknown}})
+        {
+            const auto cipher = Encode(recipients, data);
+
+            std::vector<BYTE> result;
+            PCCERT_CONTEXT pDecryptor = NULL;
+            Assert::IsTrue(S_OK == Decode(cipher, result, &pDecryptor));
+            Assert::IsTrue(result == data);
+
+            Assert::IsTrue(pDecryptor != NULL);
+            Assert::IsTrue(CertCompareCertificate(
+                X509_ASN_ENCODING | PKCS_7_ASN_ENCODING, pDecryptor->pCertInfo, recipient.Context->pCertInfo));
+            CertFreeCertificateContext(pDecryptor);
+        }
+    }
+};
+}  // namespace Orc::Test
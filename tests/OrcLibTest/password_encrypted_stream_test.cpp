@@ -0,0 +1,277 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "LogFileWriter.h"
+#include "PasswordEncryptedStream.h"
+#include "MemoryStream.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(PasswordEncryptedStreamTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+    static constexpr DWORD ChunkSize = 0x1000;
+
+    // A memory stream which only reads forward and does not know its size, as a pipe does
+    class SequentialStream : public MemoryStream
+    {
+    public:
+        SequentialStream(logger pLog, const std::vector<BYTE>& data)
+            : MemoryStream(std::move(pLog))
+        {
+            ULONGLONG ullWritten = 0LL;
+            Assert::IsTrue(S_OK == OpenForReadWrite());
+            Assert::IsTrue(S_OK == MemoryStream::Write((PVOID)data.data(), data.size(), &ullWritten));
+            Assert::IsTrue(S_OK == MemoryStream::SetFilePointer(0LL, FILE_BEGIN, NULL));
+        }
+
+        STDMETHOD(CanSeek)() { return S_FALSE; };
+        STDMETHOD_(ULONG64, GetSize)() { return (ULONG64)-1; };
+        STDMETHOD(SetFilePointer)
+        (__in LONGLONG DistanceToMove, __in DWORD dwMoveMethod, __out_opt PULONG64 pCurrPointer)
+        {
+            if (DistanceToMove != 0LL || dwMoveMethod != FILE_CURRENT)
+                return E_NOTIMPL;
+            return MemoryStream::SetFilePointer(DistanceToMove, dwMoveMethod, pCurrPointer);
+        }
+    };
+
+    std::shared_ptr<MemoryStream> Encrypt(const std::wstring& pwd, const std::vector<BYTE>& data, size_t cbWrite)
+    {
+        auto pCipherStream = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pCipherStream->OpenForReadWrite());
+
+        auto pEncrypt = std::make_shared<PasswordEncryptedStream>(_L_);
+        Assert::IsTrue(
+            S_OK
+            == pEncrypt->OpenToEncrypt(pwd, pCipherStream, PasswordEncryptedStream::Format::Chunked, ChunkSize));
+
+        for (size_t i = 0; i < data.size(); i += cbWrite)
+        {
+            ULONGLONG ullWritten = 0LL;
+            const auto cbThisWrite = std::min(cbWrite, data.size() - i);
+            Assert::IsTrue(S_OK == pEncrypt->Write((PVOID)(data.data() + i), cbThisWrite, &ullWritten));
+            Assert::IsTrue(ullWritten == cbThisWrite);
+        }
+        Assert::IsTrue(pEncrypt->GetSize() == data.size());
+        Assert::IsTrue(S_OK == pEncrypt->Close());
+
+        Assert::IsTrue(S_OK == pCipherStream->SetFilePointer(0LL, FILE_BEGIN, NULL));
+        return pCipherStream;
+    }
+
+    std::vector<BYTE> GetBytes(const std::shared_ptr<MemoryStream>& pStream)
+    {
+        const auto buffer = pStream->GetConstBuffer();
+        return std::vector<BYTE>(buffer.GetData(), buffer.GetData() + buffer.GetCount());
+    }
+
+    // Reads the decrypted stream to its end, cbRead bytes at a time
+    std::vector<BYTE> ReadAll(PasswordEncryptedStream& decrypt, size_t cbRead)
+    {
+        std::vector<BYTE> result;
+        std::vector<BYTE> buffer(cbRead);
+        for (;;)
+        {
+            ULONGLONG ullRead = 0LL;
+            Assert::IsTrue(S_OK == decrypt.Read(buffer.data(), buffer.size(), &ullRead));
+            if (ullRead == 0LL)
+                break;
+            result.insert(end(result), buffer.data(), buffer.data() + ullRead);
+        }
+        return result;
+    }
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(PasswordEncryptedStreamChunkedRoundTripTest)
+    {
+        // empty, partial chunk, exact chunks and many batches of chunks
+        for (const size_t cbData : {(size_t)0, (size_t)100, (size_t)ChunkSize * 3, (size_t)ChunkSize * 40 + 17})
+        {
+            const auto data = MakeData(cbData);
+            auto pCipherStream = Encrypt(L"P@ssw0rd", data, 1000);
+
+            auto pDecrypt = std::make_shared<PasswordEncryptedStream>(_L_);
+            Assert::IsTrue(S_OK == pDecrypt->OpenToDecrypt(L"P@ssw0rd", pCipherStream));
+            Assert::IsTrue(pDecrypt->GetSize() == cbData);
+
+            std::vector<BYTE> result(cbData + 1);
+            ULONGLONG ullRead = 0LL;
+            Assert::IsTrue(S_OK == pDecrypt->Read(result.data(), result.size(), &ullRead));
+            Assert::IsTrue(ullRead == cbData);
+            Assert::IsTrue(cbData == 0 || !memcmp(result.data(), data.data(), cbData));
+        }
+    }
+
+    TEST_METHOD(PasswordEncryptedStreamChunkedSeekTest)
+    {
+        const auto data = MakeData(ChunkSize * 10 + 123);
+        auto pCipherStream = Encrypt(L"P@ssw0rd", data, data.size());
+
+        auto pDecrypt = std::make_shared<PasswordEncryptedStream>(_L_);
+        Assert::IsTrue(S_OK == pDecrypt->OpenToDecrypt(L"P@ssw0rd", pCipherStream));
+        Assert::IsTrue(S_OK == pDecrypt->CanSeek());
+
+        // reads spanning chunk boundaries, backward and to the end
+        for (const ULONGLONG ullOffset : {ChunkSize * 7 - 10ULL, 5ULL, ChunkSize * 10ULL + 100})
+        {
+            BYTE buffer[64];
+            ULONG64 ullPosition = 0LL;
+            Assert::IsTrue(S_OK == pDecrypt->SetFilePointer(ullOffset, FILE_BEGIN, &ullPosition));
+            Assert::IsTrue(ullPosition == ullOffset);
+
+            ULONGLONG ullRead = 0LL;
+            Assert::IsTrue(S_OK == pDecrypt->Read(buffer, sizeof(buffer), &ullRead));
+
+            const auto cbExpected = std::min<ULONGLONG>(sizeof(buffer), data.size() - ullOffset);
+            Assert::IsTrue(ullRead == cbExpected);
+            Assert::IsTrue(!memcmp(buffer, data.data() + ullOffset, (size_t)cbExpected));
+        }
+    }
+
+    TEST_METHOD(PasswordEncryptedStreamSequentialTest)
+    {
+        // an exact multiple of the chunk size ends with a full chunk, only found final by reading past it
+        for (const size_t cbData : {(size_t)0, (size_t)ChunkSize * 3, (size_t)ChunkSize * 5 + 1000})
+        {
+            // the chunked header is recognized without seeking, chunks are then read one after the other
+            const auto data = MakeData(cbData);
+            auto pSequential = std::make_shared<SequentialStream>(_L_, GetBytes(Encrypt(L"P@ssw0rd", data, 1000)));
+
+            PasswordEncryptedStream decrypt(_L_);
+            Assert::IsTrue(S_OK == decrypt.OpenToDecrypt(L"P@ssw0rd", pSequential));
+            Assert::IsTrue(S_FALSE == decrypt.CanSeek());
+            Assert::IsTrue(decrypt.GetSize() == (ULONG64)-1);
+            Assert::IsTrue(ReadAll(decrypt, 1000) == data);
+            Assert::IsTrue(decrypt.GetSize() == data.size());
+        }
+
+        const auto data = MakeData(ChunkSize * 5 + 1000);
+        {
+            // CryptoAPI cipher text: the bytes read while looking for the header are decrypted first
+            auto pCipherStream = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pCipherStream->OpenForReadWrite());
+
+            PasswordEncryptedStream encrypt(_L_);
+            Assert::IsTrue(S_OK == encrypt.OpenToEncrypt(L"P@ssw0rd", pCipherStream));
+            ULONGLONG ullWritten = 0LL;
+            Assert::IsTrue(S_OK == encrypt.Write((PVOID)data.data(), data.size(), &ullWritten));
+            Assert::IsTrue(S_OK == encrypt.Close());
+
+            auto pSequential = std::make_shared<SequentialStream>(_L_, GetBytes(pCipherStream));
+
+            PasswordEncryptedStream decrypt(_L_);
+            Assert::IsTrue(S_OK == decrypt.OpenToDecrypt(L"P@ssw0rd", pSequential));
+            Assert::IsTrue(ReadAll(decrypt, 1000) == data);
+        }
+    }
+
+    TEST_METHOD(PasswordEncryptedStreamCloseTwiceTest)
+    {
+        const auto data = MakeData(ChunkSize * 2 + 10);
+
+        auto pCipherStream = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pCipherStream->OpenForReadWrite());
+
+        PasswordEncryptedStream encrypt(_L_);
+        Assert::IsTrue(
+            S_OK
+            == encrypt.OpenToEncrypt(L"P@ssw0rd", pCipherStream, PasswordEncryptedStream::Format::Chunked, ChunkSize));
+        ULONGLONG ullWritten = 0LL;
+        Assert::IsTrue(S_OK == encrypt.Write((PVOID)data.data(), data.size(), &ullWritten));
+        Assert::IsTrue(S_OK == encrypt.Close());
+
+        // no second final chunk, and nothing more can be written
+        const auto ullCipherSize = pCipherStream->GetSize();
+        Assert::IsTrue(S_OK == encrypt.Close());
+        Assert::IsTrue(pCipherStream->GetSize() == ullCipherSize);
+        Assert::IsTrue(FAILED(encrypt.Write((PVOID)data.data(), 1, &ullWritten)));
+
+        Assert::IsTrue(S_OK == pCipherStream->SetFilePointer(0LL, FILE_BEGIN, NULL));
+        PasswordEncryptedStream decrypt(_L_);
+        Assert::IsTrue(S_OK == decrypt.OpenToDecrypt(L"P@ssw0rd", pCipherStream));
+        Assert::IsTrue(ReadAll(decrypt, 777) == data);
+    }
+
+    TEST_METHOD(PasswordEncryptedStreamChunkedTamperTest)
+    {
+        const auto data = MakeData(ChunkSize * 4);
+
+        {
+            // altered cipher text in the third chunk: only that chunk fails
+            auto pCipherStream = Encrypt(L"P@ssw0rd", data, data.size());
+
+            const ULONGLONG ullTampered = 40 + (ChunkSize + 16) * 2 + 10;
+            BYTE bTampered = 0;
+            ULONGLONG ullProcessed = 0LL;
+            Assert::IsTrue(S_OK == pCipherStream->SetFilePointer(ullTampered, FILE_BEGIN, NULL));
+            Assert::IsTrue(S_OK == pCipherStream->Read(&bTampered, 1, &ullProcessed));
+            bTampered ^= 0x01;
+            Assert::IsTrue(S_OK == pCipherStream->SetFilePointer(ullTampered, FILE_BEGIN, NULL));
+            Assert::IsTrue(S_OK == pCipherStream->Write(&bTampered, 1, &ullProcessed));
+            Assert::IsTrue(S_OK == pCipherStream->SetFilePointer(0LL, FILE_BEGIN, NULL));
+
+            auto pDecrypt = std::make_shared<PasswordEncryptedStream>(_L_);
+            Assert::IsTrue(S_OK == pDecrypt->OpenToDecrypt(L"P@ssw0rd", pCipherStream));
+
+            BYTE buffer[16];
+            ULONGLONG ullRead = 0LL;
+            Assert::IsTrue(S_OK == pDecrypt->Read(buffer, sizeof(buffer), &ullRead));
+            Assert::IsTrue(S_OK == pDecrypt->SetFilePointer(ChunkSize * 2, FILE_BEGIN, NULL));
+            Assert::IsTrue(FAILED(pDecrypt->Read(buffer, sizeof(buffer), &ullRead)));
+        }
+        {
+            // truncated on a chunk boundary: the last chunk left is not the final one
+            auto pFullStream = Encrypt(L"P@ssw0rd", data, data.size());
+
+            std::vector<BYTE> truncated(40 + (ChunkSize + 16) * 2);
+            ULONGLONG ullProcessed = 0LL;
+            Assert::IsTrue(S_OK == pFullStream->Read(truncated.data(), truncated.size(), &ullProcessed));
+
+            auto pCipherStream = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pCipherStream->OpenForReadWrite());
+            Assert::IsTrue(S_OK == pCipherStream->Write(truncated.data(), truncated.size(), &ullProcessed));
+            Assert::IsTrue(S_OK == pCipherStream->SetFilePointer(0LL, FILE_BEGIN, NULL));
+
+            auto pDecrypt = std::make_shared<PasswordEncryptedStream>(_L_);
+            Assert::IsTrue(S_OK == pDecrypt->OpenToDecrypt(L"P@ssw0rd", pCipherStream));
+            Assert::IsTrue(S_OK == pDecrypt->SetFilePointer(ChunkSize, FILE_BEGIN, NULL));
+
+            BYTE buffer[16];
+            ULONGLONG ullRead = 0LL;
+            Assert::IsTrue(FAILED(pDecrypt->Read(buffer, sizeof(buffer), &ullRead)));
+        }
+        {
+            auto pCipherStream = Encrypt(L"P@ssw0rd", data, data.size());
+
+            auto pDecrypt = std::make_shared<PasswordEncryptedStream>(_L_);
+            Assert::IsTrue(S_OK == pDecrypt->OpenToDecrypt(L"WrongPassword", pCipherStream));
+
+            BYTE buffer[16];
+            ULONGLONG ullRead = 0LL;
+            Assert::IsTrue(FAILED(pDecrypt->Read(buffer, sizeof(buffer), &ullRead)));
+        }
+    }
+};
+}  // namespace Orc::Test
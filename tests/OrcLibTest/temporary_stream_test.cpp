@@ -0,0 +1,134 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "FileStream.h"
+#include "LogFileWriter.h"
+#include "TemporaryStream.h"
+
+#include <boost/scope_exit.hpp>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(TemporaryStreamTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+    void CheckContent(TemporaryStream& stream, const std::vector<BYTE>& expected)
+    {
+        Assert::IsTrue(stream.GetSize() == expected.size());
+        Assert::IsTrue(S_OK == stream.SetFilePointer(0LL, FILE_BEGIN, NULL));
+
+        std::vector<BYTE> content(expected.size());
+        ULONGLONG ullRead = 0LL;
+        Assert::IsTrue(S_OK == stream.Read(content.data(), content.size(), &ullRead));
+        Assert::IsTrue(ullRead == expected.size());
+        Assert::IsTrue(content == expected);
+    }
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(TemporaryStreamThresholdTest)
+    {
+        TemporaryStream stream(_L_);
+        Assert::IsTrue(S_OK == stream.Open(L"", L"TemporaryStreamThresholdTest", 256 * 1024));
+
+        // crosses the threshold in the middle of the writes, the following ones go behind the spilled data
+        const auto data = MakeData(1024 * 1024, 1);
+        for (size_t i = 0; i < data.size(); i += 100 * 1024)
+        {
+            ULONGLONG ullWritten = 0LL;
+            const auto cbWrite = std::min<size_t>(100 * 1024, data.size() - i);
+            Assert::IsTrue(S_OK == stream.Write((PVOID)(data.data() + i), cbWrite, &ullWritten));
+            Assert::IsTrue(ullWritten == cbWrite);
+        }
+        Assert::IsTrue(S_OK == stream.IsFileStream());
+
+        CheckContent(stream, data);
+        Assert::IsTrue(S_OK == stream.Close());
+    }
+
+    TEST_METHOD(TemporaryStreamBudgetTest)
+    {
+        // the budget is process wide, it is restored even when an assertion fails
+        const auto ullBudget = TemporaryStream::GetMemoryBudget();
+        BOOST_SCOPE_EXIT(&ullBudget) { TemporaryStream::SetMemoryBudget(ullBudget); }
+        BOOST_SCOPE_EXIT_END;
+        TemporaryStream::SetMemoryBudget(TemporaryStream::GetMemoryInUse() + 1024 * 1024);
+
+        TemporaryStream first(_L_), second(_L_);
+        Assert::IsTrue(S_OK == first.Open(L"", L"TemporaryStreamBudgetTest", 16 * 1024 * 1024));
+        Assert::IsTrue(S_OK == second.Open(L"", L"TemporaryStreamBudgetTest", 16 * 1024 * 1024));
+
+        const auto firstData = MakeData(600 * 1024, 2);
+        const auto secondData = MakeData(600 * 1024, 3);
+
+        ULONGLONG ullWritten = 0LL;
+        Assert::IsTrue(S_OK == first.Write((PVOID)firstData.data(), firstData.size(), &ullWritten));
+        Assert::IsTrue(S_OK == first.IsMemoryStream());
+
+        // the least recently written stream moves to disk
+        Assert::IsTrue(S_OK == second.Write((PVOID)secondData.data(), secondData.size(), &ullWritten));
+        Assert::IsTrue(S_OK == first.IsFileStream());
+        Assert::IsTrue(S_OK == second.IsMemoryStream());
+
+        CheckContent(first, firstData);
+        CheckContent(second, secondData);
+
+        Assert::IsTrue(S_OK == first.Close());
+        Assert::IsTrue(S_OK == second.Close());
+    }
+
+    TEST_METHOD(TemporaryStreamMoveCompressedTest)
+    {
+        const auto bCompress = TemporaryStream::GetSpillCompression();
+        BOOST_SCOPE_EXIT(&bCompress) { TemporaryStream::SetSpillCompression(bCompress); }
+        BOOST_SCOPE_EXIT_END;
+        TemporaryStream::SetSpillCompression(true);
+
+        TemporaryStream stream(_L_);
+        Assert::IsTrue(S_OK == stream.Open(L"", L"TemporaryStreamMoveCompressedTest", 64 * 1024));
+
+        const auto data = MakeData(256 * 1024, 4);
+        ULONGLONG ullWritten = 0LL;
+        Assert::IsTrue(S_OK == stream.Write((PVOID)data.data(), data.size(), &ullWritten));
+        Assert::IsTrue(S_OK == stream.IsFileStream());
+
+        WCHAR szTempDir[MAX_PATH];
+        Assert::IsTrue(GetTempPath(MAX_PATH, szTempDir) != 0L);
+        const std::wstring strMoved = std::wstring(szTempDir) + L"TemporaryStreamMoveCompressedTest.bin";
+        BOOST_SCOPE_EXIT(&strMoved) { DeleteFile(strMoved.c_str()); }
+        BOOST_SCOPE_EXIT_END;
+
+        // the compression of the spilled file does not follow it to its destination
+        Assert::IsTrue(S_OK == stream.MoveTo(strMoved.c_str()));
+        const auto dwAttributes = GetFileAttributes(strMoved.c_str());
+        Assert::IsTrue(dwAttributes != INVALID_FILE_ATTRIBUTES);
+        Assert::IsTrue((dwAttributes & FILE_ATTRIBUTE_COMPRESSED) == 0L);
+
+        FileStream moved(_L_);
+        Assert::IsTrue(S_OK == moved.ReadFrom(strMoved.c_str()));
+        Assert::IsTrue(moved.GetSize() == data.size());
+        Assert::IsTrue(GetContent(moved) == data);
+        moved.Close();
+    }
+};
+}  // namespace Orc::Test
@@ -11,6 +11,8 @@
 #include "XORStream.h"
 #include "MemoryStream.h"
 
+#include <chrono>
+
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
 using namespace Orc;
@@ -23,6 +25,14 @@ private:
     logger _L_;
     UnitTestHelper helper;
 
+    // Byte by byte reference: byte i of the stream is XOR'ed with byte (i % 4) of the pattern
+    static void XORReference(BYTE* pData, size_t cbData, ULONGLONG ullPosition, DWORD dwPattern)
+    {
+        const auto pbPattern = reinterpret_cast<const BYTE*>(&dwPattern);
+        for (size_t i = 0; i < cbData; i++)
+            pData[i] ^= pbPattern[(ullPosition + i) % sizeof(DWORD)];
+    }
+
 public:
     TEST_METHOD_INITIALIZE(Initialize)
     {
@@ -59,5 +69,69 @@ public:
         Assert::IsTrue(ullDataRead == sizeof(data));
         Assert::IsTrue(!memcmp(data, expectedResult, sizeof(expectedResult)));
     }
+
+    TEST_METHOD(XORStreamKernelTest)
+    {
+        std::vector<BYTE> data(4096 + 64);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (BYTE)(i * 13);
+
+        const DWORD dwOriginal = 0xDDCCBBAA;
+
+        // unaligned buffers, chunk lengths around the vector sizes
+        for (size_t offset : {0, 1, 3})
+        {
+            std::vector<BYTE> expected(data.begin() + offset, data.end());
+            XORReference(expected.data(), expected.size(), 0, dwOriginal);
+
+            std::vector<BYTE> actual(data.begin() + offset, data.end());
+            DWORD dwPattern = dwOriginal;
+            size_t position = 0;
+            for (size_t cbChunk : {1, 3, 15, 16, 17, 31, 32, 33, 127, 128, 129, 1000})
+            {
+                XORStream::XORBuffer(actual.data() + position, actual.data() + position, cbChunk, dwPattern);
+                position += cbChunk;
+            }
+            XORStream::XORBuffer(
+                actual.data() + position, actual.data() + position, actual.size() - position, dwPattern);
+
+            Assert::IsTrue(actual == expected);
+        }
+    }
+
+    // A few MB only so that the suite stays fast, run it alone with /TestCaseFilter:"TestCategory=Benchmark"
+    BEGIN_TEST_METHOD_ATTRIBUTE(XORStreamBenchmark)
+    TEST_METHOD_ATTRIBUTE(L"TestCategory", L"Benchmark")
+    END_TEST_METHOD_ATTRIBUTE()
+
+    TEST_METHOD(XORStreamBenchmark)
+    {
+        std::vector<BYTE> data(8 * 1024 * 1024);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = (BYTE)(i * 13);
+
+        {
+            auto start = std::chrono::steady_clock::now();
+            XORReference(data.data(), data.size(), 0, 0xDDCCBBAA);
+            log::Info(_L_, L"\r\nXOR byte by byte    : %.2f MB/sec\r\n", MBPerSec(data.size(), start));
+        }
+
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            // same chunk size as ByteStream::CopyTo, XOR'ed in place as in XORStream::Read
+            DWORD dwPattern = 0xDDCCBBAA;
+            for (size_t offset = 0; offset < data.size(); offset += DEFAULT_READ_SIZE)
+                XORStream::XORBuffer(data.data() + offset, data.data() + offset, DEFAULT_READ_SIZE, dwPattern);
+
+            log::Info(_L_, L"XORStream::XORBuffer: %.2f MB/sec\r\n", MBPerSec(data.size(), start));
+        }
+
+        // XOR'ed twice with the same pattern
+        bool bOriginal = true;
+        for (size_t i = 0; i < data.size(); i++)
+            bOriginal &= data[i] == (BYTE)(i * 13);
+        Assert::IsTrue(bOriginal);
+    }
 };
-}  // namespace Orc::Test
\ No newline at end of file
+}  // namespace Orc::Test
@@ -0,0 +1,626 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "ArchiveCreate.h"
+#include "ArchiveExtract.h"
+#include "CompressionPolicy.h"
+#include "LogFileWriter.h"
+#include "MemoryStream.h"
+#include "ZipCreate.h"
+#include "ZipStreamReader.h"
+#include "ZipStreamWriter.h"
+#include "ZipStructures.h"
+
+#include <chrono>
+#include <map>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(ZipCreateTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+    // A memory stream written front to back only, as a pipe is
+    class ForwardOnlyStream : public MemoryStream
+    {
+    public:
+        ForwardOnlyStream(logger pLog)
+            : MemoryStream(std::move(pLog))
+        {
+        }
+
+        STDMETHOD(CanSeek)() { return S_FALSE; };
+    };
+
+    // Checks the end of central directory record and returns its entry count
+    WORD CheckZipStructure(const std::vector<BYTE>& content)
+    {
+        const DWORD dwLocalSignature = 0x04034b50;
+        const DWORD dwEndSignature = 0x06054b50;
+        const size_t cbEnd = 22;
+
+        Assert::IsTrue(content.size() >= cbEnd);
+        Assert::IsTrue(*reinterpret_cast<const DWORD*>(content.data()) == dwLocalSignature);
+
+        const BYTE* pEnd = content.data() + content.size() - cbEnd;
+        Assert::IsTrue(*reinterpret_cast<const DWORD*>(pEnd) == dwEndSignature);
+
+        const auto cbDirectory = *reinterpret_cast<const DWORD*>(pEnd + 12);
+        const auto dwDirectoryOffset = *reinterpret_cast<const DWORD*>(pEnd + 16);
+        Assert::IsTrue(dwDirectoryOffset + cbDirectory + cbEnd == content.size());
+
+        return *reinterpret_cast<const WORD*>(pEnd + 10);
+    }
+
+    // A one entry archive whose central directory entry needs a zip64 extra field, cut cbZip64Extra bytes long
+    std::vector<BYTE> MakeZip64ExtraArchive(WORD cbZip64Extra)
+    {
+        std::vector<BYTE> archive;
+        const auto append = [&archive](const void* pData, size_t cbData) {
+            archive.insert(archive.end(), (const BYTE*)pData, (const BYTE*)pData + cbData);
+        };
+
+        Zip::LocalFileHeader local;
+        local.Method = Zip::ZipMethodStored;
+        local.Time = local.Date = 0;
+        local.NameLength = 1;
+        local.ExtraLength = 0;
+        append(&local, sizeof(local));
+        append("a", 1);
+
+        const auto ullDirectoryOffset = archive.size();
+
+        Zip::CentralFileHeader central;
+        central.Method = Zip::ZipMethodStored;
+        central.Time = central.Date = 0;
+        central.CRC = 0L;
+        central.CompressedSize = Zip::Zip32Max;
+        central.UncompressedSize = Zip::Zip32Max;
+        central.NameLength = 1;
+        central.ExtraLength = 2 * sizeof(WORD) + cbZip64Extra;
+        central.LocalHeaderOffset = 0L;
+        append(&central, sizeof(central));
+        append("a", 1);
+
+        const WORD extra[2] = {Zip::Zip64ExtraID, cbZip64Extra};
+        append(extra, sizeof(extra));
+        archive.resize(archive.size() + cbZip64Extra);
+
+        Zip::EndOfCentralDirectory end;
+        end.DiskEntries = end.TotalEntries = 1;
+        end.CentralDirectorySize = (DWORD)(archive.size() - ullDirectoryOffset);
+        end.CentralDirectoryOffset = (DWORD)ullDirectoryOffset;
+        append(&end, sizeof(end));
+        return archive;
+    }
+
+    std::shared_ptr<MemoryStream> MakeStream(const std::vector<BYTE>& content)
+    {
+        auto pStream = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pStream->OpenForReadWrite());
+
+        ULONGLONG ullWritten = 0LL;
+        Assert::IsTrue(S_OK == pStream->Write((PVOID)content.data(), content.size(), &ullWritten));
+        Assert::IsTrue(S_OK == pStream->SetFilePointer(0LL, FILE_BEGIN, NULL));
+        return pStream;
+    }
+
+    double ArchiveWithFlushes(ArchiveFormat format, size_t nbEntries, const std::vector<BYTE>& data)
+    {
+        auto pArchive = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+        auto compressor = ArchiveCreate::MakeCreate(format, _L_);
+        Assert::IsTrue(compressor != nullptr);
+        Assert::IsTrue(S_OK == compressor->InitArchive(pArchive));
+        Assert::IsTrue(S_OK == compressor->SetCompressionLevel(L"Fast"));
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < nbEntries; i++)
+        {
+            const auto strName = L"entry_" + std::to_wstring(i) + L".bin";
+            Assert::IsTrue(S_OK == compressor->AddBuffer(strName.c_str(), (PVOID)data.data(), (DWORD)data.size()));
+            Assert::IsTrue(S_OK == compressor->FlushQueue());
+        }
+        Assert::IsTrue(S_OK == compressor->Complete());
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        Assert::IsTrue(compressor->Items().size() == nbEntries);
+        if (format == ArchiveFormat::Zip)
+            Assert::IsTrue(CheckZipStructure(GetContent(*pArchive)) == nbEntries);
+
+        return elapsed.count();
+    }
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(ZipStreamWriterStructure)
+    {
+        for (DWORD dwLevel : {ZipStreamWriter::StoredLevel, 5UL})
+        {
+            auto pArchive = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+            ZipStreamWriter writer(_L_);
+            Assert::IsTrue(S_OK == writer.Open(pArchive, dwLevel));
+            Assert::IsTrue(S_OK == writer.SetPolicy(false));
+
+            const auto data = MakeData(300 * 1024, 3);
+            for (size_t i = 0; i < 3; i++)
+            {
+                auto pInput = std::make_shared<MemoryStream>(_L_);
+                Assert::IsTrue(S_OK == pInput->OpenForReadOnly((PVOID)data.data(), data.size()));
+                Assert::IsTrue(S_OK == writer.AddEntry(L"dir\\entry_" + std::to_wstring(i), pInput, {0L, 0L}));
+            }
+
+            // empty entries are valid too
+            auto pEmpty = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pEmpty->OpenForReadOnly((PVOID)data.data(), 0));
+            Assert::IsTrue(S_OK == writer.AddEntry(L"empty", pEmpty, {0L, 0L}));
+
+            Assert::IsTrue(S_OK == writer.Close());
+            Assert::IsTrue(writer.GetEntryCount() == 4);
+            Assert::IsTrue(writer.GetArchiveSize() == pArchive->GetSize());
+
+            const auto content = GetContent(*pArchive);
+            Assert::IsTrue(CheckZipStructure(content) == 4);
+
+            if (dwLevel == ZipStreamWriter::StoredLevel)
+                Assert::IsTrue(content.size() > 3 * data.size());
+            else
+                Assert::IsTrue(content.size() < data.size());
+
+            // stored entries of a seekable input have their sizes in the local header and no data descriptor
+            const auto& local = *reinterpret_cast<const Zip::LocalFileHeader*>(content.data());
+            const auto& extra =
+                *reinterpret_cast<const Zip::LocalZip64Extra*>(content.data() + sizeof(local) + local.NameLength);
+            if (dwLevel == ZipStreamWriter::StoredLevel)
+            {
+                Assert::IsTrue((local.Flags & Zip::ZipDataDescriptorFlag) == 0);
+                Assert::IsTrue(local.CRC != 0L);
+                Assert::IsTrue(extra.UncompressedSize == data.size() && extra.CompressedSize == data.size());
+
+                const size_t cbFirstEntry = sizeof(local) + local.NameLength + local.ExtraLength + data.size();
+                Assert::IsTrue(
+                    *reinterpret_cast<const DWORD*>(content.data() + cbFirstEntry) == Zip::LocalFileHeaderSignature);
+
+                ZipStreamReader reader(_L_);
+                Assert::IsTrue(S_OK == reader.Open(pArchive));
+                Assert::IsTrue(reader.Entries().size() == 4);
+                Assert::IsTrue(reader.Entries()[0].CRC == local.CRC);
+            }
+            else
+            {
+                Assert::IsTrue((local.Flags & Zip::ZipDataDescriptorFlag) != 0);
+                Assert::IsTrue(extra.UncompressedSize == 0LL);
+            }
+        }
+    }
+
+    TEST_METHOD(ZipStreamWriterParallel)
+    {
+        const auto data = MakeData(1024 * 1024, 5);
+
+        std::vector<ZipStreamWriter::Source> sources(8);
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            sources[i].NameInArchive = L"entry_" + std::to_wstring(i);
+            if (i == 3)
+                continue;  // no stream: skipped, the others are still added
+
+            auto pInput = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pInput->OpenForReadOnly((PVOID)data.data(), data.size() - i));
+            sources[i].Stream = pInput;
+        }
+
+        auto pSerial = std::make_shared<MemoryStream>(_L_);
+        auto pParallel = std::make_shared<MemoryStream>(_L_);
+        for (auto& pArchive : {pSerial, pParallel})
+        {
+            Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+            for (auto& source : sources)
+            {
+                if (source.Stream != nullptr)
+                    Assert::IsTrue(S_OK == source.Stream->SetFilePointer(0LL, FILE_BEGIN, NULL));
+            }
+
+            ZipStreamWriter writer(_L_);
+            Assert::IsTrue(S_OK == writer.Open(pArchive, 5));
+            Assert::IsTrue(S_OK == writer.SetThreads(pArchive == pSerial ? 1 : 4));
+            Assert::IsTrue(S_OK == writer.SetPolicy(false));
+
+            std::vector<HRESULT> results;
+            Assert::IsTrue(S_OK == writer.AddEntries(sources, results));
+            Assert::IsTrue(results.size() == sources.size());
+            for (size_t i = 0; i < results.size(); i++)
+                Assert::IsTrue(i == 3 ? FAILED(results[i]) : SUCCEEDED(results[i]));
+
+            Assert::IsTrue(S_OK == writer.Close());
+            Assert::IsTrue(CheckZipStructure(GetContent(*pArchive)) == 7);
+        }
+
+        // stitching the entries compressed in parallel gives the layout of the serial archive
+        Assert::IsTrue(pSerial->GetSize() == pParallel->GetSize());
+
+        // and both extract to the same entries, in the same order
+        std::vector<std::pair<std::wstring, std::vector<BYTE>>> extracted[2];
+        for (size_t archive = 0; archive < 2; archive++)
+        {
+            ZipStreamReader reader(_L_);
+            Assert::IsTrue(S_OK == reader.Open(archive == 0 ? pSerial : pParallel));
+
+            for (size_t i = 0; i < reader.Entries().size(); i++)
+            {
+                MemoryStream output(_L_);
+                Assert::IsTrue(S_OK == output.OpenForReadWrite());
+                Assert::IsTrue(S_OK == reader.Extract(i, output));
+                extracted[archive].emplace_back(reader.Entries()[i].Name, GetContent(output));
+            }
+        }
+
+        Assert::IsTrue(extracted[0].size() == 7);
+        Assert::IsTrue(extracted[0] == extracted[1]);
+        for (size_t i = 0, entry = 0; i < sources.size(); i++)
+        {
+            if (sources[i].Stream == nullptr)
+                continue;
+
+            const auto& [strName, content] = extracted[0][entry++];
+            Assert::IsTrue(strName == sources[i].NameInArchive);
+            Assert::IsTrue(content == std::vector<BYTE>(data.begin(), data.end() - i));
+        }
+    }
+
+    TEST_METHOD(ZipStreamWriterRollback)
+    {
+        const auto data = MakeData(1024 * 1024, 9);
+
+        auto addEntry = [&](ZipStreamWriter& writer, const std::wstring& strName, ULONGLONG cbReadable) {
+            auto pInput = std::make_shared<FailingStream>(_L_, data, cbReadable);
+            return writer.AddEntry(strName, pInput, {0L, 0L});
+        };
+
+        {
+            // the failed entry is dropped from a seekable output, the archive goes on
+            auto pArchive = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+            ZipStreamWriter writer(_L_);
+            Assert::IsTrue(S_OK == writer.Open(pArchive, 5));
+            Assert::IsTrue(S_OK == writer.SetPolicy(false));
+
+            Assert::IsTrue(S_OK == addEntry(writer, L"first", MAXULONGLONG));
+            const auto ullFirstSize = pArchive->GetSize();
+
+            // its local header is written before its input fails
+            Assert::IsTrue(FAILED(addEntry(writer, L"failing", 200 * 1024)));
+            Assert::IsTrue(writer.GetArchiveSize() == ullFirstSize);
+            Assert::IsTrue(pArchive->GetSize() == ullFirstSize);
+
+            Assert::IsTrue(S_OK == addEntry(writer, L"last", MAXULONGLONG));
+            Assert::IsTrue(S_OK == writer.Close());
+            Assert::IsTrue(writer.GetArchiveSize() == pArchive->GetSize());
+            Assert::IsTrue(CheckZipStructure(GetContent(*pArchive)) == 2);
+
+            ZipStreamReader reader(_L_);
+            Assert::IsTrue(S_OK == reader.Open(pArchive));
+            Assert::IsTrue(reader.Entries().size() == 2);
+            Assert::IsTrue(reader.Entries()[1].Name == L"last");
+
+            MemoryStream output(_L_);
+            Assert::IsTrue(S_OK == output.OpenForReadWrite());
+            Assert::IsTrue(S_OK == reader.Extract(1, output));
+            Assert::IsTrue(GetContent(output) == data);
+        }
+        {
+            // an output which cannot seek back leaves the archive failed
+            auto pArchive = std::make_shared<ForwardOnlyStream>(_L_);
+            Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+            ZipStreamWriter writer(_L_);
+            Assert::IsTrue(S_OK == writer.Open(pArchive, 5));
+            Assert::IsTrue(S_OK == writer.SetPolicy(false));
+
+            Assert::IsTrue(S_OK == addEntry(writer, L"first", MAXULONGLONG));
+            Assert::IsTrue(FAILED(addEntry(writer, L"failing", 200 * 1024)));
+            Assert::IsTrue(FAILED(addEntry(writer, L"last", MAXULONGLONG)));
+            Assert::IsTrue(FAILED(writer.Close()));
+        }
+        {
+            // ZipCreate releases the failed item's stream and archives the next ones
+            auto pArchive = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+            auto compressor = ArchiveCreate::MakeCreate(ArchiveFormat::Zip, _L_, false);
+            Assert::IsTrue(S_OK == compressor->InitArchive(pArchive));
+
+            auto pFailing = std::make_shared<FailingStream>(_L_, data, 200 * 1024);
+            Assert::IsTrue(S_OK == compressor->AddStream(L"failing", L"failing", pFailing));
+            Assert::IsTrue(S_OK == compressor->AddBuffer(L"last", (PVOID)data.data(), (DWORD)data.size()));
+            Assert::IsTrue(S_OK == compressor->Complete());
+
+            Assert::IsTrue(pFailing.use_count() == 1);
+            Assert::IsTrue(compressor->Items().size() == 1);
+            Assert::IsTrue(CheckZipStructure(GetContent(*pArchive)) == 1);
+        }
+    }
+
+    TEST_METHOD(SevenZipSolidOptions)
+    {
+        const auto getProperties = [this](ArchiveFormat format, const std::wstring& strLevel) {
+            auto compressor = std::dynamic_pointer_cast<ZipCreate>(ArchiveCreate::MakeCreate(format, _L_));
+            Assert::IsTrue(compressor != nullptr);
+
+            auto pArchive = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+            Assert::IsTrue(S_OK == compressor->InitArchive(pArchive));
+            Assert::IsTrue(S_OK == compressor->SetCompressionLevel(strLevel));
+
+            std::map<std::wstring, lib7z::CPropVariant> properties;
+            std::vector<const wchar_t*> names;
+            std::vector<lib7z::CPropVariant> values;
+            compressor->GetArchiveProperties(2, names, values);
+            Assert::IsTrue(names.size() == values.size());
+            for (size_t i = 0; i < names.size(); i++)
+                properties[names[i]] = values[i];
+            return properties;
+        };
+
+        {
+            // bounded solid blocks of entries sorted by type by default
+            auto properties = getProperties(ArchiveFormat::SevenZip, L"Normal");
+            Assert::IsTrue(properties.size() == 4);
+            Assert::IsTrue(properties[L"x"].vt == VT_UI4 && properties[L"x"].ulVal == ZipCreate::Normal);
+            Assert::IsTrue(properties[L"mt"].vt == VT_UI4 && properties[L"mt"].ulVal == 2);
+            Assert::IsTrue(properties[L"qs"].vt == VT_BOOL && properties[L"qs"].boolVal == VARIANT_TRUE);
+            Assert::IsTrue(properties[L"s"].vt == VT_BSTR);
+            Assert::AreEqual(L"4096f32m", properties[L"s"].bstrVal);
+
+            // without a thread count, 7-Zip's own default is kept
+            std::vector<const wchar_t*> names;
+            std::vector<lib7z::CPropVariant> values;
+            std::dynamic_pointer_cast<ZipCreate>(ArchiveCreate::MakeCreate(ArchiveFormat::SevenZip, _L_))
+                ->GetArchiveProperties(0L, names, values);
+            Assert::IsTrue(std::find(names.begin(), names.end(), std::wstring(L"mt")) == names.end());
+        }
+        {
+            auto properties = getProperties(ArchiveFormat::SevenZip, L"Maximum, solid=8");
+            Assert::IsTrue(properties[L"x"].ulVal == ZipCreate::Maximum);
+            Assert::AreEqual(L"4096f8m", properties[L"s"].bstrVal);
+        }
+        {
+            // solid compression disabled
+            auto properties = getProperties(ArchiveFormat::SevenZip, L"Fast,solid=0");
+            Assert::IsTrue(properties[L"s"].vt == VT_BOOL && properties[L"s"].boolVal == VARIANT_FALSE);
+            Assert::IsTrue(properties[L"qs"].boolVal == VARIANT_TRUE);
+        }
+        {
+            // zip compresses each entry on its own
+            auto properties = getProperties(ArchiveFormat::Zip, L"Normal,solid=8");
+            Assert::IsTrue(properties.size() == 2);  // x and mt
+            Assert::IsTrue(properties.count(L"s") == 0 && properties.count(L"qs") == 0);
+        }
+    }
+
+    TEST_METHOD(CompressionPolicyDecisions)
+    {
+        using Decision = CompressionPolicy::Decision;
+
+        std::string text;
+        while (text.size() < CompressionPolicy::SampleSize)
+            text += "The quick brown fox jumps over the lazy dog\r\n";
+        const auto pText = reinterpret_cast<const BYTE*>(text.data());
+
+        std::vector<BYTE> random(CompressionPolicy::SampleSize);
+        DWORD seed = 0x12345678;
+        for (auto& b : random)
+        {
+            seed = seed * 1103515245 + 12345;
+            b = (BYTE)(seed >> 16);
+        }
+
+        Assert::IsTrue(CompressionPolicy::Evaluate(pText, text.size(), false) == Decision::Strong);
+        Assert::IsTrue(CompressionPolicy::Evaluate(random.data(), random.size(), false) == Decision::Store);
+        Assert::IsTrue(CompressionPolicy::Evaluate(pText, 100, true) == Decision::Store);
+
+        std::vector<BYTE> png(text.begin(), text.end());
+        const BYTE pngMagic[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        std::copy(std::begin(pngMagic), std::end(pngMagic), png.begin());
+        Assert::IsTrue(CompressionPolicy::Evaluate(png.data(), png.size(), false) == Decision::Store);
+
+        // the writer follows the decisions
+        auto pArchive = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+        ZipStreamWriter writer(_L_);
+        Assert::IsTrue(S_OK == writer.Open(pArchive, 7));
+
+        auto pTextInput = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pTextInput->OpenForReadOnly((PVOID)text.data(), text.size()));
+        Assert::IsTrue(S_OK == writer.AddEntry(L"text.txt", pTextInput, {0L, 0L}));
+
+        auto pRandomInput = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pRandomInput->OpenForReadOnly(random.data(), random.size()));
+        Assert::IsTrue(S_OK == writer.AddEntry(L"random.bin", pRandomInput, {0L, 0L}));
+
+        Assert::IsTrue(S_OK == writer.Close());
+        Assert::IsTrue(writer.GetEntryDecision(0) == Decision::Strong);
+        Assert::IsTrue(writer.GetEntryDecision(1) == Decision::Store);
+
+        const auto& stats = writer.GetStatistics();
+        const auto store = static_cast<size_t>(Decision::Store);
+        Assert::IsTrue(stats.Entries[store] == 1);
+        Assert::IsTrue(stats.CompressedSize[store] == random.size());
+        Assert::IsTrue(CheckZipStructure(GetContent(*pArchive)) == 2);
+    }
+
+    TEST_METHOD(ZipStreamReaderIndex)
+    {
+        const auto data = MakeData(256 * 1024, 9);
+
+        auto pArchive = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+        ZipStreamWriter writer(_L_);
+        Assert::IsTrue(S_OK == writer.Open(pArchive, 5));
+        Assert::IsTrue(S_OK == writer.SetPolicy(false));
+
+        CBinaryBuffer md5, sha1;
+        md5.SetCount(16);
+        sha1.SetCount(20);
+        for (size_t i = 0; i < 6; i++)
+        {
+            auto pInput = std::make_shared<MemoryStream>(_L_);
+            Assert::IsTrue(S_OK == pInput->OpenForReadOnly((PVOID)data.data(), data.size() - i * 1000));
+            Assert::IsTrue(S_OK == writer.AddEntry(L"dir\\entry_" + std::to_wstring(i), pInput, {0L, 0L}));
+
+            md5.GetData()[0] = (BYTE)i;
+            sha1.GetData()[0] = (BYTE)i;
+            Assert::IsTrue(S_OK == writer.SetEntryHashes(i, md5, sha1));
+        }
+        Assert::IsTrue(S_OK == writer.Close());
+
+        Assert::IsTrue(ZipStreamReader::IsZip(*pArchive));
+
+        ZipStreamReader reader(_L_);
+        Assert::IsTrue(S_OK == reader.Open(pArchive));
+        Assert::IsTrue(reader.Entries().size() == 6);
+        Assert::IsTrue(reader.Find(L"dir/entry_4") == 4);
+        Assert::IsTrue(reader.Find(L"missing") == (size_t)-1);
+
+        const auto& entry = reader.Entries()[2];
+        Assert::IsTrue(entry.UncompressedSize == data.size() - 2000);
+        Assert::IsTrue(entry.MD5.GetCount() == 16 && entry.MD5.GetData()[0] == 2);
+        Assert::IsTrue(entry.SHA1.GetCount() == 20 && entry.SHA1.GetData()[0] == 2);
+
+        // every other entry, extracted out of order on several threads
+        const std::vector<size_t> indexes = {5, 1, 3};
+        std::map<size_t, std::shared_ptr<MemoryStream>> outputs;
+        std::vector<HRESULT> results;
+        Assert::IsTrue(
+            S_OK
+            == reader.ExtractEntries(
+                indexes,
+                [&](const ZipStreamReader::Entry& entry) {
+                    auto pOutput = std::make_shared<MemoryStream>(_L_);
+                    Assert::IsTrue(S_OK == pOutput->OpenForReadWrite());
+                    outputs[&entry - reader.Entries().data()] = pOutput;
+                    return pOutput;
+                },
+                results,
+                4));
+
+        Assert::IsTrue(results.size() == indexes.size());
+        for (size_t i = 0; i < indexes.size(); i++)
+        {
+            Assert::IsTrue(S_OK == results[i]);
+
+            const auto content = GetContent(*outputs[indexes[i]]);
+            Assert::IsTrue(content.size() == data.size() - indexes[i] * 1000);
+            Assert::IsTrue(std::equal(content.begin(), content.end(), data.begin()));
+        }
+
+        // a central directory running past the end of the archive
+        {
+            auto content = GetContent(*pArchive);
+            auto& end = *reinterpret_cast<Zip::EndOfCentralDirectory*>(
+                content.data() + content.size() - sizeof(Zip::EndOfCentralDirectory));
+            Assert::IsTrue(end.Signature == Zip::EndOfCentralDirectorySignature);
+
+            end.CentralDirectorySize += 1024;
+            ZipStreamReader truncated(_L_);
+            Assert::IsTrue(FAILED(truncated.Open(MakeStream(content))));
+
+            end.CentralDirectorySize -= 1024;
+            end.CentralDirectoryOffset = Zip::Zip32Max - 16;
+            Assert::IsTrue(FAILED(truncated.Open(MakeStream(content))));
+        }
+
+        // zip64 extra fields holding all, some or none of the sizes that did not fit
+        {
+            ZipStreamReader complete(_L_);
+            Assert::IsTrue(S_OK == complete.Open(MakeStream(MakeZip64ExtraArchive(3 * sizeof(ULONGLONG)))));
+            Assert::IsTrue(complete.Entries().size() == 1 && complete.Entries()[0].UncompressedSize == 0LL);
+
+            for (const WORD cbExtra : {(WORD)0, (WORD)4, (WORD)(sizeof(ULONGLONG) + 4)})
+            {
+                ZipStreamReader malformed(_L_);
+                Assert::IsTrue(FAILED(malformed.Open(MakeStream(MakeZip64ExtraArchive(cbExtra)))));
+            }
+        }
+
+        // the extractor does not get anything out of an archive whose index is corrupted
+        {
+            Zip::EndOfCentralDirectory end;
+            end.DiskEntries = end.TotalEntries = 1;
+            end.CentralDirectorySize = 0x10000;
+            end.CentralDirectoryOffset = 0L;
+
+            std::vector<BYTE> content((const BYTE*)&end, (const BYTE*)&end + sizeof(end));
+            auto pCorrupted = MakeStream(content);
+
+            size_t nbOutputs = 0;
+            auto extractor = ArchiveExtract::MakeExtractor(ArchiveFormat::Zip, _L_, false);
+            Assert::IsTrue(
+                S_OK
+                != extractor->Extract(
+                    [&pCorrupted](std::shared_ptr<ByteStream>& stream) {
+                        stream = pCorrupted;
+                        return S_OK;
+                    },
+                    [](const std::wstring&) { return true; },
+                    [&nbOutputs, this](Archive::ArchiveItem& item) {
+                        nbOutputs++;
+                        auto pOutput = std::make_shared<MemoryStream>(_L_);
+                        pOutput->OpenForReadWrite();
+                        return pOutput;
+                    }));
+            Assert::IsTrue(nbOutputs == 0);
+        }
+    }
+
+    BEGIN_TEST_METHOD_ATTRIBUTE(ZipCreateFlushBenchmark)
+    TEST_METHOD_ATTRIBUTE(L"TestCategory", L"Benchmark")
+    END_TEST_METHOD_ATTRIBUTE()
+
+    TEST_METHOD(ZipCreateFlushBenchmark)
+    {
+        // the 7z archive is rewritten on each flush while the zip one is appended to
+        const auto data = MakeData(64 * 1024, 7);
+
+        for (size_t nbEntries : {50, 100, 200})
+        {
+            const auto dSevenZip = ArchiveWithFlushes(ArchiveFormat::SevenZip, nbEntries, data);
+            const auto dZip = ArchiveWithFlushes(ArchiveFormat::Zip, nbEntries, data);
+
+            log::Info(
+                _L_,
+                L"\r\n%Iu entries, flushed one by one: 7z %.3f sec, zip %.3f sec\r\n",
+                nbEntries,
+                dSevenZip,
+                dZip);
+        }
+    }
+};
+}  // namespace Orc::Test
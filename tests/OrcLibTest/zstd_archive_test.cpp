@@ -0,0 +1,142 @@
+//
+// SPDX-License-Identifier: LGPL-2.1-or-later
+//
+// Copyright © 2011-2019 ANSSI. All Rights Reserved.
+//
+// Author(s): Jean Gautier (ANSSI)
+//
+#include "stdafx.h"
+
+#include "ArchiveCreate.h"
+#include "ArchiveExtract.h"
+#include "LogFileWriter.h"
+#include "MemoryStream.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+using namespace Orc;
+using namespace Orc::Test;
+
+namespace Orc::Test {
+TEST_CLASS(ZstdArchiveTest)
+{
+private:
+    logger _L_;
+    UnitTestHelper helper;
+
+public:
+    TEST_METHOD_INITIALIZE(Initialize)
+    {
+        _L_ = std::make_shared<LogFileWriter>();
+        helper.InitLogFileWriter(_L_);
+    }
+
+    TEST_METHOD_CLEANUP(Finalize) { helper.FinalizeLogFileWriter(_L_); }
+
+    TEST_METHOD(ZstdArchiveRoundTrip)
+    {
+        const auto data = MakeData(512 * 1024, 11);
+
+        auto pArchive = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+        Assert::IsTrue(Archive::GetArchiveFormat(L"output.zst") == ArchiveFormat::Zstd);
+
+        auto compressor = ArchiveCreate::MakeCreate(ArchiveFormat::Zstd, _L_, true);
+        Assert::IsTrue(compressor != nullptr);
+        Assert::IsTrue(S_OK == compressor->InitArchive(pArchive));
+        Assert::IsTrue(S_OK == compressor->SetCompressionLevel(L"Fast,threads=2"));
+
+        for (size_t i = 0; i < 4; i++)
+        {
+            const auto strName = L"dir\\entry_" + std::to_wstring(i);
+            Assert::IsTrue(
+                S_OK == compressor->AddBuffer(strName.c_str(), (PVOID)data.data(), (DWORD)(data.size() - i * 100)));
+            if (i == 1)
+                Assert::IsTrue(S_OK == compressor->FlushQueue());
+        }
+        Assert::IsTrue(S_OK == compressor->Complete());
+        Assert::IsTrue(compressor->Items().size() == 4);
+        Assert::IsTrue(pArchive->GetSize() < data.size());
+
+        // only the selected entry is decompressed
+        auto extractor = ArchiveExtract::MakeExtractor(ArchiveFormat::Zstd, _L_, true);
+        Assert::IsTrue(extractor != nullptr);
+
+        auto pOutput = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pOutput->OpenForReadWrite());
+
+        Assert::IsTrue(
+            S_OK
+            == extractor->Extract(
+                [&pArchive](std::shared_ptr<ByteStream>& stream) {
+                    stream = pArchive;
+                    return S_OK;
+                },
+                [](const std::wstring& strName) { return strName == L"dir\\entry_2"; },
+                [&pOutput](Archive::ArchiveItem&) { return pOutput; }));
+
+        Assert::IsTrue(extractor->Items().size() == 1);
+        const auto& item = extractor->Items().front();
+        Assert::IsTrue(item.Index == 2);
+        CBinaryBuffer md5(item.MD5);
+        Assert::IsTrue(md5.GetCount() == 16 && md5 == compressor->Items()[2].MD5);
+
+        const auto content = GetContent(*pOutput);
+        Assert::IsTrue(content.size() == data.size() - 200);
+        Assert::IsTrue(std::equal(content.begin(), content.end(), data.begin()));
+    }
+
+    TEST_METHOD(ZstdArchiveFailedItem)
+    {
+        const auto data = MakeData(1024 * 1024, 3);
+
+        auto pArchive = std::make_shared<MemoryStream>(_L_);
+        Assert::IsTrue(S_OK == pArchive->OpenForReadWrite());
+
+        std::vector<std::pair<std::wstring, ULONGLONG>> archived;
+        auto compressor = ArchiveCreate::MakeCreate(ArchiveFormat::Zstd, _L_, true);
+        Assert::IsTrue(compressor != nullptr);
+        Assert::IsTrue(
+            S_OK == compressor->InitArchive(pArchive, [&archived](const Archive::ArchiveItem& item) {
+                archived.emplace_back(item.NameInArchive, item.CompressedSize);
+            }));
+
+        Assert::IsTrue(S_OK == compressor->AddBuffer(L"first", (PVOID)data.data(), (DWORD)data.size()));
+        Assert::IsTrue(S_OK == compressor->FlushQueue());
+        const auto ullFirstSize = pArchive->GetSize();
+
+        // its partial frame is dropped, the failed stream is released
+        auto pFailing = std::make_shared<FailingStream>(_L_, data, 600 * 1024);
+        Assert::IsTrue(S_OK == compressor->AddStream(L"failing", L"failing", pFailing));
+        Assert::IsTrue(FAILED(compressor->FlushQueue()));
+        Assert::IsTrue(pArchive->GetSize() == ullFirstSize);
+        Assert::IsTrue(pFailing.use_count() == 1);
+
+        Assert::IsTrue(S_OK == compressor->AddBuffer(L"last", (PVOID)data.data(), (DWORD)data.size()));
+        Assert::IsTrue(S_OK == compressor->Complete());
+
+        Assert::IsTrue(archived.size() == 2);
+        for (const auto& entry : archived)
+            Assert::IsTrue(entry.second > 0LL && entry.second < data.size());
+
+        std::vector<std::wstring> extracted;
+        auto extractor = ArchiveExtract::MakeExtractor(ArchiveFormat::Zstd, _L_, true);
+        Assert::IsTrue(
+            S_OK
+            == extractor->Extract(
+                [&pArchive](std::shared_ptr<ByteStream>& stream) {
+                    stream = pArchive;
+                    return S_OK;
+                },
+                [](const std::wstring&) { return true; },
+                [this, &extracted](Archive::ArchiveItem& item) {
+                    extracted.push_back(item.NameInArchive);
+                    auto pOutput = std::make_shared<MemoryStream>(_L_);
+                    Assert::IsTrue(S_OK == pOutput->OpenForReadWrite());
+                    return pOutput;
+                }));
+        Assert::IsTrue(extracted == std::vector<std::wstring>({L"first", L"last"}));
+    }
+};
+}  // namespace Orc::Test